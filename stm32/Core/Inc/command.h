@@ -0,0 +1,40 @@
+/**
+  ******************************************************************************
+  * @file command.h
+  * @author fdominguez
+  * @brief This file provides the UART command interpreter
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef COMMAND_H_
+#define COMMAND_H_
+
+#include <stdint.h>
+
+/* A frame starting with a letter is a command: the letter selects the
+ * command and the rest of the frame are its arguments. Any other frame is
+ * a data ID lookup */
+#define CMD_IS_COMMAND(frame)	(((frame)[0] >= 'A' && (frame)[0] <= 'Z') || \
+								 ((frame)[0] >= 'a' && (frame)[0] <= 'z'))
+
+/* Arguments end at the frame end or at a line terminator */
+#define CMD_IS_END(c)			((c) == '\0' || (c) == '\r' || (c) == '\n')
+
+typedef enum
+{
+  CMD_ERROR = -1,
+  CMD_OK    = 0
+} CMD_StatusTypeDef;
+
+typedef CMD_StatusTypeDef (*CMD_HandlerTypeDef)(const char *args);
+
+typedef struct
+{
+  char name;
+  CMD_HandlerTypeDef handler;
+} CMD_EntryTypeDef;
+
+CMD_StatusTypeDef CMD_Execute(const char *frame);
+
+#endif /* COMMAND_H_ */
@@ -0,0 +1,50 @@
+/**
+  ******************************************************************************
+  * @file cycle_counter.h
+  * @author fdominguez
+  * @brief This file provides access to the DWT cycle counter, used as a
+  * high resolution time stamp
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef CYCLE_COUNTER_H_
+#define CYCLE_COUNTER_H_
+
+#include "main.h"
+
+/**
+  * @brief Starts the DWT cycle counter. It runs even with no debugger attached
+  */
+static inline void CYCCNT_Init(void)
+{
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+/**
+  * @brief Gets the current cycle count (wraps every 2^32 cycles, ~59 s at 72 MHz)
+  */
+static inline uint32_t CYCCNT_Get(void)
+{
+  return DWT->CYCCNT;
+}
+
+/**
+  * @brief Converts a number of cycles to microseconds at the current core clock
+  */
+static inline uint32_t CYCCNT_ToUs(uint32_t cycles)
+{
+  return cycles / (SystemCoreClock / 1000000U);
+}
+
+/**
+  * @brief Converts a number of cycles to nanoseconds at the current core clock
+  */
+static inline uint32_t CYCCNT_ToNs(uint32_t cycles)
+{
+  return (uint32_t)(((uint64_t)cycles * 1000U) / (SystemCoreClock / 1000000U));
+}
+
+#endif /* CYCLE_COUNTER_H_ */
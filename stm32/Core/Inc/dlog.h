@@ -0,0 +1,63 @@
+/**
+  ******************************************************************************
+  * @file dlog.h
+  * @author fdominguez
+  * @brief This file provides the deferred log: a call site only stores its
+  * message ID and argument words, the text is rebuilt by the host
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef DLOG_H_
+#define DLOG_H_
+
+#include <stdint.h>
+#include "dlog_table.h"
+
+/* Enable/Disable this option to keep the log call sites in the build */
+#define DLOG_ENABLED
+
+/* Ring of 32 bit words, power of two. An entry takes a header, the tick and
+ * one word per argument */
+#define DLOG_RING_WORDS				128
+#define DLOG_MAX_ARGS				3
+/* UART task poll period while entries wait in binary mode */
+#define DLOG_DRAIN_MS				50
+
+typedef enum
+{
+#define DLOG_MESSAGE(id, text)		id,
+  DLOG_MESSAGES
+#undef DLOG_MESSAGE
+  DLOG_MESSAGE_COUNT
+} DLOG_MessageTypeDef;
+
+typedef struct
+{
+  uint32_t written;
+  /* Lost because the ring was full */
+  uint32_t dropped;
+  uint32_t sent;
+  /* Most words used at once */
+  uint32_t peak_words;
+} DLOG_StatsTypeDef;
+
+#ifdef DLOG_ENABLED
+/* Header word: message ID (16), argument count (8) */
+#define DLOG0(id)					DLOG_Write(((uint32_t)(id) << 16) | (0 << 8), 0, 0, 0)
+#define DLOG1(id, a)				DLOG_Write(((uint32_t)(id) << 16) | (1 << 8), (uint32_t)(a), 0, 0)
+#define DLOG2(id, a, b)				DLOG_Write(((uint32_t)(id) << 16) | (2 << 8), (uint32_t)(a), (uint32_t)(b), 0)
+#define DLOG3(id, a, b, c)			DLOG_Write(((uint32_t)(id) << 16) | (3 << 8), (uint32_t)(a), (uint32_t)(b), (uint32_t)(c))
+#else
+#define DLOG0(id)					((void)0)
+#define DLOG1(id, a)				((void)0)
+#define DLOG2(id, a, b)				((void)0)
+#define DLOG3(id, a, b, c)			((void)0)
+#endif
+
+void DLOG_Write(uint32_t header, uint32_t arg0, uint32_t arg1, uint32_t arg2);
+uint32_t DLOG_Pending(void);
+void DLOG_Drain(void);
+void DLOG_GetStats(DLOG_StatsTypeDef *stats);
+
+#endif /* DLOG_H_ */
@@ -0,0 +1,35 @@
+/**
+  ******************************************************************************
+  * @file dlog_table.h
+  * @author fdominguez
+  * @brief This file provides the messages of the deferred log. The ID of a
+  * message is its position in the table, so the firmware only sends the ID
+  * and the arguments; tools/dlog_decode.py reads this file to print them.
+  * Add messages at the end and decode with the table of the running build
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef DLOG_TABLE_H_
+#define DLOG_TABLE_H_
+
+/* DLOG_MESSAGE(ID, text). The text takes %u, %d and %X fields, one per
+ * argument word, the same count as the DLOG<n> call site */
+#define DLOG_MESSAGES \
+  DLOG_MESSAGE(DLOG_DROPPED,            "log ring full, %u entries dropped so far") \
+  DLOG_MESSAGE(DLOG_MAGACQ_BURST_ERROR, "acquisition burst failed, SPI error %X") \
+  DLOG_MESSAGE(DLOG_MAGARRAY_RETRY,     "array sensor %u not done, read again") \
+  DLOG_MESSAGE(DLOG_MAGARRAY_MISSING,   "array sensor %u left out of the record") \
+  DLOG_MESSAGE(DLOG_MAGPWR_TIMEOUT,     "single conversion timed out, %u so far") \
+  DLOG_MESSAGE(DLOG_MAGSCOPE_FAILED,    "capture of %u records not stored") \
+  DLOG_MESSAGE(DLOG_UARTRX_ERROR,       "USART1 reception error %X, restarted") \
+  DLOG_MESSAGE(DLOG_UARTTX_ERROR,       "USART1 transmit DMA not started, %u bytes waiting") \
+  DLOG_MESSAGE(DLOG_BAUD_SWITCH,        "baud rate %u switched to %u") \
+  DLOG_MESSAGE(DLOG_BAUD_REVERT,        "baud rate %u not confirmed, back to %u") \
+  DLOG_MESSAGE(DLOG_BAUD_DETECTED,      "auto-baud %u, shortest pulse %u cycles") \
+  DLOG_MESSAGE(DLOG_BAUD_REJECTED,      "auto-baud rejected, %u edges, shortest pulse %u cycles") \
+  DLOG_MESSAGE(DLOG_FLASH_DMA_TIMEOUT,  "flash DMA not done after %u ms, reception %u") \
+  DLOG_MESSAGE(DLOG_MAG_SPI_ERROR,      "magnetometer SPI transfer error %X") \
+  DLOG_MESSAGE(DLOG_BAUD_EXPIRED,       "auto-baud disarmed, no byte in %u ms")
+
+#endif /* DLOG_TABLE_H_ */
@@ -0,0 +1,52 @@
+/**
+  ******************************************************************************
+  * @file dma_pool.h
+  * @author fdominguez
+  * @brief This file provides a static pool of DMA capable buffers
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef DMA_POOL_H_
+#define DMA_POOL_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Small blocks: command headers, register reads, log records */
+#define DMAPOOL_SMALL_BLOCK_SIZE	32
+#define DMAPOOL_SMALL_BLOCK_COUNT	8
+
+/* Sector blocks: one complete W25Q80DV sector */
+#define DMAPOOL_SECTOR_BLOCK_SIZE	4096
+#define DMAPOOL_SECTOR_BLOCK_COUNT	1
+
+/* Blocks are aligned so that they can be used with any DMA data width */
+#define DMAPOOL_ALIGNMENT			4
+
+/* Total RAM taken by the pool. Checked against the .dma_pool section in the
+ * linker script */
+#define DMAPOOL_TOTAL_SIZE			(DMAPOOL_SMALL_BLOCK_SIZE * DMAPOOL_SMALL_BLOCK_COUNT + \
+									 DMAPOOL_SECTOR_BLOCK_SIZE * DMAPOOL_SECTOR_BLOCK_COUNT)
+
+typedef enum
+{
+  DMAPOOL_SMALL = 0,
+  DMAPOOL_SECTOR,
+  DMAPOOL_COUNT
+} DMAPOOL_IdTypeDef;
+
+typedef struct
+{
+  uint16_t block_size;
+  uint16_t block_count;
+  uint16_t in_use;
+  uint16_t peak;
+  uint32_t failures;
+} DMAPOOL_StatsTypeDef;
+
+uint8_t* DMAPOOL_Acquire(DMAPOOL_IdTypeDef pool);
+void DMAPOOL_Release(uint8_t *block);
+void DMAPOOL_GetStats(DMAPOOL_IdTypeDef pool, DMAPOOL_StatsTypeDef *stats);
+
+#endif /* DMA_POOL_H_ */
@@ -11,13 +11,39 @@
 #define FLASH_MEMORY_H_
 
 #include <stdint.h>
+#include "w25q80dv.h"
 
-/* FIXME: 4096 (sector size) / 12 does not result in an integer, so certain data
- * would be stored in two different sectors */
-/* ID + x_mag + y_mag + z_mag + temp = 12 bytes */
-#define EXTFLASH_BYTES_STORED_PER_FIELD	12
-#define EXTFLASH_BYTES_TO_READ_DATA		(EXTFLASH_BYTES_STORED_PER_FIELD - 4)
-#define EXTFLASH_MAX_WRITE_RETRIALS		4
+/* The memory is a circular log of sectors. Each one starts with a header and
+ * holds records of a single format, numbered by consecutive IDs. When the log
+ * wraps, the oldest sector is erased and its records are lost */
+#define EXTFLASH_SECTOR_COUNT		(W25Q80DV_CAPACITY / W25Q80DV_SECTOR_SIZE)
+#define EXTFLASH_HEADER_SIZE		16
+/* "MAGL", an erased sector reads 0xFFFFFFFF */
+#define EXTFLASH_HEADER_MAGIC		0x4C47414DUL
+
+/* Full record: x, y, z and temperature (int16, LSB first), status and
+ * EXTFLASH_RECORD_MARKER */
+#define EXTFLASH_FULL_RECORD_SIZE		10
+#define EXTFLASH_RECORD_MARKER			0x5A
+/* Compact record: high byte of x, y and z, and the temperature in degrees
+ * (offset by 128, clamped below 0xFF). Used with the LIS3MDL FAST_READ */
+#define EXTFLASH_COMPACT_RECORD_SIZE	4
+#define EXTFLASH_COMPACT_TEMP_OFFSET	128
+#define EXTFLASH_COMPACT_TEMP_SHIFT		3
+/* Multi-channel record: x, y and z of every channel (int16, LSB first),
+ * the temperature of the first one, a mask of the channels sampled and
+ * EXTFLASH_RECORD_MARKER. Used by the magnetometer array */
+#define EXTFLASH_MULTI_CHANNELS			4
+#define EXTFLASH_MULTI_RECORD_SIZE		(EXTFLASH_MULTI_CHANNELS * 6 + 4)
+
+/* Event sectors hold a single capture, tagged in the header padding: tag,
+ * event number (LSB first), records, pre-trigger records and trigger
+ * source. Plain log sectors leave the padding erased */
+#define EXTFLASH_EVENT_TAG			0x45
+#define EXTFLASH_EVENT_MAX_RECORDS	255
+
+/* Records waiting in RAM before being programmed */
+#define EXTFLASH_PENDING_SIZE		W25Q80DV_PAGE_SIZE
 
 typedef enum
 {
@@ -25,8 +51,79 @@ typedef enum
   EXTFLASH_OK    = 0
 } EXTFLASH_StatusTypeDef;
 
-EXTFLASH_StatusTypeDef EXTFLASH_CheckID(uint32_t id_value);
-EXTFLASH_StatusTypeDef EXTFLASH_ReadData(uint32_t id_value, int16_t *x_mag, int16_t *y_mag, int16_t *z_mag, int16_t *temp);
-EXTFLASH_StatusTypeDef EXTFLASH_WriteData(uint32_t id_value, int16_t x_mag, int16_t y_mag, int16_t z_mag, int16_t temp);
+typedef enum
+{
+  EXTFLASH_FORMAT_FULL = 0,
+  EXTFLASH_FORMAT_COMPACT,
+  EXTFLASH_FORMAT_MULTI,
+  EXTFLASH_FORMAT_COUNT
+} EXTFLASH_FormatTypeDef;
+
+typedef struct
+{
+  int16_t mag_x;
+  int16_t mag_y;
+  int16_t mag_z;
+  int16_t temp;
+  /* LIS3MDL STATUS_REG, 0 for compact records */
+  uint8_t status;
+} EXTFLASH_RecordTypeDef;
+
+typedef struct
+{
+  /* x, y and z by channel */
+  int16_t mag[EXTFLASH_MULTI_CHANNELS][3];
+  int16_t temp;
+  /* Bit n set if channel n holds a fresh sample */
+  uint8_t channels;
+} EXTFLASH_MultiRecordTypeDef;
+
+typedef struct
+{
+  uint16_t number;
+  /* ID of the first record, the event is count consecutive IDs */
+  uint32_t first_id;
+  uint8_t count;
+  /* Records before the trigger one */
+  uint8_t pre_trigger;
+  uint8_t source;
+} EXTFLASH_EventTypeDef;
+
+typedef struct
+{
+  /* DMA capable buffer, up to a sector */
+  uint8_t *data;
+  uint32_t first_id;
+  /* Records requested, set to the records read (up to the sector end) */
+  uint32_t count;
+  EXTFLASH_FormatTypeDef format;
+} EXTFLASH_RangeTypeDef;
+
+typedef struct
+{
+  /* Stored IDs go from oldest_id to next_id - 1 */
+  uint32_t oldest_id;
+  uint32_t next_id;
+  uint32_t head_sector;
+  uint32_t tail_sector;
+  EXTFLASH_FormatTypeDef format;
+  uint32_t records_per_sector;
+  /* Records still in RAM, lost on reset unless flushed */
+  uint32_t pending;
+} EXTFLASH_InfoTypeDef;
+
+EXTFLASH_StatusTypeDef EXTFLASH_Init(void);
+EXTFLASH_StatusTypeDef EXTFLASH_SetFormat(EXTFLASH_FormatTypeDef format);
+EXTFLASH_StatusTypeDef EXTFLASH_Append(const EXTFLASH_RecordTypeDef *record, uint32_t *id);
+EXTFLASH_StatusTypeDef EXTFLASH_AppendMulti(const EXTFLASH_MultiRecordTypeDef *record, uint32_t *id);
+EXTFLASH_StatusTypeDef EXTFLASH_Flush(void);
+EXTFLASH_StatusTypeDef EXTFLASH_Read(uint32_t id, EXTFLASH_RecordTypeDef *record);
+EXTFLASH_StatusTypeDef EXTFLASH_ReadMulti(uint32_t id, EXTFLASH_MultiRecordTypeDef *record);
+EXTFLASH_StatusTypeDef EXTFLASH_ReadRange(EXTFLASH_RangeTypeDef *range);
+EXTFLASH_StatusTypeDef EXTFLASH_RangeRecord(const EXTFLASH_RangeTypeDef *range, uint32_t index, EXTFLASH_RecordTypeDef *record);
+EXTFLASH_StatusTypeDef EXTFLASH_WriteEvent(uint8_t *image, const EXTFLASH_RecordTypeDef *ring, uint32_t ring_size, uint32_t first, EXTFLASH_EventTypeDef *event);
+EXTFLASH_StatusTypeDef EXTFLASH_NextEvent(uint32_t *cursor, EXTFLASH_EventTypeDef *event);
+EXTFLASH_StatusTypeDef EXTFLASH_FindEvent(uint16_t number, EXTFLASH_EventTypeDef *event);
+void EXTFLASH_GetInfo(EXTFLASH_InfoTypeDef *info);
 
 #endif /* FLASH_MEMORY_H_ */
@@ -0,0 +1,34 @@
+/**
+  ******************************************************************************
+  * @file fmt.h
+  * @author fdominguez
+  * @brief This file provides the allocation-free text formatting used for
+  * every UART reply instead of sprintf
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef FMT_H_
+#define FMT_H_
+
+#include <stdint.h>
+
+/* Longest 32 bit field: sign and 10 digits */
+#define FMT_MAX_DIGITS				11
+
+typedef struct
+{
+  /* Cycles taken by the last and the slowest record formatted */
+  uint32_t record_cycles;
+  uint32_t record_max_cycles;
+  uint32_t records;
+} FMT_StatsTypeDef;
+
+char* FMT_UDec(char *out, uint32_t value, uint32_t width);
+char* FMT_Dec(char *out, int32_t value);
+char* FMT_Hex(char *out, uint32_t value, uint32_t digits);
+uint32_t FMT_Format(char *out, const char *format, ...);
+void FMT_AccountRecord(uint32_t cycles);
+void FMT_GetStats(FMT_StatsTypeDef *stats);
+
+#endif /* FMT_H_ */
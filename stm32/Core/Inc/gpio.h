@@ -38,6 +38,9 @@ extern "C" {
 void MX_GPIO_Init(void);
 
 /* USER CODE BEGIN Prototypes */
+void GPIO_MagInterrupts_Init(void);
+void GPIO_MagArray_Init(void);
+void GPIO_UartAutoBaud_Init(void);
 
 /* USER CODE END Prototypes */
 
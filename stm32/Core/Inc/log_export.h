@@ -0,0 +1,61 @@
+/**
+  ******************************************************************************
+  * @file log_export.h
+  * @author fdominguez
+  * @brief This file provides the bulk export of a range of logged records
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef LOG_EXPORT_H_
+#define LOG_EXPORT_H_
+
+#include <stdint.h>
+#include "extflash_memory.h"
+#include "dma_pool.h"
+
+/* Records read at once into the sector block and decoded, the block is
+ * given back before they are sent (up to 32) */
+#define LOGEXPORT_CHUNK_RECORDS		32
+/* Records between checkpoints */
+#define LOGEXPORT_CHECKPOINT_RECORDS	256
+/* Waits for the sector block before giving up, 10 ms each */
+#define LOGEXPORT_BLOCK_RETRIES		50
+
+typedef enum
+{
+  LOGEXPORT_ERROR = -1,
+  LOGEXPORT_OK    = 0
+} LOGEXPORT_StatusTypeDef;
+
+typedef enum
+{
+  LOGEXPORT_END_COMPLETE = 0,
+  /* Stopped by input from the host, it can be resumed */
+  LOGEXPORT_END_ABORTED,
+  /* Flash, buffer or send failure, it can be resumed */
+  LOGEXPORT_END_ERROR,
+  LOGEXPORT_END_RUNNING
+} LOGEXPORT_EndTypeDef;
+
+typedef struct
+{
+  uint32_t first_id;
+  uint32_t last_id;
+  /* Resume point, every record before it was sent */
+  uint32_t next_id;
+  uint32_t records;
+  /* Lost slots and records overwritten before they were sent */
+  uint32_t skipped;
+  /* CRC-16/CCITT-FALSE of the packed records sent, in ID order */
+  uint16_t checksum;
+  LOGEXPORT_EndTypeDef end;
+  /* Time spent by the last run */
+  uint32_t elapsed_ms;
+} LOGEXPORT_ResultTypeDef;
+
+LOGEXPORT_StatusTypeDef LOGEXPORT_Run(uint32_t first_id, uint32_t last_id);
+LOGEXPORT_StatusTypeDef LOGEXPORT_Resume(void);
+void LOGEXPORT_GetResult(LOGEXPORT_ResultTypeDef *result);
+
+#endif /* LOG_EXPORT_H_ */
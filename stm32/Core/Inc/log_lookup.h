@@ -0,0 +1,41 @@
+/**
+  ******************************************************************************
+  * @file log_lookup.h
+  * @author fdominguez
+  * @brief This file provides the pipelined record lookups: requests carry a
+  * tag and are answered in flash order, not in arrival order
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef LOG_LOOKUP_H_
+#define LOG_LOOKUP_H_
+
+#include <stdint.h>
+#include "extflash_memory.h"
+
+/* Requests served at once */
+#define LOGLOOKUP_QUEUE_SIZE		16
+/* Requests this close in ID are read together, skipping the ones between */
+#define LOGLOOKUP_MAX_GAP			16
+/* Longest read together, fits the sector block in any format */
+#define LOGLOOKUP_RUN_RECORDS		64
+
+typedef struct
+{
+  /* Requests queued and answered */
+  uint32_t requests;
+  /* Queues served, and the most requests in one */
+  uint32_t batches;
+  uint32_t peak;
+  /* Requests answered from a read shared with others */
+  uint32_t shared;
+  /* Frames with a tag that could not be parsed */
+  uint32_t malformed;
+} LOGLOOKUP_StatsTypeDef;
+
+uint32_t LOGLOOKUP_IsTagged(const char *frame);
+const char* LOGLOOKUP_Pipeline(const char *frame);
+void LOGLOOKUP_GetStats(LOGLOOKUP_StatsTypeDef *stats);
+
+#endif /* LOG_LOOKUP_H_ */
@@ -0,0 +1,96 @@
+/**
+  ******************************************************************************
+  * @file log_query.h
+  * @author fdominguez
+  * @brief This file provides the aggregate queries over a range of logged
+  * records, evaluated on the MCU
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef LOG_QUERY_H_
+#define LOG_QUERY_H_
+
+#include <stdint.h>
+#include "extflash_memory.h"
+#include "dma_pool.h"
+
+/* Records read at once into the sector block, any format fits */
+#define LOGQUERY_CHUNK_RECORDS		(DMAPOOL_SECTOR_BLOCK_SIZE / EXTFLASH_MULTI_RECORD_SIZE)
+/* Waits for the sector block before giving up, 10 ms each */
+#define LOGQUERY_BLOCK_RETRIES		50
+/* Fraction bits of the mean and the variance */
+#define LOGQUERY_Q					8
+/* Histogram buckets, as many as fit a PROTO_MSG_QUERY (34 bytes plus 4
+ * per bucket) */
+#define LOGQUERY_MAX_BUCKETS		15
+
+typedef enum
+{
+  LOGQUERY_ERROR = -1,
+  LOGQUERY_OK    = 0
+} LOGQUERY_StatusTypeDef;
+
+typedef enum
+{
+  LOGQUERY_STATS = 0,
+  LOGQUERY_HISTOGRAM
+} LOGQUERY_KindTypeDef;
+
+typedef enum
+{
+  LOGQUERY_FIELD_X = 0,
+  LOGQUERY_FIELD_Y,
+  LOGQUERY_FIELD_Z,
+  LOGQUERY_FIELD_TEMP,
+  LOGQUERY_FIELD_COUNT
+} LOGQUERY_FieldTypeDef;
+
+typedef enum
+{
+  LOGQUERY_END_COMPLETE = 0,
+  /* Stopped by input from the host */
+  LOGQUERY_END_ABORTED,
+  /* Flash or buffer failure */
+  LOGQUERY_END_ERROR
+} LOGQUERY_EndTypeDef;
+
+typedef struct
+{
+  LOGQUERY_KindTypeDef kind;
+  LOGQUERY_FieldTypeDef field;
+  uint32_t first_id;
+  uint32_t last_id;
+  /* Histogram: buckets of equal width from low to high, both included */
+  int32_t low;
+  int32_t high;
+  uint32_t buckets;
+} LOGQUERY_QueryTypeDef;
+
+typedef struct
+{
+  /* Range clamped to the stored IDs */
+  LOGQUERY_QueryTypeDef query;
+  uint32_t count;
+  /* Lost slots and records overwritten before they were read */
+  uint32_t skipped;
+  int16_t min;
+  int16_t max;
+  /* Q8 */
+  int32_t mean;
+  /* Sample variance, Q8 */
+  uint64_t variance;
+  uint32_t width;
+  /* Values out of the histogram */
+  uint32_t below;
+  uint32_t above;
+  uint32_t histogram[LOGQUERY_MAX_BUCKETS];
+  LOGQUERY_EndTypeDef end;
+  uint32_t elapsed_ms;
+} LOGQUERY_ResultTypeDef;
+
+LOGQUERY_StatusTypeDef LOGQUERY_Run(const LOGQUERY_QueryTypeDef *query);
+void LOGQUERY_SendResult(void);
+void LOGQUERY_GetResult(LOGQUERY_ResultTypeDef *result);
+
+#endif /* LOG_QUERY_H_ */
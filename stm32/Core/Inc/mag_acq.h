@@ -0,0 +1,84 @@
+/**
+  ******************************************************************************
+  * @file mag_acq.h
+  * @author fdominguez
+  * @brief This file provides the timer paced magnetometer acquisition
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef MAG_ACQ_H_
+#define MAG_ACQ_H_
+
+#include <stdint.h>
+#include "lis3mdl.h"
+
+/* Samples in each half of the ring. The consumer task wakes once per half.
+ * At 1 kHz a half lasts longer than a typical sector erase of the log */
+#define MAGACQ_SAMPLES_PER_HALF		64
+#define MAGACQ_RING_SIZE			(2 * MAGACQ_SAMPLES_PER_HALF)
+
+/* Pacing timer (TIM3) counts at this frequency */
+#define MAGACQ_TIMER_TICK_HZ		100000U
+#define MAGACQ_MIN_RATE_HZ			2
+#define MAGACQ_MAX_RATE_HZ			LIS3MDL_FAST_ODR_LP_HZ
+
+
+typedef enum
+{
+  MAGACQ_ERROR = -1,
+  MAGACQ_OK    = 0
+} MAGACQ_StatusTypeDef;
+
+/* One ring slot, the raw STATUS_REG burst. Only the first
+ * LIS3MDL_GetBurstSize() bytes are read, decode with LIS3MDL_DecodeBurst */
+typedef struct
+{
+  uint8_t burst[LIS3MDL_BURST_SIZE];
+} MAGACQ_SampleTypeDef;
+
+typedef struct
+{
+  uint32_t rate_hz;
+  uint32_t samples;
+  uint32_t halves;
+  /* Timer ticks that found the bus busy and were served late */
+  uint32_t deferred;
+  /* Timer ticks lost because the previous one was still deferred */
+  uint32_t overruns;
+  /* Halves completed while the consumer still had both */
+  uint32_t halves_lost;
+  uint32_t errors;
+  /* CPU time spent in the acquisition ISRs */
+  uint64_t isr_cycles;
+  uint32_t start_tick;
+} MAGACQ_StatsTypeDef;
+
+/* Conversion driven sampling (DRDY on EXTI), used while the paced
+ * acquisition is stopped */
+typedef struct
+{
+  /* DRDY rising edges */
+  uint32_t edges;
+  /* Edges dropped because the previous one had not been consumed */
+  uint32_t missed;
+  /* Waits that saw no edge. A missed edge leaves DRDY high, the read after
+   * the timeout brings it low again */
+  uint32_t timeouts;
+  /* Edge to task wake up */
+  uint32_t latency_last_us;
+  uint32_t latency_max_us;
+} MAGACQ_DataReadyStatsTypeDef;
+
+void MAGACQ_Init(void);
+MAGACQ_StatusTypeDef MAGACQ_Start(uint32_t rate_hz);
+void MAGACQ_Stop(void);
+uint32_t MAGACQ_IsRunning(void);
+const MAGACQ_SampleTypeDef* MAGACQ_WaitHalf(uint32_t timeout);
+void MAGACQ_UpdateTimer(void);
+void MAGACQ_GetStats(MAGACQ_StatsTypeDef *stats);
+void MAGACQ_TimerIRQHandler(void);
+MAGACQ_StatusTypeDef MAGACQ_WaitDataReady(uint32_t timeout);
+void MAGACQ_GetDataReadyStats(MAGACQ_DataReadyStatsTypeDef *stats);
+
+#endif /* MAG_ACQ_H_ */
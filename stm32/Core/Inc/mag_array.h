@@ -0,0 +1,65 @@
+/**
+  ******************************************************************************
+  * @file mag_array.h
+  * @author fdominguez
+  * @brief This file provides the LIS3MDL device handles and the synchronized
+  * sampling of the magnetometer array
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef MAG_ARRAY_H_
+#define MAG_ARRAY_H_
+
+#include <stdint.h>
+#include "lis3mdl.h"
+#include "extflash_memory.h"
+#include "mag_slot.h"
+
+/* One chip select each, all on SPI1. The first one is the only sensor with
+ * DRDY and INT wired, used by every single sensor mode */
+#define MAGARRAY_MAX_SENSORS		EXTFLASH_MULTI_CHANNELS
+#define MAGARRAY_PRIMARY			(&hmag[0])
+
+#define MAGARRAY_DEFAULT_PERIOD_MS	1000
+#define MAGARRAY_MIN_PERIOD_MS		MAGSLOT_MIN_PERIOD_MS
+#define MAGARRAY_MAX_PERIOD_MS		MAGSLOT_MAX_PERIOD_MS
+/* A sensor not done when the primary one is gets read once more after this */
+#define MAGARRAY_RETRY_DELAY_MS		1
+
+typedef enum
+{
+  MAGARRAY_ERROR = -1,
+  MAGARRAY_OK    = 0
+} MAGARRAY_StatusTypeDef;
+
+typedef struct
+{
+  uint32_t samples;
+  /* Samples not stored: no sensor could be started or read */
+  uint32_t errors;
+  /* Sensors read a second time */
+  uint32_t retries;
+  /* Sensors left out of a sample (not fresh after the retry) */
+  uint32_t missing;
+  /* Slots skipped to keep the cadence */
+  uint32_t late;
+  /* From the first conversion start to the last one */
+  uint32_t skew_ns;
+  uint32_t skew_max_ns;
+} MAGARRAY_StatsTypeDef;
+
+extern LIS3MDL_HandleTypeDef hmag[MAGARRAY_MAX_SENSORS];
+
+MAGARRAY_StatusTypeDef MAGARRAY_Init(void);
+uint32_t MAGARRAY_GetPresent(void);
+MAGARRAY_StatusTypeDef MAGARRAY_Enable(uint32_t period_ms);
+MAGARRAY_StatusTypeDef MAGARRAY_Disable(void);
+uint32_t MAGARRAY_IsEnabled(void);
+uint32_t MAGARRAY_GetPeriod(void);
+void MAGARRAY_WaitSlot(void);
+MAGARRAY_StatusTypeDef MAGARRAY_StartConversions(void);
+MAGARRAY_StatusTypeDef MAGARRAY_ReadSamples(EXTFLASH_MultiRecordTypeDef *record);
+void MAGARRAY_GetStats(MAGARRAY_StatsTypeDef *stats);
+
+#endif /* MAG_ARRAY_H_ */
@@ -0,0 +1,73 @@
+/**
+  ******************************************************************************
+  * @file mag_cal.h
+  * @author fdominguez
+  * @brief This file provides the magnetometer hard/soft iron calibration
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef MAG_CAL_H_
+#define MAG_CAL_H_
+
+#include <stdint.h>
+#include "lis3mdl.h"
+
+#define MAGCAL_AXES				3
+/* Offsets and matrix elements, in this order (matrix row major) */
+#define MAGCAL_COEFF_COUNT		(MAGCAL_AXES + MAGCAL_AXES * MAGCAL_AXES)
+
+/* Q15 one can not be represented, the identity uses the closest value */
+#define MAGCAL_Q15_ONE			32767
+
+/* "MCAL", stored along with the coefficients */
+#define MAGCAL_STORED_MAGIC		0x4C41434DUL
+
+/* Fit accumulation: samples are scaled down so that the fourth order sums
+ * can not overflow within MAGCAL_FIT_MAX_SAMPLES */
+#define MAGCAL_FIT_SHIFT		3
+#define MAGCAL_FIT_MAX_SAMPLES	16384
+/* Fewer samples do not constrain the fit */
+#define MAGCAL_FIT_MIN_SAMPLES	64
+/* Fit unknowns: x^2, y^2, z^2, x, y, z */
+#define MAGCAL_FIT_TERMS		6
+
+typedef enum
+{
+  MAGCAL_ERROR = -1,
+  MAGCAL_OK    = 0
+} MAGCAL_StatusTypeDef;
+
+/* calibrated = matrix * (raw - offset). The matrix is Q15, so the fit keeps
+ * every gain below one (the smallest axis radius is the reference) */
+typedef struct
+{
+  /* Hard iron offset, raw counts */
+  int16_t offset[MAGCAL_AXES];
+  /* Soft iron correction, Q15 */
+  int16_t matrix[MAGCAL_AXES][MAGCAL_AXES];
+} MAGCAL_CoeffsTypeDef;
+
+typedef struct
+{
+  uint32_t enabled;
+  uint32_t fitting;
+  /* Samples in the running (or last) fit */
+  uint32_t fit_samples;
+  /* Worst CPU time per sample */
+  uint32_t apply_cycles_max;
+  uint32_t fit_cycles_max;
+} MAGCAL_StatsTypeDef;
+
+void MAGCAL_Init(void);
+void MAGCAL_Process(LIS3MDL_DataTypeDef *data);
+void MAGCAL_Enable(uint32_t enable);
+void MAGCAL_GetCoeffs(MAGCAL_CoeffsTypeDef *coeffs);
+void MAGCAL_SetCoeffs(const MAGCAL_CoeffsTypeDef *coeffs);
+void MAGCAL_ResetCoeffs(void);
+MAGCAL_StatusTypeDef MAGCAL_Save(void);
+void MAGCAL_FitStart(void);
+MAGCAL_StatusTypeDef MAGCAL_FitFinish(void);
+void MAGCAL_GetStats(MAGCAL_StatsTypeDef *stats);
+
+#endif /* MAG_CAL_H_ */
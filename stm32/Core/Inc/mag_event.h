@@ -0,0 +1,76 @@
+/**
+  ******************************************************************************
+  * @file mag_event.h
+  * @author fdominguez
+  * @brief This file provides the change triggered magnetometer logging
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef MAG_EVENT_H_
+#define MAG_EVENT_H_
+
+#include <stdint.h>
+#include "lis3mdl.h"
+
+/* Deviation from the baseline that triggers a capture, raw counts */
+#define MAGEVT_DEFAULT_THRESHOLD	500
+/* Threshold step of the UART command */
+#define MAGEVT_THRESHOLD_STEP		100
+/* One sample stored this often while the field is quiet */
+#define MAGEVT_DEFAULT_HEARTBEAT_S	60
+/* The capture ends after this long without deviations */
+#define MAGEVT_DEFAULT_HOLD_S		2
+/* Longest heartbeat and hold time, a day (kept well below the tick wrap) */
+#define MAGEVT_MAX_TIME_S			86400
+
+typedef enum
+{
+  MAGEVT_ERROR = -1,
+  MAGEVT_OK    = 0
+} MAGEVT_StatusTypeDef;
+
+typedef enum
+{
+  MAGEVT_STATE_OFF = 0,
+  /* Waiting for a sample to take as the baseline */
+  MAGEVT_STATE_ARMING,
+  /* Threshold interrupt armed, one sample per heartbeat */
+  MAGEVT_STATE_QUIET,
+  /* Every conversion is stored */
+  MAGEVT_STATE_ACTIVE
+} MAGEVT_StateTypeDef;
+
+typedef struct
+{
+  uint32_t threshold;
+  uint32_t heartbeat_s;
+  uint32_t hold_s;
+} MAGEVT_ConfigTypeDef;
+
+typedef struct
+{
+  MAGEVT_StateTypeDef state;
+  /* INT pin edges and captures started */
+  uint32_t interrupts;
+  uint32_t triggers;
+  uint32_t heartbeats;
+  /* Samples stored while active */
+  uint32_t captured;
+  /* Baseline the threshold is armed around */
+  int16_t baseline[3];
+} MAGEVT_StatsTypeDef;
+
+void MAGEVT_Init(void);
+void MAGEVT_Enable(void);
+MAGEVT_StatusTypeDef MAGEVT_Disable(void);
+uint32_t MAGEVT_IsEnabled(void);
+uint32_t MAGEVT_IsActive(void);
+MAGEVT_StatusTypeDef MAGEVT_Configure(const MAGEVT_ConfigTypeDef *config);
+void MAGEVT_GetConfig(MAGEVT_ConfigTypeDef *config);
+void MAGEVT_WaitTrigger(void);
+uint32_t MAGEVT_Update(const LIS3MDL_DataTypeDef *raw);
+void MAGEVT_GetStats(MAGEVT_StatsTypeDef *stats);
+void MAGEVT_InterruptCallback(void);
+
+#endif /* MAG_EVENT_H_ */
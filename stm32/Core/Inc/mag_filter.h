@@ -0,0 +1,53 @@
+/**
+  ******************************************************************************
+  * @file mag_filter.h
+  * @author fdominguez
+  * @brief This file provides the magnetometer low-pass and decimation stage
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef MAG_FILTER_H_
+#define MAG_FILTER_H_
+
+#include <stdint.h>
+#include "lis3mdl.h"
+
+/* Samples averaged into each output. An int16 sum of this many fits */
+#define MAGFILT_MAX_DECIMATION		65535
+/* One output per second at the default 10 Hz data rate */
+#define MAGFILT_DEFAULT_DECIMATION	10
+/* IIR smoothing factor is 2^-shift, 0 turns it off */
+#define MAGFILT_MAX_IIR_SHIFT		8
+/* Fractional bits of the IIR state */
+#define MAGFILT_IIR_FRACTION		8
+
+typedef enum
+{
+  MAGFILT_ERROR = -1,
+  MAGFILT_OK    = 0
+} MAGFILT_StatusTypeDef;
+
+typedef struct
+{
+  /* Input samples per output (boxcar length), 1 passes every sample */
+  uint32_t decimation;
+  /* First order IIR ahead of the boxcar, 0 = off */
+  uint32_t iir_shift;
+} MAGFILT_ConfigTypeDef;
+
+typedef struct
+{
+  uint32_t inputs;
+  uint32_t outputs;
+  /* CPU time per input sample */
+  uint64_t cycles_total;
+  uint32_t cycles_max;
+} MAGFILT_StatsTypeDef;
+
+MAGFILT_StatusTypeDef MAGFILT_Configure(const MAGFILT_ConfigTypeDef *config);
+void MAGFILT_GetConfig(MAGFILT_ConfigTypeDef *config);
+uint32_t MAGFILT_Process(const LIS3MDL_DataTypeDef *input, LIS3MDL_DataTypeDef *output);
+void MAGFILT_GetStats(MAGFILT_StatsTypeDef *stats);
+
+#endif /* MAG_FILTER_H_ */
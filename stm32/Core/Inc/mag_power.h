@@ -0,0 +1,63 @@
+/**
+  ******************************************************************************
+  * @file mag_power.h
+  * @author fdominguez
+  * @brief This file provides the single conversion power scheduler
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef MAG_POWER_H_
+#define MAG_POWER_H_
+
+#include <stdint.h>
+#include "mag_slot.h"
+
+#define MAGPWR_DEFAULT_PERIOD_MS	1000
+#define MAGPWR_MIN_PERIOD_MS		MAGSLOT_MIN_PERIOD_MS
+#define MAGPWR_MAX_PERIOD_MS		MAGSLOT_MAX_PERIOD_MS
+/* A conversion takes up to 6.5 ms (ultra high performance) */
+#define MAGPWR_CONVERSION_TIMEOUT_MS	20
+
+/* Energy model: the sensor draws its operating mode supply current while
+ * converting and the power-down current the rest of the period. LP and UHP
+ * are the datasheet typical values, MP and HP are interpolated */
+#define MAGPWR_SUPPLY_MV			3300
+#define MAGPWR_CURRENT_LP_UA		40
+#define MAGPWR_CURRENT_MP_UA		90
+#define MAGPWR_CURRENT_HP_UA		160
+#define MAGPWR_CURRENT_UHP_UA		270
+#define MAGPWR_CURRENT_PD_UA		1
+
+typedef enum
+{
+  MAGPWR_ERROR = -1,
+  MAGPWR_OK    = 0
+} MAGPWR_StatusTypeDef;
+
+typedef struct
+{
+  uint32_t samples;
+  /* Conversions without DRDY */
+  uint32_t timeouts;
+  /* Slots skipped to keep the cadence */
+  uint32_t late;
+  /* From the conversion start to DRDY seen by the task */
+  uint32_t on_time_us;
+  uint32_t on_time_max_us;
+  /* Estimated sensor energy per sample, and in continuous mode at the
+   * same cadence */
+  uint32_t energy_nj;
+  uint32_t continuous_nj;
+} MAGPWR_StatsTypeDef;
+
+MAGPWR_StatusTypeDef MAGPWR_Enable(uint32_t period_ms);
+MAGPWR_StatusTypeDef MAGPWR_Disable(void);
+uint32_t MAGPWR_IsEnabled(void);
+uint32_t MAGPWR_GetPeriod(void);
+void MAGPWR_WaitSlot(void);
+MAGPWR_StatusTypeDef MAGPWR_StartConversion(void);
+void MAGPWR_ConversionDone(uint32_t done);
+void MAGPWR_GetStats(MAGPWR_StatsTypeDef *stats);
+
+#endif /* MAG_POWER_H_ */
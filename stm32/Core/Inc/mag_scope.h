@@ -0,0 +1,84 @@
+/**
+  ******************************************************************************
+  * @file mag_scope.h
+  * @author fdominguez
+  * @brief This file provides the pre-trigger capture of magnetic transients
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef MAG_SCOPE_H_
+#define MAG_SCOPE_H_
+
+#include <stdint.h>
+#include "extflash_memory.h"
+
+/* RAM ring, pre-trigger plus post-trigger samples */
+#define MAGSCOPE_MAX_DEPTH			200
+#define MAGSCOPE_DEFAULT_PRE		50
+#define MAGSCOPE_DEFAULT_POST		150
+/* Level and slope steps of the UART command, raw counts */
+#define MAGSCOPE_TRIGGER_STEP		100
+
+#if MAGSCOPE_MAX_DEPTH > EXTFLASH_EVENT_MAX_RECORDS
+#error "MAGSCOPE_MAX_DEPTH does not fit an event sector"
+#endif
+
+typedef enum
+{
+  MAGSCOPE_ERROR = -1,
+  MAGSCOPE_OK    = 0
+} MAGSCOPE_StatusTypeDef;
+
+typedef enum
+{
+  MAGSCOPE_STATE_OFF = 0,
+  /* Gathering the pre-trigger window */
+  MAGSCOPE_STATE_FILLING,
+  MAGSCOPE_STATE_ARMED,
+  /* Gathering the post-trigger samples */
+  MAGSCOPE_STATE_TRIGGERED,
+  /* Waiting to be committed, samples are dropped */
+  MAGSCOPE_STATE_COMPLETE
+} MAGSCOPE_StateTypeDef;
+
+/* Stored in the event tag */
+typedef enum
+{
+  MAGSCOPE_SOURCE_LEVEL = 0,
+  MAGSCOPE_SOURCE_SLOPE,
+  MAGSCOPE_SOURCE_COMMAND
+} MAGSCOPE_SourceTypeDef;
+
+typedef struct
+{
+  uint32_t pre_trigger;
+  /* Samples from the trigger one on */
+  uint32_t post_trigger;
+  /* Any axis crossing this magnitude upwards, 0 = off */
+  uint32_t level;
+  /* Any axis changing this much between samples, 0 = off */
+  uint32_t slope;
+} MAGSCOPE_ConfigTypeDef;
+
+typedef struct
+{
+  MAGSCOPE_StateTypeDef state;
+  uint32_t triggers;
+  uint32_t events;
+  /* Captures that could not be stored */
+  uint32_t failures;
+  uint16_t last_event;
+} MAGSCOPE_StatsTypeDef;
+
+MAGSCOPE_StatusTypeDef MAGSCOPE_Configure(const MAGSCOPE_ConfigTypeDef *config);
+void MAGSCOPE_GetConfig(MAGSCOPE_ConfigTypeDef *config);
+void MAGSCOPE_Arm(void);
+void MAGSCOPE_Disarm(void);
+uint32_t MAGSCOPE_IsEnabled(void);
+void MAGSCOPE_Trigger(void);
+uint32_t MAGSCOPE_Process(const EXTFLASH_RecordTypeDef *sample);
+MAGSCOPE_StatusTypeDef MAGSCOPE_Commit(void);
+void MAGSCOPE_GetStats(MAGSCOPE_StatsTypeDef *stats);
+
+#endif /* MAG_SCOPE_H_ */
@@ -0,0 +1,36 @@
+/**
+  ******************************************************************************
+  * @file mag_slot.h
+  * @author fdominguez
+  * @brief This file provides the sample slot scheduler shared by the single
+  * conversion modes
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef MAG_SLOT_H_
+#define MAG_SLOT_H_
+
+#include <stdint.h>
+
+/* Single conversion mode is specified up to 80 Hz */
+#define MAGSLOT_MIN_PERIOD_MS		13
+#define MAGSLOT_MAX_PERIOD_MS		3600000
+
+typedef enum
+{
+  MAGSLOT_ERROR = -1,
+  MAGSLOT_OK    = 0
+} MAGSLOT_StatusTypeDef;
+
+typedef struct
+{
+  uint32_t period_ms;
+  uint32_t next_slot;
+} MAGSLOT_HandleTypeDef;
+
+MAGSLOT_StatusTypeDef MAGSLOT_Check(uint32_t period_ms);
+void MAGSLOT_Start(MAGSLOT_HandleTypeDef *hslot, uint32_t period_ms);
+uint32_t MAGSLOT_Wait(MAGSLOT_HandleTypeDef *hslot);
+
+#endif /* MAG_SLOT_H_ */
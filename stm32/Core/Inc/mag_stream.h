@@ -0,0 +1,59 @@
+/**
+  ******************************************************************************
+  * @file mag_stream.h
+  * @author fdominguez
+  * @brief This file provides the live streaming of new samples to a UART
+  * subscriber
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef MAG_STREAM_H_
+#define MAG_STREAM_H_
+
+#include <stdint.h>
+#include "extflash_memory.h"
+#include "proto.h"
+
+/* Samples waiting for the UART task, 32 ms at 1 kHz */
+#define MAGSTREAM_RING_SIZE			32
+/* A partial batch is sent after this long */
+#define MAGSTREAM_FLUSH_MS			20
+
+typedef enum
+{
+  MAGSTREAM_ERROR = -1,
+  MAGSTREAM_OK    = 0
+} MAGSTREAM_StatusTypeDef;
+
+typedef struct
+{
+  /* Most samples per second, 0 = every sample */
+  uint32_t rate;
+  /* Samples per binary message, 1 to PROTO_STREAM_MAX */
+  uint32_t batch;
+} MAGSTREAM_ConfigTypeDef;
+
+typedef struct
+{
+  uint32_t subscribed;
+  /* Samples numbered, the sequence number of the next one */
+  uint32_t sequence;
+  uint32_t sent;
+  /* Lost because the ring was full, the UART fell behind */
+  uint32_t overflows;
+  /* Left out by the rate limit, not numbered */
+  uint32_t limited;
+  uint32_t messages;
+} MAGSTREAM_StatsTypeDef;
+
+MAGSTREAM_StatusTypeDef MAGSTREAM_Configure(const MAGSTREAM_ConfigTypeDef *config);
+void MAGSTREAM_GetConfig(MAGSTREAM_ConfigTypeDef *config);
+void MAGSTREAM_Subscribe(void);
+void MAGSTREAM_Unsubscribe(void);
+uint32_t MAGSTREAM_IsSubscribed(void);
+void MAGSTREAM_Push(const EXTFLASH_RecordTypeDef *sample);
+void MAGSTREAM_Drain(void);
+void MAGSTREAM_GetStats(MAGSTREAM_StatsTypeDef *stats);
+
+#endif /* MAG_STREAM_H_ */
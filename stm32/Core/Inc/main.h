@@ -67,6 +67,25 @@ void Error_Handler(void);
 #define CS_MAG_Pin GPIO_PIN_1
 #define CS_MAG_GPIO_Port GPIOB
 /* USER CODE BEGIN Private defines */
+/* LIS3MDL DRDY output, high while a new conversion is available */
+#define DRDY_MAG_Pin GPIO_PIN_1
+#define DRDY_MAG_GPIO_Port GPIOA
+#define DRDY_MAG_EXTI_IRQn EXTI1_IRQn
+/* LIS3MDL INT output, threshold interrupt (latched, active high) */
+#define INT_MAG_Pin GPIO_PIN_0
+#define INT_MAG_GPIO_Port GPIOA
+#define INT_MAG_EXTI_IRQn EXTI0_IRQn
+/* Chip selects of the additional LIS3MDL of the array (CS_MAG is the first) */
+#define CS_MAG2_Pin GPIO_PIN_10
+#define CS_MAG2_GPIO_Port GPIOB
+#define CS_MAG3_Pin GPIO_PIN_11
+#define CS_MAG3_GPIO_Port GPIOB
+#define CS_MAG4_Pin GPIO_PIN_12
+#define CS_MAG4_GPIO_Port GPIOB
+/* USART1 RX, also on EXTI for the auto-baud detection */
+#define RX_UART_Pin GPIO_PIN_10
+#define RX_UART_GPIO_Port GPIOA
+#define RX_UART_EXTI_IRQn EXTI15_10_IRQn
 
 /* USER CODE END Private defines */
 
@@ -0,0 +1,94 @@
+/**
+  ******************************************************************************
+  * @file proto.h
+  * @author fdominguez
+  * @brief This file provides the UART response protocol, human readable
+  * text or COBS framed binary messages
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef PROTO_H_
+#define PROTO_H_
+
+#include <stdint.h>
+#include "extflash_memory.h"
+
+/* Binary message before framing: type, sequence number, payload and the
+ * CRC-16/CCITT-FALSE (poly 0x1021, init 0xFFFF) of all of them, LSB first.
+ * It is COBS encoded and ends with a 0x00 delimiter. Multi-byte payload
+ * fields are little endian */
+#define PROTO_MAX_PAYLOAD			96
+#define PROTO_HEADER_SIZE			2
+#define PROTO_CRC_SIZE				2
+#define PROTO_MAX_MESSAGE			(PROTO_HEADER_SIZE + PROTO_MAX_PAYLOAD + PROTO_CRC_SIZE)
+/* COBS adds one byte every 254 and the delimiter */
+#define PROTO_MAX_FRAME				(PROTO_MAX_MESSAGE + (PROTO_MAX_MESSAGE / 254) + 2)
+
+typedef enum
+{
+  PROTO_ERROR = -1,
+  PROTO_OK    = 0
+} PROTO_StatusTypeDef;
+
+typedef enum
+{
+  PROTO_MODE_TEXT = 0,
+  PROTO_MODE_BINARY
+} PROTO_ModeTypeDef;
+
+typedef enum
+{
+  /* Text line, what text mode would print */
+  PROTO_MSG_TEXT = 0x01,
+  /* ID (4), x, y, z, temperature (2 each) */
+  PROTO_MSG_RECORD = 0x02,
+  /* Code (1), ID (4) */
+  PROTO_MSG_ERROR = 0x03,
+  /* First ID (4), count (1), count times x, y, z, temperature (2 each) */
+  PROTO_MSG_RECORDS = 0x04,
+  /* Next ID (4), records sent (4), checksum so far (2) */
+  PROTO_MSG_CHECKPOINT = 0x05,
+  /* Next ID (4), records sent (4), checksum (2), end reason (1) */
+  PROTO_MSG_END = 0x06,
+  /* First sequence number (4), samples dropped so far (4), count (1),
+   * count times x, y, z, temperature (2 each) */
+  PROTO_MSG_STREAM = 0x07,
+  /* Deferred log entries, each one ID (2), argument count (1), tick in
+   * ms (4), count times argument (4) */
+  PROTO_MSG_LOG = 0x08,
+  /* Kind (1), field (1), end reason (1), first ID (4), last ID (4),
+   * count (4), skipped (4). Statistics: min, max (2 each), mean (4),
+   * variance (8), both Q8. Histogram: low (2), width (4), below (4),
+   * above (4), buckets (1), buckets times count (4) */
+  PROTO_MSG_QUERY = 0x09,
+  /* Tag (2), ID (4), error code (1, 0 if found), then x, y, z,
+   * temperature (2 each) if found */
+  PROTO_MSG_TAGGED = 0x0A
+} PROTO_MessageTypeDef;
+
+/* Packed record of PROTO_MSG_RECORDS */
+#define PROTO_PACKED_RECORD_SIZE	8
+#define PROTO_RECORDS_MAX			((PROTO_MAX_PAYLOAD - 5) / PROTO_PACKED_RECORD_SIZE)
+#define PROTO_STREAM_MAX			((PROTO_MAX_PAYLOAD - 9) / PROTO_PACKED_RECORD_SIZE)
+
+typedef enum
+{
+  PROTO_ERR_NOT_FOUND = 0x01,
+  PROTO_ERR_COMMAND = 0x02
+} PROTO_ErrorTypeDef;
+
+void PROTO_Init(void);
+void PROTO_SetMode(PROTO_ModeTypeDef mode);
+PROTO_ModeTypeDef PROTO_GetMode(void);
+uint16_t PROTO_Crc16(const uint8_t *data, uint32_t size, uint16_t crc);
+uint8_t* PROTO_Put16(uint8_t *data, uint16_t value);
+uint8_t* PROTO_Put32(uint8_t *data, uint32_t value);
+uint8_t* PROTO_PackRecord(uint8_t *data, const EXTFLASH_RecordTypeDef *record);
+PROTO_StatusTypeDef PROTO_Send(PROTO_MessageTypeDef type, const uint8_t *payload, uint32_t size);
+PROTO_StatusTypeDef PROTO_SendText(const char *str);
+PROTO_StatusTypeDef PROTO_SendRecord(uint32_t id, const EXTFLASH_RecordTypeDef *record);
+PROTO_StatusTypeDef PROTO_SendError(PROTO_ErrorTypeDef code, uint32_t id);
+PROTO_StatusTypeDef PROTO_SendTagged(uint16_t tag, uint32_t id, const EXTFLASH_RecordTypeDef *record);
+
+#endif /* PROTO_H_ */
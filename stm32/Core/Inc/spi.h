@@ -35,12 +35,41 @@ extern SPI_HandleTypeDef hspi1;
 
 /* USER CODE BEGIN Private defines */
 
+/* Maximum SCK frequency supported by SPI1 in master mode */
+#define SPI1_MAX_SCK_HZ				18000000U
+/* W25Q80DV maximum SCK for the 0x03 (READ) instruction */
+#define SPI1_FLASH_MAX_SCK_HZ		50000000U
+/* LIS3MDL maximum SCK */
+#define SPI1_MAG_MAX_SCK_HZ			10000000U
+
+/* Devices sharing the SPI1 bus */
+typedef enum
+{
+  SPI1_DEVICE_FLASH = 0,
+  SPI1_DEVICE_MAG,
+  SPI1_DEVICE_COUNT
+} SPI1_DeviceTypeDef;
+
+/* Who is driving the SPI1 bus. Tasks serialize among themselves with
+ * SPISemaphore, the timer paced magnetometer acquisition runs from ISRs */
+typedef enum
+{
+  SPI1_OWNER_NONE = 0,
+  SPI1_OWNER_TASK,
+  SPI1_OWNER_MAG_ACQ
+} SPI1_OwnerTypeDef;
 /* USER CODE END Private defines */
 
 void MX_SPI1_Init(void);
 
 /* USER CODE BEGIN Prototypes */
-
+void SPI1_UpdateClocks(void);
+void SPI1_SelectDevice(SPI1_DeviceTypeDef device);
+uint32_t SPI1_GetDeviceSck(SPI1_DeviceTypeDef device);
+uint32_t SPI1_TryAcquireBus(SPI1_OwnerTypeDef owner);
+void SPI1_ReleaseBus(SPI1_OwnerTypeDef owner);
+SPI1_OwnerTypeDef SPI1_GetBusOwner(void);
+void SPI1_BusReleasedCallback(void);
 /* USER CODE END Prototypes */
 
 #ifdef __cplusplus
@@ -0,0 +1,98 @@
+/**
+  ******************************************************************************
+  * @file spi_trace.h
+  * @author fdominguez
+  * @brief This file provides SPI transaction tracing with latency histograms
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef SPI_TRACE_H_
+#define SPI_TRACE_H_
+
+#include <stdint.h>
+#include "spi.h"
+
+/* Enable/Disable this option to trace every SPI1 transaction. Off by
+ * default, the histograms take about 800 bytes of RAM */
+/*#define SPI_TRACE_ENABLED*/
+
+/* Bucket n counts transactions of [2^(n-1), 2^n) cycles, the last one
+ * everything above */
+#define SPI_TRACE_BUCKETS		24
+
+typedef enum
+{
+  SPI_TRACE_FLASH_READ = 0,
+  SPI_TRACE_FLASH_PAGE_PROGRAM,
+  SPI_TRACE_FLASH_ERASE_SECTOR,
+  SPI_TRACE_FLASH_STATUS,
+  SPI_TRACE_FLASH_OTHER,
+  SPI_TRACE_MAG_BURST,
+  SPI_TRACE_MAG_OTHER,
+  SPI_TRACE_TAG_COUNT
+} SPI_TRACE_TagTypeDef;
+
+typedef struct
+{
+  uint32_t count;
+  uint32_t max_cycles;
+  uint64_t total_cycles;
+  uint32_t buckets[SPI_TRACE_BUCKETS];
+} SPI_TRACE_HistogramTypeDef;
+
+#ifdef SPI_TRACE_ENABLED
+
+/* Transaction in progress (the bus only carries one at a time) */
+typedef struct
+{
+  uint32_t start;
+  uint8_t device;
+  uint8_t opcode;
+  uint8_t active;
+  uint8_t opcode_set;
+} SPI_TRACE_CurrentTypeDef;
+
+extern SPI_TRACE_CurrentTypeDef spi_trace_current;
+
+/**
+  * @brief Marks the beginning of a transaction (chip select asserted)
+  */
+static inline void SPI_TRACE_Begin(SPI1_DeviceTypeDef device)
+{
+  spi_trace_current.start = DWT->CYCCNT;
+  spi_trace_current.device = device;
+  spi_trace_current.active = 1;
+  spi_trace_current.opcode_set = 0;
+}
+
+/**
+  * @brief Tags the transaction with the first byte sent after chip select
+  */
+static inline void SPI_TRACE_Opcode(uint8_t opcode)
+{
+  if(!spi_trace_current.opcode_set)
+  {
+    spi_trace_current.opcode = opcode;
+    spi_trace_current.opcode_set = 1;
+  }
+}
+
+void SPI_TRACE_End(void);
+
+#define SPI_TRACE_BEGIN(device)		SPI_TRACE_Begin(device)
+#define SPI_TRACE_OPCODE(opcode)	SPI_TRACE_Opcode(opcode)
+#define SPI_TRACE_END()				SPI_TRACE_End()
+
+#else
+
+#define SPI_TRACE_BEGIN(device)		((void)0)
+#define SPI_TRACE_OPCODE(opcode)	((void)0)
+#define SPI_TRACE_END()				((void)0)
+
+#endif /* SPI_TRACE_ENABLED */
+
+void SPI_TRACE_Reset(void);
+void SPI_TRACE_Dump(void);
+
+#endif /* SPI_TRACE_H_ */
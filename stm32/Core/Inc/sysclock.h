@@ -0,0 +1,37 @@
+/**
+  ******************************************************************************
+  * @file sysclock.h
+  * @author fdominguez
+  * @brief This file provides the system clock profiles
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef SYSCLOCK_H_
+#define SYSCLOCK_H_
+
+#include <stdint.h>
+
+/* HSE crystal x9: 72 MHz SYSCLK */
+#define SYSCLOCK_PLL_HSE_MUL		RCC_PLL_MUL9
+/* HSI/2 x16: 64 MHz SYSCLK, used when no HSE crystal is found */
+#define SYSCLOCK_PLL_HSI_MUL		RCC_PLL_MUL16
+
+typedef enum
+{
+  SYSCLOCK_ERROR = -1,
+  SYSCLOCK_OK    = 0
+} SYSCLOCK_StatusTypeDef;
+
+typedef enum
+{
+  /* 8 MHz HSI, no PLL, zero wait states */
+  SYSCLOCK_PROFILE_LOW_POWER = 0,
+  /* PLL, 72 MHz (HSE) or 64 MHz (HSI), APB1 at half speed */
+  SYSCLOCK_PROFILE_PERFORMANCE
+} SYSCLOCK_ProfileTypeDef;
+
+SYSCLOCK_StatusTypeDef SYSCLOCK_SetProfile(SYSCLOCK_ProfileTypeDef profile);
+SYSCLOCK_ProfileTypeDef SYSCLOCK_GetProfile(void);
+
+#endif /* SYSCLOCK_H_ */
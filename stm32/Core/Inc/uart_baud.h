@@ -0,0 +1,66 @@
+/**
+  ******************************************************************************
+  * @file uart_baud.h
+  * @author fdominguez
+  * @brief This file provides the USART1 baud rate negotiation and auto-baud
+  * detection
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef UART_BAUD_H_
+#define UART_BAUD_H_
+
+#include <stdint.h>
+
+/* Rate set by MX_USART1_UART_Init, and the fallback */
+#define UARTBAUD_DEFAULT			115200
+/* Largest divider error accepted, per mille */
+#define UARTBAUD_MAX_ERROR_PERMILLE	20
+/* The host has this long to confirm a new rate at that rate */
+#define UARTBAUD_CONFIRM_MS			2000
+/* Edges of the first byte time stamped by the auto-baud detection */
+#define UARTBAUD_AUTO_EDGES			10
+/* A byte at 9600 baud is over by then */
+#define UARTBAUD_AUTO_SETTLE_MS		5
+/* UART task poll period while the detection is armed */
+#define UARTBAUD_AUTO_POLL_MS		10
+/* The detection is disarmed, and the poll stopped, if no byte comes by then */
+#define UARTBAUD_AUTO_TIMEOUT_MS	30000
+/* An edge time stamp jitters by some 20 cycles (interrupt entry and the
+ * instruction in progress). Rates with shorter bits than this can not be
+ * told apart within the tolerance: up to 115200 baud at 72 MHz */
+#define UARTBAUD_AUTO_MIN_BIT_CYCLES	400
+/* Measured rate to standard rate match, per mille */
+#define UARTBAUD_AUTO_TOLERANCE_PERMILLE	50
+
+typedef enum
+{
+  UARTBAUD_ERROR = -1,
+  UARTBAUD_OK    = 0
+} UARTBAUD_StatusTypeDef;
+
+typedef struct
+{
+  /* Negotiated switches confirmed by the host */
+  uint32_t switches;
+  /* Negotiated switches not confirmed in time */
+  uint32_t reverts;
+  uint32_t detected;
+  /* First bytes that matched no standard rate, detection armed again */
+  uint32_t rejected;
+  /* Detections disarmed without a byte */
+  uint32_t expired;
+} UARTBAUD_StatsTypeDef;
+
+uint32_t UARTBAUD_IsReachable(uint32_t baud);
+uint32_t UARTBAUD_GetMax(void);
+uint32_t UARTBAUD_Get(void);
+UARTBAUD_StatusTypeDef UARTBAUD_Negotiate(uint32_t baud);
+void UARTBAUD_AutoArm(void);
+uint32_t UARTBAUD_IsAutoArmed(void);
+uint32_t UARTBAUD_Poll(void);
+void UARTBAUD_GetStats(UARTBAUD_StatsTypeDef *stats);
+void UARTBAUD_EdgeIRQHandler(void);
+
+#endif /* UART_BAUD_H_ */
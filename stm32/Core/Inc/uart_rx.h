@@ -0,0 +1,39 @@
+/**
+  ******************************************************************************
+  * @file uart_rx.h
+  * @author fdominguez
+  * @brief This file provides the idle-line framed USART1 command receiver
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef UART_RX_H_
+#define UART_RX_H_
+
+#include <stdint.h>
+
+/* Circular DMA ring, about 22 ms of back to back input at 115200 baud */
+#define UARTRX_RING_SIZE			256
+/* Longest frame, longer ones are dropped whole */
+#define UARTRX_MAX_FRAME			32
+
+typedef struct
+{
+  uint32_t frames;
+  /* Frames ended by a line pause instead of CR/LF */
+  uint32_t idle_frames;
+  /* Frames dropped for being too long */
+  uint32_t too_long;
+  /* Reception restarted after a USART error (overrun, framing, noise) */
+  uint32_t errors;
+  /* Ring overrun: input overwritten by the DMA before it was parsed */
+  uint32_t overruns;
+} UARTRX_StatsTypeDef;
+
+void UARTRX_Start(void);
+const char* UARTRX_GetFrame(uint32_t timeout);
+void UARTRX_Wake(void);
+void UARTRX_GetStats(UARTRX_StatsTypeDef *stats);
+void UARTRX_IRQHandler(void);
+
+#endif /* UART_RX_H_ */
@@ -0,0 +1,47 @@
+/**
+  ******************************************************************************
+  * @file uart_tx.h
+  * @author fdominguez
+  * @brief This file provides the USART1 transmit queue, drained by DMA
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+#ifndef UART_TX_H_
+#define UART_TX_H_
+
+#include <stdint.h>
+
+/* About 45 ms of output at 115200 baud */
+#define UARTTX_RING_SIZE			512
+/* Longest wait for room in the ring, then the rest is dropped */
+#define UARTTX_TIMEOUT_MS			100
+
+typedef enum
+{
+  UARTTX_ERROR = -1,
+  UARTTX_OK    = 0
+} UARTTX_StatusTypeDef;
+
+typedef struct
+{
+  uint32_t bytes;
+  /* DMA transfers started */
+  uint32_t transfers;
+  /* Writers that had to wait for room */
+  uint32_t waits;
+  /* Bytes dropped after UARTTX_TIMEOUT_MS without room */
+  uint32_t dropped;
+  /* Transfers that could not be started or ended in error */
+  uint32_t errors;
+  uint32_t peak;
+} UARTTX_StatsTypeDef;
+
+void UARTTX_Init(void);
+UARTTX_StatusTypeDef UARTTX_Write(const uint8_t *data, uint32_t size);
+UARTTX_StatusTypeDef UARTTX_Send(const char *str);
+uint32_t UARTTX_Pending(void);
+void UARTTX_GetStats(UARTTX_StatsTypeDef *stats);
+void UARTTX_ErrorCallback(void);
+
+#endif /* UART_TX_H_ */
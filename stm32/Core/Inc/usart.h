@@ -29,21 +29,24 @@ extern "C" {
 
 /* USER CODE BEGIN Includes */
 
-#include <string.h>
+#include "uart_tx.h"
+#include "proto.h"
+#include "uart_baud.h"
 /* USER CODE END Includes */
 
 extern UART_HandleTypeDef huart1;
 
 /* USER CODE BEGIN Private defines */
 
-#define SERIAL_SEND(str)		HAL_UART_Transmit(&huart1, (uint8_t *) str, strlen((const char*)(str)), 100)
-#define UART_DATA_SIZE	4
+/* Queued, sent by DMA in the background. Wrapped in text messages while
+ * the binary protocol is selected */
+#define SERIAL_SEND(str)		PROTO_SendText((const char*)(str))
 /* USER CODE END Private defines */
 
 void MX_USART1_UART_Init(void);
 
 /* USER CODE BEGIN Prototypes */
-
+void USART1_UpdateBaudRate(void);
 /* USER CODE END Prototypes */
 
 #ifdef __cplusplus
@@ -0,0 +1,1068 @@
+/**
+  ******************************************************************************
+  * @file command.c
+  * @author fdominguez
+  * @brief This file provides the UART command interpreter
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "command.h"
+#include "usart.h"
+#include "spi_trace.h"
+#include "w25q80dv.h"
+#include "extflash_memory.h"
+#include "mag_acq.h"
+#include "mag_cal.h"
+#include "mag_filter.h"
+#include "mag_event.h"
+#include "mag_scope.h"
+#include "mag_power.h"
+#include "mag_array.h"
+#include "mag_stream.h"
+#include "uart_rx.h"
+#include "proto.h"
+#include "log_export.h"
+#include "log_query.h"
+#include "log_lookup.h"
+#include "dma_pool.h"
+#include "lis3mdl.h"
+#include "cmsis_os.h"
+#include "fmt.h"
+#include "dlog.h"
+#include <stddef.h>
+#include <stdlib.h>
+
+extern osSemaphoreId SPISemaphoreHandle;
+extern osThreadId MagTaskHandle;
+
+/* Calibration upload: coefficient selected by "CI" and high byte staged
+ * by "CH", the frames are too short for a whole value */
+static uint32_t cal_index;
+static uint8_t cal_high;
+
+/* Response line, shared by the handlers (UART task only) to keep it off
+ * the task stack. Sized for the longest one ("R") with every counter at
+ * ten digits */
+static char line[144];
+
+/**
+  * @brief Converts a hexadecimal digit
+  * @param c: Character
+  * @retval Value, -1 if not a hexadecimal digit
+  */
+static int32_t CMD_HexDigit(char c)
+{
+  if(c >= '0' && c <= '9')
+    return c - '0';
+  if(c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+  if(c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  return -1;
+}
+
+/**
+  * @brief Parses a decimal number that ends the command
+  * @param args: First digit
+  * @param min: Smallest value accepted
+  * @param max: Largest value accepted
+  * @param value: Where the number is stored
+  * @retval CMD Status, error if not a number, out of range or followed by
+  * anything else
+  */
+static CMD_StatusTypeDef CMD_ParseNumber(const char *args, uint32_t min, uint32_t max, uint32_t *value)
+{
+  unsigned long number;
+  char *end;
+
+  /* strtoul would also take blanks and a sign */
+  if(args[0] < '0' || args[0] > '9')
+    return CMD_ERROR;
+
+  /* Saturates to ULONG_MAX on overflow, above any max used here */
+  number = strtoul(args, &end, 10);
+  if(!CMD_IS_END(*end) || number < min || number > max)
+    return CMD_ERROR;
+
+  *value = number;
+  return CMD_OK;
+}
+
+/**
+  * @brief SPI trace: "T" or "TD" dumps the histograms, "TR" clears them
+  */
+static CMD_StatusTypeDef CMD_Trace(const char *args)
+{
+  if(CMD_IS_END(args[0]))
+  {
+    SPI_TRACE_Dump();
+    return CMD_OK;
+  }
+
+  switch(args[0])
+  {
+    case 'D':
+      SPI_TRACE_Dump();
+      return CMD_OK;
+    case 'R':
+      SPI_TRACE_Reset();
+      SERIAL_SEND("OK\r\n");
+      return CMD_OK;
+    default:
+      return CMD_ERROR;
+  }
+}
+
+/**
+  * @brief Flash wait statistics: "W" prints estimate and counters per
+  * operation, and the state of the record log
+  */
+static CMD_StatusTypeDef CMD_FlashWaitStats(const char *args)
+{
+  static const char * const op_names[W25Q80DV_OP_COUNT] = { "PROGRAM", "ERASE" };
+  static const char * const format_names[EXTFLASH_FORMAT_COUNT] = { "FULL", "COMPACT", "MULTI" };
+  W25Q80DV_WaitStatsTypeDef stats;
+  EXTFLASH_InfoTypeDef info;
+  uint32_t op;
+
+  if(!CMD_IS_END(args[0]))
+    return CMD_ERROR;
+
+  for(op = 0; op < W25Q80DV_OP_COUNT; op++)
+  {
+    W25Q80DV_GetWaitStats((W25Q80DV_OperationTypeDef)op, &stats);
+    FMT_Format(line, "%s est=%luus last=%luus n=%lu polls=%lu wakeups=%lu timeouts=%lu\r\n",
+        op_names[op], stats.estimate_us, stats.last_us, stats.count,
+        stats.polls, stats.wakeups, stats.timeouts);
+    SERIAL_SEND(line);
+  }
+
+  EXTFLASH_GetInfo(&info);
+  FMT_Format(line, "LOG ids=%lu..%lu sectors=%lu..%lu format=%s per_sector=%lu pending=%lu\r\n",
+      info.oldest_id, info.next_id, info.head_sector, info.tail_sector,
+      format_names[info.format], info.records_per_sector, info.pending);
+  SERIAL_SEND(line);
+
+  return CMD_OK;
+}
+
+/**
+  * @brief Paced acquisition: "A<rate>" starts it at rate Hz, "AS" stops it,
+  * "A" prints its statistics, the DRDY driven sampling ones and the
+  * sample quality counters
+  */
+static CMD_StatusTypeDef CMD_Acquisition(const char *args)
+{
+  MAGACQ_StatsTypeDef stats;
+  MAGACQ_DataReadyStatsTypeDef drdy_stats;
+  LIS3MDL_SampleStatsTypeDef sample_stats;
+  MAGACQ_StatusTypeDef status = MAGACQ_ERROR;
+  uint32_t elapsed_ms, load_permille = 0, rate_hz;
+
+  if(CMD_IS_END(args[0]))
+  {
+    MAGACQ_GetStats(&stats);
+    elapsed_ms = osKernelSysTick() - stats.start_tick;
+    if(elapsed_ms > 0)
+      load_permille = (uint32_t)((stats.isr_cycles * 1000) / ((uint64_t)elapsed_ms * (SystemCoreClock / 1000)));
+    FMT_Format(line, "%s rate=%luHz n=%lu halves=%lu lost=%lu\r\n",
+        MAGACQ_IsRunning() ? "RUN" : "STOP", stats.rate_hz, stats.samples,
+        stats.halves, stats.halves_lost);
+    SERIAL_SEND(line);
+    FMT_Format(line, "deferred=%lu overruns=%lu errors=%lu load=%lu/1000\r\n",
+        stats.deferred, stats.overruns, stats.errors, load_permille);
+    SERIAL_SEND(line);
+    MAGACQ_GetDataReadyStats(&drdy_stats);
+    FMT_Format(line, "DRDY edges=%lu missed=%lu timeouts=%lu latency=%luus max=%luus\r\n",
+        drdy_stats.edges, drdy_stats.missed, drdy_stats.timeouts,
+        drdy_stats.latency_last_us, drdy_stats.latency_max_us);
+    SERIAL_SEND(line);
+    LIS3MDL_GetSampleStats(MAGARRAY_PRIMARY, &sample_stats);
+    FMT_Format(line, "SAMPLES fresh=%lu duplicate=%lu overrun=%lu\r\n",
+        sample_stats.fresh, sample_stats.duplicate, sample_stats.overrun);
+    SERIAL_SEND(line);
+    return CMD_OK;
+  }
+
+  if(args[0] == 'S')
+  {
+    MAGACQ_Stop();
+    SERIAL_SEND("OK\r\n");
+    return CMD_OK;
+  }
+
+  if(CMD_ParseNumber(args, MAGACQ_MIN_RATE_HZ, MAGACQ_MAX_RATE_HZ, &rate_hz) != CMD_OK)
+    return CMD_ERROR;
+
+  /* The array and the power mode drive single conversions themselves */
+  if(MAGARRAY_IsEnabled() || MAGPWR_IsEnabled())
+    return CMD_ERROR;
+
+  /* Setting the data rate needs the bus */
+  if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+  {
+    status = MAGACQ_Start(rate_hz);
+    osSemaphoreRelease(SPISemaphoreHandle);
+  }
+
+  if(status != MAGACQ_OK)
+    return CMD_ERROR;
+
+  SERIAL_SEND("OK\r\n");
+  return CMD_OK;
+}
+
+/**
+  * @brief Magnetometer configuration: "M" prints it, "ML" low power logging
+  * (0.625 Hz), "MF" fast capture (1 kHz FAST_ODR), "MH" high rate capture
+  * (MF with FAST_READ and BDU), "MO<0-7|F>" data rate, "MP<0-3>" operating
+  * mode, "MS<0-3>" full scale, "MC<0|1|3>" conversion mode, "MR<0|1>"
+  * FAST_READ, "MB<0|1>" block data update
+  */
+static CMD_StatusTypeDef CMD_MagConfig(const char *args)
+{
+  static const char * const odr_names[] = { "0.625", "1.25", "2.5", "5", "10", "20", "40", "80", "FAST" };
+  static const uint8_t full_scale_gauss[] = { 4, 8, 12, 16 };
+  LIS3MDL_ConfigTypeDef config;
+  LIS3MDL_StatusTypeDef status = LIS3MDL_ERROR;
+
+  LIS3MDL_GetConfig(MAGARRAY_PRIMARY, &config);
+
+  if(CMD_IS_END(args[0]))
+  {
+    FMT_Format(line, "ODR=%s OM=%u FS=%ugauss MD=%u LP=%u FR=%u BDU=%u\r\n", odr_names[config.odr],
+        config.mode, full_scale_gauss[config.full_scale], config.conversion, config.low_power,
+        config.fast_read, config.block_data_update);
+    SERIAL_SEND(line);
+    return CMD_OK;
+  }
+
+  switch(args[0])
+  {
+    case 'L':
+      config.odr = LIS3MDL_ODR_0_625HZ;
+      config.mode = LIS3MDL_MODE_LOW_POWER;
+      config.low_power = 1;
+      break;
+    case 'F':
+      config.odr = LIS3MDL_ODR_FAST;
+      config.mode = LIS3MDL_MODE_LOW_POWER;
+      config.low_power = 0;
+      break;
+    case 'H':
+      /* 3 bytes per sample instead of 8, stored in the compact format */
+      config.odr = LIS3MDL_ODR_FAST;
+      config.mode = LIS3MDL_MODE_LOW_POWER;
+      config.low_power = 0;
+      config.fast_read = 1;
+      config.block_data_update = 1;
+      break;
+    case 'O':
+      if(args[1] == 'F')
+        config.odr = LIS3MDL_ODR_FAST;
+      else if(args[1] >= '0' && args[1] <= '7')
+        config.odr = (LIS3MDL_OdrTypeDef)(args[1] - '0');
+      else
+        return CMD_ERROR;
+      config.low_power = 0;
+      break;
+    case 'P':
+      if(args[1] < '0' || args[1] > '3')
+        return CMD_ERROR;
+      config.mode = (LIS3MDL_OperatingModeTypeDef)(args[1] - '0');
+      break;
+    case 'S':
+      if(args[1] < '0' || args[1] > '3')
+        return CMD_ERROR;
+      config.full_scale = (LIS3MDL_FullScaleTypeDef)(args[1] - '0');
+      break;
+    case 'C':
+      if(args[1] != '0' && args[1] != '1' && args[1] != '3')
+        return CMD_ERROR;
+      config.conversion = (LIS3MDL_ConversionModeTypeDef)(args[1] - '0');
+      break;
+    case 'R':
+      if(args[1] != '0' && args[1] != '1')
+        return CMD_ERROR;
+      config.fast_read = args[1] - '0';
+      break;
+    case 'B':
+      if(args[1] != '0' && args[1] != '1')
+        return CMD_ERROR;
+      config.block_data_update = args[1] - '0';
+      break;
+    default:
+      return CMD_ERROR;
+  }
+
+  /* The paced acquisition owns the data rate while it runs, the array
+   * keeps every sensor on the same configuration */
+  if(MAGACQ_IsRunning() || MAGARRAY_IsEnabled())
+    return CMD_ERROR;
+
+  if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+  {
+    status = LIS3MDL_Configure(MAGARRAY_PRIMARY, &config);
+    osSemaphoreRelease(SPISemaphoreHandle);
+  }
+
+  if(status != LIS3MDL_OK)
+    return CMD_ERROR;
+
+  SERIAL_SEND("OK\r\n");
+  return CMD_OK;
+}
+
+/**
+  * @brief Magnetometer calibration: "C" prints it, "CE<0|1>" disables or
+  * enables it, "CF" starts a fit, "CD" ends it and applies the result,
+  * "CW" stores the coefficients in flash, "CR" resets them to the identity.
+  * A coefficient (0-2 offset, 3-B matrix row major) is uploaded with
+  * "CI<0-B>", "CH<hh>" (high byte) and "CL<hh>" (low byte, applies it)
+  */
+static CMD_StatusTypeDef CMD_Calibration(const char *args)
+{
+  MAGCAL_StatsTypeDef stats;
+  MAGCAL_CoeffsTypeDef coeffs;
+  int32_t high_digit, low_digit;
+  int16_t *coeff;
+
+  MAGCAL_GetCoeffs(&coeffs);
+
+  if(CMD_IS_END(args[0]))
+  {
+    MAGCAL_GetStats(&stats);
+    FMT_Format(line, "%s fit=%s n=%lu cycles=%lu fit_cycles=%lu\r\n",
+        stats.enabled ? "ON" : "OFF", stats.fitting ? "RUN" : "STOP", stats.fit_samples,
+        stats.apply_cycles_max, stats.fit_cycles_max);
+    SERIAL_SEND(line);
+    FMT_Format(line, "OFFSET %d %d %d\r\n", coeffs.offset[0], coeffs.offset[1], coeffs.offset[2]);
+    SERIAL_SEND(line);
+    FMT_Format(line, "MATRIX %d %d %d %d %d %d %d %d %d\r\n",
+        coeffs.matrix[0][0], coeffs.matrix[0][1], coeffs.matrix[0][2],
+        coeffs.matrix[1][0], coeffs.matrix[1][1], coeffs.matrix[1][2],
+        coeffs.matrix[2][0], coeffs.matrix[2][1], coeffs.matrix[2][2]);
+    SERIAL_SEND(line);
+    return CMD_OK;
+  }
+
+  switch(args[0])
+  {
+    case 'E':
+      if(args[1] != '0' && args[1] != '1')
+        return CMD_ERROR;
+      MAGCAL_Enable(args[1] - '0');
+      break;
+    case 'F':
+      MAGCAL_FitStart();
+      break;
+    case 'D':
+      if(MAGCAL_FitFinish() != MAGCAL_OK)
+        return CMD_ERROR;
+      break;
+    case 'W':
+      /* The CPU stalls while the page is erased */
+      if(MAGACQ_IsRunning() || MAGCAL_Save() != MAGCAL_OK)
+        return CMD_ERROR;
+      break;
+    case 'R':
+      MAGCAL_ResetCoeffs();
+      break;
+    case 'I':
+      high_digit = CMD_HexDigit(args[1]);
+      if(high_digit < 0 || high_digit >= MAGCAL_COEFF_COUNT)
+        return CMD_ERROR;
+      cal_index = high_digit;
+      break;
+    case 'H':
+    case 'L':
+      high_digit = CMD_HexDigit(args[1]);
+      low_digit = CMD_HexDigit(args[2]);
+      if(high_digit < 0 || low_digit < 0)
+        return CMD_ERROR;
+      if(args[0] == 'H')
+      {
+        cal_high = (high_digit << 4) | low_digit;
+        break;
+      }
+      if(cal_index < MAGCAL_AXES)
+        coeff = &coeffs.offset[cal_index];
+      else
+        coeff = &coeffs.matrix[(cal_index - MAGCAL_AXES) / MAGCAL_AXES][(cal_index - MAGCAL_AXES) % MAGCAL_AXES];
+      *coeff = (int16_t)((cal_high << 8) | (high_digit << 4) | low_digit);
+      MAGCAL_SetCoeffs(&coeffs);
+      break;
+    default:
+      return CMD_ERROR;
+  }
+
+  SERIAL_SEND("OK\r\n");
+  return CMD_OK;
+}
+
+/**
+  * @brief Logging filter: "F" prints its configuration and statistics,
+  * "F<n>" sets the decimation ratio (1-65535), "FI<0-8>" the IIR shift (0 off)
+  */
+static CMD_StatusTypeDef CMD_Filter(const char *args)
+{
+  MAGFILT_ConfigTypeDef config;
+  MAGFILT_StatsTypeDef stats;
+
+  MAGFILT_GetConfig(&config);
+
+  if(CMD_IS_END(args[0]))
+  {
+    MAGFILT_GetStats(&stats);
+    FMT_Format(line, "DEC=%lu IIR=%lu in=%lu out=%lu cycles=%lu max=%lu\r\n",
+        config.decimation, config.iir_shift, stats.inputs, stats.outputs,
+        stats.inputs ? (uint32_t)(stats.cycles_total / stats.inputs) : 0, stats.cycles_max);
+    SERIAL_SEND(line);
+    return CMD_OK;
+  }
+
+  if(args[0] == 'I')
+  {
+    if(CMD_ParseNumber(&args[1], 0, MAGFILT_MAX_IIR_SHIFT, &config.iir_shift) != CMD_OK)
+      return CMD_ERROR;
+  }
+  else if(CMD_ParseNumber(args, 1, MAGFILT_MAX_DECIMATION, &config.decimation) != CMD_OK)
+    return CMD_ERROR;
+
+  if(MAGFILT_Configure(&config) != MAGFILT_OK)
+    return CMD_ERROR;
+
+  SERIAL_SEND("OK\r\n");
+  return CMD_OK;
+}
+
+/**
+  * @brief Bulk export: "D<a>,<b>" sends records a to b, "D<a>" from a to
+  * the newest one, "DR" resumes the last export and "D" prints its state.
+  * Any command stops an export
+  */
+static CMD_StatusTypeDef CMD_Dump(const char *args)
+{
+  static const char * const end_names[] = { "COMPLETE", "ABORTED", "ERROR", "RUNNING" };
+  LOGEXPORT_ResultTypeDef result;
+  uint32_t first_id, last_id = UINT32_MAX;
+  char *end;
+
+  if(CMD_IS_END(args[0]))
+  {
+    LOGEXPORT_GetResult(&result);
+    FMT_Format(line, "%s first=%lu last=%lu next=%lu n=%lu skipped=%lu crc=%04X time=%lums\r\n",
+        end_names[result.end], result.first_id, result.last_id, result.next_id, result.records,
+        result.skipped, result.checksum, result.elapsed_ms);
+    SERIAL_SEND(line);
+    return CMD_OK;
+  }
+
+  /* The end message is the response */
+  if(args[0] == 'R' && CMD_IS_END(args[1]))
+    return (LOGEXPORT_Resume() == LOGEXPORT_OK) ? CMD_OK : CMD_ERROR;
+
+  first_id = strtoul(args, &end, 10);
+  if(end == args)
+    return CMD_ERROR;
+  if(*end == ',')
+  {
+    args = end + 1;
+    last_id = strtoul(args, &end, 10);
+    if(end == args)
+      return CMD_ERROR;
+  }
+  if(!CMD_IS_END(*end))
+    return CMD_ERROR;
+
+  if(LOGEXPORT_Run(first_id, last_id) != LOGEXPORT_OK)
+    PROTO_SendError(PROTO_ERR_NOT_FOUND, first_id);
+
+  return CMD_OK;
+}
+
+/**
+  * @brief Aggregate queries over logged records: "Q" sends the last result
+  * again, "Q<f>[<a>[,<b>]]" the count, min, max, mean and variance of field
+  * f (X, Y, Z or T) from ID a to b, "QH<f><low>,<high>,<n>[,<a>[,<b>]]" a
+  * histogram of n buckets from low to high
+  */
+static CMD_StatusTypeDef CMD_Query(const char *args)
+{
+  static const char field_names[LOGQUERY_FIELD_COUNT] = { 'X', 'Y', 'Z', 'T' };
+  LOGQUERY_QueryTypeDef query = { .kind = LOGQUERY_STATS, .last_id = UINT32_MAX };
+  char *end;
+
+  if(CMD_IS_END(args[0]))
+  {
+    LOGQUERY_SendResult();
+    return CMD_OK;
+  }
+
+  if(args[0] == 'H')
+  {
+    query.kind = LOGQUERY_HISTOGRAM;
+    args++;
+  }
+
+  for(query.field = 0; query.field < LOGQUERY_FIELD_COUNT; query.field++)
+    if(args[0] == field_names[query.field])
+      break;
+  if(query.field == LOGQUERY_FIELD_COUNT)
+    return CMD_ERROR;
+  args++;
+
+  if(query.kind == LOGQUERY_HISTOGRAM)
+  {
+    query.low = strtol(args, &end, 10);
+    if(end == args || *end != ',')
+      return CMD_ERROR;
+    args = end + 1;
+    query.high = strtol(args, &end, 10);
+    if(end == args || *end != ',')
+      return CMD_ERROR;
+    args = end + 1;
+    query.buckets = strtoul(args, &end, 10);
+    if(end == args || query.buckets == 0 || query.buckets > LOGQUERY_MAX_BUCKETS ||
+        query.low > query.high || query.low < INT16_MIN || query.high > INT16_MAX)
+      return CMD_ERROR;
+    if(*end == ',')
+      end++;
+    args = end;
+  }
+
+  if(!CMD_IS_END(args[0]))
+  {
+    query.first_id = strtoul(args, &end, 10);
+    if(end == args)
+      return CMD_ERROR;
+    if(*end == ',')
+    {
+      args = end + 1;
+      query.last_id = strtoul(args, &end, 10);
+      if(end == args)
+        return CMD_ERROR;
+    }
+    if(!CMD_IS_END(*end))
+      return CMD_ERROR;
+  }
+
+  /* The result is the response */
+  if(LOGQUERY_Run(&query) != LOGQUERY_OK)
+    PROTO_SendError(PROTO_ERR_NOT_FOUND, query.first_id);
+
+  return CMD_OK;
+}
+
+/**
+  * @brief Change triggered logging: "E" prints its state and statistics,
+  * "E<0|1>" disables or enables it, "ET<n>" sets the threshold (n * 100
+  * counts), "EH<n>" the heartbeat and "EQ<n>" the hold time (seconds)
+  */
+static CMD_StatusTypeDef CMD_Event(const char *args)
+{
+  static const char * const state_names[] = { "OFF", "ARMING", "QUIET", "ACTIVE" };
+  MAGEVT_ConfigTypeDef config;
+  MAGEVT_StatsTypeDef stats;
+  MAGEVT_StatusTypeDef status = MAGEVT_ERROR;
+  uint32_t value;
+
+  MAGEVT_GetConfig(&config);
+
+  if(CMD_IS_END(args[0]))
+  {
+    MAGEVT_GetStats(&stats);
+    FMT_Format(line, "%s ths=%lu hb=%lus hold=%lus base=%d %d %d\r\n",
+        state_names[stats.state], config.threshold, config.heartbeat_s, config.hold_s,
+        stats.baseline[0], stats.baseline[1], stats.baseline[2]);
+    SERIAL_SEND(line);
+    FMT_Format(line, "int=%lu triggers=%lu heartbeats=%lu captured=%lu\r\n",
+        stats.interrupts, stats.triggers, stats.heartbeats, stats.captured);
+    SERIAL_SEND(line);
+    return CMD_OK;
+  }
+
+  switch(args[0])
+  {
+    case '0':
+      /* Disarming the INT pin needs the bus */
+      if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+      {
+        status = MAGEVT_Disable();
+        osSemaphoreRelease(SPISemaphoreHandle);
+      }
+      if(status != MAGEVT_OK)
+        return CMD_ERROR;
+      break;
+    case '1':
+      /* The paced acquisition, the array or the power mode owns the sensor */
+      if(MAGACQ_IsRunning() || MAGARRAY_IsEnabled() || MAGPWR_IsEnabled())
+        return CMD_ERROR;
+      MAGEVT_Enable();
+      break;
+    case 'T':
+    case 'H':
+    case 'Q':
+      if(args[0] == 'T')
+      {
+        if(CMD_ParseNumber(&args[1], 1, LIS3MDL_INT_THS_MAX / MAGEVT_THRESHOLD_STEP, &value) != CMD_OK)
+          return CMD_ERROR;
+        config.threshold = value * MAGEVT_THRESHOLD_STEP;
+      }
+      else if(CMD_ParseNumber(&args[1], 1, MAGEVT_MAX_TIME_S, &value) != CMD_OK)
+        return CMD_ERROR;
+      else if(args[0] == 'H')
+        config.heartbeat_s = value;
+      else
+        config.hold_s = value;
+      if(MAGEVT_Configure(&config) != MAGEVT_OK)
+        return CMD_ERROR;
+      break;
+    default:
+      return CMD_ERROR;
+  }
+
+  SERIAL_SEND("OK\r\n");
+  return CMD_OK;
+}
+
+/**
+  * @brief Power scheduler: "P" prints its statistics and energy estimates,
+  * "P<n>" takes a single conversion every n seconds, "P0" goes back to
+  * continuous conversion
+  */
+static CMD_StatusTypeDef CMD_Power(const char *args)
+{
+  MAGPWR_StatsTypeDef stats;
+  MAGPWR_StatusTypeDef status = MAGPWR_ERROR;
+  uint32_t period_s;
+
+  if(CMD_IS_END(args[0]))
+  {
+    MAGPWR_GetStats(&stats);
+    FMT_Format(line, "%s period=%lums n=%lu timeouts=%lu late=%lu on=%luus max=%luus\r\n",
+        MAGPWR_IsEnabled() ? "SINGLE" : "CONT", MAGPWR_GetPeriod(), stats.samples,
+        stats.timeouts, stats.late, stats.on_time_us, stats.on_time_max_us);
+    SERIAL_SEND(line);
+    FMT_Format(line, "ENERGY sample=%lunJ continuous=%lunJ\r\n", stats.energy_nj, stats.continuous_nj);
+    SERIAL_SEND(line);
+    return CMD_OK;
+  }
+
+  if(CMD_ParseNumber(args, 0, MAGPWR_MAX_PERIOD_MS / 1000, &period_s) != CMD_OK)
+    return CMD_ERROR;
+
+  /* The paced acquisition and the change triggered logging convert
+   * continuously, the array drives the conversions itself */
+  if(period_s > 0 && (MAGACQ_IsRunning() || MAGEVT_IsEnabled() || MAGARRAY_IsEnabled()))
+    return CMD_ERROR;
+
+  /* Changing the conversion mode needs the bus */
+  if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+  {
+    if(period_s > 0)
+      status = MAGPWR_Enable(period_s * 1000);
+    else
+      status = MAGPWR_Disable();
+    osSemaphoreRelease(SPISemaphoreHandle);
+  }
+
+  if(status != MAGPWR_OK)
+    return CMD_ERROR;
+
+  SERIAL_SEND("OK\r\n");
+  return CMD_OK;
+}
+
+/**
+  * @brief Sends a stored event: its tag and every record, numbered from
+  * the trigger one. The records come from a single range read
+  * @param number: Event number
+  * @return CMD Status, error if not stored
+  */
+static CMD_StatusTypeDef CMD_ScopeEvent(uint16_t number)
+{
+  static const char * const source_names[] = { "LEVEL", "SLOPE", "CMD" };
+  EXTFLASH_EventTypeDef event;
+  EXTFLASH_RangeTypeDef range;
+  EXTFLASH_RecordTypeDef record;
+  EXTFLASH_StatusTypeDef status = EXTFLASH_ERROR;
+  uint32_t index;
+
+  range.data = DMAPOOL_Acquire(DMAPOOL_SECTOR);
+  if(range.data == NULL)
+    return CMD_ERROR;
+
+  if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+  {
+    if(EXTFLASH_FindEvent(number, &event) == EXTFLASH_OK)
+    {
+      range.first_id = event.first_id;
+      range.count = event.count;
+      status = EXTFLASH_ReadRange(&range);
+    }
+    osSemaphoreRelease(SPISemaphoreHandle);
+  }
+
+  if(status == EXTFLASH_OK)
+  {
+    FMT_Format(line, "EVENT %u id=%lu n=%lu pre=%u src=%s\r\n", event.number, event.first_id,
+        range.count, event.pre_trigger, (event.source <= MAGSCOPE_SOURCE_COMMAND) ? source_names[event.source] : "?");
+    SERIAL_SEND(line);
+
+    for(index = 0; index < range.count; index++)
+    {
+      if(EXTFLASH_RangeRecord(&range, index, &record) != EXTFLASH_OK)
+        continue;
+      FMT_Format(line, "%ld %d %d %d %d\r\n", (int32_t)index - event.pre_trigger,
+          record.mag_x, record.mag_y, record.mag_z, record.temp);
+      SERIAL_SEND(line);
+    }
+  }
+
+  /* The capture may be waiting for the buffer */
+  DMAPOOL_Release(range.data);
+
+  return (status == EXTFLASH_OK) ? CMD_OK : CMD_ERROR;
+}
+
+/**
+  * @brief Pre-trigger capture: "S" prints its state, "SA" arms it, "SX"
+  * disarms it, "ST" triggers it, "SP<n>" and "SN<n>" set the pre and
+  * post-trigger samples, "SV<n>" the level and "SD<n>" the slope trigger
+  * (n * 100 counts, 0 off). "SL" lists the stored events and "S<n>" sends
+  * event n
+  */
+static CMD_StatusTypeDef CMD_Scope(const char *args)
+{
+  static const char * const state_names[] = { "OFF", "FILL", "ARMED", "TRIG", "DONE" };
+  MAGSCOPE_ConfigTypeDef config;
+  MAGSCOPE_StatsTypeDef stats;
+  EXTFLASH_EventTypeDef event;
+  EXTFLASH_StatusTypeDef status;
+  uint32_t cursor = 0, value, limit;
+
+  MAGSCOPE_GetConfig(&config);
+
+  if(CMD_IS_END(args[0]))
+  {
+    MAGSCOPE_GetStats(&stats);
+    FMT_Format(line, "%s pre=%lu post=%lu level=%lu slope=%lu\r\n", state_names[stats.state],
+        config.pre_trigger, config.post_trigger, config.level, config.slope);
+    SERIAL_SEND(line);
+    FMT_Format(line, "triggers=%lu events=%lu failures=%lu last=%u\r\n",
+        stats.triggers, stats.events, stats.failures, stats.last_event);
+    SERIAL_SEND(line);
+    return CMD_OK;
+  }
+
+  if(args[0] >= '0' && args[0] <= '9')
+  {
+    if(CMD_ParseNumber(args, 0, UINT16_MAX, &value) != CMD_OK)
+      return CMD_ERROR;
+    return CMD_ScopeEvent(value);
+  }
+
+  switch(args[0])
+  {
+    case 'A':
+      MAGSCOPE_Arm();
+      break;
+    case 'X':
+      MAGSCOPE_Disarm();
+      break;
+    case 'T':
+      MAGSCOPE_Trigger();
+      break;
+    case 'L':
+      do
+      {
+        status = EXTFLASH_ERROR;
+        if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+        {
+          status = EXTFLASH_NextEvent(&cursor, &event);
+          osSemaphoreRelease(SPISemaphoreHandle);
+        }
+        if(status == EXTFLASH_OK)
+        {
+          FMT_Format(line, "EVENT %u id=%lu n=%u pre=%u\r\n", event.number, event.first_id,
+              event.count, event.pre_trigger);
+          SERIAL_SEND(line);
+        }
+      } while(status == EXTFLASH_OK);
+      break;
+    case 'P':
+    case 'N':
+    case 'V':
+    case 'D':
+      if(args[0] == 'P' || args[0] == 'N')
+        limit = MAGSCOPE_MAX_DEPTH;
+      else
+        limit = ((args[0] == 'V') ? INT16_MAX : UINT16_MAX) / MAGSCOPE_TRIGGER_STEP;
+      if(CMD_ParseNumber(&args[1], 0, limit, &value) != CMD_OK)
+        return CMD_ERROR;
+      if(args[0] == 'P')
+        config.pre_trigger = value;
+      else if(args[0] == 'N')
+        config.post_trigger = value;
+      else if(args[0] == 'V')
+        config.level = value * MAGSCOPE_TRIGGER_STEP;
+      else
+        config.slope = value * MAGSCOPE_TRIGGER_STEP;
+      if(MAGSCOPE_Configure(&config) != MAGSCOPE_OK)
+        return CMD_ERROR;
+      break;
+    default:
+      return CMD_ERROR;
+  }
+
+  SERIAL_SEND("OK\r\n");
+  return CMD_OK;
+}
+
+/**
+  * @brief Magnetometer array: "G" prints the sensors found and the sampling
+  * statistics, "G<n>" samples every sensor at once each n seconds, "G0"
+  * goes back to the primary sensor alone
+  */
+static CMD_StatusTypeDef CMD_Array(const char *args)
+{
+  MAGARRAY_StatsTypeDef stats;
+  MAGARRAY_StatusTypeDef status = MAGARRAY_ERROR;
+  uint32_t period_s;
+
+  if(CMD_IS_END(args[0]))
+  {
+    MAGARRAY_GetStats(&stats);
+    FMT_Format(line, "%s sensors=%lX period=%lums n=%lu errors=%lu late=%lu\r\n",
+        MAGARRAY_IsEnabled() ? "ON" : "OFF", MAGARRAY_GetPresent(), MAGARRAY_GetPeriod(),
+        stats.samples, stats.errors, stats.late);
+    SERIAL_SEND(line);
+    FMT_Format(line, "retries=%lu missing=%lu skew=%luns max=%luns\r\n",
+        stats.retries, stats.missing, stats.skew_ns, stats.skew_max_ns);
+    SERIAL_SEND(line);
+    return CMD_OK;
+  }
+
+  if(CMD_ParseNumber(args, 0, MAGARRAY_MAX_PERIOD_MS / 1000, &period_s) != CMD_OK)
+    return CMD_ERROR;
+
+  /* The other modes only drive the primary sensor */
+  if(period_s > 0 && (MAGACQ_IsRunning() || MAGEVT_IsEnabled() || MAGPWR_IsEnabled()))
+    return CMD_ERROR;
+
+  /* Changing the conversion mode needs the bus */
+  if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+  {
+    if(period_s > 0)
+      status = MAGARRAY_Enable(period_s * 1000);
+    else
+      status = MAGARRAY_Disable();
+    osSemaphoreRelease(SPISemaphoreHandle);
+  }
+
+  if(status != MAGARRAY_OK)
+    return CMD_ERROR;
+
+  SERIAL_SEND("OK\r\n");
+  return CMD_OK;
+}
+
+/**
+  * @brief Live streaming: "L" prints the subscription and its counters,
+  * "L<n>" subscribes at up to n samples per second (0 = every sample),
+  * "LB<n>" sets the samples per binary message and "LX" unsubscribes
+  */
+static CMD_StatusTypeDef CMD_Live(const char *args)
+{
+  MAGSTREAM_ConfigTypeDef config;
+  MAGSTREAM_StatsTypeDef stats;
+
+  MAGSTREAM_GetConfig(&config);
+
+  if(CMD_IS_END(args[0]))
+  {
+    MAGSTREAM_GetStats(&stats);
+    FMT_Format(line, "%s rate=%lu batch=%lu seq=%lu sent=%lu overflows=%lu limited=%lu msgs=%lu\r\n",
+        stats.subscribed ? "ON" : "OFF", config.rate, config.batch, stats.sequence, stats.sent,
+        stats.overflows, stats.limited, stats.messages);
+    SERIAL_SEND(line);
+    return CMD_OK;
+  }
+
+  switch(args[0])
+  {
+    case 'X':
+      MAGSTREAM_Unsubscribe();
+      break;
+    case 'B':
+      if(CMD_ParseNumber(&args[1], 1, PROTO_STREAM_MAX, &config.batch) != CMD_OK)
+        return CMD_ERROR;
+      if(MAGSTREAM_Configure(&config) != MAGSTREAM_OK)
+        return CMD_ERROR;
+      break;
+    default:
+      if(CMD_ParseNumber(args, 0, MAGACQ_MAX_RATE_HZ, &config.rate) != CMD_OK)
+        return CMD_ERROR;
+      if(MAGSTREAM_Configure(&config) != MAGSTREAM_OK)
+        return CMD_ERROR;
+      MAGSTREAM_Subscribe();
+      break;
+  }
+
+  SERIAL_SEND("OK\r\n");
+  return CMD_OK;
+}
+
+/**
+  * @brief USART1 rate: "R" prints it, "R<n>" switches to n baud once the
+  * host confirms with "RC" at the new rate, "RA" detects the rate of the
+  * next byte received (send "U" at the new rate)
+  */
+static CMD_StatusTypeDef CMD_Rate(const char *args)
+{
+  UARTBAUD_StatsTypeDef stats;
+  uint32_t baud;
+
+  if(CMD_IS_END(args[0]))
+  {
+    UARTBAUD_GetStats(&stats);
+    FMT_Format(line, "%lu max=%lu auto=%s switches=%lu reverts=%lu detected=%lu rejected=%lu expired=%lu\r\n",
+        UARTBAUD_Get(), UARTBAUD_GetMax(), UARTBAUD_IsAutoArmed() ? "ARMED" : "OFF",
+        stats.switches, stats.reverts, stats.detected, stats.rejected, stats.expired);
+    SERIAL_SEND(line);
+    return CMD_OK;
+  }
+
+  switch(args[0])
+  {
+    case 'A':
+      /* Answered at the old rate, the detection answers at the new one */
+      SERIAL_SEND("OK\r\n");
+      UARTBAUD_AutoArm();
+      return CMD_OK;
+    case 'C':
+      /* Late or repeated confirmation */
+      SERIAL_SEND("OK\r\n");
+      return CMD_OK;
+    default:
+      if(CMD_ParseNumber(args, 1, UARTBAUD_GetMax(), &baud) != CMD_OK || !UARTBAUD_IsReachable(baud))
+        return CMD_ERROR;
+      /* Answered by the negotiation itself */
+      UARTBAUD_Negotiate(baud);
+      return CMD_OK;
+  }
+}
+
+/**
+  * @brief Response protocol: "B" prints it, "B0" human readable text,
+  * "B1" COBS framed binary messages (the reply already comes framed)
+  */
+static CMD_StatusTypeDef CMD_Binary(const char *args)
+{
+  if(CMD_IS_END(args[0]))
+  {
+    SERIAL_SEND((PROTO_GetMode() == PROTO_MODE_BINARY) ? "BINARY\r\n" : "TEXT\r\n");
+    return CMD_OK;
+  }
+
+  if((args[0] != '0' && args[0] != '1') || !CMD_IS_END(args[1]))
+    return CMD_ERROR;
+
+  PROTO_SetMode((args[0] == '1') ? PROTO_MODE_BINARY : PROTO_MODE_TEXT);
+
+  SERIAL_SEND("OK\r\n");
+  return CMD_OK;
+}
+
+/**
+  * @brief UART: "U" prints the reception and transmission statistics, the
+  * cycles taken to format a record, the deferred log use, the pipelined
+  * lookups and the least stack left (in words) to the UART and Mag tasks
+  */
+static CMD_StatusTypeDef CMD_Uart(const char *args)
+{
+  UARTRX_StatsTypeDef stats;
+  UARTTX_StatsTypeDef tx_stats;
+  FMT_StatsTypeDef fmt_stats;
+  DLOG_StatsTypeDef log_stats;
+  LOGLOOKUP_StatsTypeDef lookup_stats;
+
+  if(!CMD_IS_END(args[0]))
+    return CMD_ERROR;
+
+  UARTRX_GetStats(&stats);
+  FMT_Format(line, "RX frames=%lu idle=%lu too_long=%lu errors=%lu overruns=%lu\r\n",
+      stats.frames, stats.idle_frames, stats.too_long, stats.errors, stats.overruns);
+  SERIAL_SEND(line);
+  UARTTX_GetStats(&tx_stats);
+  FMT_Format(line, "TX bytes=%lu dma=%lu waits=%lu dropped=%lu errors=%lu peak=%lu\r\n",
+      tx_stats.bytes, tx_stats.transfers, tx_stats.waits, tx_stats.dropped,
+      tx_stats.errors, tx_stats.peak);
+  SERIAL_SEND(line);
+  FMT_GetStats(&fmt_stats);
+  FMT_Format(line, "FMT records=%lu cycles=%lu max=%lu\r\n",
+      fmt_stats.records, fmt_stats.record_cycles, fmt_stats.record_max_cycles);
+  SERIAL_SEND(line);
+  DLOG_GetStats(&log_stats);
+  FMT_Format(line, "LOG written=%lu sent=%lu dropped=%lu peak=%lu/%u\r\n",
+      log_stats.written, log_stats.sent, log_stats.dropped, log_stats.peak_words,
+      DLOG_RING_WORDS);
+  SERIAL_SEND(line);
+  LOGLOOKUP_GetStats(&lookup_stats);
+  FMT_Format(line, "LOOKUP requests=%lu batches=%lu peak=%lu shared=%lu malformed=%lu\r\n",
+      lookup_stats.requests, lookup_stats.batches, lookup_stats.peak, lookup_stats.shared,
+      lookup_stats.malformed);
+  SERIAL_SEND(line);
+  FMT_Format(line, "STACK uart=%lu mag=%lu\r\n",
+      (uint32_t)uxTaskGetStackHighWaterMark(NULL),
+      (uint32_t)uxTaskGetStackHighWaterMark(MagTaskHandle));
+  SERIAL_SEND(line);
+
+  return CMD_OK;
+}
+
+static const CMD_EntryTypeDef commands[] =
+{
+  { 'A', CMD_Acquisition },
+  { 'B', CMD_Binary },
+  { 'C', CMD_Calibration },
+  { 'D', CMD_Dump },
+  { 'E', CMD_Event },
+  { 'F', CMD_Filter },
+  { 'G', CMD_Array },
+  { 'L', CMD_Live },
+  { 'M', CMD_MagConfig },
+  { 'P', CMD_Power },
+  { 'Q', CMD_Query },
+  { 'R', CMD_Rate },
+  { 'S', CMD_Scope },
+  { 'T', CMD_Trace },
+  { 'U', CMD_Uart },
+  { 'W', CMD_FlashWaitStats },
+};
+
+/**
+  * @brief Executes a command frame
+  * @param frame: NUL terminated frame, command letter first
+  * @return CMD Status, error if unknown command or wrong arguments
+  */
+CMD_StatusTypeDef CMD_Execute(const char *frame)
+{
+  uint32_t index;
+  const char *args = &frame[1];
+
+  /* Skip separators between the command letter and its arguments */
+  while(*args == ' ')
+    args++;
+
+  for(index = 0; index < sizeof(commands) / sizeof(commands[0]); index++)
+  {
+    if(commands[index].name == frame[0])
+      return commands[index].handler(args);
+  }
+
+  return CMD_ERROR;
+}
@@ -0,0 +1,159 @@
+/**
+  ******************************************************************************
+  * @file dlog.c
+  * @author fdominguez
+  * @brief This file provides the deferred log. A call site stores its
+  * message ID (the position in dlog_table.h), the tick and up to three raw
+  * argument words in a RAM ring, a few dozen cycles with interrupts off
+  * and no formatting, so that drivers and interrupts can log without their
+  * timing changing. The UART task drains the ring in binary mode as
+  * PROTO_MSG_LOG messages and tools/dlog_decode.py prints the text.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "dlog.h"
+#include "proto.h"
+#include "main.h"
+
+#define DLOG_MASK					(DLOG_RING_WORDS - 1)
+/* ID (2), argument count (1), tick (4) */
+#define DLOG_ENTRY_HEADER_SIZE		7
+
+/* Written at the head by any context with interrupts off, read at the tail
+ * by the UART task */
+static uint32_t ring[DLOG_RING_WORDS];
+static volatile uint32_t head;
+static volatile uint32_t tail;
+
+/* PROTO_MSG_LOG being filled, UART task only */
+static uint8_t payload[PROTO_MAX_PAYLOAD];
+static uint32_t reported_dropped;
+
+static volatile DLOG_StatsTypeDef stats;
+
+/**
+  * @brief Stores an entry, any context including interrupts above the RTOS
+  * priorities. Use the DLOG<n> macros
+  * @param header: Message ID (16), argument count (8)
+  * @param arg0: First argument
+  * @param arg1: Second argument
+  * @param arg2: Third argument
+  */
+void DLOG_Write(uint32_t header, uint32_t arg0, uint32_t arg1, uint32_t arg2)
+{
+  uint32_t count = (header >> 8) & 0xFF, used, index, primask;
+
+  primask = __get_PRIMASK();
+  __disable_irq();
+
+  used = (head - tail) & DLOG_MASK;
+  /* One word stays free, else a full ring would look empty */
+  if(used + 2 + count >= DLOG_RING_WORDS)
+  {
+    stats.dropped++;
+    __set_PRIMASK(primask);
+    return;
+  }
+
+  index = head;
+  ring[index] = header;
+  index = (index + 1) & DLOG_MASK;
+  ring[index] = HAL_GetTick();
+  index = (index + 1) & DLOG_MASK;
+  if(count > 0)
+  {
+    ring[index] = arg0;
+    index = (index + 1) & DLOG_MASK;
+  }
+  if(count > 1)
+  {
+    ring[index] = arg1;
+    index = (index + 1) & DLOG_MASK;
+  }
+  if(count > 2)
+  {
+    ring[index] = arg2;
+    index = (index + 1) & DLOG_MASK;
+  }
+  /* Published whole */
+  head = index;
+
+  stats.written++;
+  used += 2 + count;
+  if(used > stats.peak_words)
+    stats.peak_words = used;
+
+  __set_PRIMASK(primask);
+}
+
+/**
+  * @brief Words waiting in the ring
+  */
+uint32_t DLOG_Pending(void)
+{
+  return (head - tail) & DLOG_MASK;
+}
+
+/**
+  * @brief Sends the entries waiting in the ring, UART task. Binary mode
+  * only: text mode replies must not be mixed with log frames, the entries
+  * wait (or are dropped) until binary mode is selected
+  */
+void DLOG_Drain(void)
+{
+  uint32_t size = 0, header, count, index, dropped;
+
+  if(PROTO_GetMode() != PROTO_MODE_BINARY)
+    return;
+
+  dropped = stats.dropped;
+  if(dropped != reported_dropped)
+  {
+    reported_dropped = dropped;
+    DLOG1(DLOG_DROPPED, dropped);
+  }
+
+  while(tail != head)
+  {
+    header = ring[tail];
+    count = (header >> 8) & 0xFF;
+
+    if(size + DLOG_ENTRY_HEADER_SIZE + count * 4 > PROTO_MAX_PAYLOAD)
+    {
+      PROTO_Send(PROTO_MSG_LOG, payload, size);
+      size = 0;
+    }
+
+    PROTO_Put16(&payload[size], header >> 16);
+    payload[size + 2] = count;
+    PROTO_Put32(&payload[size + 3], ring[(tail + 1) & DLOG_MASK]);
+    size += DLOG_ENTRY_HEADER_SIZE;
+    for(index = 0; index < count; index++)
+    {
+      PROTO_Put32(&payload[size], ring[(tail + 2 + index) & DLOG_MASK]);
+      size += 4;
+    }
+
+    /* Only now the words can be written again */
+    tail = (tail + 2 + count) & DLOG_MASK;
+    stats.sent++;
+  }
+
+  if(size > 0)
+    PROTO_Send(PROTO_MSG_LOG, payload, size);
+}
+
+/**
+  * @brief Gets a copy of the log statistics
+  * @param copy: Where the statistics are copied
+  */
+void DLOG_GetStats(DLOG_StatsTypeDef *copy)
+{
+  uint32_t primask = __get_PRIMASK();
+
+  __disable_irq();
+  *copy = stats;
+  __set_PRIMASK(primask);
+}
@@ -0,0 +1,151 @@
+/**
+  ******************************************************************************
+  * @file dma_pool.c
+  * @author fdominguez
+  * @brief This file provides a static pool of DMA capable buffers.
+  * Blocks are handed over by pointer (no copies) and can be acquired and
+  * released both from tasks and ISRs, as every shared field is updated
+  * with LDREX/STREX instead of disabling interrupts.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "dma_pool.h"
+#include "main.h"
+
+/* One bit per block in the free mask */
+_Static_assert(DMAPOOL_SMALL_BLOCK_COUNT <= 32, "DMA pool: too many small blocks");
+_Static_assert(DMAPOOL_SECTOR_BLOCK_COUNT <= 32, "DMA pool: too many sector blocks");
+_Static_assert((DMAPOOL_SMALL_BLOCK_SIZE % DMAPOOL_ALIGNMENT) == 0, "DMA pool: misaligned small blocks");
+_Static_assert((DMAPOOL_SECTOR_BLOCK_SIZE % DMAPOOL_ALIGNMENT) == 0, "DMA pool: misaligned sector blocks");
+
+typedef struct
+{
+  uint8_t *base;
+  uint16_t block_size;
+  uint16_t block_count;
+  /* Bit set: block available */
+  volatile uint32_t free_mask;
+  volatile uint32_t peak;
+  volatile uint32_t failures;
+} DMAPOOL_PoolTypeDef;
+
+/* Storage lives in its own section, so the linker accounts for it and the
+ * map file reports it */
+static uint8_t small_blocks[DMAPOOL_SMALL_BLOCK_COUNT][DMAPOOL_SMALL_BLOCK_SIZE]
+  __attribute__((section(".dma_pool"), aligned(DMAPOOL_ALIGNMENT)));
+static uint8_t sector_blocks[DMAPOOL_SECTOR_BLOCK_COUNT][DMAPOOL_SECTOR_BLOCK_SIZE]
+  __attribute__((section(".dma_pool"), aligned(DMAPOOL_ALIGNMENT)));
+
+static DMAPOOL_PoolTypeDef pools[DMAPOOL_COUNT] =
+{
+  [DMAPOOL_SMALL] =
+  {
+    .base = &small_blocks[0][0],
+    .block_size = DMAPOOL_SMALL_BLOCK_SIZE,
+    .block_count = DMAPOOL_SMALL_BLOCK_COUNT,
+    .free_mask = (uint32_t)((1ULL << DMAPOOL_SMALL_BLOCK_COUNT) - 1),
+  },
+  [DMAPOOL_SECTOR] =
+  {
+    .base = &sector_blocks[0][0],
+    .block_size = DMAPOOL_SECTOR_BLOCK_SIZE,
+    .block_count = DMAPOOL_SECTOR_BLOCK_COUNT,
+    .free_mask = (uint32_t)((1ULL << DMAPOOL_SECTOR_BLOCK_COUNT) - 1),
+  },
+};
+
+/**
+  * @brief Number of blocks in use given a free mask
+  */
+static uint32_t DMAPOOL_InUse(const DMAPOOL_PoolTypeDef *pool, uint32_t free_mask)
+{
+  return pool->block_count - __builtin_popcount(free_mask);
+}
+
+/**
+  * @brief Acquires a block from a pool
+  * @param pool: Pool to take the block from
+  * @return Pointer to the block, NULL if the pool is exhausted
+  */
+uint8_t* DMAPOOL_Acquire(DMAPOOL_IdTypeDef pool)
+{
+  DMAPOOL_PoolTypeDef *p = &pools[pool];
+  uint32_t mask, index, in_use, value;
+
+  do
+  {
+    mask = __LDREXW(&p->free_mask);
+    if(mask == 0)
+    {
+      __CLREX();
+      do
+      {
+        value = __LDREXW(&p->failures);
+      } while(__STREXW(value + 1, &p->failures) != 0);
+      return NULL;
+    }
+
+    /* Lowest available block */
+    index = __CLZ(__RBIT(mask));
+    mask &= ~(1UL << index);
+  } while(__STREXW(mask, &p->free_mask) != 0);
+
+  /* Track the high water mark */
+  in_use = DMAPOOL_InUse(p, mask);
+  do
+  {
+    value = __LDREXW(&p->peak);
+    if(in_use <= value)
+    {
+      __CLREX();
+      break;
+    }
+  } while(__STREXW(in_use, &p->peak) != 0);
+
+  return p->base + (index * p->block_size);
+}
+
+/**
+  * @brief Gives a block back to its pool
+  * @param block: Block previously returned by DMAPOOL_Acquire (NULL allowed)
+  */
+void DMAPOOL_Release(uint8_t *block)
+{
+  DMAPOOL_PoolTypeDef *p;
+  uint32_t pool, index, mask;
+
+  if(block == NULL)
+    return;
+
+  for(pool = 0; pool < DMAPOOL_COUNT; pool++)
+  {
+    p = &pools[pool];
+    if(block >= p->base && block < p->base + (p->block_count * p->block_size))
+    {
+      index = (uint32_t)(block - p->base) / p->block_size;
+      do
+      {
+        mask = __LDREXW(&p->free_mask);
+      } while(__STREXW(mask | (1UL << index), &p->free_mask) != 0);
+      return;
+    }
+  }
+}
+
+/**
+  * @brief Gets usage statistics of a pool
+  * @param pool: Pool to get the statistics of
+  * @param stats: Statistics read
+  */
+void DMAPOOL_GetStats(DMAPOOL_IdTypeDef pool, DMAPOOL_StatsTypeDef *stats)
+{
+  DMAPOOL_PoolTypeDef *p = &pools[pool];
+
+  stats->block_size = p->block_size;
+  stats->block_count = p->block_count;
+  stats->in_use = DMAPOOL_InUse(p, p->free_mask);
+  stats->peak = p->peak;
+  stats->failures = p->failures;
+}
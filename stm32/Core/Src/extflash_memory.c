@@ -2,7 +2,14 @@
   ******************************************************************************
   * @file extflash_memory.c
   * @author fdominguez
-  * @brief This file provides code for specific FLASH application
+  * @brief This file provides code for specific FLASH application.
+  * Records are appended to a circular log of sectors. Each sector starts
+  * with a header (magic, ID of its first record, format) and the records
+  * follow without gaps, so the ID of a record gives its position. Records
+  * are gathered in RAM and programmed a page at a time, a sector is only
+  * erased when the log moves into it. A triggered capture is an event
+  * sector of its own: its records are programmed at once and the sector
+  * is closed.
   * @date 01/13/2020
   * @version 1.0.0
   ******************************************************************************
@@ -10,112 +17,949 @@
 
 #include "extflash_memory.h"
 #include "w25q80dv.h"
-#include <stdlib.h>
+#include "dma_pool.h"
+#include <string.h>
+
+#if EXTFLASH_MULTI_RECORD_SIZE > DMAPOOL_SMALL_BLOCK_SIZE
+#error "A multi-channel record must fit a small DMA block"
+#endif
+
+/* Bytes per record, by format */
+static const uint8_t record_size[EXTFLASH_FORMAT_COUNT] =
+{
+  EXTFLASH_FULL_RECORD_SIZE,
+  EXTFLASH_COMPACT_RECORD_SIZE,
+  EXTFLASH_MULTI_RECORD_SIZE
+};
+
+static struct
+{
+  uint32_t mounted;
+  /* Oldest sector and its first ID */
+  uint32_t head_sector;
+  uint32_t oldest_id;
+  /* Sector being written, its first ID and records (pending included) */
+  uint32_t tail_sector;
+  uint32_t tail_first_id;
+  uint32_t tail_count;
+  EXTFLASH_FormatTypeDef format;
+  /* Number of the newest event */
+  uint16_t event_number;
+} extflash_log;
+
+/* Records of the tail sector not programmed yet, from pending_first_slot */
+static uint8_t pending[EXTFLASH_PENDING_SIZE];
+static uint32_t pending_count;
+static uint32_t pending_first_slot;
+
+/* Sector found by the last lookup, reads usually go in sequence */
+static struct
+{
+  uint32_t valid;
+  uint32_t sector;
+  uint32_t first_id;
+  /* First ID of the following sector */
+  uint32_t end_id;
+  EXTFLASH_FormatTypeDef format;
+} lookup_cache;
 
 /**
-  * @brief Checks the ID is present on FLASH memory
-  * @param id_value: ID to look for in FLASH memory
-  * @return FLASH Status
+  * @brief Records that fit in a sector after the header
+  * @param format: Record format
+  * @retval Records per sector
   */
-EXTFLASH_StatusTypeDef EXTFLASH_CheckID(uint32_t id_value)
+static uint32_t EXTFLASH_RecordsPerSector(EXTFLASH_FormatTypeDef format)
 {
+  return (W25Q80DV_SECTOR_SIZE - EXTFLASH_HEADER_SIZE) / record_size[format];
+}
+
+/**
+  * @brief Gets the memory address of a record
+  * @param sector: Log sector
+  * @param slot: Record position inside the sector
+  * @param format: Record format of the sector
+  * @retval Address
+  */
+static uint32_t EXTFLASH_RecordAddress(uint32_t sector, uint32_t slot, EXTFLASH_FormatTypeDef format)
+{
+  return sector * W25Q80DV_SECTOR_SIZE + EXTFLASH_HEADER_SIZE + slot * record_size[format];
+}
+
+/**
+  * @brief Reads a sector header
+  * @param sector: Sector to read
+  * @param first_id: ID of the first record of the sector
+  * @param format: Record format of the sector
+  * @param valid: Set to 0 if the sector does not belong to the log
+  * @param event: Event tag, count is 0 for a plain log sector (may be NULL)
+  * @retval EXTFLASH Status, error if the memory could not be read
+  */
+static EXTFLASH_StatusTypeDef EXTFLASH_ReadHeader(uint32_t sector, uint32_t *first_id, EXTFLASH_FormatTypeDef *format, uint32_t *valid, EXTFLASH_EventTypeDef *event)
+{
+  uint8_t *header;
+  uint32_t magic;
   EXTFLASH_StatusTypeDef retval = EXTFLASH_ERROR;
-  char aux[4];
-  uint32_t high_index_aux = (id_value & (~(W25Q80DV_SECTOR_SIZE-1))) * W25Q80DV_SECTOR_SIZE;
-  uint32_t low_index_aux = (id_value & (W25Q80DV_SECTOR_SIZE-1)) * EXTFLASH_BYTES_STORED_PER_FIELD;
-  uint32_t starting_position =  high_index_aux + low_index_aux;
 
-  /* Read ID in memory */
-  if(W25Q80DV_ReadBytes(starting_position, (uint8_t*)aux, 4) == W25Q80DV_OK)
+  header = DMAPOOL_Acquire(DMAPOOL_SMALL);
+  if(header == NULL)
+    return EXTFLASH_ERROR;
+
+  if(W25Q80DV_ReadBytes(sector * W25Q80DV_SECTOR_SIZE, header, EXTFLASH_HEADER_SIZE) == W25Q80DV_OK)
   {
-	  /* Check if both ID matches */
-	  if(id_value == atoi(aux))
-		retval = EXTFLASH_OK;
+    magic = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t)header[3] << 24);
+    *first_id = header[4] | (header[5] << 8) | (header[6] << 16) | ((uint32_t)header[7] << 24);
+    *format = (EXTFLASH_FormatTypeDef)header[8];
+
+    *valid = (magic == EXTFLASH_HEADER_MAGIC && header[8] < EXTFLASH_FORMAT_COUNT &&
+              header[9] == record_size[header[8]]);
+
+    if(event != NULL)
+    {
+      event->first_id = *first_id;
+      event->count = 0;
+      if(header[10] == EXTFLASH_EVENT_TAG)
+      {
+        event->number = header[11] | (header[12] << 8);
+        event->count = header[13];
+        event->pre_trigger = header[14];
+        event->source = header[15];
+      }
+    }
+    retval = EXTFLASH_OK;
   }
 
+  DMAPOOL_Release(header);
+
   return retval;
 }
 
 /**
-  * @brief Reads data from external FLASH memory
-  * @param id_value: ID to look for in FLASH memory
-  * @param x_mag: magnetometer X value read
-  * @param y_mag: magnetometer Y value read
-  * @param z_mag: magnetometer Z value read
-  * @param temp: temperature value read
-  * @return EXTFLASH Status
+  * @brief Encodes a sector header
+  * @param header: EXTFLASH_HEADER_SIZE bytes
+  * @param first_id: ID of the first record of the sector
+  * @param format: Record format of the sector
+  * @param event: Event tag (NULL for a plain log sector)
   */
-EXTFLASH_StatusTypeDef EXTFLASH_ReadData(uint32_t id_value, int16_t *x_mag, int16_t *y_mag, int16_t *z_mag, int16_t *temp)
+static void EXTFLASH_EncodeHeader(uint8_t *header, uint32_t first_id, EXTFLASH_FormatTypeDef format, const EXTFLASH_EventTypeDef *event)
 {
+  uint32_t index;
+
+  for(index = 0; index < 4; index++)
+  {
+    header[index] = (EXTFLASH_HEADER_MAGIC >> (8 * index)) & 0xFF;
+    header[index + 4] = (first_id >> (8 * index)) & 0xFF;
+  }
+  header[8] = format;
+  header[9] = record_size[format];
+  for(index = 10; index < EXTFLASH_HEADER_SIZE; index++)
+    header[index] = 0xFF;
+
+  if(event != NULL)
+  {
+    header[10] = EXTFLASH_EVENT_TAG;
+    header[11] = event->number & 0xFF;
+    header[12] = (event->number >> 8) & 0xFF;
+    header[13] = event->count;
+    header[14] = event->pre_trigger;
+    header[15] = event->source;
+  }
+}
+
+/**
+  * @brief Erases a sector and makes it the tail of the log
+  * @param sector: Sector to start
+  * @param first_id: ID of its first record
+  * @param format: Record format
+  * @retval EXTFLASH Status
+  */
+static EXTFLASH_StatusTypeDef EXTFLASH_StartSector(uint32_t sector, uint32_t first_id, EXTFLASH_FormatTypeDef format)
+{
+  uint8_t *header;
   EXTFLASH_StatusTypeDef retval = EXTFLASH_ERROR;
-  uint8_t aux[4];
-  uint32_t high_index_aux = (id_value & (~(W25Q80DV_SECTOR_SIZE-1))) * W25Q80DV_SECTOR_SIZE;
-  uint32_t low_index_aux = (id_value & (W25Q80DV_SECTOR_SIZE-1)) * EXTFLASH_BYTES_STORED_PER_FIELD + 4;
-  uint32_t starting_position = high_index_aux + low_index_aux;
 
-  /* TODO: Add the condition when we need to read 2 sectors to get the data (12 bytes against 4096) */
-  /* Read data in memory (ID + 4 bytes based on initial position) */
-  if(W25Q80DV_ReadBytes(starting_position, (uint8_t*)aux, EXTFLASH_BYTES_TO_READ_DATA) == W25Q80DV_OK)
+  if(lookup_cache.sector == sector)
+    lookup_cache.valid = 0;
+
+  header = DMAPOOL_Acquire(DMAPOOL_SMALL);
+  if(header == NULL)
+    return EXTFLASH_ERROR;
+
+  EXTFLASH_EncodeHeader(header, first_id, format, NULL);
+
+  if(W25Q80DV_EraseSector(sector * W25Q80DV_SECTOR_SIZE) == W25Q80DV_OK &&
+     W25Q80DV_WriteBytes(sector * W25Q80DV_SECTOR_SIZE, header, EXTFLASH_HEADER_SIZE) == W25Q80DV_OK)
   {
-    *x_mag = (int16_t)((aux[0] << 8) | aux[1]);
-	*y_mag = (int16_t)((aux[2] << 8) | aux[3]);
-	*z_mag = (int16_t)((aux[4] << 8) | aux[5]);
-	*temp = (int16_t)((aux[6] << 8) | aux[7]);
-	retval = EXTFLASH_OK;
+    extflash_log.tail_sector = sector;
+    extflash_log.tail_first_id = first_id;
+    extflash_log.tail_count = 0;
+    extflash_log.format = format;
+    retval = EXTFLASH_OK;
   }
 
+  DMAPOOL_Release(header);
+
   return retval;
 }
 
 /**
-  * @brief Writes data to external FLASH memory
-  * @param id_value: ID to look for in FLASH memory
-  * @param x_mag: magnetometer X value to write
-  * @param y_mag: magnetometer Y value to write
-  * @param z_mag: magnetometer Z value to write
-  * @param temp: temperature value to write
-  * @return EXTFLASH Status
+  * @brief Gets the sector following the tail, recycling the oldest one when
+  * the log is full
+  * @param sector: Next sector
+  * @retval EXTFLASH Status
   */
-EXTFLASH_StatusTypeDef EXTFLASH_WriteData(uint32_t id_value, int16_t x_mag, int16_t y_mag, int16_t z_mag, int16_t temp)
+static EXTFLASH_StatusTypeDef EXTFLASH_NextSector(uint32_t *sector)
 {
+  uint32_t next = (extflash_log.tail_sector + 1) % EXTFLASH_SECTOR_COUNT;
+  uint32_t first_id, valid;
+  EXTFLASH_FormatTypeDef head_format;
+
+  if(next == extflash_log.head_sector)
+  {
+    extflash_log.head_sector = (next + 1) % EXTFLASH_SECTOR_COUNT;
+    if(EXTFLASH_ReadHeader(extflash_log.head_sector, &first_id, &head_format, &valid, NULL) != EXTFLASH_OK || !valid)
+      return EXTFLASH_ERROR;
+    extflash_log.oldest_id = first_id;
+  }
+
+  *sector = next;
+
+  return EXTFLASH_OK;
+}
+
+/**
+  * @brief Moves the tail to the next sector. Pending records must have been
+  * flushed
+  * @param format: Record format of the new sector
+  * @retval EXTFLASH Status
+  */
+static EXTFLASH_StatusTypeDef EXTFLASH_AdvanceTail(EXTFLASH_FormatTypeDef format)
+{
+  uint32_t sector;
+
+  if(EXTFLASH_NextSector(&sector) != EXTFLASH_OK)
+    return EXTFLASH_ERROR;
+
+  return EXTFLASH_StartSector(sector, extflash_log.tail_first_id + extflash_log.tail_count, format);
+}
+
+/**
+  * @brief Tells whether a record slot was programmed. The last byte of
+  * a record is never 0xFF
+  * @param sector: Log sector
+  * @param slot: Record position inside the sector
+  * @param format: Record format of the sector
+  * @param programmed: Set to 1 if the record was programmed
+  * @retval EXTFLASH Status
+  */
+static EXTFLASH_StatusTypeDef EXTFLASH_IsProgrammed(uint32_t sector, uint32_t slot, EXTFLASH_FormatTypeDef format, uint32_t *programmed)
+{
+  uint8_t *last_byte;
   EXTFLASH_StatusTypeDef retval = EXTFLASH_ERROR;
-  uint8_t sector_data[W25Q80DV_SECTOR_SIZE];
-  uint32_t index_aux, write_retrials;
-
-  /* TODO: Add the condition when we need to write 2 sectors (12 bytes against 4096) */
-  index_aux = (id_value & (~(W25Q80DV_SECTOR_SIZE-1))) * W25Q80DV_SECTOR_SIZE;
-  /* First, read data of target sector (mask to read the beginning of that sector) */
-  if(W25Q80DV_ReadSector(index_aux, sector_data) == W25Q80DV_OK)
-  {
-	  /* Then, erase sector */
-	  index_aux = (id_value & (W25Q80DV_SECTOR_SIZE-1)) * EXTFLASH_BYTES_STORED_PER_FIELD;
-	  if(W25Q80DV_EraseSector((id_value & (~(W25Q80DV_SECTOR_SIZE-1))) * W25Q80DV_SECTOR_SIZE) == W25Q80DV_OK)
-	  {
-		  /* Finally, write the new values and write the sector in memory */
-		  sector_data[index_aux] = ((id_value >> 24) & 0xFF);
-		  sector_data[index_aux + 1] = ((id_value >> 16) & 0xFF);
-		  sector_data[index_aux + 2] = ((id_value >> 8) & 0xFF);
-		  sector_data[index_aux + 3] = (id_value & 0xFF);
-		  sector_data[index_aux + 4] = (x_mag >> 8);
-		  sector_data[index_aux + 5] = (x_mag & 0xFF);
-		  sector_data[index_aux + 6] = (y_mag >> 8);
-		  sector_data[index_aux + 7] = (y_mag & 0xFF);
-		  sector_data[index_aux + 8] = (z_mag >> 8);
-		  sector_data[index_aux + 9] = (z_mag & 0xFF);
-		  sector_data[index_aux + 10] = (temp >> 8);
-		  sector_data[(id_value & (W25Q80DV_SECTOR_SIZE-1)) * EXTFLASH_BYTES_STORED_PER_FIELD + 11] = (temp & 0xFF);
-
-		  /* At this point, if data is not written in memory, all the information in that sector
-		   * would be lost, so the loop tries to minimize this to happen */
-		  for(write_retrials = 0; write_retrials < EXTFLASH_MAX_WRITE_RETRIALS; write_retrials++)
-		  {
-			  if(W25Q80DV_WriteSector(((id_value & (~(W25Q80DV_SECTOR_SIZE-1))) * W25Q80DV_SECTOR_SIZE), (uint8_t*)sector_data) == W25Q80DV_OK)
-			  {
-				  retval = EXTFLASH_OK;
-				  break;
-			  }
-		  }
-	  }
+
+  last_byte = DMAPOOL_Acquire(DMAPOOL_SMALL);
+  if(last_byte == NULL)
+    return EXTFLASH_ERROR;
+
+  if(W25Q80DV_ReadBytes(EXTFLASH_RecordAddress(sector, slot + 1, format) - 1, last_byte, 1) == W25Q80DV_OK)
+  {
+    *programmed = (last_byte[0] != 0xFF);
+    retval = EXTFLASH_OK;
+  }
+
+  DMAPOOL_Release(last_byte);
+
+  return retval;
+}
+
+/**
+  * @brief Encodes a record
+  * @param record: Record
+  * @param format: Record format, full or compact
+  * @param data: Encoded record, record_size[format] bytes
+  */
+static void EXTFLASH_Encode(const EXTFLASH_RecordTypeDef *record, EXTFLASH_FormatTypeDef format, uint8_t *data)
+{
+  int32_t temp;
+
+  if(format == EXTFLASH_FORMAT_COMPACT)
+  {
+    data[0] = (record->mag_x >> 8) & 0xFF;
+    data[1] = (record->mag_y >> 8) & 0xFF;
+    data[2] = (record->mag_z >> 8) & 0xFF;
+
+    /* 0xFF would read as an erased slot */
+    temp = (record->temp >> EXTFLASH_COMPACT_TEMP_SHIFT) + EXTFLASH_COMPACT_TEMP_OFFSET;
+    if(temp < 0)
+      temp = 0;
+    else if(temp > 0xFE)
+      temp = 0xFE;
+    data[3] = temp;
+  }
+  else
+  {
+    data[0] = record->mag_x & 0xFF;
+    data[1] = (record->mag_x >> 8) & 0xFF;
+    data[2] = record->mag_y & 0xFF;
+    data[3] = (record->mag_y >> 8) & 0xFF;
+    data[4] = record->mag_z & 0xFF;
+    data[5] = (record->mag_z >> 8) & 0xFF;
+    data[6] = record->temp & 0xFF;
+    data[7] = (record->temp >> 8) & 0xFF;
+    data[8] = record->status;
+    data[9] = EXTFLASH_RECORD_MARKER;
+  }
+}
+
+/**
+  * @brief Encodes a multi-channel record
+  * @param record: Record
+  * @param data: Encoded record, EXTFLASH_MULTI_RECORD_SIZE bytes
+  */
+static void EXTFLASH_EncodeMulti(const EXTFLASH_MultiRecordTypeDef *record, uint8_t *data)
+{
+  uint32_t channel, axis;
+
+  for(channel = 0; channel < EXTFLASH_MULTI_CHANNELS; channel++)
+  {
+    for(axis = 0; axis < 3; axis++)
+    {
+      *data++ = record->mag[channel][axis] & 0xFF;
+      *data++ = (record->mag[channel][axis] >> 8) & 0xFF;
+    }
+  }
+  data[0] = record->temp & 0xFF;
+  data[1] = (record->temp >> 8) & 0xFF;
+  data[2] = record->channels;
+  data[3] = EXTFLASH_RECORD_MARKER;
+}
+
+/**
+  * @brief Decodes a multi-channel record
+  * @param data: Encoded record, EXTFLASH_MULTI_RECORD_SIZE bytes
+  * @param record: Record
+  */
+static void EXTFLASH_DecodeMulti(const uint8_t *data, EXTFLASH_MultiRecordTypeDef *record)
+{
+  uint32_t channel, axis;
+
+  for(channel = 0; channel < EXTFLASH_MULTI_CHANNELS; channel++)
+  {
+    for(axis = 0; axis < 3; axis++)
+    {
+      record->mag[channel][axis] = (int16_t)((data[1] << 8) | data[0]);
+      data += 2;
+    }
+  }
+  record->temp = (int16_t)((data[1] << 8) | data[0]);
+  record->channels = data[2];
+}
+
+/**
+  * @brief Decodes a record. A multi-channel one gives its first channel
+  * @param data: Encoded record, record_size[format] bytes
+  * @param format: Record format
+  * @param record: Record
+  */
+static void EXTFLASH_Decode(const uint8_t *data, EXTFLASH_FormatTypeDef format, EXTFLASH_RecordTypeDef *record)
+{
+  EXTFLASH_MultiRecordTypeDef multi;
+
+  if(format == EXTFLASH_FORMAT_MULTI)
+  {
+    EXTFLASH_DecodeMulti(data, &multi);
+    record->mag_x = multi.mag[0][0];
+    record->mag_y = multi.mag[0][1];
+    record->mag_z = multi.mag[0][2];
+    record->temp = multi.temp;
+    record->status = 0;
+  }
+  else if(format == EXTFLASH_FORMAT_COMPACT)
+  {
+    record->mag_x = (int16_t)(data[0] << 8);
+    record->mag_y = (int16_t)(data[1] << 8);
+    record->mag_z = (int16_t)(data[2] << 8);
+    record->temp = ((int16_t)data[3] - EXTFLASH_COMPACT_TEMP_OFFSET) * (1 << EXTFLASH_COMPACT_TEMP_SHIFT);
+    record->status = 0;
+  }
+  else
+  {
+    record->mag_x = (int16_t)((data[1] << 8) | data[0]);
+    record->mag_y = (int16_t)((data[3] << 8) | data[2]);
+    record->mag_z = (int16_t)((data[5] << 8) | data[4]);
+    record->temp = (int16_t)((data[7] << 8) | data[6]);
+    record->status = data[8];
+  }
+}
+
+/**
+  * @brief Finds the sector holding a record older than the tail sector.
+  * Sectors are in ID order from the head, so it is a binary search
+  * over their headers
+  * @param id: Record ID
+  * @retval EXTFLASH Status, the sector is left in lookup_cache
+  */
+static EXTFLASH_StatusTypeDef EXTFLASH_Lookup(uint32_t id)
+{
+  uint32_t low = 0, high, middle, first_id, end_id, valid;
+  EXTFLASH_FormatTypeDef format;
+
+  if(lookup_cache.valid && id >= lookup_cache.first_id && id < lookup_cache.end_id)
+    return EXTFLASH_OK;
+
+  /* Sectors from the head, the tail excluded */
+  high = (extflash_log.tail_sector + EXTFLASH_SECTOR_COUNT - extflash_log.head_sector) % EXTFLASH_SECTOR_COUNT;
+  end_id = extflash_log.tail_first_id;
+
+  while(high - low > 1)
+  {
+    middle = (low + high) / 2;
+    if(EXTFLASH_ReadHeader((extflash_log.head_sector + middle) % EXTFLASH_SECTOR_COUNT, &first_id, &format, &valid, NULL) != EXTFLASH_OK || !valid)
+      return EXTFLASH_ERROR;
+
+    if(first_id <= id)
+      low = middle;
+    else
+    {
+      high = middle;
+      end_id = first_id;
+    }
+  }
+
+  middle = (extflash_log.head_sector + low) % EXTFLASH_SECTOR_COUNT;
+  if(EXTFLASH_ReadHeader(middle, &first_id, &format, &valid, NULL) != EXTFLASH_OK || !valid || first_id > id)
+    return EXTFLASH_ERROR;
+
+  lookup_cache.sector = middle;
+  lookup_cache.first_id = first_id;
+  lookup_cache.end_id = end_id;
+  lookup_cache.format = format;
+  lookup_cache.valid = 1;
+
+  return EXTFLASH_OK;
+}
+
+/**
+  * @brief Mounts the log: the sector headers give the oldest and the newest
+  * sector, and a binary search the records already in the newest one.
+  * An empty memory gets a new log in the first sector
+  * @return EXTFLASH Status
+  */
+EXTFLASH_StatusTypeDef EXTFLASH_Init(void)
+{
+  uint32_t sector, first_id, valid, found = 0, tail_event = 0, newest_event_id = 0;
+  uint32_t newest_id = 0, low, high, middle, programmed;
+  EXTFLASH_FormatTypeDef format, tail_format = EXTFLASH_FORMAT_FULL;
+  EXTFLASH_EventTypeDef event;
+
+  extflash_log.mounted = 0;
+  extflash_log.event_number = 0;
+  pending_count = 0;
+  lookup_cache.valid = 0;
+
+  for(sector = 0; sector < EXTFLASH_SECTOR_COUNT; sector++)
+  {
+    if(EXTFLASH_ReadHeader(sector, &first_id, &format, &valid, &event) != EXTFLASH_OK)
+      return EXTFLASH_ERROR;
+
+    if(!valid)
+      continue;
+
+    /* Events are numbered in log order */
+    if(event.count > 0 && first_id >= newest_event_id)
+    {
+      newest_event_id = first_id;
+      extflash_log.event_number = event.number;
+    }
+
+    if(!found || first_id < extflash_log.oldest_id)
+    {
+      extflash_log.oldest_id = first_id;
+      extflash_log.head_sector = sector;
+    }
+    if(!found || first_id >= newest_id)
+    {
+      newest_id = first_id;
+      extflash_log.tail_sector = sector;
+      tail_format = format;
+      tail_event = (event.count > 0);
+    }
+    found = 1;
+  }
+
+  if(!found)
+  {
+    extflash_log.head_sector = 0;
+    extflash_log.oldest_id = 0;
+    if(EXTFLASH_StartSector(0, 0, EXTFLASH_FORMAT_FULL) != EXTFLASH_OK)
+      return EXTFLASH_ERROR;
+  }
+  else if(tail_event)
+  {
+    /* An event sector is closed */
+    extflash_log.tail_first_id = newest_id;
+    extflash_log.tail_count = EXTFLASH_RecordsPerSector(tail_format);
+    extflash_log.format = tail_format;
+  }
+  else
+  {
+    /* Records are programmed in order, find the first erased slot */
+    low = 0;
+    high = EXTFLASH_RecordsPerSector(tail_format);
+    while(low < high)
+    {
+      middle = (low + high) / 2;
+      if(EXTFLASH_IsProgrammed(extflash_log.tail_sector, middle, tail_format, &programmed) != EXTFLASH_OK)
+        return EXTFLASH_ERROR;
+
+      if(programmed)
+        low = middle + 1;
+      else
+        high = middle;
+    }
+
+    extflash_log.tail_first_id = newest_id;
+    extflash_log.tail_count = low;
+    extflash_log.format = tail_format;
+  }
+
+  extflash_log.mounted = 1;
+
+  return EXTFLASH_OK;
+}
+
+/**
+  * @brief Selects the format of the records appended from now on. The
+  * records already in the tail sector keep theirs, so the log moves to
+  * a new sector unless the tail one is still empty
+  * @param format: Record format
+  * @return EXTFLASH Status
+  */
+EXTFLASH_StatusTypeDef EXTFLASH_SetFormat(EXTFLASH_FormatTypeDef format)
+{
+  if(!extflash_log.mounted || format >= EXTFLASH_FORMAT_COUNT)
+    return EXTFLASH_ERROR;
+
+  if(format == extflash_log.format)
+    return EXTFLASH_OK;
+
+  if(EXTFLASH_Flush() != EXTFLASH_OK)
+    return EXTFLASH_ERROR;
+
+  if(extflash_log.tail_count == 0)
+    return EXTFLASH_StartSector(extflash_log.tail_sector, extflash_log.tail_first_id, format);
+
+  return EXTFLASH_AdvanceTail(format);
+}
+
+/**
+  * @brief Makes room in RAM for the next record, moving to a new sector
+  * when the tail one is full
+  * @retval Where the record has to be encoded, NULL on error
+  */
+static uint8_t* EXTFLASH_Reserve(void)
+{
+  if(extflash_log.tail_count == EXTFLASH_RecordsPerSector(extflash_log.format))
+  {
+    if(EXTFLASH_Flush() != EXTFLASH_OK || EXTFLASH_AdvanceTail(extflash_log.format) != EXTFLASH_OK)
+      return NULL;
   }
+
+  if(pending_count == 0)
+    pending_first_slot = extflash_log.tail_count;
+
+  return &pending[pending_count * record_size[extflash_log.format]];
+}
+
+/**
+  * @brief Adds the record encoded in the room given by EXTFLASH_Reserve
+  * @param id: ID given to the record (may be NULL)
+  * @return EXTFLASH Status
+  */
+static EXTFLASH_StatusTypeDef EXTFLASH_Commit(uint32_t *id)
+{
+  pending_count++;
+  extflash_log.tail_count++;
+
+  if(id != NULL)
+    *id = extflash_log.tail_first_id + extflash_log.tail_count - 1;
+
+  /* Program as soon as the next record would not fit */
+  if((pending_count + 1) * record_size[extflash_log.format] > EXTFLASH_PENDING_SIZE)
+    return EXTFLASH_Flush();
+
+  return EXTFLASH_OK;
+}
+
+/**
+  * @brief Appends a record to the log. It is kept in RAM until a page worth
+  * of records is gathered or EXTFLASH_Flush is called
+  * @param record: Record to append
+  * @param id: ID given to the record (may be NULL)
+  * @return EXTFLASH Status, error in the multi-channel format
+  */
+EXTFLASH_StatusTypeDef EXTFLASH_Append(const EXTFLASH_RecordTypeDef *record, uint32_t *id)
+{
+  uint8_t *data;
+
+  if(!extflash_log.mounted || extflash_log.format == EXTFLASH_FORMAT_MULTI)
+    return EXTFLASH_ERROR;
+
+  data = EXTFLASH_Reserve();
+  if(data == NULL)
+    return EXTFLASH_ERROR;
+
+  EXTFLASH_Encode(record, extflash_log.format, data);
+
+  return EXTFLASH_Commit(id);
+}
+
+/**
+  * @brief Appends a multi-channel record to the log, like EXTFLASH_Append
+  * @param record: Record to append
+  * @param id: ID given to the record (may be NULL)
+  * @return EXTFLASH Status, error unless in the multi-channel format
+  */
+EXTFLASH_StatusTypeDef EXTFLASH_AppendMulti(const EXTFLASH_MultiRecordTypeDef *record, uint32_t *id)
+{
+  uint8_t *data;
+
+  if(!extflash_log.mounted || extflash_log.format != EXTFLASH_FORMAT_MULTI)
+    return EXTFLASH_ERROR;
+
+  data = EXTFLASH_Reserve();
+  if(data == NULL)
+    return EXTFLASH_ERROR;
+
+  EXTFLASH_EncodeMulti(record, data);
+
+  return EXTFLASH_Commit(id);
+}
+
+/**
+  * @brief Programs the records kept in RAM. On error they are lost and the
+  * tail sector is closed, so no record is ever programmed after a gap
+  * @return EXTFLASH Status
+  */
+EXTFLASH_StatusTypeDef EXTFLASH_Flush(void)
+{
+  uint32_t address;
+
+  if(pending_count == 0)
+    return EXTFLASH_OK;
+
+  address = EXTFLASH_RecordAddress(extflash_log.tail_sector, pending_first_slot, extflash_log.format);
+  if(W25Q80DV_WriteBytes(address, pending, pending_count * record_size[extflash_log.format]) != W25Q80DV_OK)
+  {
+    pending_count = 0;
+    extflash_log.tail_count = EXTFLASH_RecordsPerSector(extflash_log.format);
+    return EXTFLASH_ERROR;
+  }
+
+  pending_count = 0;
+
+  return EXTFLASH_OK;
+}
+
+/**
+  * @brief Gets a record from the log, still encoded
+  * @param id: Record ID
+  * @param data: DMA capable buffer of a small block
+  * @param format: Record format
+  * @return EXTFLASH Status, error if the ID is not stored
+  */
+static EXTFLASH_StatusTypeDef EXTFLASH_ReadEncoded(uint32_t id, uint8_t *data, EXTFLASH_FormatTypeDef *format)
+{
+  uint32_t sector, slot;
+
+  if(!extflash_log.mounted || id < extflash_log.oldest_id ||
+     id >= extflash_log.tail_first_id + extflash_log.tail_count)
+    return EXTFLASH_ERROR;
+
+  if(id >= extflash_log.tail_first_id)
+  {
+    sector = extflash_log.tail_sector;
+    slot = id - extflash_log.tail_first_id;
+    *format = extflash_log.format;
+
+    /* Still in RAM */
+    if(pending_count > 0 && slot >= pending_first_slot)
+    {
+      memcpy(data, &pending[(slot - pending_first_slot) * record_size[*format]], record_size[*format]);
+      return EXTFLASH_OK;
+    }
+  }
+  else
+  {
+    if(EXTFLASH_Lookup(id) != EXTFLASH_OK)
+      return EXTFLASH_ERROR;
+
+    sector = lookup_cache.sector;
+    slot = id - lookup_cache.first_id;
+    *format = lookup_cache.format;
+  }
+
+  if(W25Q80DV_ReadBytes(EXTFLASH_RecordAddress(sector, slot, *format), data, record_size[*format]) != W25Q80DV_OK)
+    return EXTFLASH_ERROR;
+
+  /* Lost in a failed flush */
+  if(data[record_size[*format] - 1] == 0xFF)
+    return EXTFLASH_ERROR;
+
+  return EXTFLASH_OK;
+}
+
+/**
+  * @brief Reads a record from the log. Multi-channel records give their
+  * first channel
+  * @param id: Record ID
+  * @param record: Record read
+  * @return EXTFLASH Status, error if the ID is not stored
+  */
+EXTFLASH_StatusTypeDef EXTFLASH_Read(uint32_t id, EXTFLASH_RecordTypeDef *record)
+{
+  uint8_t *data;
+  EXTFLASH_FormatTypeDef format;
+  EXTFLASH_StatusTypeDef retval;
+
+  /* Borrow the DMA target */
+  data = DMAPOOL_Acquire(DMAPOOL_SMALL);
+  if(data == NULL)
+    return EXTFLASH_ERROR;
+
+  retval = EXTFLASH_ReadEncoded(id, data, &format);
+  if(retval == EXTFLASH_OK)
+    EXTFLASH_Decode(data, format, record);
+
+  DMAPOOL_Release(data);
+
   return retval;
 }
+
+/**
+  * @brief Reads a multi-channel record from the log
+  * @param id: Record ID
+  * @param record: Record read
+  * @return EXTFLASH Status, error if the ID is not stored or is not
+  * a multi-channel record
+  */
+EXTFLASH_StatusTypeDef EXTFLASH_ReadMulti(uint32_t id, EXTFLASH_MultiRecordTypeDef *record)
+{
+  uint8_t *data;
+  EXTFLASH_FormatTypeDef format;
+  EXTFLASH_StatusTypeDef retval;
+
+  /* Borrow the DMA target */
+  data = DMAPOOL_Acquire(DMAPOOL_SMALL);
+  if(data == NULL)
+    return EXTFLASH_ERROR;
+
+  retval = EXTFLASH_ReadEncoded(id, data, &format);
+  if(retval == EXTFLASH_OK && format != EXTFLASH_FORMAT_MULTI)
+    retval = EXTFLASH_ERROR;
+  if(retval == EXTFLASH_OK)
+    EXTFLASH_DecodeMulti(data, record);
+
+  DMAPOOL_Release(data);
+
+  return retval;
+}
+
+/**
+  * @brief Reads consecutive records with a single memory read. The range
+  * ends at the sector end and before the records still in RAM, unless it
+  * starts in them
+  * @param range: Buffer, first ID and count. Count and format are updated
+  * @return EXTFLASH Status, error if the first ID is not stored
+  */
+EXTFLASH_StatusTypeDef EXTFLASH_ReadRange(EXTFLASH_RangeTypeDef *range)
+{
+  uint32_t sector, slot, end;
+  EXTFLASH_FormatTypeDef format;
+
+  if(!extflash_log.mounted || range->count == 0 || range->first_id < extflash_log.oldest_id ||
+     range->first_id >= extflash_log.tail_first_id + extflash_log.tail_count)
+    return EXTFLASH_ERROR;
+
+  if(range->first_id >= extflash_log.tail_first_id)
+  {
+    sector = extflash_log.tail_sector;
+    slot = range->first_id - extflash_log.tail_first_id;
+    format = extflash_log.format;
+    end = extflash_log.tail_count;
+
+    if(pending_count > 0)
+    {
+      /* Still in RAM */
+      if(slot >= pending_first_slot)
+      {
+        if(range->count > end - slot)
+          range->count = end - slot;
+        memcpy(range->data, &pending[(slot - pending_first_slot) * record_size[format]], range->count * record_size[format]);
+        range->format = format;
+        return EXTFLASH_OK;
+      }
+      end = pending_first_slot;
+    }
+  }
+  else
+  {
+    if(EXTFLASH_Lookup(range->first_id) != EXTFLASH_OK)
+      return EXTFLASH_ERROR;
+
+    sector = lookup_cache.sector;
+    slot = range->first_id - lookup_cache.first_id;
+    format = lookup_cache.format;
+    end = lookup_cache.end_id - lookup_cache.first_id;
+    if(end > EXTFLASH_RecordsPerSector(format))
+      end = EXTFLASH_RecordsPerSector(format);
+  }
+
+  if(slot >= end)
+    return EXTFLASH_ERROR;
+  if(range->count > end - slot)
+    range->count = end - slot;
+  range->format = format;
+
+  if(W25Q80DV_ReadBytes(EXTFLASH_RecordAddress(sector, slot, format), range->data, range->count * record_size[format]) != W25Q80DV_OK)
+    return EXTFLASH_ERROR;
+
+  return EXTFLASH_OK;
+}
+
+/**
+  * @brief Decodes a record of a range
+  * @param range: Range read by EXTFLASH_ReadRange
+  * @param index: Record position in the range
+  * @param record: Record
+  * @return EXTFLASH Status, error if the record was lost (erased slot)
+  */
+EXTFLASH_StatusTypeDef EXTFLASH_RangeRecord(const EXTFLASH_RangeTypeDef *range, uint32_t index, EXTFLASH_RecordTypeDef *record)
+{
+  const uint8_t *data = &range->data[index * record_size[range->format]];
+
+  if(index >= range->count || data[record_size[range->format] - 1] == 0xFF)
+    return EXTFLASH_ERROR;
+
+  EXTFLASH_Decode(data, range->format, record);
+
+  return EXTFLASH_OK;
+}
+
+/**
+  * @brief Stores a capture as an event sector: header and records are
+  * built in RAM and programmed at once, then the sector is closed
+  * @param image: DMA capable buffer of a sector
+  * @param ring: Records of the capture
+  * @param ring_size: Length of the ring
+  * @param first: Position of the oldest record in the ring
+  * @param event: Records, pre-trigger records and source. Number and first
+  * ID are set
+  * @return EXTFLASH Status
+  */
+EXTFLASH_StatusTypeDef EXTFLASH_WriteEvent(uint8_t *image, const EXTFLASH_RecordTypeDef *ring, uint32_t ring_size, uint32_t first, EXTFLASH_EventTypeDef *event)
+{
+  uint32_t sector, index;
+
+  if(!extflash_log.mounted || event->count == 0 || event->count > ring_size)
+    return EXTFLASH_ERROR;
+
+  if(EXTFLASH_Flush() != EXTFLASH_OK)
+    return EXTFLASH_ERROR;
+
+  /* An empty tail sector is reused */
+  if(extflash_log.tail_count == 0)
+    sector = extflash_log.tail_sector;
+  else if(EXTFLASH_NextSector(&sector) != EXTFLASH_OK)
+    return EXTFLASH_ERROR;
+
+  event->number = extflash_log.event_number + 1;
+  event->first_id = extflash_log.tail_first_id + extflash_log.tail_count;
+
+  EXTFLASH_EncodeHeader(image, event->first_id, EXTFLASH_FORMAT_FULL, event);
+  for(index = 0; index < event->count; index++)
+    EXTFLASH_Encode(&ring[(first + index) % ring_size], EXTFLASH_FORMAT_FULL,
+        &image[EXTFLASH_HEADER_SIZE + index * EXTFLASH_FULL_RECORD_SIZE]);
+
+  if(lookup_cache.sector == sector)
+    lookup_cache.valid = 0;
+
+  if(W25Q80DV_EraseSector(sector * W25Q80DV_SECTOR_SIZE) != W25Q80DV_OK)
+    return EXTFLASH_ERROR;
+
+  /* The sector is in the log from now on, even if programming fails */
+  extflash_log.tail_sector = sector;
+  extflash_log.tail_first_id = event->first_id;
+  extflash_log.tail_count = EXTFLASH_RecordsPerSector(EXTFLASH_FORMAT_FULL);
+  extflash_log.format = EXTFLASH_FORMAT_FULL;
+  extflash_log.event_number = event->number;
+
+  if(W25Q80DV_WriteBytes(sector * W25Q80DV_SECTOR_SIZE, image,
+      EXTFLASH_HEADER_SIZE + event->count * EXTFLASH_FULL_RECORD_SIZE) != W25Q80DV_OK)
+    return EXTFLASH_ERROR;
+
+  return EXTFLASH_OK;
+}
+
+/**
+  * @brief Gets the next event of the log, from the oldest one
+  * @param cursor: Sector position from the head, 0 for the first call
+  * @param event: Event found
+  * @return EXTFLASH Status, error when there are no more events
+  */
+EXTFLASH_StatusTypeDef EXTFLASH_NextEvent(uint32_t *cursor, EXTFLASH_EventTypeDef *event)
+{
+  uint32_t sectors, first_id, valid;
+  EXTFLASH_FormatTypeDef format;
+
+  if(!extflash_log.mounted)
+    return EXTFLASH_ERROR;
+
+  /* Sectors from the head, the tail included */
+  sectors = (extflash_log.tail_sector + EXTFLASH_SECTOR_COUNT - extflash_log.head_sector) % EXTFLASH_SECTOR_COUNT + 1;
+
+  while(*cursor < sectors)
+  {
+    if(EXTFLASH_ReadHeader((extflash_log.head_sector + *cursor) % EXTFLASH_SECTOR_COUNT, &first_id, &format, &valid, event) != EXTFLASH_OK)
+      return EXTFLASH_ERROR;
+
+    (*cursor)++;
+    if(valid && event->count > 0)
+      return EXTFLASH_OK;
+  }
+
+  return EXTFLASH_ERROR;
+}
+
+/**
+  * @brief Finds an event by its number
+  * @param number: Event number
+  * @param event: Event found
+  * @return EXTFLASH Status, error if not stored
+  */
+EXTFLASH_StatusTypeDef EXTFLASH_FindEvent(uint16_t number, EXTFLASH_EventTypeDef *event)
+{
+  uint32_t cursor = 0;
+
+  while(EXTFLASH_NextEvent(&cursor, event) == EXTFLASH_OK)
+  {
+    if(event->number == number)
+      return EXTFLASH_OK;
+  }
+
+  return EXTFLASH_ERROR;
+}
+
+/**
+  * @brief Gets the state of the log
+  * @param info: Where the state is copied
+  */
+void EXTFLASH_GetInfo(EXTFLASH_InfoTypeDef *info)
+{
+  info->oldest_id = extflash_log.oldest_id;
+  info->next_id = extflash_log.tail_first_id + extflash_log.tail_count;
+  info->head_sector = extflash_log.head_sector;
+  info->tail_sector = extflash_log.tail_sector;
+  info->format = extflash_log.format;
+  info->records_per_sector = EXTFLASH_RecordsPerSector(extflash_log.format);
+  info->pending = pending_count;
+}
@@ -0,0 +1,210 @@
+/**
+  ******************************************************************************
+  * @file fmt.c
+  * @author fdominguez
+  * @brief This file provides the allocation-free text formatting used for
+  * every UART reply. Only what the replies need is there: integers in
+  * decimal or hexadecimal, with a fixed width, strings and characters. It
+  * takes no heap, no locale and no reentrancy structure, so newlib's
+  * printf is no longer linked and the UART task stack is not strained.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "fmt.h"
+#include "cmsis_os.h"
+#include <stdarg.h>
+
+static const char hex_digits[] = "0123456789ABCDEF";
+
+static volatile FMT_StatsTypeDef stats;
+
+/**
+  * @brief Writes an unsigned number
+  * @param out: Where it is written
+  * @param value: Value
+  * @param base: 10 or 16
+  * @param width: Least number of characters, sign included
+  * @param pad: '0' or ' '
+  * @param negative: 1 to write a minus sign
+  * @retval Character after the number, not NUL terminated
+  */
+static char* FMT_Number(char *out, uint32_t value, uint32_t base, uint32_t width, char pad, uint32_t negative)
+{
+  char digits[FMT_MAX_DIGITS];
+  uint32_t count = 0;
+
+  do
+  {
+    digits[count++] = hex_digits[value % base];
+    value /= base;
+  } while(value > 0);
+
+  if(negative)
+  {
+    if(width > 0)
+      width--;
+    /* The sign goes before zeros, after spaces */
+    if(pad == '0')
+      *out++ = '-';
+  }
+
+  while(width > count)
+  {
+    *out++ = pad;
+    width--;
+  }
+
+  if(negative && pad != '0')
+    *out++ = '-';
+
+  while(count > 0)
+    *out++ = digits[--count];
+
+  return out;
+}
+
+/**
+  * @brief Writes an unsigned decimal number, NUL terminated
+  * @param out: Where it is written
+  * @param value: Value
+  * @param width: Least number of digits, zero padded. 0 for no padding
+  * @retval The NUL terminator, to write the next field
+  */
+char* FMT_UDec(char *out, uint32_t value, uint32_t width)
+{
+  out = FMT_Number(out, value, 10, width, '0', 0);
+  *out = '\0';
+  return out;
+}
+
+/**
+  * @brief Writes a signed decimal number, NUL terminated
+  * @param out: Where it is written
+  * @param value: Value
+  * @retval The NUL terminator, to write the next field
+  */
+char* FMT_Dec(char *out, int32_t value)
+{
+  /* The magnitude of INT32_MIN only fits unsigned */
+  out = (value < 0) ? FMT_Number(out, 0U - (uint32_t)value, 10, 0, ' ', 1) : FMT_Number(out, value, 10, 0, ' ', 0);
+  *out = '\0';
+  return out;
+}
+
+/**
+  * @brief Writes an upper case hexadecimal number, NUL terminated
+  * @param out: Where it is written
+  * @param value: Value
+  * @param digits: Least number of digits, zero padded. 0 for no padding
+  * @retval The NUL terminator, to write the next field
+  */
+char* FMT_Hex(char *out, uint32_t value, uint32_t digits)
+{
+  out = FMT_Number(out, value, 16, digits, '0', 0);
+  *out = '\0';
+  return out;
+}
+
+/**
+  * @brief Fills a template, a printf subset: %d, %u, %X (%x is upper case
+  * too), %s, %c and %%, with an optional '0' flag and width. The 'l'
+  * modifier is accepted, int and long are both 32 bits
+  * @param out: Where the text is written, NUL terminated
+  * @param format: Template, text with the fields
+  * @retval Length of the text
+  */
+uint32_t FMT_Format(char *out, const char *format, ...)
+{
+  va_list args;
+  char *start = out, pad;
+  const char *str;
+  uint32_t width;
+  int32_t value;
+
+  va_start(args, format);
+
+  while(*format != '\0')
+  {
+    if(*format != '%')
+    {
+      *out++ = *format++;
+      continue;
+    }
+    format++;
+
+    pad = ' ';
+    if(*format == '0')
+    {
+      pad = '0';
+      format++;
+    }
+    width = 0;
+    while(*format >= '0' && *format <= '9')
+      width = width * 10 + (*format++ - '0');
+    if(*format == 'l')
+      format++;
+
+    switch(*format)
+    {
+      case 'd':
+        value = va_arg(args, int32_t);
+        out = (value < 0) ? FMT_Number(out, 0U - (uint32_t)value, 10, width, pad, 1) :
+              FMT_Number(out, value, 10, width, pad, 0);
+        break;
+      case 'u':
+        out = FMT_Number(out, va_arg(args, uint32_t), 10, width, pad, 0);
+        break;
+      case 'X':
+      case 'x':
+        out = FMT_Number(out, va_arg(args, uint32_t), 16, width, pad, 0);
+        break;
+      case 's':
+        str = va_arg(args, const char*);
+        while(*str != '\0')
+          *out++ = *str++;
+        break;
+      case 'c':
+        *out++ = (char)va_arg(args, int32_t);
+        break;
+      case '%':
+        *out++ = '%';
+        break;
+      default:
+        /* Unknown field, the text is cut there */
+        va_end(args);
+        *out = '\0';
+        return out - start;
+    }
+    format++;
+  }
+
+  va_end(args);
+  *out = '\0';
+
+  return out - start;
+}
+
+/**
+  * @brief Accounts the cycles taken to format a record
+  * @param cycles: Cycles, from CYCCNT
+  */
+void FMT_AccountRecord(uint32_t cycles)
+{
+  stats.record_cycles = cycles;
+  if(cycles > stats.record_max_cycles)
+    stats.record_max_cycles = cycles;
+  stats.records++;
+}
+
+/**
+  * @brief Gets a copy of the formatting statistics
+  * @param copy: Where the statistics are copied
+  */
+void FMT_GetStats(FMT_StatsTypeDef *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  taskEXIT_CRITICAL();
+}
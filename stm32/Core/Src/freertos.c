@@ -27,13 +27,25 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include <stdlib.h>
-#include <stdio.h>
 #include <string.h>
 #include "cmsis_os.h"
 #include "usart.h"
 #include "lis3mdl.h"
 #include "w25q80dv.h"
 #include "extflash_memory.h"
+#include "command.h"
+#include "mag_acq.h"
+#include "mag_cal.h"
+#include "mag_filter.h"
+#include "mag_event.h"
+#include "mag_scope.h"
+#include "mag_power.h"
+#include "mag_array.h"
+#include "mag_stream.h"
+#include "uart_rx.h"
+#include "proto.h"
+#include "dlog.h"
+#include "log_lookup.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -43,6 +55,12 @@
 
 /* Private define ------------------------------------------------------------*/
 /* USER CODE BEGIN PD */
+/* Longest wait for a DRDY edge, above the slowest output data period (1.6 s) */
+#define MAG_DRDY_TIMEOUT_MS	2000
+/* With FAST_READ the samples carry no temperature, it is read this often */
+#define MAG_TEMP_PERIOD_MS	1000
+/* Longest time a stored record stays in RAM */
+#define MAG_FLUSH_PERIOD_MS	1000
 /* USER CODE END PD */
 
 /* Private macro -------------------------------------------------------------*/
@@ -79,6 +97,20 @@ void MX_FREERTOS_Init(void); /* (MISRA C 2004 rule 8.1) */
 /* GetIdleTaskMemory prototype (linked to static allocation support) */
 void vApplicationGetIdleTaskMemory( StaticTask_t **ppxIdleTaskTCBBuffer, StackType_t **ppxIdleTaskStackBuffer, uint32_t *pulIdleTaskStackSize );
 
+/* Hook prototypes */
+void vApplicationStackOverflowHook(xTaskHandle xTask, signed char *pcTaskName);
+
+/* USER CODE BEGIN 4 */
+void vApplicationStackOverflowHook(xTaskHandle xTask, signed char *pcTaskName)
+{
+  /* Run time stack overflow checking is performed if
+  configCHECK_FOR_STACK_OVERFLOW is defined to 1 or 2. This hook function is
+  called if a stack overflow is detected: the task state can no longer be
+  trusted, so stop here instead of running on corrupted memory. */
+  Error_Handler();
+}
+/* USER CODE END 4 */
+
 /* USER CODE BEGIN GET_IDLE_TASK_MEMORY */
 static StaticTask_t xIdleTaskTCBBuffer;
 static StackType_t xIdleStack[configMINIMAL_STACK_SIZE];
@@ -134,11 +166,15 @@ void MX_FREERTOS_Init(void) {
 
   /* USER CODE BEGIN RTOS_QUEUES */
   /* add queues, ... */
+  MAGACQ_Init();
+  MAGEVT_Init();
+  UARTTX_Init();
+  PROTO_Init();
   /* USER CODE END RTOS_QUEUES */
 
   /* Create the thread(s) */
   /* definition and creation of UARTTask */
-  osThreadDef(UARTTask, StartUARTTask, osPriorityAboveNormal, 0, 128);
+  osThreadDef(UARTTask, StartUARTTask, osPriorityAboveNormal, 0, 256);
   UARTTaskHandle = osThreadCreate(osThread(UARTTask), NULL);
 
   /* USER CODE BEGIN RTOS_THREADS */
@@ -157,17 +193,20 @@ void MX_FREERTOS_Init(void) {
 void StartUARTTask(void const * argument)
 {
   /* USER CODE BEGIN StartUARTTask */
-  char rx_buffer[UART_DATA_SIZE];
-  char dt_buff[30];
-  osEvent event;
-  int16_t x_mag, y_mag, z_mag, temp_mag;
+  const char *frame;
+  uint32_t timeout, waited;
+  EXTFLASH_RecordTypeDef record;
+  EXTFLASH_StatusTypeDef read_status = EXTFLASH_ERROR;
   uint32_t received_id_value;
 
-  /* Start DMA RX interrupt (circular mode) */
-  HAL_UART_Receive_DMA(&huart1,(uint8_t*)&rx_buffer[0],UART_DATA_SIZE);
+  /* Start DMA RX (circular mode), frames end at CR/LF or a line pause */
+  UARTRX_Start();
+
+  /* The host may open at another rate, the first byte tells */
+  UARTBAUD_AutoArm();
 
   /* Try to initialize both memory and magnetometer, if error reset program */
-  if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) > 0)
+  if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
   {
 	  /* If memory init could not be done,
 	   * inform via UART and do something (reset maybe).
@@ -179,10 +218,22 @@ void StartUARTTask(void const * argument)
 		osThreadTerminate(UARTTaskHandle);
 	  }
 
+	  /* Find where the stored records end. A log that can not be scanned
+	   * is not written over: let the message out and start again */
+	  if(EXTFLASH_Init() != EXTFLASH_OK)
+	  {
+		SERIAL_SEND("FLASH log error. Resetting MCU\r\n");
+		osSemaphoreRelease(SPISemaphoreHandle);
+		for(waited = 0; UARTTX_Pending() > 0 && waited < UARTTX_TIMEOUT_MS; waited++)
+		  osDelay(1);
+		NVIC_SystemReset();
+	  }
+
 	  /* If magnetometer init could not be done,
 	   * inform via UART and do something (reset maybe).
+	   * The other sensors of the array are optional
 	   */
-	  if(LIS3MDL_Init() != LIS3MDL_OK)
+	  if(MAGARRAY_Init() != MAGARRAY_OK)
 	  {
 		SERIAL_SEND("FLASH init error. Resetting MCU\r\n");
 		/* TODO: Reset MCU or something... */
@@ -197,48 +248,57 @@ void StartUARTTask(void const * argument)
   /* Infinite loop */
   for(;;)
   {
-	/* Wait until UART data received */
-	event = osMessageGet(UARTQueueHandle, osWaitForever);
-	if(event.status == osEventMessage)
+	/* Wait until a complete frame is received. A subscriber is served in
+	 * between, partial batches after MAGSTREAM_FLUSH_MS at most, and the
+	 * auto-baud detection is polled while armed. Interrupts cannot wake
+	 * the task for log entries, so binary mode drains them every
+	 * DLOG_DRAIN_MS at most */
+	timeout = MAGSTREAM_IsSubscribed() ? MAGSTREAM_FLUSH_MS : osWaitForever;
+	if(UARTBAUD_IsAutoArmed())
+	  timeout = UARTBAUD_AUTO_POLL_MS;
+	if(PROTO_GetMode() == PROTO_MODE_BINARY && timeout > DLOG_DRAIN_MS)
+	  timeout = DLOG_DRAIN_MS;
+	frame = UARTRX_GetFrame(timeout);
+
+	/* A frame received at the old rate is garbage */
+	if(UARTBAUD_Poll())
+	  continue;
+
+	MAGSTREAM_Drain();
+	DLOG_Drain();
+	/* Tagged lookups are queued with the ones already received and
+	 * answered in flash order. What stopped the queue is handled below */
+	if(frame != NULL && LOGLOOKUP_IsTagged(frame))
+	  frame = LOGLOOKUP_Pipeline(frame);
+	if(frame != NULL)
 	{
+	  /* Commands do not need the SPI bus unless they take it themselves */
+	  if(CMD_IS_COMMAND(frame))
+	  {
+		if(CMD_Execute(frame) != CMD_OK)
+		  PROTO_SendError(PROTO_ERR_COMMAND, 0);
+		continue;
+	  }
+
+	  /* Get ID value */
+	  received_id_value = strtoul(frame, NULL, 10);
+
  	  /* Take SPI semaphore when available, so that we receive the data as fast as possible */
-	  if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) > 0)
+	  read_status = EXTFLASH_ERROR;
+	  if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
 	  {
-		/* Get ID value */
-		received_id_value = atoi(rx_buffer);
-
-		/* Check if data present on memory, otherwise send error. */
-		if(EXTFLASH_CheckID(received_id_value) != EXTFLASH_OK)
-		{
-		  SERIAL_SEND("Error. Data not found.\r\n");
-		}
-		else
-		{
-		  /* Get data from FLASH memory and send it via UART if OK */
-		  if(EXTFLASH_ReadData(received_id_value, &x_mag, &y_mag, &z_mag, &temp_mag) == EXTFLASH_OK)
-		  {
-			  /* Send data via UART */
-			  sprintf(dt_buff,"Magnetometer x value = %d\r\n", x_mag);
-			  SERIAL_SEND(dt_buff);
-
-			  sprintf(dt_buff,"Magnetometer y value = %d\r\n", y_mag);
-			  SERIAL_SEND(dt_buff);
-
-			  sprintf(dt_buff,"Magnetometer z value = %d\r\n", z_mag);
-			  SERIAL_SEND(dt_buff);
-
-			  sprintf(dt_buff,"Temperature value = %d\r\n", temp_mag);
-			  SERIAL_SEND(dt_buff);
-		  }
-		  else
-		  {
-		    SERIAL_SEND("Error reading external flash data\r\n");
-		  }
-		}
-
-		/* Release SPI semaphore */
+		/* Get data from FLASH memory */
+		read_status = EXTFLASH_Read(received_id_value, &record);
+
+		/* Release SPI semaphore, it is never held across UART output */
 		osSemaphoreRelease(SPISemaphoreHandle);
 	  }
+
+	  /* Send it via UART if present, otherwise send error */
+	  if(read_status != EXTFLASH_OK)
+		PROTO_SendError(PROTO_ERR_NOT_FOUND, received_id_value);
+	  else
+		PROTO_SendRecord(received_id_value, &record);
     }
   }
   /* USER CODE END StartUARTTask */
@@ -255,45 +315,292 @@ void StartUARTTask(void const * argument)
 void StartMagTask(void const * argument)
 {
   LIS3MDL_DataTypeDef read_data;
+  LIS3MDL_ConfigTypeDef config;
   LIS3MDL_StatusTypeDef magnetometer_retval = LIS3MDL_ERROR;
-  uint32_t memory_id = 0;
+  EXTFLASH_RecordTypeDef record;
+  const MAGACQ_SampleTypeDef *half;
+  /* Kept off the task stack */
+  static EXTFLASH_MultiRecordTypeDef array_record;
+  uint32_t index, store;
+  uint32_t last_temp = 0, last_flush = osKernelSysTick();
 
   /* Infinite loop */
   for(;;)
   {
-    /* Take SPI semaphore when available */
-    if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) > 0)
-    {
-        /* Read magnetometer values */
-    	magnetometer_retval = LIS3MDL_ReadValues(&read_data);
+    /* The configuration does not change while the paced acquisition runs */
+    LIS3MDL_GetConfig(MAGARRAY_PRIMARY, &config);
 
-    	/* Release SPI semaphore */
-    	osSemaphoreRelease(SPISemaphoreHandle);
+    /* Paced acquisition: the ring is filled by interrupts. Every fresh
+     * sample is stored, with FAST_READ in the compact (8 bits per axis)
+     * format, or goes to the pre-trigger capture when it is enabled */
+    if(MAGACQ_IsRunning())
+    {
+      half = MAGACQ_WaitHalf(1000);
+      if(half != NULL && osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+      {
+        if(config.fast_read && (osKernelSysTick() - last_temp) >= MAG_TEMP_PERIOD_MS)
+        {
+          LIS3MDL_ReadTemperature(MAGARRAY_PRIMARY, NULL);
+          last_temp = osKernelSysTick();
+        }
+
+        EXTFLASH_SetFormat(config.fast_read ? EXTFLASH_FORMAT_COMPACT : EXTFLASH_FORMAT_FULL);
+
+        /* The timer is not aligned to conversions, only fresh samples count */
+        for(index = 0; index < MAGACQ_SAMPLES_PER_HALF; index++)
+        {
+          LIS3MDL_DecodeBurst(MAGARRAY_PRIMARY, half[index].burst, &read_data);
+          LIS3MDL_AccountSample(MAGARRAY_PRIMARY, read_data.status);
+          if(!LIS3MDL_IS_FRESH(read_data.status))
+            continue;
+
+          MAGCAL_Process(&read_data);
+          record.mag_x = read_data.mag_x;
+          record.mag_y = read_data.mag_y;
+          record.mag_z = read_data.mag_z;
+          record.temp = read_data.temp;
+          record.status = read_data.status;
+          MAGSTREAM_Push(&record);
+
+          /* A complete capture is stored as one event right away */
+          if(MAGSCOPE_IsEnabled())
+          {
+            if(MAGSCOPE_Process(&record))
+              MAGSCOPE_Commit();
+            continue;
+          }
+
+          EXTFLASH_Append(&record, NULL);
+        }
+
+        /* Release SPI semaphore */
+        osSemaphoreRelease(SPISemaphoreHandle);
+      }
+    }
+    else if(MAGEVT_IsEnabled())
+    {
+      /* Change triggered: nothing is read while the field is quiet, the
+       * task sleeps until the threshold interrupt or the heartbeat. A
+       * capture reads every conversion on DRDY until the field settles */
+      if(MAGEVT_IsActive())
+        MAGACQ_WaitDataReady(MAG_DRDY_TIMEOUT_MS);
+      else
+        MAGEVT_WaitTrigger();
+
+      store = 0;
+
+      /* Take SPI semaphore when available */
+      if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+      {
+        if(config.fast_read && (osKernelSysTick() - last_temp) >= MAG_TEMP_PERIOD_MS)
+        {
+          LIS3MDL_ReadTemperature(MAGARRAY_PRIMARY, NULL);
+          last_temp = osKernelSysTick();
+        }
+
+        /* The thresholds are armed around raw samples */
+        if(LIS3MDL_ReadValues(MAGARRAY_PRIMARY, &read_data) == LIS3MDL_OK)
+          store = MAGEVT_Update(&read_data);
+
+        /* Release SPI semaphore */
+        osSemaphoreRelease(SPISemaphoreHandle);
+      }
+
+      /* Events are stored at the full rate, not decimated */
+      if(store)
+      {
+        MAGCAL_Process(&read_data);
+
+        record.mag_x = read_data.mag_x;
+        record.mag_y = read_data.mag_y;
+        record.mag_z = read_data.mag_z;
+        record.temp = read_data.temp;
+        record.status = read_data.status;
+        MAGSTREAM_Push(&record);
+
+        /* Take SPI semaphore when available */
+        if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+        {
+          EXTFLASH_SetFormat(config.fast_read ? EXTFLASH_FORMAT_COMPACT : EXTFLASH_FORMAT_FULL);
+          EXTFLASH_Append(&record, NULL);
+
+          /* Release SPI semaphore */
+          osSemaphoreRelease(SPISemaphoreHandle);
+        }
+      }
+    }
+    else if(MAGARRAY_IsEnabled())
+    {
+      /* Array: a conversion is started on every sensor at once at every
+       * slot, all of them are read when the primary one is done */
+      MAGARRAY_WaitSlot();
+
+      magnetometer_retval = LIS3MDL_ERROR;
+
+      /* Take SPI semaphore when available */
+      if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+      {
+        if(MAGARRAY_StartConversions() == MAGARRAY_OK)
+          magnetometer_retval = LIS3MDL_OK;
+
+        /* Release SPI semaphore */
+        osSemaphoreRelease(SPISemaphoreHandle);
+      }
+
+      if(magnetometer_retval == LIS3MDL_OK)
+      {
+        /* Only the primary sensor has DRDY wired. On timeout the read
+         * still picks whatever sensors are done */
+        MAGACQ_WaitDataReady(MAGPWR_CONVERSION_TIMEOUT_MS);
+
+        /* Take SPI semaphore when available */
+        if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+        {
+          if(MAGARRAY_ReadSamples(&array_record) == MAGARRAY_OK)
+          {
+            /* Only the primary sensor is streamed */
+            if(array_record.channels & 0x01)
+            {
+              record.mag_x = array_record.mag[0][0];
+              record.mag_y = array_record.mag[0][1];
+              record.mag_z = array_record.mag[0][2];
+              record.temp = array_record.temp;
+              record.status = 0;
+              MAGSTREAM_Push(&record);
+            }
+
+            EXTFLASH_SetFormat(EXTFLASH_FORMAT_MULTI);
+            EXTFLASH_AppendMulti(&array_record, NULL);
+          }
+
+          /* Release SPI semaphore */
+          osSemaphoreRelease(SPISemaphoreHandle);
+        }
+      }
     }
+    else if(MAGPWR_IsEnabled())
+    {
+      /* Single conversions: the sensor is powered down between samples,
+       * one conversion is started at every slot and stored once done */
+      MAGPWR_WaitSlot();
+
+      magnetometer_retval = LIS3MDL_ERROR;
+
+      /* Take SPI semaphore when available */
+      if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+      {
+        if(MAGPWR_StartConversion() == MAGPWR_OK)
+          magnetometer_retval = LIS3MDL_OK;
+
+        /* Release SPI semaphore */
+        osSemaphoreRelease(SPISemaphoreHandle);
+      }
+
+      if(magnetometer_retval == LIS3MDL_OK)
+      {
+        MAGPWR_ConversionDone(MAGACQ_WaitDataReady(MAGPWR_CONVERSION_TIMEOUT_MS) == MAGACQ_OK);
+
+        /* Take SPI semaphore when available */
+        if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+        {
+          if(config.fast_read && (osKernelSysTick() - last_temp) >= MAG_TEMP_PERIOD_MS)
+          {
+            LIS3MDL_ReadTemperature(MAGARRAY_PRIMARY, NULL);
+            last_temp = osKernelSysTick();
+          }
+
+          /* Read magnetometer values */
+          magnetometer_retval = LIS3MDL_ReadValues(MAGARRAY_PRIMARY, &read_data);
+
+          /* Release SPI semaphore */
+          osSemaphoreRelease(SPISemaphoreHandle);
+        }
+      }
+
+      /* Every sample is stored, the period is the logging cadence */
+      if(magnetometer_retval == LIS3MDL_OK && LIS3MDL_IS_FRESH(read_data.status))
+      {
+        MAGCAL_Process(&read_data);
+
+        record.mag_x = read_data.mag_x;
+        record.mag_y = read_data.mag_y;
+        record.mag_z = read_data.mag_z;
+        record.temp = read_data.temp;
+        record.status = read_data.status;
+        MAGSTREAM_Push(&record);
+
+        /* Take SPI semaphore when available */
+        if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+        {
+          EXTFLASH_SetFormat(config.fast_read ? EXTFLASH_FORMAT_COMPACT : EXTFLASH_FORMAT_FULL);
+          EXTFLASH_Append(&record, NULL);
+
+          /* Release SPI semaphore */
+          osSemaphoreRelease(SPISemaphoreHandle);
+        }
+      }
+    }
+    else
+    {
+      /* Conversion driven: wake up on DRDY and read every conversion once.
+       * The read after a timeout clears a DRDY left high by a missed edge */
+      MAGACQ_WaitDataReady(MAG_DRDY_TIMEOUT_MS);
+
+      /* Take SPI semaphore when available */
+      if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+      {
+        if(config.fast_read && (osKernelSysTick() - last_temp) >= MAG_TEMP_PERIOD_MS)
+        {
+          LIS3MDL_ReadTemperature(MAGARRAY_PRIMARY, NULL);
+          last_temp = osKernelSysTick();
+        }
 
-    /* In case a UART receive interrupt occured during the LIS3MDL read, release the SPI
-     * semaphore to unlock the serial thread. An osDelay is added to call the scheduler */
-    osDelay(1);
+        /* Read magnetometer values */
+        magnetometer_retval = LIS3MDL_ReadValues(MAGARRAY_PRIMARY, &read_data);
+
+        /* Release SPI semaphore */
+        osSemaphoreRelease(SPISemaphoreHandle);
+      }
+
+      /* A duplicate (read after a timeout) is not stored again */
+      /* Logging: fresh samples are low-pass filtered and decimated, the
+       * stored rate is the data rate over the decimation ratio */
+      if(magnetometer_retval == LIS3MDL_OK && LIS3MDL_IS_FRESH(read_data.status))
+      {
+        MAGCAL_Process(&read_data);
+
+        if(MAGFILT_Process(&read_data, &read_data))
+        {
+          record.mag_x = read_data.mag_x;
+          record.mag_y = read_data.mag_y;
+          record.mag_z = read_data.mag_z;
+          record.temp = read_data.temp;
+          record.status = read_data.status;
+          MAGSTREAM_Push(&record);
+
+          /* Take SPI semaphore when available */
+          if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+          {
+            EXTFLASH_SetFormat(config.fast_read ? EXTFLASH_FORMAT_COMPACT : EXTFLASH_FORMAT_FULL);
+            EXTFLASH_Append(&record, NULL);
+
+            /* Release SPI semaphore */
+            osSemaphoreRelease(SPISemaphoreHandle);
+          }
+        }
+      }
+    }
 
-    /* Try to write only if magnetometer data read OK */
-    if(magnetometer_retval == LIS3MDL_OK)
+    /* Captured records do not wait in RAM for long */
+    if((osKernelSysTick() - last_flush) >= MAG_FLUSH_PERIOD_MS)
     {
-	  /* Take SPI semaphore when available */
-	  if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) > 0)
-	  {
-		/* Write to FLASH memory and if OK increment offset */
-		if(EXTFLASH_WriteData(memory_id, read_data.mag_x, read_data.mag_y, read_data.mag_z, read_data.temp) == EXTFLASH_OK)
-		{
-		  /* Increment memory offset */
-		  memory_id++;
-		}
-
-		/* Release SPI semaphore */
-		osSemaphoreRelease(SPISemaphoreHandle);
-	  }
+      if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+      {
+        EXTFLASH_Flush();
+        osSemaphoreRelease(SPISemaphoreHandle);
+      }
+      last_flush = osKernelSysTick();
     }
-	/* Send data every second (if possible) */
-	osDelay(1000);
   }
 }
 /* USER CODE END Application */
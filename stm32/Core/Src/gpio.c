@@ -66,6 +66,73 @@ void MX_GPIO_Init(void)
 
 /* USER CODE BEGIN 2 */
 
+/**
+  * @brief Configures the magnetometer interrupt lines (EXTI)
+  */
+void GPIO_MagInterrupts_Init(void)
+{
+  GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+  __HAL_RCC_AFIO_CLK_ENABLE();
+
+  /* DRDY rises at every new conversion */
+  GPIO_InitStruct.Pin = DRDY_MAG_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING;
+  GPIO_InitStruct.Pull = GPIO_PULLDOWN;
+  HAL_GPIO_Init(DRDY_MAG_GPIO_Port, &GPIO_InitStruct);
+
+  /* The handler uses the RTOS API */
+  HAL_NVIC_SetPriority(DRDY_MAG_EXTI_IRQn, 5, 0);
+  HAL_NVIC_EnableIRQ(DRDY_MAG_EXTI_IRQn);
+
+  /* INT rises when a field threshold is crossed */
+  GPIO_InitStruct.Pin = INT_MAG_Pin;
+  HAL_GPIO_Init(INT_MAG_GPIO_Port, &GPIO_InitStruct);
+
+  HAL_NVIC_SetPriority(INT_MAG_EXTI_IRQn, 5, 0);
+  HAL_NVIC_EnableIRQ(INT_MAG_EXTI_IRQn);
+}
+
+/**
+  * @brief Configures the chip selects of the additional magnetometers,
+  * deselected. Unpopulated positions just read no WHO_AM_I
+  */
+void GPIO_MagArray_Init(void)
+{
+  GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+  HAL_GPIO_WritePin(GPIOB, CS_MAG2_Pin|CS_MAG3_Pin|CS_MAG4_Pin, GPIO_PIN_SET);
+
+  /* Same as CS_MAG */
+  GPIO_InitStruct.Pin = CS_MAG2_Pin|CS_MAG3_Pin|CS_MAG4_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_OUTPUT_OD;
+  GPIO_InitStruct.Pull = GPIO_NOPULL;
+  GPIO_InitStruct.Speed = GPIO_SPEED_FREQ_LOW;
+  HAL_GPIO_Init(GPIOB, &GPIO_InitStruct);
+}
+
+/**
+  * @brief Puts the USART1 RX pin on EXTI as well, masked until the
+  * auto-baud detection is armed. The USART still receives from it
+  */
+void GPIO_UartAutoBaud_Init(void)
+{
+  GPIO_InitTypeDef GPIO_InitStruct = {0};
+
+  __HAL_RCC_AFIO_CLK_ENABLE();
+
+  /* Same input as the USART1 MSP init, plus both edges */
+  GPIO_InitStruct.Pin = RX_UART_Pin;
+  GPIO_InitStruct.Mode = GPIO_MODE_IT_RISING_FALLING;
+  GPIO_InitStruct.Pull = GPIO_NOPULL;
+  HAL_GPIO_Init(RX_UART_GPIO_Port, &GPIO_InitStruct);
+  EXTI->IMR &= ~RX_UART_Pin;
+
+  /* Time stamps only, no RTOS calls: above the RTOS priorities */
+  HAL_NVIC_SetPriority(RX_UART_EXTI_IRQn, 2, 0);
+  HAL_NVIC_EnableIRQ(RX_UART_EXTI_IRQn);
+}
+
 /* USER CODE END 2 */
 
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -0,0 +1,377 @@
+/**
+  ******************************************************************************
+  * @file log_export.c
+  * @author fdominguez
+  * @brief This file provides the bulk export of a range of logged records.
+  * A chunk is read from the flash into the sector block by SPI DMA and
+  * decoded, the block is given back and the records are queued for USART1
+  * TX DMA, which drains them while the next chunk is read.
+  * Binary mode packs the records into PROTO_MSG_RECORDS messages, text
+  * mode prints a line per record. A checkpoint follows every
+  * LOGEXPORT_CHECKPOINT_RECORDS records and an end message closes the
+  * export; both carry the resume ID and a CRC-16 of the packed records
+  * sent, the same in both modes.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "log_export.h"
+#include "proto.h"
+#include "uart_rx.h"
+#include "usart.h"
+#include "cmsis_os.h"
+#include "fmt.h"
+#include <string.h>
+
+extern osSemaphoreId SPISemaphoreHandle;
+
+static LOGEXPORT_ResultTypeDef result = { .end = LOGEXPORT_END_COMPLETE };
+
+/* PROTO_MSG_RECORDS being filled. Its records are counted in the result
+ * once the message is sent, the first one is result.next_id */
+static uint8_t payload[PROTO_MAX_PAYLOAD];
+static uint32_t payload_count;
+static uint16_t payload_checksum;
+static uint32_t since_checkpoint;
+
+/* Text record or mark, off the UART task stack */
+static char line[96];
+
+/* Chunk decoded out of the sector block, bit n of lost set if record n
+ * was lost (erased slot) */
+static EXTFLASH_RecordTypeDef chunk[LOGEXPORT_CHUNK_RECORDS];
+static uint32_t chunk_lost;
+
+/**
+  * @brief Sends the records gathered in the payload, if any, and counts
+  * them as sent
+  * @retval LOGEXPORT Status, error if the message could not be queued. The
+  * records are dropped and the resume point stays at the first of them
+  */
+static LOGEXPORT_StatusTypeDef LOGEXPORT_Flush(void)
+{
+  uint32_t count = payload_count;
+
+  if(count == 0)
+    return LOGEXPORT_OK;
+
+  payload_count = 0;
+  payload[4] = count;
+  if(PROTO_Send(PROTO_MSG_RECORDS, payload, 5 + count * PROTO_PACKED_RECORD_SIZE) != PROTO_OK)
+    return LOGEXPORT_ERROR;
+
+  result.next_id += count;
+  result.records += count;
+  result.checksum = payload_checksum;
+  return LOGEXPORT_OK;
+}
+
+/**
+  * @brief Sends a record, it is added to the checksum once sent
+  * @param id: Record ID, result.next_id in text mode
+  * @param record: Record
+  * @retval LOGEXPORT Status, error if the record or the records gathered
+  * before it could not be sent
+  */
+static LOGEXPORT_StatusTypeDef LOGEXPORT_Record(uint32_t id, const EXTFLASH_RecordTypeDef *record)
+{
+  uint8_t packed[PROTO_PACKED_RECORD_SIZE];
+  char *field;
+
+  PROTO_PackRecord(packed, record);
+  since_checkpoint++;
+
+  if(PROTO_GetMode() == PROTO_MODE_TEXT)
+  {
+    /* Field by field, no template to parse on the bulk path */
+    field = FMT_UDec(line, id, 0);
+    *field++ = ' ';
+    field = FMT_Dec(field, record->mag_x);
+    *field++ = ' ';
+    field = FMT_Dec(field, record->mag_y);
+    *field++ = ' ';
+    field = FMT_Dec(field, record->mag_z);
+    *field++ = ' ';
+    field = FMT_Dec(field, record->temp);
+    *field++ = '\r';
+    *field++ = '\n';
+    if(UARTTX_Write((const uint8_t*)line, field - line) != UARTTX_OK)
+      return LOGEXPORT_ERROR;
+
+    result.checksum = PROTO_Crc16(packed, sizeof(packed), result.checksum);
+    result.records++;
+    result.next_id = id + 1;
+    return LOGEXPORT_OK;
+  }
+
+  if(payload_count == 0)
+  {
+    PROTO_Put32(payload, id);
+    payload_checksum = result.checksum;
+  }
+  payload_checksum = PROTO_Crc16(packed, sizeof(packed), payload_checksum);
+  memcpy(&payload[5 + payload_count * PROTO_PACKED_RECORD_SIZE], packed, sizeof(packed));
+  if(++payload_count == PROTO_RECORDS_MAX)
+    return LOGEXPORT_Flush();
+
+  return LOGEXPORT_OK;
+}
+
+/**
+  * @brief Sends a checkpoint, or the end message. A failure to send the
+  * gathered records turns the end into LOGEXPORT_END_ERROR
+  * @param end: 1 for the end message
+  * @retval LOGEXPORT Status, error if something could not be sent
+  */
+static LOGEXPORT_StatusTypeDef LOGEXPORT_Mark(uint32_t end)
+{
+  static const char * const end_names[] = { "COMPLETE", "ABORTED", "ERROR", "RUNNING" };
+  uint8_t mark[11], *data;
+  PROTO_StatusTypeDef status;
+
+  if(LOGEXPORT_Flush() != LOGEXPORT_OK)
+  {
+    if(!end)
+      return LOGEXPORT_ERROR;
+    result.end = LOGEXPORT_END_ERROR;
+  }
+  since_checkpoint = 0;
+
+  if(PROTO_GetMode() == PROTO_MODE_BINARY)
+  {
+    data = PROTO_Put32(mark, result.next_id);
+    data = PROTO_Put32(data, result.records);
+    data = PROTO_Put16(data, result.checksum);
+    if(!end)
+      status = PROTO_Send(PROTO_MSG_CHECKPOINT, mark, 10);
+    else
+    {
+      *data = result.end;
+      status = PROTO_Send(PROTO_MSG_END, mark, 11);
+    }
+  }
+  else
+  {
+    if(!end)
+      FMT_Format(line, "CHECKPOINT next=%lu n=%lu crc=%04X\r\n", result.next_id, result.records, result.checksum);
+    else
+      FMT_Format(line, "END %s next=%lu n=%lu skipped=%lu crc=%04X\r\n", end_names[result.end],
+          result.next_id, result.records, result.skipped, result.checksum);
+    status = SERIAL_SEND(line);
+  }
+
+  return (status == PROTO_OK) ? LOGEXPORT_OK : LOGEXPORT_ERROR;
+}
+
+/**
+  * @brief Decodes the records of a chunk, so that the sector block can be
+  * given back before they are sent
+  * @param range: Chunk read by EXTFLASH_ReadRange
+  */
+static void LOGEXPORT_Decode(const EXTFLASH_RangeTypeDef *range)
+{
+  uint32_t index;
+
+  chunk_lost = 0;
+  for(index = 0; index < range->count; index++)
+    if(EXTFLASH_RangeRecord(range, index, &chunk[index]) != EXTFLASH_OK)
+      chunk_lost |= 1UL << index;
+}
+
+/**
+  * @brief Sends the records of a decoded chunk
+  * @param first_id: ID of the first record
+  * @param count: Records in the chunk
+  * @retval LOGEXPORT Status, error if a send failed
+  */
+static LOGEXPORT_StatusTypeDef LOGEXPORT_Chunk(uint32_t first_id, uint32_t count)
+{
+  uint32_t index;
+
+  for(index = 0; index < count; index++)
+  {
+    if(chunk_lost & (1UL << index))
+    {
+      /* A message holds consecutive IDs only */
+      if(LOGEXPORT_Flush() != LOGEXPORT_OK)
+        return LOGEXPORT_ERROR;
+      result.skipped++;
+      result.next_id = first_id + index + 1;
+      continue;
+    }
+    if(LOGEXPORT_Record(first_id + index, &chunk[index]) != LOGEXPORT_OK)
+      return LOGEXPORT_ERROR;
+  }
+
+  return LOGEXPORT_OK;
+}
+
+/**
+  * @brief Exports from the resume point on until the last ID, input from
+  * the host or a failure, then sends the end message
+  */
+static void LOGEXPORT_Loop(void)
+{
+  EXTFLASH_RangeTypeDef range;
+  EXTFLASH_InfoTypeDef info;
+  EXTFLASH_StatusTypeDef status;
+  LOGEXPORT_StatusTypeDef sent;
+  uint32_t start = osKernelSysTick(), retries = 0;
+  /* Next ID to read, ahead of result.next_id by the gathered records */
+  uint32_t read_id = result.next_id;
+
+  result.end = LOGEXPORT_END_RUNNING;
+  payload_count = 0;
+  since_checkpoint = 0;
+
+  while(read_id <= result.last_id)
+  {
+    /* Any command stops the export */
+    if(UARTRX_GetFrame(0) != NULL)
+    {
+      result.end = LOGEXPORT_END_ABORTED;
+      break;
+    }
+
+    /* Taken again for every chunk and held for the read only, a capture
+     * commit may be waiting */
+    range.data = DMAPOOL_Acquire(DMAPOOL_SECTOR);
+    if(range.data == NULL)
+    {
+      if(++retries > LOGEXPORT_BLOCK_RETRIES)
+      {
+        result.end = LOGEXPORT_END_ERROR;
+        break;
+      }
+      osDelay(10);
+      continue;
+    }
+    retries = 0;
+
+    range.first_id = read_id;
+    range.count = result.last_id - read_id + 1;
+    if(range.count > LOGEXPORT_CHUNK_RECORDS)
+      range.count = LOGEXPORT_CHUNK_RECORDS;
+
+    status = EXTFLASH_ERROR;
+    info.oldest_id = 0;
+    if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+    {
+      status = EXTFLASH_ReadRange(&range);
+      if(status != EXTFLASH_OK)
+        EXTFLASH_GetInfo(&info);
+      osSemaphoreRelease(SPISemaphoreHandle);
+    }
+
+    if(status == EXTFLASH_OK)
+      LOGEXPORT_Decode(&range);
+    DMAPOOL_Release(range.data);
+
+    sent = LOGEXPORT_OK;
+    if(status == EXTFLASH_OK)
+    {
+      sent = LOGEXPORT_Chunk(read_id, range.count);
+      read_id += range.count;
+    }
+
+    if(sent != LOGEXPORT_OK)
+    {
+      result.end = LOGEXPORT_END_ERROR;
+      break;
+    }
+
+    if(status != EXTFLASH_OK)
+    {
+      /* Overwritten by the log before it was sent */
+      if(read_id < info.oldest_id && info.oldest_id <= result.last_id)
+      {
+        /* A message holds consecutive IDs only */
+        if(LOGEXPORT_Flush() != LOGEXPORT_OK)
+        {
+          result.end = LOGEXPORT_END_ERROR;
+          break;
+        }
+        result.skipped += info.oldest_id - read_id;
+        read_id = info.oldest_id;
+        result.next_id = read_id;
+        continue;
+      }
+      result.end = LOGEXPORT_END_ERROR;
+      break;
+    }
+
+    if(since_checkpoint >= LOGEXPORT_CHECKPOINT_RECORDS && LOGEXPORT_Mark(0) != LOGEXPORT_OK)
+    {
+      result.end = LOGEXPORT_END_ERROR;
+      break;
+    }
+  }
+
+  if(result.end == LOGEXPORT_END_RUNNING)
+    result.end = LOGEXPORT_END_COMPLETE;
+  result.elapsed_ms = osKernelSysTick() - start;
+
+  /* Nothing left to tell the host if the end message fails too */
+  LOGEXPORT_Mark(1);
+}
+
+/**
+  * @brief Exports a range of records. Runs in the calling task until done
+  * or until a command arrives, which is discarded
+  * @param first_id: First ID, raised to the oldest stored one
+  * @param last_id: Last ID, lowered to the newest stored one
+  * @retval LOGEXPORT Status, error if nothing is stored in the range. Else
+  * the end message tells how the export ended
+  */
+LOGEXPORT_StatusTypeDef LOGEXPORT_Run(uint32_t first_id, uint32_t last_id)
+{
+  EXTFLASH_InfoTypeDef info;
+
+  if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) != osOK)
+    return LOGEXPORT_ERROR;
+  EXTFLASH_GetInfo(&info);
+  osSemaphoreRelease(SPISemaphoreHandle);
+
+  if(info.next_id == info.oldest_id)
+    return LOGEXPORT_ERROR;
+  if(first_id < info.oldest_id)
+    first_id = info.oldest_id;
+  if(last_id >= info.next_id)
+    last_id = info.next_id - 1;
+  if(first_id > last_id)
+    return LOGEXPORT_ERROR;
+
+  result.first_id = first_id;
+  result.last_id = last_id;
+  result.next_id = first_id;
+  result.records = 0;
+  result.skipped = 0;
+  result.checksum = 0xFFFF;
+
+  LOGEXPORT_Loop();
+  return LOGEXPORT_OK;
+}
+
+/**
+  * @brief Continues an aborted or failed export from its resume point. The
+  * record count and the checksum carry on from it
+  * @retval LOGEXPORT Status, error if there is nothing to resume
+  */
+LOGEXPORT_StatusTypeDef LOGEXPORT_Resume(void)
+{
+  if(result.end != LOGEXPORT_END_ABORTED && result.end != LOGEXPORT_END_ERROR)
+    return LOGEXPORT_ERROR;
+
+  LOGEXPORT_Loop();
+  return LOGEXPORT_OK;
+}
+
+/**
+  * @brief Gets the state of the last export
+  * @param copy: Where it is copied
+  */
+void LOGEXPORT_GetResult(LOGEXPORT_ResultTypeDef *copy)
+{
+  *copy = result;
+}
@@ -0,0 +1,214 @@
+/**
+  ******************************************************************************
+  * @file log_lookup.c
+  * @author fdominguez
+  * @brief This file provides the pipelined record lookups. A lookup frame
+  * "<tag>:<id>" is queued with the tagged frames already received, up to
+  * LOGLOOKUP_QUEUE_SIZE, so the host can send many without waiting. The
+  * queue is sorted by position in the log ring, from the oldest record,
+  * which is the flash address order: the sector found by a lookup stays
+  * cached for the next requests, and requests a few IDs apart share one
+  * range read. Each response carries its tag, in service order.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "log_lookup.h"
+#include "proto.h"
+#include "uart_rx.h"
+#include "dma_pool.h"
+#include "cmsis_os.h"
+#include <stdlib.h>
+
+extern osSemaphoreId SPISemaphoreHandle;
+
+typedef struct
+{
+  uint32_t id;
+  uint16_t tag;
+  uint8_t found;
+  EXTFLASH_RecordTypeDef record;
+} LOGLOOKUP_RequestTypeDef;
+
+/* UART task only */
+static LOGLOOKUP_RequestTypeDef queue[LOGLOOKUP_QUEUE_SIZE];
+static uint32_t queue_count;
+
+static LOGLOOKUP_StatsTypeDef stats;
+
+/**
+  * @brief Queues a tagged lookup
+  * @param frame: "<tag>:<id>"
+  * @retval 1 if queued, 0 if malformed
+  */
+static uint32_t LOGLOOKUP_Add(const char *frame)
+{
+  LOGLOOKUP_RequestTypeDef *request = &queue[queue_count];
+  uint32_t tag;
+  char *end;
+
+  tag = strtoul(frame, &end, 10);
+  if(end == frame || *end != ':' || tag > UINT16_MAX)
+    return 0;
+  frame = end + 1;
+  request->id = strtoul(frame, &end, 10);
+  if(end == frame || *end != '\0')
+    return 0;
+
+  request->tag = tag;
+  request->found = 0;
+  queue_count++;
+
+  return 1;
+}
+
+/**
+  * @brief Sorts the queue by position in the log ring. Insertion sort, the
+  * queue is short
+  * @param oldest_id: Oldest stored ID, first in the ring
+  */
+static void LOGLOOKUP_Sort(uint32_t oldest_id)
+{
+  LOGLOOKUP_RequestTypeDef request;
+  uint32_t index, position;
+
+  for(index = 1; index < queue_count; index++)
+  {
+    request = queue[index];
+    /* IDs already overwritten wrap to the end, they are not found anyway */
+    for(position = index; position > 0 && (queue[position - 1].id - oldest_id) > (request.id - oldest_id); position--)
+      queue[position] = queue[position - 1];
+    queue[position] = request;
+  }
+}
+
+/**
+  * @brief Reads the queued records, sorted. The caller holds the SPI
+  * semaphore
+  */
+static void LOGLOOKUP_Read(void)
+{
+  EXTFLASH_RangeTypeDef range;
+  uint32_t first, last, index;
+
+  /* Shared reads only when the block is free, else one read each */
+  range.data = DMAPOOL_Acquire(DMAPOOL_SECTOR);
+
+  for(first = 0; first < queue_count; first = last)
+  {
+    /* Requests close enough to the previous one go in the same read */
+    for(last = first + 1; last < queue_count; last++)
+      if(queue[last].id - queue[last - 1].id > LOGLOOKUP_MAX_GAP ||
+         queue[last].id - queue[first].id >= LOGLOOKUP_RUN_RECORDS)
+        break;
+
+    range.count = 0;
+    if(range.data != NULL && last - first > 1)
+    {
+      range.first_id = queue[first].id;
+      range.count = queue[last - 1].id - queue[first].id + 1;
+      if(EXTFLASH_ReadRange(&range) != EXTFLASH_OK)
+        range.count = 0;
+    }
+
+    for(index = first; index < last; index++)
+    {
+      /* The range stops at the sector end, the rest is read one by one */
+      if(range.count > 0 && queue[index].id - range.first_id < range.count)
+      {
+        queue[index].found = (EXTFLASH_RangeRecord(&range, queue[index].id - range.first_id,
+            &queue[index].record) == EXTFLASH_OK);
+        stats.shared++;
+      }
+      else
+        queue[index].found = (EXTFLASH_Read(queue[index].id, &queue[index].record) == EXTFLASH_OK);
+    }
+  }
+
+  if(range.data != NULL)
+    DMAPOOL_Release(range.data);
+}
+
+/**
+  * @brief Serves the queued requests and empties the queue
+  */
+static void LOGLOOKUP_Serve(void)
+{
+  EXTFLASH_InfoTypeDef info;
+  uint32_t index;
+
+  if(queue_count == 0)
+    return;
+
+  if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+  {
+    EXTFLASH_GetInfo(&info);
+    LOGLOOKUP_Sort(info.oldest_id);
+    LOGLOOKUP_Read();
+    /* Released before the responses, it is never held across UART output */
+    osSemaphoreRelease(SPISemaphoreHandle);
+  }
+
+  for(index = 0; index < queue_count; index++)
+    PROTO_SendTagged(queue[index].tag, queue[index].id, queue[index].found ? &queue[index].record : NULL);
+
+  stats.requests += queue_count;
+  stats.batches++;
+  if(queue_count > stats.peak)
+    stats.peak = queue_count;
+  queue_count = 0;
+}
+
+/**
+  * @brief Tells if a frame is a tagged lookup, "<tag>:<id>"
+  * @param frame: NUL terminated frame
+  */
+uint32_t LOGLOOKUP_IsTagged(const char *frame)
+{
+  if(frame[0] < '0' || frame[0] > '9')
+    return 0;
+
+  while(*frame != '\0' && *frame != ':')
+    frame++;
+
+  return (*frame == ':');
+}
+
+/**
+  * @brief Queues a tagged lookup with the tagged frames already received
+  * after it, serving the queue each time it fills, then serves the rest.
+  * UART task
+  * @param frame: Tagged lookup
+  * @retval Frame that stopped the gathering, a command or an untagged
+  * lookup, valid until the next UARTRX_GetFrame. NULL if none
+  */
+const char* LOGLOOKUP_Pipeline(const char *frame)
+{
+  while(frame != NULL && LOGLOOKUP_IsTagged(frame))
+  {
+    if(!LOGLOOKUP_Add(frame))
+    {
+      stats.malformed++;
+      PROTO_SendError(PROTO_ERR_COMMAND, 0);
+    }
+    if(queue_count == LOGLOOKUP_QUEUE_SIZE)
+      LOGLOOKUP_Serve();
+
+    /* Only what already arrived, no waiting */
+    frame = UARTRX_GetFrame(0);
+  }
+
+  LOGLOOKUP_Serve();
+
+  return frame;
+}
+
+/**
+  * @brief Gets a copy of the lookup statistics
+  * @param copy: Where the statistics are copied
+  */
+void LOGLOOKUP_GetStats(LOGLOOKUP_StatsTypeDef *copy)
+{
+  *copy = stats;
+}
@@ -0,0 +1,383 @@
+/**
+  ******************************************************************************
+  * @file log_query.c
+  * @author fdominguez
+  * @brief This file provides the aggregate queries over a range of logged
+  * records: count, min, max, mean and variance, or a histogram, of one
+  * field. The range is scanned by chunks with EXTFLASH_ReadRange into the
+  * sector block, and one result frame is sent instead of the records.
+  * The mean and the variance come from Welford's update in Q8 fixed point:
+  * the division remainder is carried from a record to the next, so the
+  * mean stays exact however many records are added, and the squared
+  * deviations add up in 64 bits without overflow for the whole flash.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "log_query.h"
+#include "proto.h"
+#include "uart_rx.h"
+#include "usart.h"
+#include "cmsis_os.h"
+#include "fmt.h"
+
+#define LOGQUERY_ONE				(1 << LOGQUERY_Q)
+
+/* Result line: 77 characters of names, separators, CR/LF and NUL, up to
+ * 9 numbers (histogram) or 7 numbers and 3 fixed point ones (statistics:
+ * sign, digits, point and 2 decimals) */
+#define LOGQUERY_RESULT_LINE		(77 + 7 * FMT_MAX_DIGITS + 3 * (FMT_MAX_DIGITS + 4))
+/* Counts line: a number and a separator per bucket, LF and NUL */
+#define LOGQUERY_COUNTS_LINE		(LOGQUERY_MAX_BUCKETS * (FMT_MAX_DIGITS + 1) + 2)
+#define LOGQUERY_LINE_SIZE			((LOGQUERY_RESULT_LINE > LOGQUERY_COUNTS_LINE) ? \
+                                     LOGQUERY_RESULT_LINE : LOGQUERY_COUNTS_LINE)
+
+extern osSemaphoreId SPISemaphoreHandle;
+
+static LOGQUERY_ResultTypeDef result;
+
+/* Welford state. The exact mean is mean + remainder / count, Q8 */
+static int32_t mean;
+static int32_t remainder;
+static int64_t m2;
+
+/* Result frame or text, UART task only */
+static uint8_t payload[PROTO_MAX_PAYLOAD];
+static char line[LOGQUERY_LINE_SIZE];
+
+/**
+  * @brief Gets the queried field of a record
+  * @param record: Record
+  * @retval Value
+  */
+static int32_t LOGQUERY_Field(const EXTFLASH_RecordTypeDef *record)
+{
+  switch(result.query.field)
+  {
+    case LOGQUERY_FIELD_X:
+      return record->mag_x;
+    case LOGQUERY_FIELD_Y:
+      return record->mag_y;
+    case LOGQUERY_FIELD_Z:
+      return record->mag_z;
+    default:
+      return record->temp;
+  }
+}
+
+/**
+  * @brief Adds a value to the statistics and the histogram
+  * @param value: Value
+  */
+static void LOGQUERY_Add(int32_t value)
+{
+  int32_t x = value * LOGQUERY_ONE, before = mean, numerator;
+
+  result.count++;
+
+  /* mean + remainder / count moves by (x - that) / count */
+  numerator = remainder + (x - mean);
+  mean += numerator / (int32_t)result.count;
+  remainder = numerator % (int32_t)result.count;
+  m2 += ((int64_t)(x - before) * (x - mean)) >> LOGQUERY_Q;
+
+  if(value < result.min)
+    result.min = value;
+  if(value > result.max)
+    result.max = value;
+
+  if(result.query.kind != LOGQUERY_HISTOGRAM)
+    return;
+
+  if(value < result.query.low)
+    result.below++;
+  else if(value > result.query.high)
+    result.above++;
+  else
+    result.histogram[(uint32_t)(value - result.query.low) / result.width]++;
+}
+
+/**
+  * @brief Adds the records of a chunk
+  * @param range: Chunk read by EXTFLASH_ReadRange
+  */
+static void LOGQUERY_Chunk(const EXTFLASH_RangeTypeDef *range)
+{
+  EXTFLASH_RecordTypeDef record;
+  uint32_t index;
+
+  for(index = 0; index < range->count; index++)
+  {
+    if(EXTFLASH_RangeRecord(range, index, &record) != EXTFLASH_OK)
+    {
+      result.skipped++;
+      continue;
+    }
+    LOGQUERY_Add(LOGQUERY_Field(&record));
+  }
+}
+
+/**
+  * @brief Scans the range until its last ID, input from the host or a
+  * failure
+  */
+static void LOGQUERY_Scan(void)
+{
+  EXTFLASH_RangeTypeDef range;
+  EXTFLASH_InfoTypeDef info;
+  EXTFLASH_StatusTypeDef status;
+  uint32_t next_id = result.query.first_id, retries = 0;
+
+  while(next_id <= result.query.last_id)
+  {
+    /* Any command stops the query */
+    if(UARTRX_GetFrame(0) != NULL)
+    {
+      result.end = LOGQUERY_END_ABORTED;
+      return;
+    }
+
+    /* Taken again for every chunk, a capture commit may be waiting */
+    range.data = DMAPOOL_Acquire(DMAPOOL_SECTOR);
+    if(range.data == NULL)
+    {
+      if(++retries > LOGQUERY_BLOCK_RETRIES)
+      {
+        result.end = LOGQUERY_END_ERROR;
+        return;
+      }
+      osDelay(10);
+      continue;
+    }
+    retries = 0;
+
+    range.first_id = next_id;
+    range.count = result.query.last_id - next_id + 1;
+    if(range.count > LOGQUERY_CHUNK_RECORDS)
+      range.count = LOGQUERY_CHUNK_RECORDS;
+
+    status = EXTFLASH_ERROR;
+    info.oldest_id = 0;
+    if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) == osOK)
+    {
+      status = EXTFLASH_ReadRange(&range);
+      if(status != EXTFLASH_OK)
+        EXTFLASH_GetInfo(&info);
+      osSemaphoreRelease(SPISemaphoreHandle);
+    }
+
+    if(status == EXTFLASH_OK)
+    {
+      LOGQUERY_Chunk(&range);
+      next_id += range.count;
+    }
+
+    DMAPOOL_Release(range.data);
+
+    if(status != EXTFLASH_OK)
+    {
+      /* Overwritten by the log meanwhile */
+      if(next_id < info.oldest_id && info.oldest_id <= result.query.last_id)
+      {
+        result.skipped += info.oldest_id - next_id;
+        next_id = info.oldest_id;
+        continue;
+      }
+      result.end = LOGQUERY_END_ERROR;
+      return;
+    }
+  }
+}
+
+/**
+  * @brief Integer square root
+  * @param value: Value
+  * @retval Floor of the square root
+  */
+static uint32_t LOGQUERY_Sqrt(uint64_t value)
+{
+  uint64_t root = 0, bit = (uint64_t)1 << 62;
+
+  while(bit > value)
+    bit >>= 2;
+
+  while(bit != 0)
+  {
+    if(value >= root + bit)
+    {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    }
+    else
+      root >>= 1;
+    bit >>= 2;
+  }
+
+  return root;
+}
+
+/**
+  * @brief Writes a Q8 number with two decimals, NUL terminated
+  * @param out: Where it is written
+  * @param value: Q8 value
+  * @retval The NUL terminator, to write the next field
+  */
+static char* LOGQUERY_PutFixed(char *out, int64_t value)
+{
+  uint64_t magnitude = (value < 0) ? -(uint64_t)value : (uint64_t)value;
+
+  if(value < 0)
+    *out++ = '-';
+  out = FMT_UDec(out, magnitude >> LOGQUERY_Q, 0);
+  *out++ = '.';
+  return FMT_UDec(out, ((magnitude & (LOGQUERY_ONE - 1)) * 100) >> LOGQUERY_Q, 2);
+}
+
+/**
+  * @brief Runs a query over a range of records in the calling task, then
+  * sends the result. A command arriving meanwhile stops it and is discarded
+  * @param query: Query. The range is clamped to the stored IDs, the
+  * histogram needs low <= high and 1 to LOGQUERY_MAX_BUCKETS buckets
+  * @retval LOGQUERY Status, error if the query is wrong or nothing is
+  * stored in the range. Else the result tells how the scan ended
+  */
+LOGQUERY_StatusTypeDef LOGQUERY_Run(const LOGQUERY_QueryTypeDef *query)
+{
+  EXTFLASH_InfoTypeDef info;
+  uint32_t start = osKernelSysTick();
+
+  if(query->field >= LOGQUERY_FIELD_COUNT)
+    return LOGQUERY_ERROR;
+  if(query->kind == LOGQUERY_HISTOGRAM && (query->low > query->high || query->buckets == 0 ||
+      query->buckets > LOGQUERY_MAX_BUCKETS || query->low < INT16_MIN || query->high > INT16_MAX))
+    return LOGQUERY_ERROR;
+
+  if(osSemaphoreWait(SPISemaphoreHandle, osWaitForever) != osOK)
+    return LOGQUERY_ERROR;
+  EXTFLASH_GetInfo(&info);
+  osSemaphoreRelease(SPISemaphoreHandle);
+
+  result = (LOGQUERY_ResultTypeDef){0};
+  result.query = *query;
+  if(info.next_id == info.oldest_id)
+    return LOGQUERY_ERROR;
+  if(result.query.first_id < info.oldest_id)
+    result.query.first_id = info.oldest_id;
+  if(result.query.last_id >= info.next_id)
+    result.query.last_id = info.next_id - 1;
+  if(result.query.first_id > result.query.last_id)
+    return LOGQUERY_ERROR;
+
+  result.min = INT16_MAX;
+  result.max = INT16_MIN;
+  /* Rounded up, so that high falls in the last bucket */
+  if(query->kind == LOGQUERY_HISTOGRAM)
+    result.width = ((uint32_t)(query->high - query->low) + query->buckets) / query->buckets;
+  mean = 0;
+  remainder = 0;
+  m2 = 0;
+
+  result.end = LOGQUERY_END_COMPLETE;
+  LOGQUERY_Scan();
+
+  result.mean = mean;
+  if(result.count > 1)
+    result.variance = (uint64_t)(m2 > 0 ? m2 : 0) / (result.count - 1);
+  if(result.count == 0)
+    result.min = result.max = 0;
+  result.elapsed_ms = osKernelSysTick() - start;
+
+  LOGQUERY_SendResult();
+  return LOGQUERY_OK;
+}
+
+/**
+  * @brief Sends the result of the last query: a PROTO_MSG_QUERY in binary
+  * mode, else "QUERY" or "HIST" lines
+  */
+void LOGQUERY_SendResult(void)
+{
+  static const char field_names[] = "XYZT";
+  static const char * const end_names[] = { "COMPLETE", "ABORTED", "ERROR" };
+  uint8_t *data = payload;
+  char *text;
+  uint32_t index;
+
+  if(PROTO_GetMode() == PROTO_MODE_BINARY)
+  {
+    *data++ = result.query.kind;
+    *data++ = result.query.field;
+    *data++ = result.end;
+    data = PROTO_Put32(data, result.query.first_id);
+    data = PROTO_Put32(data, result.query.last_id);
+    data = PROTO_Put32(data, result.count);
+    data = PROTO_Put32(data, result.skipped);
+    if(result.query.kind == LOGQUERY_STATS)
+    {
+      data = PROTO_Put16(data, result.min);
+      data = PROTO_Put16(data, result.max);
+      data = PROTO_Put32(data, result.mean);
+      data = PROTO_Put32(data, result.variance & 0xFFFFFFFF);
+      data = PROTO_Put32(data, result.variance >> 32);
+    }
+    else
+    {
+      data = PROTO_Put16(data, result.query.low);
+      /* A single bucket over the whole int16 range is 65536 wide */
+      data = PROTO_Put32(data, result.width);
+      data = PROTO_Put32(data, result.below);
+      data = PROTO_Put32(data, result.above);
+      *data++ = result.query.buckets;
+      for(index = 0; index < result.query.buckets; index++)
+        data = PROTO_Put32(data, result.histogram[index]);
+    }
+    PROTO_Send(PROTO_MSG_QUERY, payload, data - payload);
+    return;
+  }
+
+  text = line + FMT_Format(line, "%s %c first=%lu last=%lu n=%lu skipped=%lu ",
+      (result.query.kind == LOGQUERY_STATS) ? "QUERY" : "HIST", field_names[result.query.field],
+      result.query.first_id, result.query.last_id, result.count, result.skipped);
+
+  if(result.query.kind == LOGQUERY_STATS)
+  {
+    text += FMT_Format(text, "min=%d max=%d mean=", result.min, result.max);
+    text = LOGQUERY_PutFixed(text, result.mean);
+    text += FMT_Format(text, " var=");
+    text = LOGQUERY_PutFixed(text, result.variance);
+    text += FMT_Format(text, " sd=");
+    /* Q16 root, Q8 */
+    text = LOGQUERY_PutFixed(text, LOGQUERY_Sqrt(result.variance << LOGQUERY_Q));
+  }
+  else
+    text += FMT_Format(text, "low=%ld width=%lu below=%lu above=%lu",
+        result.query.low, result.width, result.below, result.above);
+
+  FMT_Format(text, " %s time=%lums\r\n", end_names[result.end], result.elapsed_ms);
+  SERIAL_SEND(line);
+
+  if(result.query.kind != LOGQUERY_HISTOGRAM)
+    return;
+
+  /* The counts on a line of their own */
+  text = line;
+  for(index = 0; index < result.query.buckets; index++)
+  {
+    text = FMT_UDec(text, result.histogram[index], 0);
+    *text++ = ' ';
+  }
+  text[-1] = '\r';
+  *text++ = '\n';
+  *text = '\0';
+  SERIAL_SEND(line);
+}
+
+/**
+  * @brief Gets the result of the last query
+  * @param copy: Where it is copied
+  */
+void LOGQUERY_GetResult(LOGQUERY_ResultTypeDef *copy)
+{
+  *copy = result;
+}
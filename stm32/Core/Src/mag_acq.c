@@ -0,0 +1,365 @@
+/**
+  ******************************************************************************
+  * @file mag_acq.c
+  * @author fdominguez
+  * @brief This file provides the timer paced magnetometer acquisition.
+  * Every TIM3 update starts a burst read of the output registers straight
+  * into a double buffered sample ring, and the SPI DMA completion releases
+  * the chip select. Both run in interrupt context, so the consumer task
+  * only wakes up once per half ring.
+  * While it is stopped, the LIS3MDL DRDY line (EXTI) wakes the sampling task
+  * on every new conversion instead.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "mag_acq.h"
+#include "main.h"
+#include "cmsis_os.h"
+#include "spi.h"
+#include "spi_trace.h"
+#include "cycle_counter.h"
+#include "mag_event.h"
+#include "mag_array.h"
+#include "dlog.h"
+
+extern SPI_HandleTypeDef hspi1;
+
+static MAGACQ_SampleTypeDef ring[MAGACQ_RING_SIZE];
+
+/* Read, auto increment, from STATUS_REG. The rest are dummy bytes clocking
+ * the data out */
+static uint8_t burst_command[LIS3MDL_BURST_SIZE] =
+{
+  LIS3MDL_STATUS_REG | LIS3MDL_READ | LIS3MDL_AUTO_INCREMENT
+};
+
+/* Completed halves (0 or 1) for the consumer task */
+static osMessageQId half_queue;
+
+/* Bytes clocked per burst, fixed at start (FAST_READ reads half of them) */
+static uint32_t burst_size;
+
+static volatile uint32_t running;
+/* A timer tick found the bus busy, the burst starts when it is released */
+static volatile uint32_t pending;
+static volatile uint32_t write_index;
+static volatile MAGACQ_StatsTypeDef stats;
+
+/* DRDY edge time stamps (DWT cycles) for the sampling task */
+static osMessageQId drdy_queue;
+static volatile MAGACQ_DataReadyStatsTypeDef drdy_stats;
+
+/**
+  * @brief Starts the burst read of the current slot. The bus must be owned
+  * by SPI1_OWNER_MAG_ACQ
+  */
+static void MAGACQ_StartBurst(void)
+{
+  MAGACQ_SampleTypeDef *slot = &ring[write_index];
+
+  SPI1_SelectDevice(SPI1_DEVICE_MAG);
+  SPI_TRACE_BEGIN(SPI1_DEVICE_MAG);
+  SPI_TRACE_OPCODE(burst_command[0]);
+  HAL_GPIO_WritePin(CS_MAG_GPIO_Port, CS_MAG_Pin, GPIO_PIN_RESET);
+
+  if(HAL_SPI_TransmitReceive_DMA(&hspi1, burst_command, slot->burst, burst_size) != HAL_OK)
+  {
+    HAL_GPIO_WritePin(CS_MAG_GPIO_Port, CS_MAG_Pin, GPIO_PIN_SET);
+    SPI_TRACE_END();
+    stats.errors++;
+    DLOG1(DLOG_MAGACQ_BURST_ERROR, hspi1.ErrorCode);
+    SPI1_ReleaseBus(SPI1_OWNER_MAG_ACQ);
+  }
+}
+
+/**
+  * @brief Programs TIM3 for the current rate from the current clock tree
+  */
+static void MAGACQ_ConfigTimer(void)
+{
+  uint32_t timer_clock = HAL_RCC_GetPCLK1Freq();
+
+  /* APB1 timers run at twice PCLK1 when APB1 is divided */
+  if((RCC->CFGR & RCC_CFGR_PPRE1) != RCC_CFGR_PPRE1_DIV1)
+    timer_clock *= 2;
+
+  TIM3->PSC = (timer_clock / MAGACQ_TIMER_TICK_HZ) - 1;
+  TIM3->ARR = (MAGACQ_TIMER_TICK_HZ / stats.rate_hz) - 1;
+
+  /* Load the prescaler now, without a spurious update interrupt */
+  TIM3->EGR = TIM_EGR_UG;
+  TIM3->SR = 0;
+}
+
+/**
+  * @brief Creates the queue the consumer task waits on. Call once before
+  * the scheduler starts
+  */
+void MAGACQ_Init(void)
+{
+  osMessageQDef(MagAcqQueue, 2, uint32_t);
+  half_queue = osMessageCreate(osMessageQ(MagAcqQueue), NULL);
+
+  osMessageQDef(MagDRDYQueue, 1, uint32_t);
+  drdy_queue = osMessageCreate(osMessageQ(MagDRDYQueue), NULL);
+}
+
+/**
+  * @brief Sets the magnetometer data rate and starts the paced acquisition.
+  * The caller must hold the SPI semaphore.
+  * @param rate_hz: Samples per second
+  * @retval MAGACQ Status
+  */
+MAGACQ_StatusTypeDef MAGACQ_Start(uint32_t rate_hz)
+{
+  osEvent event;
+
+  if(running || rate_hz < MAGACQ_MIN_RATE_HZ || rate_hz > MAGACQ_MAX_RATE_HZ)
+    return MAGACQ_ERROR;
+
+  if(LIS3MDL_SetDataRate(MAGARRAY_PRIMARY, rate_hz) != LIS3MDL_OK)
+    return MAGACQ_ERROR;
+
+  /* Drop halves left over from a previous run */
+  do
+  {
+    event = osMessageGet(half_queue, 0);
+  } while(event.status == osEventMessage);
+
+  stats = (MAGACQ_StatsTypeDef){0};
+  stats.rate_hz = rate_hz;
+  stats.start_tick = osKernelSysTick();
+  LIS3MDL_ResetSampleStats(MAGARRAY_PRIMARY);
+  burst_size = LIS3MDL_GetBurstSize(MAGARRAY_PRIMARY);
+  write_index = 0;
+  pending = 0;
+
+  __HAL_RCC_TIM3_CLK_ENABLE();
+  TIM3->CR1 = 0;
+  MAGACQ_ConfigTimer();
+  TIM3->DIER = TIM_DIER_UIE;
+
+  /* Same priority as the DMA interrupts, both use the RTOS API */
+  HAL_NVIC_SetPriority(TIM3_IRQn, 5, 0);
+  HAL_NVIC_EnableIRQ(TIM3_IRQn);
+
+  running = 1;
+  TIM3->CR1 = TIM_CR1_CEN;
+
+  return MAGACQ_OK;
+}
+
+/**
+  * @brief Stops the paced acquisition and waits for the last burst
+  */
+void MAGACQ_Stop(void)
+{
+  running = 0;
+  TIM3->CR1 = 0;
+  TIM3->DIER = 0;
+  HAL_NVIC_DisableIRQ(TIM3_IRQn);
+  pending = 0;
+
+  while(SPI1_GetBusOwner() == SPI1_OWNER_MAG_ACQ)
+    osThreadYield();
+}
+
+/**
+  * @brief Tells whether the paced acquisition is running
+  * @retval 1 if running
+  */
+uint32_t MAGACQ_IsRunning(void)
+{
+  return running;
+}
+
+/**
+  * @brief Waits for the next half of the ring to be filled. The half stays
+  * valid until the DMA wraps around to it (MAGACQ_SAMPLES_PER_HALF samples)
+  * @param timeout: Milliseconds to wait
+  * @return MAGACQ_SAMPLES_PER_HALF samples, NULL on timeout
+  */
+const MAGACQ_SampleTypeDef* MAGACQ_WaitHalf(uint32_t timeout)
+{
+  osEvent event = osMessageGet(half_queue, timeout);
+
+  if(event.status != osEventMessage)
+    return NULL;
+
+  return &ring[event.value.v * MAGACQ_SAMPLES_PER_HALF];
+}
+
+/**
+  * @brief Reprograms the pacing timer after a system clock change
+  */
+void MAGACQ_UpdateTimer(void)
+{
+  if(running)
+    MAGACQ_ConfigTimer();
+}
+
+/**
+  * @brief Gets a copy of the acquisition statistics
+  * @param copy: Where the statistics are copied
+  */
+void MAGACQ_GetStats(MAGACQ_StatsTypeDef *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  taskEXIT_CRITICAL();
+}
+
+/**
+  * @brief TIM3 update: starts the burst, or defers it while a task owns the bus
+  */
+void MAGACQ_TimerIRQHandler(void)
+{
+  uint32_t start = CYCCNT_Get();
+
+  TIM3->SR = ~TIM_SR_UIF;
+
+  if(running)
+  {
+    if(SPI1_TryAcquireBus(SPI1_OWNER_MAG_ACQ))
+      MAGACQ_StartBurst();
+    else if(pending)
+      stats.overruns++;
+    else
+    {
+      pending = 1;
+      stats.deferred++;
+
+      /* The bus may have been released before the flag was set */
+      if(SPI1_TryAcquireBus(SPI1_OWNER_MAG_ACQ))
+      {
+        pending = 0;
+        MAGACQ_StartBurst();
+      }
+    }
+  }
+
+  stats.isr_cycles += CYCCNT_Get() - start;
+}
+
+/**
+  * @brief Waits for the next magnetometer conversion (DRDY rising edge)
+  * @param timeout: Milliseconds to wait, longer than one output data period
+  * @retval MAGACQ Status, error on timeout
+  */
+MAGACQ_StatusTypeDef MAGACQ_WaitDataReady(uint32_t timeout)
+{
+  osEvent event = osMessageGet(drdy_queue, timeout);
+  uint32_t latency_us;
+
+  if(event.status != osEventMessage)
+  {
+    drdy_stats.timeouts++;
+    return MAGACQ_ERROR;
+  }
+
+  latency_us = CYCCNT_ToUs(CYCCNT_Get() - event.value.v);
+  drdy_stats.latency_last_us = latency_us;
+  if(latency_us > drdy_stats.latency_max_us)
+    drdy_stats.latency_max_us = latency_us;
+
+  return MAGACQ_OK;
+}
+
+/**
+  * @brief Gets a copy of the conversion driven sampling statistics
+  * @param copy: Where the statistics are copied
+  */
+void MAGACQ_GetDataReadyStats(MAGACQ_DataReadyStatsTypeDef *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = drdy_stats;
+  taskEXIT_CRITICAL();
+}
+
+/**
+  * @brief EXTI line detection callback
+  * @param GPIO_Pin: Pin that triggered the interrupt
+  */
+void HAL_GPIO_EXTI_Callback(uint16_t GPIO_Pin)
+{
+  if(GPIO_Pin == INT_MAG_Pin)
+  {
+    MAGEVT_InterruptCallback();
+    return;
+  }
+
+  /* Edges before MAGACQ_Init are dropped */
+  if(GPIO_Pin != DRDY_MAG_Pin || running || drdy_queue == NULL)
+    return;
+
+  drdy_stats.edges++;
+  if(osMessagePut(drdy_queue, CYCCNT_Get(), 0) != osOK)
+    drdy_stats.missed++;
+}
+
+/**
+  * @brief Serves a deferred timer tick as soon as the bus is free
+  */
+void SPI1_BusReleasedCallback(void)
+{
+  if(running && pending && SPI1_TryAcquireBus(SPI1_OWNER_MAG_ACQ))
+  {
+    pending = 0;
+    MAGACQ_StartBurst();
+  }
+}
+
+/**
+  * @brief SPI transmit/receive DMA completed. Only acquisition bursts are
+  * handled here, task transfers are signaled by the DMA interrupts
+  * @param hspi: SPI handle
+  */
+void HAL_SPI_TxRxCpltCallback(SPI_HandleTypeDef *hspi)
+{
+  uint32_t start;
+
+  if(hspi != &hspi1 || SPI1_GetBusOwner() != SPI1_OWNER_MAG_ACQ)
+    return;
+
+  start = CYCCNT_Get();
+
+  HAL_GPIO_WritePin(CS_MAG_GPIO_Port, CS_MAG_Pin, GPIO_PIN_SET);
+  SPI_TRACE_END();
+  stats.samples++;
+
+  if(++write_index == MAGACQ_SAMPLES_PER_HALF)
+  {
+    stats.halves++;
+    if(osMessagePut(half_queue, 0, 0) != osOK)
+      stats.halves_lost++;
+  }
+  else if(write_index == MAGACQ_RING_SIZE)
+  {
+    write_index = 0;
+    stats.halves++;
+    if(osMessagePut(half_queue, 1, 0) != osOK)
+      stats.halves_lost++;
+  }
+
+  stats.isr_cycles += CYCCNT_Get() - start;
+
+  SPI1_ReleaseBus(SPI1_OWNER_MAG_ACQ);
+}
+
+/**
+  * @brief SPI error during an acquisition burst: drop the sample
+  * @param hspi: SPI handle
+  */
+void HAL_SPI_ErrorCallback(SPI_HandleTypeDef *hspi)
+{
+  if(hspi != &hspi1 || SPI1_GetBusOwner() != SPI1_OWNER_MAG_ACQ)
+    return;
+
+  HAL_GPIO_WritePin(CS_MAG_GPIO_Port, CS_MAG_Pin, GPIO_PIN_SET);
+  SPI_TRACE_END();
+  stats.errors++;
+  DLOG1(DLOG_MAGACQ_BURST_ERROR, hspi->ErrorCode);
+  SPI1_ReleaseBus(SPI1_OWNER_MAG_ACQ);
+}
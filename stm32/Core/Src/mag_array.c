@@ -0,0 +1,279 @@
+/**
+  ******************************************************************************
+  * @file mag_array.c
+  * @author fdominguez
+  * @brief This file provides the LIS3MDL device handles and the synchronized
+  * sampling of the magnetometer array. Each sensor runs on its own
+  * oscillator, so continuous conversions drift apart: the array is sampled
+  * in single conversion mode instead, every present sensor is started back
+  * to back with the bus held and interrupts masked, and all of them are
+  * read once the primary one raises DRDY. The trigger skew is measured
+  * with the cycle counter.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "mag_array.h"
+#include "main.h"
+#include "cmsis_os.h"
+#include "spi.h"
+#include "mag_slot.h"
+#include "cycle_counter.h"
+#include "dlog.h"
+
+LIS3MDL_HandleTypeDef hmag[MAGARRAY_MAX_SENSORS] =
+{
+  { .cs_port = CS_MAG_GPIO_Port, .cs_pin = CS_MAG_Pin },
+  { .cs_port = CS_MAG2_GPIO_Port, .cs_pin = CS_MAG2_Pin },
+  { .cs_port = CS_MAG3_GPIO_Port, .cs_pin = CS_MAG3_Pin },
+  { .cs_port = CS_MAG4_GPIO_Port, .cs_pin = CS_MAG4_Pin }
+};
+
+/* Sensors that answered WHO_AM_I, one bit each */
+static uint32_t present;
+static uint32_t enabled;
+static MAGSLOT_HandleTypeDef slot = { .period_ms = MAGARRAY_DEFAULT_PERIOD_MS };
+
+static volatile MAGARRAY_StatsTypeDef stats;
+
+/**
+  * @brief Sets the conversion mode of every present sensor, with the
+  * rest of the primary sensor configuration
+  * @param conversion: Conversion mode
+  * @retval MAGARRAY Status
+  */
+static MAGARRAY_StatusTypeDef MAGARRAY_SetConversion(LIS3MDL_ConversionModeTypeDef conversion)
+{
+  LIS3MDL_ConfigTypeDef config;
+  uint32_t sensor;
+  MAGARRAY_StatusTypeDef retval = MAGARRAY_OK;
+
+  LIS3MDL_GetConfig(MAGARRAY_PRIMARY, &config);
+  config.conversion = conversion;
+
+  for(sensor = 0; sensor < MAGARRAY_MAX_SENSORS; sensor++)
+  {
+    if((present & (1 << sensor)) && LIS3MDL_Configure(&hmag[sensor], &config) != LIS3MDL_OK)
+      retval = MAGARRAY_ERROR;
+  }
+
+  return retval;
+}
+
+/**
+  * @brief Initializes every sensor of the array. The SPI semaphore must be
+  * held, or the scheduler not started yet
+  * @retval MAGARRAY Status, error if the primary sensor does not answer
+  */
+MAGARRAY_StatusTypeDef MAGARRAY_Init(void)
+{
+  uint32_t sensor;
+
+  present = 0;
+  for(sensor = 0; sensor < MAGARRAY_MAX_SENSORS; sensor++)
+  {
+    if(LIS3MDL_Init(&hmag[sensor]) == LIS3MDL_OK)
+      present |= (1 << sensor);
+  }
+
+  if(!(present & 1))
+    return MAGARRAY_ERROR;
+
+  return MAGARRAY_OK;
+}
+
+/**
+  * @brief Gets the sensors found by MAGARRAY_Init
+  * @retval One bit per sensor, bit 0 is the primary one
+  */
+uint32_t MAGARRAY_GetPresent(void)
+{
+  return present;
+}
+
+/**
+  * @brief Puts every present sensor in single conversion mode, with the
+  * primary sensor configuration. The first sample is taken right away.
+  * The caller must hold the SPI semaphore
+  * @param period: Sample period in milliseconds
+  * @retval MAGARRAY Status, error with FAST_ODR (continuous only)
+  */
+MAGARRAY_StatusTypeDef MAGARRAY_Enable(uint32_t period)
+{
+  if(MAGSLOT_Check(period) != MAGSLOT_OK)
+    return MAGARRAY_ERROR;
+
+  if(MAGARRAY_SetConversion(LIS3MDL_CONVERSION_SINGLE) != MAGARRAY_OK)
+    return MAGARRAY_ERROR;
+
+  taskENTER_CRITICAL();
+  MAGSLOT_Start(&slot, period);
+  stats = (MAGARRAY_StatsTypeDef){0};
+  enabled = 1;
+  taskEXIT_CRITICAL();
+
+  return MAGARRAY_OK;
+}
+
+/**
+  * @brief Puts every present sensor back in continuous conversion mode.
+  * The caller must hold the SPI semaphore
+  * @retval MAGARRAY Status
+  */
+MAGARRAY_StatusTypeDef MAGARRAY_Disable(void)
+{
+  enabled = 0;
+
+  return MAGARRAY_SetConversion(LIS3MDL_CONVERSION_CONTINUOUS);
+}
+
+/**
+  * @brief Tells whether the array sampling is enabled
+  * @retval 1 if enabled
+  */
+uint32_t MAGARRAY_IsEnabled(void)
+{
+  return enabled;
+}
+
+/**
+  * @brief Gets the sample period
+  * @retval Period in milliseconds
+  */
+uint32_t MAGARRAY_GetPeriod(void)
+{
+  return slot.period_ms;
+}
+
+/**
+  * @brief Sleeps until the next sample slot. Slots already gone are skipped,
+  * so a late sample does not shift the cadence
+  */
+void MAGARRAY_WaitSlot(void)
+{
+  stats.late += MAGSLOT_Wait(&slot);
+}
+
+/**
+  * @brief Starts a conversion on every present sensor, back to back. The
+  * caller must hold the SPI semaphore
+  * @retval MAGARRAY Status, error if any sensor could not be started
+  */
+MAGARRAY_StatusTypeDef MAGARRAY_StartConversions(void)
+{
+  static uint8_t commands[MAGARRAY_MAX_SENSORS][2];
+  uint32_t sensor, triggers = 0, first = 0, last = 0, skew_ns;
+  MAGARRAY_StatusTypeDef retval = MAGARRAY_OK;
+
+  for(sensor = 0; sensor < MAGARRAY_MAX_SENSORS; sensor++)
+    if((present & (1 << sensor)) && LIS3MDL_GetConversionCommand(&hmag[sensor], commands[sensor]) == LIS3MDL_OK)
+      triggers |= (1 << sensor);
+  if(triggers != present)
+    retval = MAGARRAY_ERROR;
+
+  /* Owned across the triggers, so no chip select has to wait for it. A
+   * timer paced burst may be in flight: sleep a tick rather than spin */
+  while(SPI1_TryAcquireBus(SPI1_OWNER_TASK) == 0)
+    osDelay(1);
+  SPI1_SelectDevice(SPI1_DEVICE_MAG);
+
+  /* Polled writes with the chip selects driven here: nothing under the
+   * mask waits on the RTOS. The skew is taken between trigger starts */
+  taskENTER_CRITICAL();
+  for(sensor = 0; sensor < MAGARRAY_MAX_SENSORS; sensor++)
+  {
+    if(!(triggers & (1 << sensor)))
+      continue;
+
+    last = CYCCNT_Get();
+    if(!(triggers & ((1 << sensor) - 1)))
+      first = last;
+
+    HAL_GPIO_WritePin((GPIO_TypeDef*)hmag[sensor].cs_port, hmag[sensor].cs_pin, GPIO_PIN_RESET);
+    if(HAL_SPI_Transmit(&hspi1, commands[sensor], 2, 1) != HAL_OK)
+      retval = MAGARRAY_ERROR;
+    HAL_GPIO_WritePin((GPIO_TypeDef*)hmag[sensor].cs_port, hmag[sensor].cs_pin, GPIO_PIN_SET);
+  }
+  taskEXIT_CRITICAL();
+
+  SPI1_ReleaseBus(SPI1_OWNER_TASK);
+
+  skew_ns = CYCCNT_ToNs(last - first);
+
+  taskENTER_CRITICAL();
+  stats.skew_ns = skew_ns;
+  if(skew_ns > stats.skew_max_ns)
+    stats.skew_max_ns = skew_ns;
+  if(retval != MAGARRAY_OK)
+    stats.errors++;
+  taskEXIT_CRITICAL();
+
+  return retval;
+}
+
+/**
+  * @brief Reads the sample of every present sensor, once the primary one
+  * is done. A sensor not done yet is read once more, and left out of the
+  * record if still not fresh. The caller must hold the SPI semaphore
+  * @param record: Sample, the temperature is the primary sensor one
+  * @retval MAGARRAY Status, error if no sensor could be read
+  */
+MAGARRAY_StatusTypeDef MAGARRAY_ReadSamples(EXTFLASH_MultiRecordTypeDef *record)
+{
+  LIS3MDL_DataTypeDef data;
+  LIS3MDL_StatusTypeDef status;
+  uint32_t sensor;
+
+  *record = (EXTFLASH_MultiRecordTypeDef){0};
+
+  for(sensor = 0; sensor < MAGARRAY_MAX_SENSORS; sensor++)
+  {
+    if(!(present & (1 << sensor)))
+      continue;
+
+    status = LIS3MDL_ReadValues(&hmag[sensor], &data);
+    if(status == LIS3MDL_OK && !LIS3MDL_IS_FRESH(data.status))
+    {
+      stats.retries++;
+      DLOG1(DLOG_MAGARRAY_RETRY, sensor);
+      osDelay(MAGARRAY_RETRY_DELAY_MS);
+      status = LIS3MDL_ReadValues(&hmag[sensor], &data);
+    }
+
+    if(status != LIS3MDL_OK || !LIS3MDL_IS_FRESH(data.status))
+    {
+      stats.missing++;
+      DLOG1(DLOG_MAGARRAY_MISSING, sensor);
+      continue;
+    }
+
+    record->mag[sensor][0] = data.mag_x;
+    record->mag[sensor][1] = data.mag_y;
+    record->mag[sensor][2] = data.mag_z;
+    if(sensor == 0)
+      record->temp = data.temp;
+    record->channels |= (1 << sensor);
+  }
+
+  if(record->channels == 0)
+  {
+    stats.errors++;
+    return MAGARRAY_ERROR;
+  }
+
+  stats.samples++;
+
+  return MAGARRAY_OK;
+}
+
+/**
+  * @brief Gets a copy of the array statistics
+  * @param copy: Where the statistics are copied
+  */
+void MAGARRAY_GetStats(MAGARRAY_StatsTypeDef *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  taskEXIT_CRITICAL();
+}
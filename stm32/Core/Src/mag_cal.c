@@ -0,0 +1,428 @@
+/**
+  ******************************************************************************
+  * @file mag_cal.c
+  * @author fdominguez
+  * @brief This file provides the magnetometer hard/soft iron calibration.
+  * Samples are corrected in Q15 fixed point before being stored. The
+  * coefficients live in the last page of the internal flash.
+  * The online fit accumulates the normal equations of an axis aligned
+  * ellipsoid (x^2, y^2, z^2, x, y, z terms) in 64 bit integers while the
+  * board is rotated, and solves them once when it finishes. It gives the
+  * offset and the diagonal of the matrix, the cross terms can be uploaded.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "mag_cal.h"
+#include "main.h"
+#include "cmsis_os.h"
+#include "cycle_counter.h"
+
+/* Upper triangle of the fit normal matrix */
+#define MAGCAL_FIT_PRODUCTS		(MAGCAL_FIT_TERMS * (MAGCAL_FIT_TERMS + 1) / 2)
+
+typedef struct
+{
+  uint32_t magic;
+  MAGCAL_CoeffsTypeDef coeffs;
+  uint32_t checksum;
+} MAGCAL_StoredTypeDef;
+
+_Static_assert(sizeof(MAGCAL_StoredTypeDef) % sizeof(uint32_t) == 0, "MAG calibration: stored size must be whole words");
+
+/* Last flash page, see the linker script */
+static const volatile MAGCAL_StoredTypeDef stored_calibration __attribute__((section(".calibration")));
+
+static MAGCAL_CoeffsTypeDef coeffs;
+static volatile MAGCAL_StatsTypeDef stats;
+
+/* Fit sums: products of every pair of terms, and the terms */
+static int64_t fit_products[MAGCAL_FIT_PRODUCTS];
+static int64_t fit_terms[MAGCAL_FIT_TERMS];
+/* Augmented normal matrix for the solve, kept off the command task stack */
+static double fit_normal[MAGCAL_FIT_TERMS][MAGCAL_FIT_TERMS + 1];
+
+/**
+  * @brief Identity matrix, no offset
+  * @param identity: Coefficients
+  */
+static void MAGCAL_Identity(MAGCAL_CoeffsTypeDef *identity)
+{
+  uint32_t row, column;
+
+  for(row = 0; row < MAGCAL_AXES; row++)
+  {
+    identity->offset[row] = 0;
+    for(column = 0; column < MAGCAL_AXES; column++)
+      identity->matrix[row][column] = (row == column) ? MAGCAL_Q15_ONE : 0;
+  }
+}
+
+/**
+  * @brief Checksum of the stored coefficients
+  * @param stored: Coefficients
+  * @retval Checksum
+  */
+static uint32_t MAGCAL_Checksum(const MAGCAL_CoeffsTypeDef *stored)
+{
+  const uint16_t *halfword = (const uint16_t*)stored;
+  uint32_t index, sum = MAGCAL_STORED_MAGIC;
+
+  for(index = 0; index < sizeof(*stored) / sizeof(uint16_t); index++)
+    sum = (sum << 1 | sum >> 31) + halfword[index];
+
+  return ~sum;
+}
+
+/**
+  * @brief Integer square root
+  * @param value: Radicand
+  * @retval Floor of the square root
+  */
+static uint32_t MAGCAL_SquareRoot(uint32_t value)
+{
+  uint32_t root = 0, bit = 1UL << 30;
+
+  while(bit > value)
+    bit >>= 2;
+
+  while(bit != 0)
+  {
+    if(value >= root + bit)
+    {
+      value -= root + bit;
+      root = (root >> 1) + bit;
+    }
+    else
+      root >>= 1;
+    bit >>= 2;
+  }
+
+  return root;
+}
+
+/**
+  * @brief Adds a raw sample to the fit sums
+  * @param data: Raw sample
+  */
+static void MAGCAL_FitAccumulate(const LIS3MDL_DataTypeDef *data)
+{
+  int32_t terms[MAGCAL_FIT_TERMS];
+  uint32_t row, column, index = 0;
+
+  if(stats.fit_samples >= MAGCAL_FIT_MAX_SAMPLES)
+    return;
+
+  terms[3] = data->mag_x >> MAGCAL_FIT_SHIFT;
+  terms[4] = data->mag_y >> MAGCAL_FIT_SHIFT;
+  terms[5] = data->mag_z >> MAGCAL_FIT_SHIFT;
+  terms[0] = terms[3] * terms[3];
+  terms[1] = terms[4] * terms[4];
+  terms[2] = terms[5] * terms[5];
+
+  for(row = 0; row < MAGCAL_FIT_TERMS; row++)
+  {
+    fit_terms[row] += terms[row];
+    for(column = row; column < MAGCAL_FIT_TERMS; column++)
+      fit_products[index++] += (int64_t)terms[row] * terms[column];
+  }
+
+  stats.fit_samples++;
+}
+
+/**
+  * @brief Applies the calibration to a sample
+  * @param data: Sample, corrected in place
+  */
+static void MAGCAL_Apply(LIS3MDL_DataTypeDef *data)
+{
+  int32_t centered[MAGCAL_AXES], corrected[MAGCAL_AXES];
+  int64_t sum;
+  uint32_t row;
+
+  centered[0] = __SSAT(data->mag_x - coeffs.offset[0], 16);
+  centered[1] = __SSAT(data->mag_y - coeffs.offset[1], 16);
+  centered[2] = __SSAT(data->mag_z - coeffs.offset[2], 16);
+
+  for(row = 0; row < MAGCAL_AXES; row++)
+  {
+    /* Q15 product, rounded */
+    sum = (int64_t)coeffs.matrix[row][0] * centered[0] +
+          (int64_t)coeffs.matrix[row][1] * centered[1] +
+          (int64_t)coeffs.matrix[row][2] * centered[2] + (1 << 14);
+    corrected[row] = __SSAT((int32_t)(sum >> 15), 16);
+  }
+
+  data->mag_x = corrected[0];
+  data->mag_y = corrected[1];
+  data->mag_z = corrected[2];
+}
+
+/**
+  * @brief Loads the stored coefficients. Without valid ones the calibration
+  * starts disabled, with the identity
+  */
+void MAGCAL_Init(void)
+{
+  MAGCAL_CoeffsTypeDef loaded = *(const MAGCAL_CoeffsTypeDef*)&stored_calibration.coeffs;
+
+  if(stored_calibration.magic == MAGCAL_STORED_MAGIC &&
+     stored_calibration.checksum == MAGCAL_Checksum(&loaded))
+  {
+    coeffs = loaded;
+    stats.enabled = 1;
+  }
+  else
+  {
+    MAGCAL_Identity(&coeffs);
+    stats.enabled = 0;
+  }
+}
+
+/**
+  * @brief Calibration stage, between the sensor read and the storage. Feeds
+  * the raw sample to a running fit, then corrects it if enabled
+  * @param data: Sample, corrected in place
+  */
+void MAGCAL_Process(LIS3MDL_DataTypeDef *data)
+{
+  uint32_t start, cycles;
+
+  if(stats.fitting)
+  {
+    start = CYCCNT_Get();
+    taskENTER_CRITICAL();
+    MAGCAL_FitAccumulate(data);
+    taskEXIT_CRITICAL();
+    cycles = CYCCNT_Get() - start;
+    if(cycles > stats.fit_cycles_max)
+      stats.fit_cycles_max = cycles;
+  }
+
+  if(stats.enabled)
+  {
+    start = CYCCNT_Get();
+    taskENTER_CRITICAL();
+    MAGCAL_Apply(data);
+    taskEXIT_CRITICAL();
+    cycles = CYCCNT_Get() - start;
+    if(cycles > stats.apply_cycles_max)
+      stats.apply_cycles_max = cycles;
+  }
+}
+
+/**
+  * @brief Enables or disables the correction
+  * @param enable: 1 to correct the samples
+  */
+void MAGCAL_Enable(uint32_t enable)
+{
+  stats.enabled = enable ? 1 : 0;
+}
+
+/**
+  * @brief Gets a copy of the coefficients in use
+  * @param copy: Where the coefficients are copied
+  */
+void MAGCAL_GetCoeffs(MAGCAL_CoeffsTypeDef *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = coeffs;
+  taskEXIT_CRITICAL();
+}
+
+/**
+  * @brief Replaces the coefficients in use (not stored until MAGCAL_Save)
+  * @param new_coeffs: Coefficients
+  */
+void MAGCAL_SetCoeffs(const MAGCAL_CoeffsTypeDef *new_coeffs)
+{
+  taskENTER_CRITICAL();
+  coeffs = *new_coeffs;
+  taskEXIT_CRITICAL();
+}
+
+/**
+  * @brief Goes back to the identity (not stored until MAGCAL_Save)
+  */
+void MAGCAL_ResetCoeffs(void)
+{
+  MAGCAL_CoeffsTypeDef identity;
+
+  MAGCAL_Identity(&identity);
+  MAGCAL_SetCoeffs(&identity);
+}
+
+/**
+  * @brief Stores the coefficients in use in the calibration flash page.
+  * The CPU stalls while the page is erased (about 20 ms), do not call it
+  * while the paced acquisition runs
+  * @retval MAGCAL Status
+  */
+MAGCAL_StatusTypeDef MAGCAL_Save(void)
+{
+  MAGCAL_StoredTypeDef image;
+  FLASH_EraseInitTypeDef erase;
+  const uint32_t *word = (const uint32_t*)&image;
+  const volatile uint32_t *stored_word = (const volatile uint32_t*)&stored_calibration;
+  uint32_t index, page_error;
+  MAGCAL_StatusTypeDef retval = MAGCAL_ERROR;
+
+  MAGCAL_GetCoeffs(&image.coeffs);
+  image.magic = MAGCAL_STORED_MAGIC;
+  image.checksum = MAGCAL_Checksum(&image.coeffs);
+
+  erase.TypeErase = FLASH_TYPEERASE_PAGES;
+  erase.Banks = FLASH_BANK_1;
+  erase.PageAddress = (uint32_t)&stored_calibration;
+  erase.NbPages = 1;
+
+  HAL_FLASH_Unlock();
+
+  if(HAL_FLASHEx_Erase(&erase, &page_error) == HAL_OK)
+  {
+    retval = MAGCAL_OK;
+    for(index = 0; index < sizeof(image) / sizeof(uint32_t) && retval == MAGCAL_OK; index++)
+    {
+      if(HAL_FLASH_Program(FLASH_TYPEPROGRAM_WORD, (uint32_t)&stored_word[index], word[index]) != HAL_OK ||
+         stored_word[index] != word[index])
+        retval = MAGCAL_ERROR;
+    }
+  }
+
+  HAL_FLASH_Lock();
+
+  return retval;
+}
+
+/**
+  * @brief Starts a fit. The raw samples processed from now on are used,
+  * rotate the board through as many orientations as possible
+  */
+void MAGCAL_FitStart(void)
+{
+  uint32_t index;
+
+  taskENTER_CRITICAL();
+  for(index = 0; index < MAGCAL_FIT_PRODUCTS; index++)
+    fit_products[index] = 0;
+  for(index = 0; index < MAGCAL_FIT_TERMS; index++)
+    fit_terms[index] = 0;
+  stats.fit_samples = 0;
+  stats.fit_cycles_max = 0;
+  stats.fitting = 1;
+  taskEXIT_CRITICAL();
+}
+
+/**
+  * @brief Ends the fit and solves a x^2 + b y^2 + c z^2 + d x + e y + f z = 1
+  * by least squares. The center gives the offset, and each gain scales its
+  * axis radius to the smallest one. The result replaces the coefficients
+  * in use, with the cross terms cleared
+  * @retval MAGCAL Status, error if the samples do not describe an ellipsoid
+  */
+MAGCAL_StatusTypeDef MAGCAL_FitFinish(void)
+{
+  double (*normal)[MAGCAL_FIT_TERMS + 1] = fit_normal;
+  double solution[MAGCAL_FIT_TERMS], pivot, factor, largest, center;
+  MAGCAL_CoeffsTypeDef fitted;
+  uint32_t row, column, index = 0, best, axis, gain;
+
+  stats.fitting = 0;
+
+  if(stats.fit_samples < MAGCAL_FIT_MIN_SAMPLES)
+    return MAGCAL_ERROR;
+
+  /* Normal equations, the right hand side is the sum of each term */
+  for(row = 0; row < MAGCAL_FIT_TERMS; row++)
+  {
+    for(column = row; column < MAGCAL_FIT_TERMS; column++)
+    {
+      normal[row][column] = (double)fit_products[index];
+      normal[column][row] = (double)fit_products[index];
+      index++;
+    }
+    normal[row][MAGCAL_FIT_TERMS] = (double)fit_terms[row];
+  }
+
+  /* Gaussian elimination with partial pivoting */
+  for(column = 0; column < MAGCAL_FIT_TERMS; column++)
+  {
+    best = column;
+    for(row = column + 1; row < MAGCAL_FIT_TERMS; row++)
+    {
+      if((normal[row][column] < 0 ? -normal[row][column] : normal[row][column]) >
+         (normal[best][column] < 0 ? -normal[best][column] : normal[best][column]))
+        best = row;
+    }
+
+    if(normal[best][column] == 0.0)
+      return MAGCAL_ERROR;
+
+    if(best != column)
+    {
+      for(index = 0; index <= MAGCAL_FIT_TERMS; index++)
+      {
+        pivot = normal[column][index];
+        normal[column][index] = normal[best][index];
+        normal[best][index] = pivot;
+      }
+    }
+
+    for(row = column + 1; row < MAGCAL_FIT_TERMS; row++)
+    {
+      factor = normal[row][column] / normal[column][column];
+      for(index = column; index <= MAGCAL_FIT_TERMS; index++)
+        normal[row][index] -= factor * normal[column][index];
+    }
+  }
+
+  for(row = MAGCAL_FIT_TERMS; row-- > 0;)
+  {
+    solution[row] = normal[row][MAGCAL_FIT_TERMS];
+    for(column = row + 1; column < MAGCAL_FIT_TERMS; column++)
+      solution[row] -= normal[row][column] * solution[column];
+    solution[row] /= normal[row][row];
+  }
+
+  /* Every quadratic term positive, otherwise it is not an ellipsoid */
+  largest = 0.0;
+  for(axis = 0; axis < MAGCAL_AXES; axis++)
+  {
+    if(solution[axis] <= 0.0)
+      return MAGCAL_ERROR;
+    if(solution[axis] > largest)
+      largest = solution[axis];
+  }
+
+  MAGCAL_Identity(&fitted);
+  for(axis = 0; axis < MAGCAL_AXES; axis++)
+  {
+    /* Center in raw counts */
+    center = -solution[MAGCAL_AXES + axis] / (2.0 * solution[axis]) * (1 << MAGCAL_FIT_SHIFT);
+    if(center > INT16_MAX || center < INT16_MIN)
+      return MAGCAL_ERROR;
+    fitted.offset[axis] = (int16_t)center;
+
+    /* Radius is proportional to 1 / sqrt(quadratic term), so the gain to
+     * the smallest radius is sqrt(term / largest term), computed in Q30 */
+    gain = MAGCAL_SquareRoot((uint32_t)(solution[axis] / largest * (1UL << 30)));
+    fitted.matrix[axis][axis] = (gain > MAGCAL_Q15_ONE) ? MAGCAL_Q15_ONE : gain;
+  }
+
+  MAGCAL_SetCoeffs(&fitted);
+
+  return MAGCAL_OK;
+}
+
+/**
+  * @brief Gets a copy of the calibration state
+  * @param copy: Where the state is copied
+  */
+void MAGCAL_GetStats(MAGCAL_StatsTypeDef *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  taskEXIT_CRITICAL();
+}
@@ -0,0 +1,263 @@
+/**
+  ******************************************************************************
+  * @file mag_event.c
+  * @author fdominguez
+  * @brief This file provides the change triggered magnetometer logging.
+  * While the field is quiet the sensor keeps converting but nothing is read:
+  * the LIS3MDL threshold interrupt (INT pin on EXTI) is armed around the
+  * last sample, and a single heartbeat sample is stored every period.
+  * An INT edge starts a capture of every conversion, which ends once the
+  * field stays within the threshold of the baseline for the hold time.
+  * The comparator works on each axis magnitude, so it is armed at the
+  * largest baseline magnitude plus the threshold. A field that only
+  * decreases is seen at the next heartbeat.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "mag_event.h"
+#include "mag_array.h"
+#include "main.h"
+#include "cmsis_os.h"
+
+static MAGEVT_ConfigTypeDef event_config =
+{
+  .threshold = MAGEVT_DEFAULT_THRESHOLD,
+  .heartbeat_s = MAGEVT_DEFAULT_HEARTBEAT_S,
+  .hold_s = MAGEVT_DEFAULT_HOLD_S
+};
+
+static volatile MAGEVT_StatsTypeDef stats;
+
+/* INT edges for the logging task, only while quiet */
+static osMessageQId int_queue;
+/* The last wait ended on an INT edge */
+static uint32_t triggered;
+static uint32_t last_deviation_tick;
+
+/**
+  * @brief Arms the threshold interrupt around a sample, which becomes the
+  * baseline. The caller must hold the SPI semaphore
+  * @param raw: Uncalibrated sample
+  * @retval MAGEVT Status
+  */
+static MAGEVT_StatusTypeDef MAGEVT_Arm(const LIS3MDL_DataTypeDef *raw)
+{
+  int32_t magnitude, largest = 0;
+  const int16_t axes[3] = { raw->mag_x, raw->mag_y, raw->mag_z };
+  uint32_t axis;
+  osEvent event;
+
+  for(axis = 0; axis < 3; axis++)
+  {
+    magnitude = (axes[axis] < 0) ? -axes[axis] : axes[axis];
+    if(magnitude > largest)
+      largest = magnitude;
+  }
+
+  largest += event_config.threshold;
+  if(largest > LIS3MDL_INT_THS_MAX)
+    largest = LIS3MDL_INT_THS_MAX;
+
+  if(LIS3MDL_ConfigureInterrupt(MAGARRAY_PRIMARY, 1, largest) != LIS3MDL_OK)
+    return MAGEVT_ERROR;
+
+  /* An edge from the previous latch is stale now */
+  do
+  {
+    event = osMessageGet(int_queue, 0);
+  } while(event.status == osEventMessage);
+
+  for(axis = 0; axis < 3; axis++)
+    stats.baseline[axis] = axes[axis];
+  triggered = 0;
+  stats.state = MAGEVT_STATE_QUIET;
+
+  return MAGEVT_OK;
+}
+
+/**
+  * @brief Creates the queue the logging task waits on. Call once before
+  * the scheduler starts
+  */
+void MAGEVT_Init(void)
+{
+  osMessageQDef(MagINTQueue, 1, uint32_t);
+  int_queue = osMessageCreate(osMessageQ(MagINTQueue), NULL);
+}
+
+/**
+  * @brief Enables the change triggered logging. The interrupt is armed
+  * with the next sample
+  */
+void MAGEVT_Enable(void)
+{
+  if(stats.state == MAGEVT_STATE_OFF)
+  {
+    stats.state = MAGEVT_STATE_ARMING;
+    /* The logging task may be waiting out a long heartbeat, wake it so the
+     * arming does not wait for the timeout */
+    osMessagePut(int_queue, 0, 0);
+  }
+}
+
+/**
+  * @brief Disables the change triggered logging and the INT pin. The caller
+  * must hold the SPI semaphore
+  * @retval MAGEVT Status
+  */
+MAGEVT_StatusTypeDef MAGEVT_Disable(void)
+{
+  stats.state = MAGEVT_STATE_OFF;
+  /* The logging task does not wait for the heartbeat to leave */
+  osMessagePut(int_queue, 0, 0);
+
+  if(LIS3MDL_ConfigureInterrupt(MAGARRAY_PRIMARY, 0, 0) != LIS3MDL_OK)
+    return MAGEVT_ERROR;
+
+  return MAGEVT_OK;
+}
+
+/**
+  * @brief Tells whether the change triggered logging is enabled
+  * @retval 1 if enabled
+  */
+uint32_t MAGEVT_IsEnabled(void)
+{
+  return stats.state != MAGEVT_STATE_OFF;
+}
+
+/**
+  * @brief Tells whether a capture is running (every conversion is read)
+  * @retval 1 if capturing
+  */
+uint32_t MAGEVT_IsActive(void)
+{
+  return stats.state == MAGEVT_STATE_ACTIVE;
+}
+
+/**
+  * @brief Changes threshold, heartbeat and hold time. An enabled logging
+  * is armed again with the next sample
+  * @param config: Configuration
+  * @retval MAGEVT Status
+  */
+MAGEVT_StatusTypeDef MAGEVT_Configure(const MAGEVT_ConfigTypeDef *config)
+{
+  if(config->threshold == 0 || config->threshold > LIS3MDL_INT_THS_MAX ||
+     config->heartbeat_s == 0 || config->heartbeat_s > MAGEVT_MAX_TIME_S ||
+     config->hold_s == 0 || config->hold_s > MAGEVT_MAX_TIME_S)
+    return MAGEVT_ERROR;
+
+  event_config = *config;
+  if(stats.state != MAGEVT_STATE_OFF)
+  {
+    stats.state = MAGEVT_STATE_ARMING;
+    osMessagePut(int_queue, 0, 0);
+  }
+
+  return MAGEVT_OK;
+}
+
+/**
+  * @brief Gets the configuration
+  * @param config: Where the configuration is copied
+  */
+void MAGEVT_GetConfig(MAGEVT_ConfigTypeDef *config)
+{
+  *config = event_config;
+}
+
+/**
+  * @brief Sleeps until an INT edge or the next heartbeat, whatever comes
+  * first. Used while quiet
+  */
+void MAGEVT_WaitTrigger(void)
+{
+  osEvent event = osMessageGet(int_queue, event_config.heartbeat_s * 1000);
+
+  triggered = (event.status == osEventMessage);
+}
+
+/**
+  * @brief Runs the logging state machine on a sample read after
+  * MAGEVT_WaitTrigger (quiet) or after DRDY (capturing). The caller must
+  * hold the SPI semaphore
+  * @param raw: Uncalibrated sample
+  * @retval 1 if the sample has to be stored
+  */
+uint32_t MAGEVT_Update(const LIS3MDL_DataTypeDef *raw)
+{
+  int32_t deviation;
+  uint32_t axis;
+  const int16_t axes[3] = { raw->mag_x, raw->mag_y, raw->mag_z };
+
+  switch(stats.state)
+  {
+    case MAGEVT_STATE_ARMING:
+      stats.heartbeats++;
+      MAGEVT_Arm(raw);
+      return 1;
+
+    case MAGEVT_STATE_QUIET:
+      if(triggered)
+      {
+        triggered = 0;
+        stats.state = MAGEVT_STATE_ACTIVE;
+        stats.triggers++;
+        stats.captured++;
+        last_deviation_tick = osKernelSysTick();
+        return 1;
+      }
+
+      /* Heartbeat, the baseline follows slow drifts */
+      stats.heartbeats++;
+      MAGEVT_Arm(raw);
+      return 1;
+
+    case MAGEVT_STATE_ACTIVE:
+      /* A duplicate (read after a timeout) is not stored again */
+      if(!LIS3MDL_IS_FRESH(raw->status))
+        return 0;
+
+      for(axis = 0; axis < 3; axis++)
+      {
+        deviation = axes[axis] - stats.baseline[axis];
+        if(deviation > (int32_t)event_config.threshold || deviation < -(int32_t)event_config.threshold)
+          last_deviation_tick = osKernelSysTick();
+      }
+
+      stats.captured++;
+
+      if((osKernelSysTick() - last_deviation_tick) >= event_config.hold_s * 1000)
+        MAGEVT_Arm(raw);
+
+      return 1;
+
+    default:
+      return 0;
+  }
+}
+
+/**
+  * @brief Gets a copy of the logging statistics
+  * @param copy: Where the statistics are copied
+  */
+void MAGEVT_GetStats(MAGEVT_StatsTypeDef *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  taskEXIT_CRITICAL();
+}
+
+/**
+  * @brief INT pin rising edge (EXTI)
+  */
+void MAGEVT_InterruptCallback(void)
+{
+  stats.interrupts++;
+
+  if(int_queue != NULL && stats.state == MAGEVT_STATE_QUIET)
+    osMessagePut(int_queue, 1, 0);
+}
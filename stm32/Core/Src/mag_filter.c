@@ -0,0 +1,160 @@
+/**
+  ******************************************************************************
+  * @file mag_filter.c
+  * @author fdominguez
+  * @brief This file provides the magnetometer low-pass and decimation stage.
+  * An optional first order IIR smooths every input, then a boxcar (first
+  * order CIC) sums a whole decimation period and dumps the average, so the
+  * stored rate is the data rate over the decimation ratio. The state is
+  * a fixed set of integers, nothing is allocated per sample.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "mag_filter.h"
+#include "cmsis_os.h"
+#include "cycle_counter.h"
+
+#define MAGFILT_CHANNELS	4
+
+static MAGFILT_ConfigTypeDef filter_config =
+{
+  .decimation = MAGFILT_DEFAULT_DECIMATION,
+  .iir_shift = 0
+};
+
+/* x, y, z and temperature */
+static int32_t iir_state[MAGFILT_CHANNELS];
+static uint32_t iir_primed;
+static int32_t boxcar_sum[MAGFILT_CHANNELS];
+static uint32_t boxcar_count;
+/* STATUS_REG of the period, so an overrun is not lost */
+static uint8_t boxcar_status;
+
+static volatile MAGFILT_StatsTypeDef stats;
+
+/**
+  * @brief Clears the filter state, the next input starts a new period
+  */
+static void MAGFILT_Reset(void)
+{
+  uint32_t channel;
+
+  for(channel = 0; channel < MAGFILT_CHANNELS; channel++)
+  {
+    iir_state[channel] = 0;
+    boxcar_sum[channel] = 0;
+  }
+  iir_primed = 0;
+  boxcar_count = 0;
+  boxcar_status = 0;
+}
+
+/**
+  * @brief Changes the filter. The running period is dropped
+  * @param config: Filter configuration
+  * @retval MAGFILT Status
+  */
+MAGFILT_StatusTypeDef MAGFILT_Configure(const MAGFILT_ConfigTypeDef *config)
+{
+  if(config->decimation == 0 || config->decimation > MAGFILT_MAX_DECIMATION ||
+     config->iir_shift > MAGFILT_MAX_IIR_SHIFT)
+    return MAGFILT_ERROR;
+
+  taskENTER_CRITICAL();
+  filter_config = *config;
+  MAGFILT_Reset();
+  stats = (MAGFILT_StatsTypeDef){0};
+  taskEXIT_CRITICAL();
+
+  return MAGFILT_OK;
+}
+
+/**
+  * @brief Gets the filter configuration
+  * @param config: Where the configuration is copied
+  */
+void MAGFILT_GetConfig(MAGFILT_ConfigTypeDef *config)
+{
+  taskENTER_CRITICAL();
+  *config = filter_config;
+  taskEXIT_CRITICAL();
+}
+
+/**
+  * @brief Filters one sample
+  * @param input: Fresh sample
+  * @param output: Filtered sample, written once per decimation period
+  * (may be the same as input)
+  * @retval 1 if an output was produced
+  */
+uint32_t MAGFILT_Process(const LIS3MDL_DataTypeDef *input, LIS3MDL_DataTypeDef *output)
+{
+  int32_t sample[MAGFILT_CHANNELS];
+  uint32_t channel, produced = 0, start, cycles;
+
+  start = CYCCNT_Get();
+  taskENTER_CRITICAL();
+
+  sample[0] = input->mag_x;
+  sample[1] = input->mag_y;
+  sample[2] = input->mag_z;
+  sample[3] = input->temp;
+
+  if(filter_config.iir_shift > 0)
+  {
+    for(channel = 0; channel < MAGFILT_CHANNELS; channel++)
+    {
+      /* y += (x - y) / 2^shift, the first sample seeds the state */
+      if(!iir_primed)
+        iir_state[channel] = sample[channel] * (1 << MAGFILT_IIR_FRACTION);
+      else
+        iir_state[channel] += (sample[channel] * (1 << MAGFILT_IIR_FRACTION) - iir_state[channel]) >> filter_config.iir_shift;
+      sample[channel] = iir_state[channel] >> MAGFILT_IIR_FRACTION;
+    }
+    iir_primed = 1;
+  }
+
+  for(channel = 0; channel < MAGFILT_CHANNELS; channel++)
+    boxcar_sum[channel] += sample[channel];
+  boxcar_status |= input->status;
+  boxcar_count++;
+
+  if(boxcar_count >= filter_config.decimation)
+  {
+    output->mag_x = boxcar_sum[0] / (int32_t)boxcar_count;
+    output->mag_y = boxcar_sum[1] / (int32_t)boxcar_count;
+    output->mag_z = boxcar_sum[2] / (int32_t)boxcar_count;
+    output->temp = boxcar_sum[3] / (int32_t)boxcar_count;
+    output->status = boxcar_status;
+
+    for(channel = 0; channel < MAGFILT_CHANNELS; channel++)
+      boxcar_sum[channel] = 0;
+    boxcar_count = 0;
+    boxcar_status = 0;
+    stats.outputs++;
+    produced = 1;
+  }
+
+  stats.inputs++;
+  taskEXIT_CRITICAL();
+
+  cycles = CYCCNT_Get() - start;
+  stats.cycles_total += cycles;
+  if(cycles > stats.cycles_max)
+    stats.cycles_max = cycles;
+
+  return produced;
+}
+
+/**
+  * @brief Gets a copy of the filter statistics
+  * @param copy: Where the statistics are copied
+  */
+void MAGFILT_GetStats(MAGFILT_StatsTypeDef *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  taskEXIT_CRITICAL();
+}
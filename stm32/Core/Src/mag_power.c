@@ -0,0 +1,172 @@
+/**
+  ******************************************************************************
+  * @file mag_power.c
+  * @author fdominguez
+  * @brief This file provides the single conversion power scheduler. For slow
+  * logging the LIS3MDL is kept in single conversion mode: one conversion is
+  * started at every sample slot and the part powers itself down once DRDY
+  * rises, instead of converting continuously between samples. The data
+  * rate and operating mode still set the conversion time and noise.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "mag_power.h"
+#include "lis3mdl.h"
+#include "mag_array.h"
+#include "mag_slot.h"
+#include "cmsis_os.h"
+#include "cycle_counter.h"
+#include "dlog.h"
+
+/* Supply current while converting, by operating mode */
+static const uint16_t supply_ua[] =
+{
+  MAGPWR_CURRENT_LP_UA,
+  MAGPWR_CURRENT_MP_UA,
+  MAGPWR_CURRENT_HP_UA,
+  MAGPWR_CURRENT_UHP_UA
+};
+
+static uint32_t enabled;
+static MAGSLOT_HandleTypeDef slot = { .period_ms = MAGPWR_DEFAULT_PERIOD_MS };
+static uint32_t conversion_start;
+
+static volatile MAGPWR_StatsTypeDef stats;
+
+/**
+  * @brief Puts the sensor in single conversion mode, the first sample is
+  * taken right away. The caller must hold the SPI semaphore
+  * @param period: Sample period in milliseconds
+  * @retval MAGPWR Status, error with FAST_ODR (continuous only)
+  */
+MAGPWR_StatusTypeDef MAGPWR_Enable(uint32_t period)
+{
+  LIS3MDL_ConfigTypeDef config;
+
+  if(MAGSLOT_Check(period) != MAGSLOT_OK)
+    return MAGPWR_ERROR;
+
+  LIS3MDL_GetConfig(MAGARRAY_PRIMARY, &config);
+  config.conversion = LIS3MDL_CONVERSION_SINGLE;
+  if(LIS3MDL_Configure(MAGARRAY_PRIMARY, &config) != LIS3MDL_OK)
+    return MAGPWR_ERROR;
+
+  taskENTER_CRITICAL();
+  MAGSLOT_Start(&slot, period);
+  stats = (MAGPWR_StatsTypeDef){0};
+  enabled = 1;
+  taskEXIT_CRITICAL();
+
+  return MAGPWR_OK;
+}
+
+/**
+  * @brief Puts the sensor back in continuous conversion mode. The caller
+  * must hold the SPI semaphore
+  * @retval MAGPWR Status
+  */
+MAGPWR_StatusTypeDef MAGPWR_Disable(void)
+{
+  LIS3MDL_ConfigTypeDef config;
+
+  enabled = 0;
+
+  LIS3MDL_GetConfig(MAGARRAY_PRIMARY, &config);
+  config.conversion = LIS3MDL_CONVERSION_CONTINUOUS;
+  if(LIS3MDL_Configure(MAGARRAY_PRIMARY, &config) != LIS3MDL_OK)
+    return MAGPWR_ERROR;
+
+  return MAGPWR_OK;
+}
+
+/**
+  * @brief Tells whether the scheduler is enabled
+  * @retval 1 if enabled
+  */
+uint32_t MAGPWR_IsEnabled(void)
+{
+  return enabled;
+}
+
+/**
+  * @brief Gets the sample period
+  * @retval Period in milliseconds
+  */
+uint32_t MAGPWR_GetPeriod(void)
+{
+  return slot.period_ms;
+}
+
+/**
+  * @brief Sleeps until the next sample slot. Slots already gone are skipped,
+  * so a late sample does not shift the cadence
+  */
+void MAGPWR_WaitSlot(void)
+{
+  stats.late += MAGSLOT_Wait(&slot);
+}
+
+/**
+  * @brief Starts the conversion of a sample. The caller must hold the SPI
+  * semaphore
+  * @retval MAGPWR Status
+  */
+MAGPWR_StatusTypeDef MAGPWR_StartConversion(void)
+{
+  conversion_start = CYCCNT_Get();
+
+  if(LIS3MDL_StartConversion(MAGARRAY_PRIMARY) != LIS3MDL_OK)
+    return MAGPWR_ERROR;
+
+  return MAGPWR_OK;
+}
+
+/**
+  * @brief Accounts a conversion and updates the energy estimates
+  * @param done: 1 if DRDY was seen, 0 on timeout
+  */
+void MAGPWR_ConversionDone(uint32_t done)
+{
+  LIS3MDL_ConfigTypeDef config;
+  uint32_t on_time_us, period_us;
+  uint64_t active, idle;
+
+  if(!done)
+  {
+    stats.timeouts++;
+    DLOG1(DLOG_MAGPWR_TIMEOUT, stats.timeouts);
+    return;
+  }
+
+  on_time_us = CYCCNT_ToUs(CYCCNT_Get() - conversion_start);
+  period_us = slot.period_ms * 1000;
+  if(on_time_us > period_us)
+    on_time_us = period_us;
+
+  /* mV * uA * us is fJ */
+  LIS3MDL_GetConfig(MAGARRAY_PRIMARY, &config);
+  active = (uint64_t)MAGPWR_SUPPLY_MV * supply_ua[config.mode] * on_time_us;
+  idle = (uint64_t)MAGPWR_SUPPLY_MV * MAGPWR_CURRENT_PD_UA * (period_us - on_time_us);
+
+  taskENTER_CRITICAL();
+  stats.samples++;
+  stats.on_time_us = on_time_us;
+  if(on_time_us > stats.on_time_max_us)
+    stats.on_time_max_us = on_time_us;
+  stats.energy_nj = (active + idle) / 1000000;
+  stats.continuous_nj = ((uint64_t)MAGPWR_SUPPLY_MV * supply_ua[config.mode] * period_us) / 1000000;
+  taskEXIT_CRITICAL();
+}
+
+/**
+  * @brief Gets a copy of the scheduler statistics
+  * @param copy: Where the statistics are copied
+  */
+void MAGPWR_GetStats(MAGPWR_StatsTypeDef *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  taskEXIT_CRITICAL();
+}
@@ -0,0 +1,286 @@
+/**
+  ******************************************************************************
+  * @file mag_scope.c
+  * @author fdominguez
+  * @brief This file provides the pre-trigger capture of magnetic transients.
+  * Like an oscilloscope in normal mode, the paced acquisition samples are
+  * kept in a RAM ring. Once the pre-trigger window is full the capture is
+  * armed, a trigger (level crossing, slope or command) starts the post-
+  * trigger samples and the whole window is then stored as one event
+  * sector. Samples are dropped while the event is being programmed.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "mag_scope.h"
+#include "cmsis_os.h"
+#include "dma_pool.h"
+#include "dlog.h"
+
+static MAGSCOPE_ConfigTypeDef scope_config =
+{
+  .pre_trigger = MAGSCOPE_DEFAULT_PRE,
+  .post_trigger = MAGSCOPE_DEFAULT_POST,
+  .level = 0,
+  .slope = 5 * MAGSCOPE_TRIGGER_STEP
+};
+
+/* pre_trigger + post_trigger samples, head is the next one written */
+static EXTFLASH_RecordTypeDef ring[MAGSCOPE_MAX_DEPTH];
+static uint32_t ring_head;
+static uint32_t ring_filled;
+static uint32_t post_remaining;
+static MAGSCOPE_SourceTypeDef trigger_source;
+/* Trigger requested by command, taken once armed */
+static volatile uint32_t forced;
+
+static volatile MAGSCOPE_StatsTypeDef stats;
+
+/**
+  * @brief Empties the ring and starts gathering the pre-trigger window
+  */
+static void MAGSCOPE_Restart(void)
+{
+  ring_head = 0;
+  ring_filled = 0;
+  post_remaining = 0;
+  stats.state = MAGSCOPE_STATE_FILLING;
+}
+
+/**
+  * @brief Checks the level and slope triggers against the previous sample
+  * @param previous: Previous sample
+  * @param sample: New sample
+  * @param source: Trigger found
+  * @retval 1 if triggered
+  */
+static uint32_t MAGSCOPE_Check(const EXTFLASH_RecordTypeDef *previous, const EXTFLASH_RecordTypeDef *sample, MAGSCOPE_SourceTypeDef *source)
+{
+  const int32_t before[3] = { previous->mag_x, previous->mag_y, previous->mag_z };
+  const int32_t after[3] = { sample->mag_x, sample->mag_y, sample->mag_z };
+  int32_t magnitude_before, magnitude_after, slope;
+  uint32_t axis;
+
+  for(axis = 0; axis < 3; axis++)
+  {
+    magnitude_before = (before[axis] < 0) ? -before[axis] : before[axis];
+    magnitude_after = (after[axis] < 0) ? -after[axis] : after[axis];
+    if(scope_config.level > 0 && magnitude_before < (int32_t)scope_config.level &&
+       magnitude_after >= (int32_t)scope_config.level)
+    {
+      *source = MAGSCOPE_SOURCE_LEVEL;
+      return 1;
+    }
+
+    slope = after[axis] - before[axis];
+    if(slope < 0)
+      slope = -slope;
+    if(scope_config.slope > 0 && slope >= (int32_t)scope_config.slope)
+    {
+      *source = MAGSCOPE_SOURCE_SLOPE;
+      return 1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+  * @brief Changes the capture window and triggers. A running capture
+  * starts over
+  * @param config: Capture configuration
+  * @retval MAGSCOPE Status, error if a capture is waiting to be stored
+  */
+MAGSCOPE_StatusTypeDef MAGSCOPE_Configure(const MAGSCOPE_ConfigTypeDef *config)
+{
+  MAGSCOPE_StatusTypeDef retval = MAGSCOPE_ERROR;
+
+  if(config->post_trigger == 0 || config->pre_trigger + config->post_trigger > MAGSCOPE_MAX_DEPTH ||
+     config->level > INT16_MAX || config->slope > UINT16_MAX)
+    return MAGSCOPE_ERROR;
+
+  taskENTER_CRITICAL();
+  if(stats.state != MAGSCOPE_STATE_COMPLETE)
+  {
+    scope_config = *config;
+    if(stats.state != MAGSCOPE_STATE_OFF)
+      MAGSCOPE_Restart();
+    retval = MAGSCOPE_OK;
+  }
+  taskEXIT_CRITICAL();
+
+  return retval;
+}
+
+/**
+  * @brief Gets the capture configuration
+  * @param config: Where the configuration is copied
+  */
+void MAGSCOPE_GetConfig(MAGSCOPE_ConfigTypeDef *config)
+{
+  taskENTER_CRITICAL();
+  *config = scope_config;
+  taskEXIT_CRITICAL();
+}
+
+/**
+  * @brief Enables the capture, the paced acquisition samples go to the ring
+  * instead of the log
+  */
+void MAGSCOPE_Arm(void)
+{
+  taskENTER_CRITICAL();
+  if(stats.state == MAGSCOPE_STATE_OFF)
+  {
+    forced = 0;
+    MAGSCOPE_Restart();
+  }
+  taskEXIT_CRITICAL();
+}
+
+/**
+  * @brief Disables the capture, a capture not stored yet is dropped
+  */
+void MAGSCOPE_Disarm(void)
+{
+  stats.state = MAGSCOPE_STATE_OFF;
+}
+
+/**
+  * @brief Tells whether the capture is enabled
+  * @retval 1 if enabled
+  */
+uint32_t MAGSCOPE_IsEnabled(void)
+{
+  return stats.state != MAGSCOPE_STATE_OFF;
+}
+
+/**
+  * @brief Triggers the capture, as soon as the pre-trigger window is full
+  */
+void MAGSCOPE_Trigger(void)
+{
+  forced = 1;
+}
+
+/**
+  * @brief Adds a sample to the ring
+  * @param sample: Calibrated sample
+  * @retval 1 if a capture is complete and has to be committed
+  */
+uint32_t MAGSCOPE_Process(const EXTFLASH_RecordTypeDef *sample)
+{
+  uint32_t length, complete;
+  MAGSCOPE_SourceTypeDef source;
+
+  taskENTER_CRITICAL();
+
+  length = scope_config.pre_trigger + scope_config.post_trigger;
+
+  if(stats.state == MAGSCOPE_STATE_OFF || stats.state == MAGSCOPE_STATE_COMPLETE)
+  {
+    complete = (stats.state == MAGSCOPE_STATE_COMPLETE);
+    taskEXIT_CRITICAL();
+    return complete;
+  }
+
+  ring[ring_head] = *sample;
+  ring_head = (ring_head + 1) % length;
+  if(ring_filled < length)
+    ring_filled++;
+
+  if(stats.state == MAGSCOPE_STATE_TRIGGERED)
+  {
+    post_remaining--;
+  }
+  else if(ring_filled > scope_config.pre_trigger)
+  {
+    /* The new sample has the whole window before it */
+    stats.state = MAGSCOPE_STATE_ARMED;
+
+    if(forced)
+    {
+      forced = 0;
+      trigger_source = MAGSCOPE_SOURCE_COMMAND;
+      stats.state = MAGSCOPE_STATE_TRIGGERED;
+    }
+    else if(ring_filled > 1 && MAGSCOPE_Check(&ring[(ring_head + length - 2) % length], sample, &source))
+    {
+      trigger_source = source;
+      stats.state = MAGSCOPE_STATE_TRIGGERED;
+    }
+
+    if(stats.state == MAGSCOPE_STATE_TRIGGERED)
+    {
+      /* The trigger sample is the first post-trigger one */
+      post_remaining = scope_config.post_trigger - 1;
+      stats.triggers++;
+    }
+  }
+
+  if(stats.state == MAGSCOPE_STATE_TRIGGERED && post_remaining == 0)
+    stats.state = MAGSCOPE_STATE_COMPLETE;
+
+  complete = (stats.state == MAGSCOPE_STATE_COMPLETE);
+  taskEXIT_CRITICAL();
+
+  return complete;
+}
+
+/**
+  * @brief Stores a complete capture as an event and starts over. The
+  * caller must hold the SPI semaphore
+  * @retval MAGSCOPE Status, error if not stored. While the sector buffer is
+  * in use the capture is kept, so it is tried again with the next sample
+  */
+MAGSCOPE_StatusTypeDef MAGSCOPE_Commit(void)
+{
+  uint8_t *image;
+  EXTFLASH_EventTypeDef event;
+  MAGSCOPE_StatusTypeDef retval = MAGSCOPE_ERROR;
+
+  if(stats.state != MAGSCOPE_STATE_COMPLETE)
+    return MAGSCOPE_ERROR;
+
+  image = DMAPOOL_Acquire(DMAPOOL_SECTOR);
+  if(image == NULL)
+    return MAGSCOPE_ERROR;
+
+  /* The ring is full, the oldest sample is at the head */
+  event.count = scope_config.pre_trigger + scope_config.post_trigger;
+  event.pre_trigger = scope_config.pre_trigger;
+  event.source = trigger_source;
+
+  if(EXTFLASH_WriteEvent(image, ring, event.count, ring_head, &event) == EXTFLASH_OK)
+  {
+    stats.events++;
+    stats.last_event = event.number;
+    retval = MAGSCOPE_OK;
+  }
+  else
+  {
+    stats.failures++;
+    DLOG1(DLOG_MAGSCOPE_FAILED, event.count);
+  }
+
+  DMAPOOL_Release(image);
+
+  taskENTER_CRITICAL();
+  if(stats.state == MAGSCOPE_STATE_COMPLETE)
+    MAGSCOPE_Restart();
+  taskEXIT_CRITICAL();
+
+  return retval;
+}
+
+/**
+  * @brief Gets a copy of the capture statistics
+  * @param copy: Where the statistics are copied
+  */
+void MAGSCOPE_GetStats(MAGSCOPE_StatsTypeDef *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  taskEXIT_CRITICAL();
+}
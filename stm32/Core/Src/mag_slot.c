@@ -0,0 +1,71 @@
+/**
+  ******************************************************************************
+  * @file mag_slot.c
+  * @author fdominguez
+  * @brief This file provides the sample slot scheduler shared by the single
+  * conversion modes (power scheduler and magnetometer array). Samples are
+  * taken on a fixed cadence of RTOS ticks, the task sleeps between them.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "mag_slot.h"
+#include "lis3mdl.h"
+#include "mag_array.h"
+#include "cmsis_os.h"
+
+/**
+  * @brief Checks that the primary sensor configuration and a period can be
+  * run in single conversion mode
+  * @param period_ms: Sample period in milliseconds
+  * @retval MAGSLOT Status, error with FAST_ODR (continuous only)
+  */
+MAGSLOT_StatusTypeDef MAGSLOT_Check(uint32_t period_ms)
+{
+  LIS3MDL_ConfigTypeDef config;
+
+  if(period_ms < MAGSLOT_MIN_PERIOD_MS || period_ms > MAGSLOT_MAX_PERIOD_MS)
+    return MAGSLOT_ERROR;
+
+  LIS3MDL_GetConfig(MAGARRAY_PRIMARY, &config);
+  if(config.odr == LIS3MDL_ODR_FAST)
+    return MAGSLOT_ERROR;
+
+  return MAGSLOT_OK;
+}
+
+/**
+  * @brief Sets the period, the first slot is the current tick
+  * @param hslot: Slot scheduler
+  * @param period_ms: Sample period in milliseconds
+  */
+void MAGSLOT_Start(MAGSLOT_HandleTypeDef *hslot, uint32_t period_ms)
+{
+  hslot->period_ms = period_ms;
+  hslot->next_slot = osKernelSysTick() - period_ms;
+}
+
+/**
+  * @brief Sleeps until the next sample slot. Slots already gone are skipped,
+  * so a late sample does not shift the cadence
+  * @param hslot: Slot scheduler
+  * @retval Number of slots skipped
+  */
+uint32_t MAGSLOT_Wait(MAGSLOT_HandleTypeDef *hslot)
+{
+  uint32_t now = osKernelSysTick();
+  uint32_t late = 0;
+
+  hslot->next_slot += hslot->period_ms;
+  while((int32_t)(hslot->next_slot - now) < 0)
+  {
+    hslot->next_slot += hslot->period_ms;
+    late++;
+  }
+
+  if(hslot->next_slot != now)
+    osDelay(hslot->next_slot - now);
+
+  return late;
+}
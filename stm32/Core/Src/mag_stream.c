@@ -0,0 +1,249 @@
+/**
+  ******************************************************************************
+  * @file mag_stream.c
+  * @author fdominguez
+  * @brief This file provides the live streaming of new samples. The
+  * magnetometer task pushes every sample it produces into a RAM ring,
+  * whether it is stored or not, and wakes the UART task once a batch is
+  * ready; the UART task sends them. The flash is never read, so a sample
+  * reaches the host milliseconds after the conversion. Samples are
+  * numbered, the ones lost when the UART falls behind leave gaps in the
+  * sequence and are counted.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "mag_stream.h"
+#include "uart_rx.h"
+#include "usart.h"
+#include "cmsis_os.h"
+#include "fmt.h"
+
+typedef struct
+{
+  EXTFLASH_RecordTypeDef record;
+  uint32_t sequence;
+} MAGSTREAM_EntryTypeDef;
+
+static MAGSTREAM_ConfigTypeDef stream_config = { 0, PROTO_STREAM_MAX };
+/* Minimum milliseconds between samples, from the rate */
+static uint32_t interval_ms;
+static uint32_t last_tick;
+
+/* Written by the magnetometer task at the head, read by the UART task at
+ * the tail */
+static MAGSTREAM_EntryTypeDef ring[MAGSTREAM_RING_SIZE];
+static volatile uint32_t head;
+static volatile uint32_t tail;
+
+/* PROTO_MSG_STREAM being filled, UART task only */
+static uint8_t payload[PROTO_MAX_PAYLOAD];
+static uint32_t reported_overflows;
+
+static volatile MAGSTREAM_StatsTypeDef stats;
+
+/**
+  * @brief Samples waiting in the ring
+  */
+static uint32_t MAGSTREAM_Count(void)
+{
+  return (head + MAGSTREAM_RING_SIZE - tail) % MAGSTREAM_RING_SIZE;
+}
+
+/**
+  * @brief Sends a stream message
+  * @param count: Samples in the payload
+  */
+static void MAGSTREAM_Flush(uint32_t count)
+{
+  if(count == 0)
+    return;
+
+  PROTO_Put32(&payload[4], stats.overflows);
+  payload[8] = count;
+  PROTO_Send(PROTO_MSG_STREAM, payload, 9 + count * PROTO_PACKED_RECORD_SIZE);
+  stats.messages++;
+}
+
+/**
+  * @brief Sets the rate limit and batch size, at once if streaming
+  * @param config: Rate limit and batch size
+  * @retval MAGSTREAM Status
+  */
+MAGSTREAM_StatusTypeDef MAGSTREAM_Configure(const MAGSTREAM_ConfigTypeDef *config)
+{
+  if(config->batch == 0 || config->batch > PROTO_STREAM_MAX)
+    return MAGSTREAM_ERROR;
+
+  taskENTER_CRITICAL();
+  stream_config = *config;
+  interval_ms = (config->rate > 0) ? (1000 / config->rate) : 0;
+  taskEXIT_CRITICAL();
+
+  return MAGSTREAM_OK;
+}
+
+/**
+  * @brief Starts streaming, the ring and the statistics are cleared
+  */
+void MAGSTREAM_Subscribe(void)
+{
+  taskENTER_CRITICAL();
+  /* The first sample always goes */
+  last_tick = osKernelSysTick() - interval_ms;
+  tail = head;
+  stats.sequence = 0;
+  stats.sent = 0;
+  stats.overflows = 0;
+  stats.limited = 0;
+  stats.messages = 0;
+  reported_overflows = 0;
+  stats.subscribed = 1;
+  taskEXIT_CRITICAL();
+}
+
+/**
+  * @brief Stops streaming, samples not sent yet are discarded. The
+  * statistics are kept
+  */
+void MAGSTREAM_Unsubscribe(void)
+{
+  taskENTER_CRITICAL();
+  stats.subscribed = 0;
+  tail = head;
+  taskEXIT_CRITICAL();
+}
+
+/**
+  * @brief Tells if there is a subscriber
+  * @retval 1 if streaming
+  */
+uint32_t MAGSTREAM_IsSubscribed(void)
+{
+  return stats.subscribed;
+}
+
+/**
+  * @brief Gets the rate limit and batch size
+  * @param config: Where they are copied
+  */
+void MAGSTREAM_GetConfig(MAGSTREAM_ConfigTypeDef *config)
+{
+  *config = stream_config;
+}
+
+/**
+  * @brief Offers a new sample, magnetometer task. Never waits: a sample is
+  * dropped if the ring is full
+  * @param sample: Sample as stored
+  */
+void MAGSTREAM_Push(const EXTFLASH_RecordTypeDef *sample)
+{
+  uint32_t next, batch, now;
+
+  if(!stats.subscribed)
+    return;
+
+  now = osKernelSysTick();
+  if(interval_ms > 0 && (now - last_tick) < interval_ms)
+  {
+    stats.limited++;
+    return;
+  }
+  last_tick = now;
+
+  /* A subscription may restart meanwhile */
+  taskENTER_CRITICAL();
+  next = (head + 1) % MAGSTREAM_RING_SIZE;
+  if(next == tail)
+  {
+    stats.overflows++;
+    stats.sequence++;
+    taskEXIT_CRITICAL();
+    return;
+  }
+
+  ring[head].record = *sample;
+  ring[head].sequence = stats.sequence++;
+  head = next;
+  taskEXIT_CRITICAL();
+
+  /* Text mode sends every sample right away */
+  batch = (PROTO_GetMode() == PROTO_MODE_BINARY) ? stream_config.batch : 1;
+  if(MAGSTREAM_Count() >= batch)
+    UARTRX_Wake();
+}
+
+/**
+  * @brief Sends the samples waiting in the ring, UART task. Binary mode
+  * packs up to a batch of consecutive samples per PROTO_MSG_STREAM, text
+  * mode prints "LIVE <seq> <x> <y> <z> <temp>" lines and "LIVE DROP <n>"
+  * with the samples lost since the previous one
+  */
+void MAGSTREAM_Drain(void)
+{
+  const MAGSTREAM_EntryTypeDef *entry;
+  uint32_t count = 0, first = 0, overflows;
+  char line[48];
+
+  if(!stats.subscribed)
+    return;
+
+  while(tail != head)
+  {
+    entry = &ring[tail];
+
+    if(PROTO_GetMode() == PROTO_MODE_TEXT)
+    {
+      FMT_Format(line, "LIVE %lu %d %d %d %d\r\n", entry->sequence, entry->record.mag_x,
+          entry->record.mag_y, entry->record.mag_z, entry->record.temp);
+      SERIAL_SEND(line);
+    }
+    else
+    {
+      /* A message holds consecutive samples only */
+      if(count > 0 && entry->sequence != first + count)
+      {
+        MAGSTREAM_Flush(count);
+        count = 0;
+      }
+      if(count == 0)
+      {
+        first = entry->sequence;
+        PROTO_Put32(payload, first);
+      }
+      PROTO_PackRecord(&payload[9 + count * PROTO_PACKED_RECORD_SIZE], &entry->record);
+      if(++count == stream_config.batch)
+      {
+        MAGSTREAM_Flush(count);
+        count = 0;
+      }
+    }
+
+    /* Only now the slot can be written again */
+    tail = (tail + 1) % MAGSTREAM_RING_SIZE;
+    stats.sent++;
+  }
+
+  MAGSTREAM_Flush(count);
+
+  overflows = stats.overflows;
+  if(PROTO_GetMode() == PROTO_MODE_TEXT && overflows != reported_overflows)
+  {
+    FMT_Format(line, "LIVE DROP %lu\r\n", overflows - reported_overflows);
+    SERIAL_SEND(line);
+  }
+  reported_overflows = overflows;
+}
+
+/**
+  * @brief Gets a copy of the streaming statistics
+  * @param copy: Where the statistics are copied
+  */
+void MAGSTREAM_GetStats(MAGSTREAM_StatsTypeDef *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  taskEXIT_CRITICAL();
+}
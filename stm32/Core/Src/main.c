@@ -29,6 +29,9 @@
 /* USER CODE BEGIN Includes */
 #include "w25q80dv.h"
 #include "lis3mdl.h"
+#include "sysclock.h"
+#include "cycle_counter.h"
+#include "mag_cal.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -87,6 +90,13 @@ int main(void)
 
   /* USER CODE BEGIN SysInit */
 
+  /* Run from the PLL. SPI1 and USART1 dividers are computed from the
+   * resulting PCLK2 when they get initialized below */
+  if(SYSCLOCK_SetProfile(SYSCLOCK_PROFILE_PERFORMANCE) != SYSCLOCK_OK)
+  {
+    Error_Handler();
+  }
+
   /* USER CODE END SysInit */
 
   /* Initialize all configured peripherals */
@@ -96,6 +106,21 @@ int main(void)
   MX_USART1_UART_Init();
   /* USER CODE BEGIN 2 */
 
+  /* Time stamps for SPI tracing */
+  CYCCNT_Init();
+
+  /* Magnetometer DRDY on EXTI */
+  GPIO_MagInterrupts_Init();
+
+  /* Additional magnetometer chip selects */
+  GPIO_MagArray_Init();
+
+  /* USART1 RX edges for the auto-baud detection */
+  GPIO_UartAutoBaud_Init();
+
+  /* Stored magnetometer calibration */
+  MAGCAL_Init();
+
   /* USER CODE END 2 */
 
   /* Call init function for freertos objects (in freertos.c) */
@@ -0,0 +1,304 @@
+/**
+  ******************************************************************************
+  * @file proto.c
+  * @author fdominguez
+  * @brief This file provides the UART response protocol. Text mode prints
+  * human readable lines as before. Binary mode sends COBS framed messages
+  * with a type, a sequence number and a CRC-16: a record takes 18 bytes
+  * instead of about 110, and text output is wrapped in text messages so
+  * the host only has to parse one stream.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "proto.h"
+#include "uart_tx.h"
+#include "cmsis_os.h"
+#include "fmt.h"
+#include "cycle_counter.h"
+#include <string.h>
+
+static volatile PROTO_ModeTypeDef mode = PROTO_MODE_TEXT;
+static uint8_t sequence;
+
+/* Guards the buffers and the sequence number */
+static osSemaphoreId proto_semaphore;
+static uint8_t message[PROTO_MAX_MESSAGE];
+static uint8_t frame[PROTO_MAX_FRAME];
+
+/**
+  * @brief COBS encodes a message, no delimiter added
+  * @param data: Message
+  * @param size: Message size
+  * @param encoded: Encoded message, up to size + size / 254 + 1 bytes
+  * @retval Encoded size
+  */
+static uint32_t PROTO_CobsEncode(const uint8_t *data, uint32_t size, uint8_t *encoded)
+{
+  uint32_t read_index = 0, write_index = 1, code_index = 0;
+  uint8_t code = 1;
+
+  while(read_index < size)
+  {
+    if(data[read_index] == 0)
+    {
+      encoded[code_index] = code;
+      code = 1;
+      code_index = write_index++;
+    }
+    else
+    {
+      encoded[write_index++] = data[read_index];
+      code++;
+      /* A full block carries no zero */
+      if(code == 0xFF)
+      {
+        encoded[code_index] = code;
+        code = 1;
+        code_index = write_index++;
+      }
+    }
+    read_index++;
+  }
+  encoded[code_index] = code;
+
+  return write_index;
+}
+
+/**
+  * @brief Creates the semaphore guarding the message buffers. Call once
+  * before the scheduler starts
+  */
+void PROTO_Init(void)
+{
+  osSemaphoreDef(ProtoSemaphore);
+  proto_semaphore = osSemaphoreCreate(osSemaphore(ProtoSemaphore), 1);
+}
+
+/**
+  * @brief Selects how responses are sent
+  * @param new_mode: Text or binary
+  */
+void PROTO_SetMode(PROTO_ModeTypeDef new_mode)
+{
+  mode = new_mode;
+}
+
+/**
+  * @brief Gets how responses are sent
+  * @retval Text or binary
+  */
+PROTO_ModeTypeDef PROTO_GetMode(void)
+{
+  return mode;
+}
+
+/**
+  * @brief CRC-16/CCITT-FALSE, bit by bit
+  * @param data: Bytes
+  * @param size: Number of bytes
+  * @param crc: 0xFFFF, or the CRC so far to continue it
+  * @retval CRC
+  */
+uint16_t PROTO_Crc16(const uint8_t *data, uint32_t size, uint16_t crc)
+{
+  uint32_t bit;
+
+  while(size--)
+  {
+    crc ^= (uint16_t)(*data++) << 8;
+    for(bit = 0; bit < 8; bit++)
+      crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+  }
+
+  return crc;
+}
+
+/**
+  * @brief Stores a little endian payload field
+  * @param data: Where it is stored
+  * @param value: Value
+  * @retval Next byte of the payload
+  */
+uint8_t* PROTO_Put16(uint8_t *data, uint16_t value)
+{
+  data[0] = value & 0xFF;
+  data[1] = (value >> 8) & 0xFF;
+  return data + 2;
+}
+
+/**
+  * @brief Stores a little endian payload field
+  * @param data: Where it is stored
+  * @param value: Value
+  * @retval Next byte of the payload
+  */
+uint8_t* PROTO_Put32(uint8_t *data, uint32_t value)
+{
+  data = PROTO_Put16(data, value & 0xFFFF);
+  return PROTO_Put16(data, value >> 16);
+}
+
+/**
+  * @brief Packs the values of a record, PROTO_PACKED_RECORD_SIZE bytes
+  * @param data: Where it is stored
+  * @param record: Record
+  * @retval Next byte of the payload
+  */
+uint8_t* PROTO_PackRecord(uint8_t *data, const EXTFLASH_RecordTypeDef *record)
+{
+  data = PROTO_Put16(data, record->mag_x);
+  data = PROTO_Put16(data, record->mag_y);
+  data = PROTO_Put16(data, record->mag_z);
+  return PROTO_Put16(data, record->temp);
+}
+
+/**
+  * @brief Sends a binary message, whatever the mode
+  * @param type: Message type
+  * @param payload: Payload
+  * @param size: Payload size, up to PROTO_MAX_PAYLOAD
+  * @retval PROTO Status
+  */
+PROTO_StatusTypeDef PROTO_Send(PROTO_MessageTypeDef type, const uint8_t *payload, uint32_t size)
+{
+  uint32_t length;
+  uint16_t crc;
+  PROTO_StatusTypeDef retval = PROTO_ERROR;
+
+  if(size > PROTO_MAX_PAYLOAD)
+    return PROTO_ERROR;
+
+  if(osSemaphoreWait(proto_semaphore, osWaitForever) != osOK)
+    return PROTO_ERROR;
+
+  message[0] = type;
+  message[1] = sequence++;
+  memcpy(&message[PROTO_HEADER_SIZE], payload, size);
+  length = PROTO_HEADER_SIZE + size;
+  crc = PROTO_Crc16(message, length, 0xFFFF);
+  PROTO_Put16(&message[length], crc);
+  length += PROTO_CRC_SIZE;
+
+  length = PROTO_CobsEncode(message, length, frame);
+  frame[length++] = 0x00;
+
+  if(UARTTX_Write(frame, length) == UARTTX_OK)
+    retval = PROTO_OK;
+
+  osSemaphoreRelease(proto_semaphore);
+
+  return retval;
+}
+
+/**
+  * @brief Sends text. In binary mode it goes in text messages
+  * @param str: NUL terminated text
+  * @retval PROTO Status
+  */
+PROTO_StatusTypeDef PROTO_SendText(const char *str)
+{
+  uint32_t size, chunk;
+
+  if(mode == PROTO_MODE_TEXT)
+    return (UARTTX_Send(str) == UARTTX_OK) ? PROTO_OK : PROTO_ERROR;
+
+  size = strlen(str);
+  do
+  {
+    chunk = (size < PROTO_MAX_PAYLOAD) ? size : PROTO_MAX_PAYLOAD;
+    if(PROTO_Send(PROTO_MSG_TEXT, (const uint8_t*)str, chunk) != PROTO_OK)
+      return PROTO_ERROR;
+    str += chunk;
+    size -= chunk;
+  } while(size > 0);
+
+  return PROTO_OK;
+}
+
+/**
+  * @brief Sends a stored record
+  * @param id: Record ID
+  * @param record: Record
+  * @retval PROTO Status
+  */
+PROTO_StatusTypeDef PROTO_SendRecord(uint32_t id, const EXTFLASH_RecordTypeDef *record)
+{
+  uint8_t payload[12], *data;
+  /* Off the task stack, the UART task is the only caller */
+  static char text[128];
+  uint32_t start, length;
+
+  if(mode == PROTO_MODE_BINARY)
+  {
+    data = PROTO_Put32(payload, id);
+    PROTO_PackRecord(data, record);
+    return PROTO_Send(PROTO_MSG_RECORD, payload, sizeof(payload));
+  }
+
+  /* One template for the four lines, queued at once */
+  start = CYCCNT_Get();
+  length = FMT_Format(text, "Magnetometer x value = %d\r\nMagnetometer y value = %d\r\n"
+      "Magnetometer z value = %d\r\nTemperature value = %d\r\n",
+      record->mag_x, record->mag_y, record->mag_z, record->temp);
+  FMT_AccountRecord(CYCCNT_Get() - start);
+
+  return (UARTTX_Write((const uint8_t*)text, length) == UARTTX_OK) ? PROTO_OK : PROTO_ERROR;
+}
+
+/**
+  * @brief Sends an error response
+  * @param code: Error
+  * @param id: Record ID it refers to, 0 if none
+  * @retval PROTO Status
+  */
+PROTO_StatusTypeDef PROTO_SendError(PROTO_ErrorTypeDef code, uint32_t id)
+{
+  uint8_t payload[5];
+
+  if(mode == PROTO_MODE_BINARY)
+  {
+    payload[0] = code;
+    PROTO_Put32(&payload[1], id);
+    return PROTO_Send(PROTO_MSG_ERROR, payload, sizeof(payload));
+  }
+
+  if(code == PROTO_ERR_NOT_FOUND)
+    return PROTO_SendText("Error. Data not found.\r\n");
+
+  return PROTO_SendText("Error. Unknown command.\r\n");
+}
+
+/**
+  * @brief Sends the response of a tagged lookup, "#<tag> <id> <x> <y> <z>
+  * <temp>" or "#<tag> <id> NOT FOUND" in text mode
+  * @param tag: Request tag
+  * @param id: Record ID
+  * @param record: Record, NULL if not found
+  * @retval PROTO Status
+  */
+PROTO_StatusTypeDef PROTO_SendTagged(uint16_t tag, uint32_t id, const EXTFLASH_RecordTypeDef *record)
+{
+  uint8_t payload[15], *data;
+  /* UART task only, off its stack */
+  static char line[64];
+
+  if(mode == PROTO_MODE_BINARY)
+  {
+    data = PROTO_Put16(payload, tag);
+    data = PROTO_Put32(data, id);
+    *data++ = (record == NULL) ? PROTO_ERR_NOT_FOUND : 0;
+    if(record != NULL)
+      data = PROTO_PackRecord(data, record);
+    return PROTO_Send(PROTO_MSG_TAGGED, payload, data - payload);
+  }
+
+  if(record == NULL)
+    FMT_Format(line, "#%u %lu NOT FOUND\r\n", tag, id);
+  else
+    FMT_Format(line, "#%u %lu %d %d %d %d\r\n", tag, id, record->mag_x, record->mag_y,
+        record->mag_z, record->temp);
+
+  return (UARTTX_Send(line) == UARTTX_OK) ? PROTO_OK : PROTO_ERROR;
+}
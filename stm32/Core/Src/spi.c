@@ -22,6 +22,22 @@
 
 /* USER CODE BEGIN 0 */
 
+/* SPI1 prescaler (CR1 BR bits) computed for each device on the bus */
+static uint32_t spi1_device_prescaler[SPI1_DEVICE_COUNT];
+
+/* Maximum SCK frequency of each device on the bus */
+static const uint32_t spi1_device_max_sck[SPI1_DEVICE_COUNT] =
+{
+  [SPI1_DEVICE_FLASH] = SPI1_FLASH_MAX_SCK_HZ,
+  [SPI1_DEVICE_MAG] = SPI1_MAG_MAX_SCK_HZ
+};
+
+/* Current bus owner (SPI1_OwnerTypeDef) */
+static volatile uint32_t spi1_bus_owner = SPI1_OWNER_NONE;
+/* Chip select nesting of the task owner (e.g. W25Q80DV_Reset reads the
+ * status register with its own chip select already asserted) */
+static uint32_t spi1_task_nesting;
+
 /* USER CODE END 0 */
 
 SPI_HandleTypeDef hspi1;
@@ -147,6 +163,129 @@ void HAL_SPI_MspDeInit(SPI_HandleTypeDef* spiHandle)
 
 /* USER CODE BEGIN 1 */
 
+/**
+  * @brief Recomputes the SPI1 prescaler of every device from the current
+  * PCLK2 frequency. Must be called after every system clock change.
+  */
+void SPI1_UpdateClocks(void)
+{
+  uint32_t pclk2 = HAL_RCC_GetPCLK2Freq();
+  uint32_t max_sck, baud_rate;
+  uint32_t device;
+
+  for(device = 0; device < SPI1_DEVICE_COUNT; device++)
+  {
+    max_sck = spi1_device_max_sck[device];
+    if(max_sck > SPI1_MAX_SCK_HZ)
+      max_sck = SPI1_MAX_SCK_HZ;
+
+    /* BR[2:0] = n divides PCLK2 by 2^(n+1), pick the fastest one allowed */
+    for(baud_rate = 0; baud_rate < 7; baud_rate++)
+    {
+      if((pclk2 >> (baud_rate + 1)) <= max_sck)
+        break;
+    }
+
+    spi1_device_prescaler[device] = baud_rate << SPI_CR1_BR_Pos;
+  }
+}
+
+/**
+  * @brief Sets the SPI1 clock for the device about to be selected.
+  * The bus must be idle (no transfer in progress).
+  * @param device: Device to be addressed
+  */
+void SPI1_SelectDevice(SPI1_DeviceTypeDef device)
+{
+  uint32_t prescaler = spi1_device_prescaler[device];
+
+  if(READ_BIT(hspi1.Instance->CR1, SPI_CR1_BR) != prescaler)
+  {
+    /* BR must not be changed while SPI is enabled. HAL re-enables it
+     * on the next transfer */
+    __HAL_SPI_DISABLE(&hspi1);
+    MODIFY_REG(hspi1.Instance->CR1, SPI_CR1_BR, prescaler);
+    hspi1.Init.BaudRatePrescaler = prescaler;
+  }
+}
+
+/**
+  * @brief Gets the SPI1 clock used for a device at the current PCLK2
+  * frequency
+  * @param device: Device addressed
+  * @retval SCK frequency (Hz)
+  */
+uint32_t SPI1_GetDeviceSck(SPI1_DeviceTypeDef device)
+{
+  return HAL_RCC_GetPCLK2Freq() >> ((spi1_device_prescaler[device] >> SPI_CR1_BR_Pos) + 1);
+}
+
+/**
+  * @brief Tries to take the SPI1 bus. Safe to call from ISRs.
+  * @param owner: Who takes the bus
+  * @retval 1 if taken, 0 if someone else owns it
+  */
+uint32_t SPI1_TryAcquireBus(SPI1_OwnerTypeDef owner)
+{
+  /* Only the task holding SPISemaphore gets here as SPI1_OWNER_TASK */
+  if(owner == SPI1_OWNER_TASK && spi1_bus_owner == SPI1_OWNER_TASK)
+  {
+    spi1_task_nesting++;
+    return 1;
+  }
+
+  do
+  {
+    if(__LDREXW(&spi1_bus_owner) != SPI1_OWNER_NONE)
+    {
+      __CLREX();
+      return 0;
+    }
+  } while(__STREXW(owner, &spi1_bus_owner) != 0);
+
+  __DMB();
+
+  if(owner == SPI1_OWNER_TASK)
+    spi1_task_nesting = 1;
+
+  return 1;
+}
+
+/**
+  * @brief Gives back the SPI1 bus taken with SPI1_TryAcquireBus
+  * @param owner: Who releases the bus
+  */
+void SPI1_ReleaseBus(SPI1_OwnerTypeDef owner)
+{
+  if(owner == SPI1_OWNER_TASK && --spi1_task_nesting > 0)
+    return;
+
+  __DMB();
+  spi1_bus_owner = SPI1_OWNER_NONE;
+
+  SPI1_BusReleasedCallback();
+}
+
+/**
+  * @brief Gets the current SPI1 bus owner
+  * @retval Owner
+  */
+SPI1_OwnerTypeDef SPI1_GetBusOwner(void)
+{
+  return (SPI1_OwnerTypeDef)spi1_bus_owner;
+}
+
+/**
+  * @brief Called every time the SPI1 bus becomes free, from the context
+  * of whoever released it
+  */
+__weak void SPI1_BusReleasedCallback(void)
+{
+  /* NOTE : This function should not be modified, when the callback is needed,
+            the SPI1_BusReleasedCallback could be implemented in the user file
+   */
+}
+
 /* USER CODE END 1 */
 
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -0,0 +1,155 @@
+/**
+  ******************************************************************************
+  * @file spi_trace.c
+  * @author fdominguez
+  * @brief This file provides SPI transaction tracing. Every transaction
+  * (chip select assert to release) is time stamped with the DWT cycle counter,
+  * tagged by device and opcode and accumulated into log2 histograms.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "spi_trace.h"
+#include "cycle_counter.h"
+#include "usart.h"
+#include "w25q80dv.h"
+#include "lis3mdl.h"
+#include "fmt.h"
+#include <string.h>
+
+#ifdef SPI_TRACE_ENABLED
+
+static const char * const tag_names[SPI_TRACE_TAG_COUNT] =
+{
+  [SPI_TRACE_FLASH_READ] = "FLASH_READ",
+  [SPI_TRACE_FLASH_PAGE_PROGRAM] = "FLASH_PAGE_PROGRAM",
+  [SPI_TRACE_FLASH_ERASE_SECTOR] = "FLASH_ERASE_SECTOR",
+  [SPI_TRACE_FLASH_STATUS] = "FLASH_STATUS",
+  [SPI_TRACE_FLASH_OTHER] = "FLASH_OTHER",
+  [SPI_TRACE_MAG_BURST] = "MAG_BURST",
+  [SPI_TRACE_MAG_OTHER] = "MAG_OTHER"
+};
+
+static SPI_TRACE_HistogramTypeDef histograms[SPI_TRACE_TAG_COUNT];
+
+SPI_TRACE_CurrentTypeDef spi_trace_current;
+
+/**
+  * @brief Classifies the current transaction
+  * @retval Histogram tag
+  */
+static SPI_TRACE_TagTypeDef SPI_TRACE_Classify(void)
+{
+  uint8_t opcode = spi_trace_current.opcode;
+
+  if(spi_trace_current.device == SPI1_DEVICE_MAG)
+  {
+    /* Read (0x80) with address auto increment (0x40) of the status and
+     * output registers */
+    if((opcode & 0xC0) == 0xC0 && (opcode & 0x3F) >= LIS3MDL_STATUS_REG
+        && (opcode & 0x3F) <= LIS3MDL_TEMP_OUT_H)
+      return SPI_TRACE_MAG_BURST;
+    return SPI_TRACE_MAG_OTHER;
+  }
+
+  switch(opcode)
+  {
+    case W25Q80DV_READ:
+      return SPI_TRACE_FLASH_READ;
+    case W25Q80DV_PAGE_PROGRAM:
+      return SPI_TRACE_FLASH_PAGE_PROGRAM;
+    case W25Q80DV_ERASE_SECTOR:
+      return SPI_TRACE_FLASH_ERASE_SECTOR;
+    case W25Q80DV_STATUS_REG_1:
+    case W25Q80DV_STATUS_REG_2:
+      return SPI_TRACE_FLASH_STATUS;
+    default:
+      return SPI_TRACE_FLASH_OTHER;
+  }
+}
+
+/**
+  * @brief Marks the end of a transaction (chip select released) and adds it
+  * to its histogram
+  */
+void SPI_TRACE_End(void)
+{
+  SPI_TRACE_HistogramTypeDef *histogram;
+  uint32_t cycles, bucket;
+
+  if(!spi_trace_current.active)
+    return;
+
+  cycles = DWT->CYCCNT - spi_trace_current.start;
+  spi_trace_current.active = 0;
+
+  if(!spi_trace_current.opcode_set)
+    return;
+
+  histogram = &histograms[SPI_TRACE_Classify()];
+
+  /* log2 bucket: number of significant bits */
+  bucket = 32 - __CLZ(cycles | 1);
+  if(bucket >= SPI_TRACE_BUCKETS)
+    bucket = SPI_TRACE_BUCKETS - 1;
+
+  histogram->count++;
+  histogram->total_cycles += cycles;
+  if(cycles > histogram->max_cycles)
+    histogram->max_cycles = cycles;
+  histogram->buckets[bucket]++;
+}
+
+#endif /* SPI_TRACE_ENABLED */
+
+/**
+  * @brief Clears every histogram
+  */
+void SPI_TRACE_Reset(void)
+{
+#ifdef SPI_TRACE_ENABLED
+  memset(histograms, 0, sizeof(histograms));
+#endif
+}
+
+/**
+  * @brief Sends every non empty histogram via UART
+  */
+void SPI_TRACE_Dump(void)
+{
+#ifndef SPI_TRACE_ENABLED
+  SERIAL_SEND("SPI trace disabled\r\n");
+#else
+  char line[64];
+  uint32_t tag, bucket;
+  SPI_TRACE_HistogramTypeDef *histogram;
+
+  for(tag = 0; tag < SPI_TRACE_TAG_COUNT; tag++)
+  {
+    histogram = &histograms[tag];
+    if(histogram->count == 0)
+      continue;
+
+    FMT_Format(line, "%s n=%lu avg=%luus max=%luus\r\n", tag_names[tag],
+        histogram->count,
+        CYCCNT_ToUs((uint32_t)(histogram->total_cycles / histogram->count)),
+        CYCCNT_ToUs(histogram->max_cycles));
+    SERIAL_SEND(line);
+
+    /* One line per non empty bucket: bound in cycles and count */
+    for(bucket = 0; bucket < SPI_TRACE_BUCKETS; bucket++)
+    {
+      if(histogram->buckets[bucket] == 0)
+        continue;
+
+      if(bucket < SPI_TRACE_BUCKETS - 1)
+        FMT_Format(line, "  <2^%lu: %lu\r\n", bucket, histogram->buckets[bucket]);
+      else
+        FMT_Format(line, "  >=2^%lu: %lu\r\n", bucket - 1, histogram->buckets[bucket]);
+      SERIAL_SEND(line);
+    }
+  }
+  SERIAL_SEND("END\r\n");
+#endif
+}
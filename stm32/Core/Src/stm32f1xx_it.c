@@ -24,6 +24,10 @@
 /* Private includes ----------------------------------------------------------*/
 /* USER CODE BEGIN Includes */
 #include "cmsis_os.h"
+#include "spi.h"
+#include "mag_acq.h"
+#include "uart_rx.h"
+#include "uart_baud.h"
 /* USER CODE END Includes */
 
 /* Private typedef -----------------------------------------------------------*/
@@ -65,6 +69,7 @@ extern TIM_HandleTypeDef htim1;
 
 /* USER CODE BEGIN EV */
 extern osMessageQId UARTQueueHandle;
+extern DMA_HandleTypeDef hdma_usart1_tx;
 extern osMessageQId SPITxQueueHandle;
 extern osMessageQId SPIRxQueueHandle;
 /* USER CODE END EV */
@@ -174,6 +179,12 @@ void DMA1_Channel2_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA1_Channel2_IRQn 0 */
 
+  /* Sampled before HAL, the acquisition completion releases the bus */
+  SPI1_OwnerTypeDef owner = SPI1_GetBusOwner();
+  /* HAL SPI also enables the half transfer interrupt, only the end of the
+   * transfer must wake the waiting task */
+  uint32_t transfer_complete = __HAL_DMA_GET_FLAG(&hdma_spi1_rx, __HAL_DMA_GET_TC_FLAG_INDEX(&hdma_spi1_rx));
+
   /* USER CODE END DMA1_Channel2_IRQn 0 */
   HAL_DMA_IRQHandler(&hdma_spi1_rx);
   /* USER CODE BEGIN DMA1_Channel2_IRQn 1 */
@@ -182,7 +193,9 @@ void DMA1_Channel2_IRQHandler(void)
   /* As this happens on an IRQ, the scheduler gets called before returning to
    * the last task in order to run the highest priority task available */
   /* We don't care the message sent, that's why is 0 */
-  osMessagePut(SPIRxQueueHandle, 0, 0);
+  /* Timer paced magnetometer bursts are completed in HAL_SPI_TxRxCpltCallback */
+  if(owner != SPI1_OWNER_MAG_ACQ && transfer_complete)
+    osMessagePut(SPIRxQueueHandle, 0, 0);
 
   /* USER CODE END DMA1_Channel2_IRQn 1 */
 }
@@ -194,6 +207,12 @@ void DMA1_Channel3_IRQHandler(void)
 {
   /* USER CODE BEGIN DMA1_Channel3_IRQn 0 */
 
+  /* Sampled before HAL, the acquisition completion releases the bus */
+  SPI1_OwnerTypeDef owner = SPI1_GetBusOwner();
+  /* HAL SPI also enables the half transfer interrupt, only the end of the
+   * transfer must wake the waiting task */
+  uint32_t transfer_complete = __HAL_DMA_GET_FLAG(&hdma_spi1_tx, __HAL_DMA_GET_TC_FLAG_INDEX(&hdma_spi1_tx));
+
   /* USER CODE END DMA1_Channel3_IRQn 0 */
   HAL_DMA_IRQHandler(&hdma_spi1_tx);
   /* USER CODE BEGIN DMA1_Channel3_IRQn 1 */
@@ -202,7 +221,9 @@ void DMA1_Channel3_IRQHandler(void)
   /* As this happens on an IRQ, the scheduler gets called before returning to
    * the last task in order to run the highest priority task available */
   /* We don't care the message sent, that's why is 0 */
-  osMessagePut(SPITxQueueHandle, 0, 0);
+  /* Timer paced magnetometer bursts are completed in HAL_SPI_TxRxCpltCallback */
+  if(owner != SPI1_OWNER_MAG_ACQ && transfer_complete)
+    osMessagePut(SPITxQueueHandle, 0, 0);
 
   /* USER CODE END DMA1_Channel3_IRQn 1 */
 }
@@ -218,7 +239,8 @@ void DMA1_Channel5_IRQHandler(void)
   HAL_DMA_IRQHandler(&hdma_usart1_rx);
   /* USER CODE BEGIN DMA1_Channel5_IRQn 1 */
 
-  /* UART Rx DMA */
+  /* UART Rx DMA, half or full ring: the task parses what is there even if
+   * the line never goes idle */
   /* As this happens on an IRQ, the scheduler gets called before returning to
    * the last task in order to run the highest priority task available */
   /* We don't care the message sent, that's why is 0 */
@@ -248,6 +270,9 @@ void USART1_IRQHandler(void)
 {
   /* USER CODE BEGIN USART1_IRQn 0 */
 
+  /* Line idle: end of a frame */
+  UARTRX_IRQHandler();
+
   /* USER CODE END USART1_IRQn 0 */
   HAL_UART_IRQHandler(&huart1);
   /* USER CODE BEGIN USART1_IRQn 1 */
@@ -257,5 +282,45 @@ void USART1_IRQHandler(void)
 
 /* USER CODE BEGIN 1 */
 
+/**
+  * @brief This function handles EXTI line0 interrupt (magnetometer INT).
+  */
+void EXTI0_IRQHandler(void)
+{
+  HAL_GPIO_EXTI_IRQHandler(INT_MAG_Pin);
+}
+
+/**
+  * @brief This function handles EXTI line1 interrupt (magnetometer DRDY).
+  */
+void EXTI1_IRQHandler(void)
+{
+  HAL_GPIO_EXTI_IRQHandler(DRDY_MAG_Pin);
+}
+
+/**
+  * @brief This function handles EXTI line[15:10] interrupts (USART1 RX edges).
+  */
+void EXTI15_10_IRQHandler(void)
+{
+  UARTBAUD_EdgeIRQHandler();
+}
+
+/**
+  * @brief This function handles DMA1 channel4 global interrupt (USART1 TX).
+  */
+void DMA1_Channel4_IRQHandler(void)
+{
+  HAL_DMA_IRQHandler(&hdma_usart1_tx);
+}
+
+/**
+  * @brief This function handles TIM3 global interrupt (magnetometer acquisition pacing).
+  */
+void TIM3_IRQHandler(void)
+{
+  MAGACQ_TimerIRQHandler();
+}
+
 /* USER CODE END 1 */
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
@@ -0,0 +1,151 @@
+/**
+  ******************************************************************************
+  * @file sysclock.c
+  * @author fdominguez
+  * @brief This file provides the system clock profiles. Switching profile
+  * keeps the HAL tick (TIM1), the FreeRTOS tick (SysTick), the SPI1 device
+  * prescalers, the USART1 baud rate and the acquisition timer (TIM3) in sync
+  * with the new clock tree.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "sysclock.h"
+#include "main.h"
+#include "FreeRTOS.h"
+#include "task.h"
+#include "cmsis_os.h"
+#include "spi.h"
+#include "usart.h"
+#include "mag_acq.h"
+
+/* SystemClock_Config() leaves the MCU running from the 8 MHz HSI */
+static SYSCLOCK_ProfileTypeDef current_profile = SYSCLOCK_PROFILE_LOW_POWER;
+
+/**
+  * @brief Starts the PLL and switches SYSCLK to it
+  * @retval HAL Status
+  */
+static HAL_StatusTypeDef SYSCLOCK_ConfigPerformance(void)
+{
+  RCC_OscInitTypeDef RCC_OscInitStruct = {0};
+  RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
+
+  /* Try the HSE crystal first */
+  RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSE;
+  RCC_OscInitStruct.HSEState = RCC_HSE_ON;
+  RCC_OscInitStruct.HSEPredivValue = RCC_HSE_PREDIV_DIV1;
+  RCC_OscInitStruct.PLL.PLLState = RCC_PLL_ON;
+  RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSE;
+  RCC_OscInitStruct.PLL.PLLMUL = SYSCLOCK_PLL_HSE_MUL;
+  if(HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
+  {
+    /* HSE did not start, stop it and use HSI/2 as PLL input */
+    RCC_OscInitStruct.HSEState = RCC_HSE_OFF;
+    RCC_OscInitStruct.PLL.PLLSource = RCC_PLLSOURCE_HSI_DIV2;
+    RCC_OscInitStruct.PLL.PLLMUL = SYSCLOCK_PLL_HSI_MUL;
+    if(HAL_RCC_OscConfig(&RCC_OscInitStruct) != HAL_OK)
+      return HAL_ERROR;
+  }
+
+  /* APB1 is limited to 36 MHz, APB2 (SPI1, USART1, TIM1) runs at HCLK.
+   * The SPI1 prescaler is then chosen per device in SPI1_SelectDevice() */
+  RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
+                              |RCC_CLOCKTYPE_PCLK1|RCC_CLOCKTYPE_PCLK2;
+  RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_PLLCLK;
+  RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
+  RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV2;
+  RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV1;
+
+  return HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_2);
+}
+
+/**
+  * @brief Switches SYSCLK back to the HSI and stops the PLL and HSE
+  * @retval HAL Status
+  */
+static HAL_StatusTypeDef SYSCLOCK_ConfigLowPower(void)
+{
+  RCC_OscInitTypeDef RCC_OscInitStruct = {0};
+  RCC_ClkInitTypeDef RCC_ClkInitStruct = {0};
+
+  RCC_ClkInitStruct.ClockType = RCC_CLOCKTYPE_HCLK|RCC_CLOCKTYPE_SYSCLK
+                              |RCC_CLOCKTYPE_PCLK1|RCC_CLOCKTYPE_PCLK2;
+  RCC_ClkInitStruct.SYSCLKSource = RCC_SYSCLKSOURCE_HSI;
+  RCC_ClkInitStruct.AHBCLKDivider = RCC_SYSCLK_DIV1;
+  RCC_ClkInitStruct.APB1CLKDivider = RCC_HCLK_DIV1;
+  RCC_ClkInitStruct.APB2CLKDivider = RCC_HCLK_DIV1;
+  if(HAL_RCC_ClockConfig(&RCC_ClkInitStruct, FLASH_LATENCY_0) != HAL_OK)
+    return HAL_ERROR;
+
+  /* PLL is no longer SYSCLK, so both it and the HSE can be stopped */
+  RCC_OscInitStruct.OscillatorType = RCC_OSCILLATORTYPE_HSE;
+  RCC_OscInitStruct.HSEState = RCC_HSE_OFF;
+  RCC_OscInitStruct.PLL.PLLState = RCC_PLL_OFF;
+
+  return HAL_RCC_OscConfig(&RCC_OscInitStruct);
+}
+
+/**
+  * @brief Switches the system clock profile. SPI1 and USART1 must be idle,
+  * so once the scheduler runs call it holding SPISemaphore.
+  * @param profile: Profile to switch to
+  * @retval SYSCLOCK Status
+  */
+SYSCLOCK_StatusTypeDef SYSCLOCK_SetProfile(SYSCLOCK_ProfileTypeDef profile)
+{
+  HAL_StatusTypeDef status;
+  int32_t kernel_running = osKernelRunning();
+  uint32_t waited;
+
+  if(profile == current_profile)
+    return SYSCLOCK_OK;
+
+  /* Queued UART output leaves at the old baud rate */
+  if(kernel_running)
+  {
+    for(waited = 0; UARTTX_Pending() > 0 && waited < UARTTX_TIMEOUT_MS; waited++)
+      osDelay(1);
+  }
+
+  /* Keep other tasks away from the buses while the clocks change. Interrupts
+   * stay enabled, as HAL_RCC_* need the HAL tick for their timeouts */
+  if(kernel_running)
+    vTaskSuspendAll();
+
+  if(profile == SYSCLOCK_PROFILE_PERFORMANCE)
+    status = SYSCLOCK_ConfigPerformance();
+  else
+    status = SYSCLOCK_ConfigLowPower();
+
+  /* HAL_RCC_ClockConfig() updated SystemCoreClock and reprogrammed the TIM1
+   * HAL tick. SysTick was set up by FreeRTOS from the old core clock */
+  if(kernel_running)
+  {
+    SysTick->LOAD = (SystemCoreClock / configTICK_RATE_HZ) - 1UL;
+    SysTick->VAL = 0UL;
+  }
+
+  /* Peripheral clocks may have changed even on error */
+  SPI1_UpdateClocks();
+  USART1_UpdateBaudRate();
+  MAGACQ_UpdateTimer();
+
+  if(status == HAL_OK)
+    current_profile = profile;
+
+  if(kernel_running)
+    xTaskResumeAll();
+
+  return (status == HAL_OK) ? SYSCLOCK_OK : SYSCLOCK_ERROR;
+}
+
+/**
+  * @brief Gets the current system clock profile
+  * @retval Current profile
+  */
+SYSCLOCK_ProfileTypeDef SYSCLOCK_GetProfile(void)
+{
+  return current_profile;
+}
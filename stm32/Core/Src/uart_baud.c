@@ -0,0 +1,281 @@
+/**
+  ******************************************************************************
+  * @file uart_baud.c
+  * @author fdominguez
+  * @brief This file provides the USART1 baud rate negotiation and auto-baud
+  * detection. A negotiated switch is announced at the old rate and must be
+  * confirmed by the host at the new one, else the old rate comes back. The
+  * STM32F1 USART has no hardware auto-baud: the edges of the first byte
+  * on the RX pin (EXTI) are time stamped with the cycle counter and the
+  * shortest pulse, one bit, gives the rate, rounded to a standard one.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "uart_baud.h"
+#include "uart_rx.h"
+#include "usart.h"
+#include "cycle_counter.h"
+#include "cmsis_os.h"
+#include "fmt.h"
+#include "dlog.h"
+#include <string.h>
+
+/* Rates the auto-baud detection rounds to. Faster ones are still reached
+ * by negotiation, their bits are too short to be measured from EXTI */
+static const uint32_t standard_rates[] =
+{
+  9600, 19200, 38400, 57600, 115200
+};
+
+static volatile uint32_t auto_armed;
+static uint32_t auto_start;
+/* Written by the EXTI interrupt */
+static volatile uint32_t edges[UARTBAUD_AUTO_EDGES];
+static volatile uint32_t edge_count;
+
+static UARTBAUD_StatsTypeDef stats;
+
+/**
+  * @brief Switches the rate once the queued output is sent at the old one
+  * @param baud: New rate, reachable
+  */
+static void UARTBAUD_Apply(uint32_t baud)
+{
+  uint32_t waited;
+
+  for(waited = 0; UARTTX_Pending() > 0 && waited < UARTTX_TIMEOUT_MS; waited++)
+    osDelay(1);
+
+  huart1.Init.BaudRate = baud;
+  USART1_UpdateBaudRate();
+}
+
+/**
+  * @brief Rounds a measured rate to a standard one
+  * @param measured: Measured rate
+  * @retval Standard rate, 0 if none is close enough
+  */
+static uint32_t UARTBAUD_Snap(uint32_t measured)
+{
+  uint32_t index, rate, error;
+
+  for(index = 0; index < sizeof(standard_rates) / sizeof(standard_rates[0]); index++)
+  {
+    rate = standard_rates[index];
+    /* Slower clock profiles resolve fewer rates */
+    if(SystemCoreClock / rate < UARTBAUD_AUTO_MIN_BIT_CYCLES)
+      break;
+    error = (measured > rate) ? (measured - rate) : (rate - measured);
+    if((uint64_t)error * 1000 <= (uint64_t)rate * UARTBAUD_AUTO_TOLERANCE_PERMILLE)
+      return rate;
+  }
+
+  return 0;
+}
+
+/**
+  * @brief Tells if USART1 can run at a rate from the current PCLK2
+  * @param baud: Rate
+  * @retval 1 if the divider error is within UARTBAUD_MAX_ERROR_PERMILLE
+  */
+uint32_t UARTBAUD_IsReachable(uint32_t baud)
+{
+  uint32_t pclk = HAL_RCC_GetPCLK2Freq(), divider, actual, error;
+
+  /* The divider is in 1/16ths with 16 times oversampling, 1.0 at least */
+  if(baud == 0 || baud > pclk / 16)
+    return 0;
+
+  divider = (pclk + baud / 2) / baud;
+  actual = pclk / divider;
+  error = (actual > baud) ? (actual - baud) : (baud - actual);
+
+  return ((uint64_t)error * 1000 <= (uint64_t)baud * UARTBAUD_MAX_ERROR_PERMILLE);
+}
+
+/**
+  * @brief Gets the highest rate at the current PCLK2, 4.5 Mbit/s at 72 MHz
+  */
+uint32_t UARTBAUD_GetMax(void)
+{
+  return HAL_RCC_GetPCLK2Freq() / 16;
+}
+
+/**
+  * @brief Gets the current rate
+  */
+uint32_t UARTBAUD_Get(void)
+{
+  return huart1.Init.BaudRate;
+}
+
+/**
+  * @brief Negotiated switch, UART task. "SWITCH <baud>" is sent at the old
+  * rate, then "RC" is expected at the new one within UARTBAUD_CONFIRM_MS
+  * and answered with "OK". Else "REVERT <baud>" is sent at the old rate
+  * @param baud: New rate
+  * @retval UARTBAUD Status, error if not reachable or not confirmed
+  */
+UARTBAUD_StatusTypeDef UARTBAUD_Negotiate(uint32_t baud)
+{
+  uint32_t old = huart1.Init.BaudRate, start, elapsed;
+  const char *frame;
+  char line[32];
+
+  if(!UARTBAUD_IsReachable(baud))
+    return UARTBAUD_ERROR;
+
+  FMT_Format(line, "SWITCH %lu\r\n", baud);
+  SERIAL_SEND(line);
+
+  UARTBAUD_Apply(baud);
+  /* Whatever arrived around the switch is garbage */
+  UARTRX_Start();
+
+  start = osKernelSysTick();
+  while((elapsed = osKernelSysTick() - start) < UARTBAUD_CONFIRM_MS)
+  {
+    frame = UARTRX_GetFrame(UARTBAUD_CONFIRM_MS - elapsed);
+    if(frame != NULL && strcmp(frame, "RC") == 0)
+    {
+      stats.switches++;
+      DLOG2(DLOG_BAUD_SWITCH, old, baud);
+      SERIAL_SEND("OK\r\n");
+      return UARTBAUD_OK;
+    }
+  }
+
+  UARTBAUD_Apply(old);
+  UARTRX_Start();
+  stats.reverts++;
+  DLOG2(DLOG_BAUD_REVERT, baud, old);
+
+  FMT_Format(line, "REVERT %lu\r\n", old);
+  SERIAL_SEND(line);
+
+  return UARTBAUD_ERROR;
+}
+
+/**
+  * @brief Starts time stamping the edges of the next byte
+  */
+static void UARTBAUD_AutoListen(void)
+{
+  edge_count = 0;
+  auto_armed = 1;
+
+  __HAL_GPIO_EXTI_CLEAR_IT(RX_UART_Pin);
+  EXTI->IMR |= RX_UART_Pin;
+}
+
+/**
+  * @brief Arms the auto-baud detection on the next byte received, for
+  * UARTBAUD_AUTO_TIMEOUT_MS at most
+  */
+void UARTBAUD_AutoArm(void)
+{
+  auto_start = osKernelSysTick();
+  UARTBAUD_AutoListen();
+}
+
+/**
+  * @brief Tells if the auto-baud detection waits for a byte
+  */
+uint32_t UARTBAUD_IsAutoArmed(void)
+{
+  return auto_armed;
+}
+
+/**
+  * @brief Completes the auto-baud detection once the first byte is over,
+  * UART task. "BAUD <baud>" is sent at the detected rate
+  * @retval 1 if the rate changed, the frame being handled is garbage
+  */
+uint32_t UARTBAUD_Poll(void)
+{
+  uint32_t count = edge_count, index, interval, shortest = UINT32_MAX, baud;
+  char line[32];
+
+  if(!auto_armed)
+    return 0;
+
+  /* Nothing came: keep the current rate and let the UART task sleep */
+  if(count == 0)
+  {
+    if((osKernelSysTick() - auto_start) >= UARTBAUD_AUTO_TIMEOUT_MS)
+    {
+      EXTI->IMR &= ~RX_UART_Pin;
+      auto_armed = 0;
+      stats.expired++;
+      DLOG1(DLOG_BAUD_EXPIRED, UARTBAUD_AUTO_TIMEOUT_MS);
+    }
+    return 0;
+  }
+
+  if((CYCCNT_Get() - edges[0]) < (SystemCoreClock / 1000) * UARTBAUD_AUTO_SETTLE_MS)
+    return 0;
+
+  EXTI->IMR &= ~RX_UART_Pin;
+  auto_armed = 0;
+
+  count = edge_count;
+  for(index = 1; index < count; index++)
+  {
+    interval = edges[index] - edges[index - 1];
+    if(interval < shortest)
+      shortest = interval;
+  }
+
+  baud = (count > 1) ? UARTBAUD_Snap(SystemCoreClock / shortest) : 0;
+  if(baud == 0 || !UARTBAUD_IsReachable(baud))
+  {
+    /* A glitch, or no isolated bit in the byte. Within the same time out,
+     * a noisy line does not keep the poll going */
+    stats.rejected++;
+    DLOG2(DLOG_BAUD_REJECTED, count, shortest);
+    UARTBAUD_AutoListen();
+    return 0;
+  }
+
+  stats.detected++;
+  DLOG2(DLOG_BAUD_DETECTED, baud, shortest);
+  if(baud == huart1.Init.BaudRate)
+    return 0;
+
+  UARTBAUD_Apply(baud);
+  UARTRX_Start();
+
+  FMT_Format(line, "BAUD %lu\r\n", baud);
+  SERIAL_SEND(line);
+
+  return 1;
+}
+
+/**
+  * @brief Gets a copy of the baud rate statistics
+  * @param copy: Where the statistics are copied
+  */
+void UARTBAUD_GetStats(UARTBAUD_StatsTypeDef *copy)
+{
+  *copy = stats;
+}
+
+/**
+  * @brief RX pin edge (EXTI15_10). Above the RTOS interrupt priorities so
+  * that critical sections do not delay the time stamps, no RTOS calls
+  */
+void UARTBAUD_EdgeIRQHandler(void)
+{
+  uint32_t now = CYCCNT_Get();
+
+  if(__HAL_GPIO_EXTI_GET_IT(RX_UART_Pin) == RESET)
+    return;
+  __HAL_GPIO_EXTI_CLEAR_IT(RX_UART_Pin);
+
+  if(edge_count < UARTBAUD_AUTO_EDGES)
+    edges[edge_count++] = now;
+  if(edge_count == UARTBAUD_AUTO_EDGES)
+    EXTI->IMR &= ~RX_UART_Pin;
+}
@@ -0,0 +1,304 @@
+/**
+  ******************************************************************************
+  * @file uart_rx.c
+  * @author fdominguez
+  * @brief This file provides the idle-line framed USART1 command receiver.
+  * The DMA writes every byte into a circular ring with no per-byte
+  * interrupt; the task follows the DMA write position (NDTR) and cuts
+  * frames at CR/LF, or where the line went idle for an unterminated
+  * frame. The IDLE interrupt and the half/full ring interrupts only wake
+  * the task, so commands can be pipelined back to back. Line pauses are
+  * queued, and the bytes written are counted across ring laps so that
+  * input overwritten before it was parsed is detected.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "uart_rx.h"
+#include "usart.h"
+#include "cmsis_os.h"
+#include "dlog.h"
+#include <string.h>
+
+/* Line pauses queued until the task reaches them, power of two */
+#define UARTRX_IDLE_SLOTS			4
+
+/* Why the frame being gathered is dropped */
+#define UARTRX_DROPPED_TOO_LONG		1
+#define UARTRX_DROPPED_OVERRUN		2
+
+extern osMessageQId UARTQueueHandle;
+
+static uint8_t ring[UARTRX_RING_SIZE];
+/* Next byte to be parsed */
+static uint32_t read_index;
+/* Bytes parsed and ring laps completed by the DMA since the start */
+static uint32_t read_count;
+static volatile uint32_t laps;
+/* DMA write positions where the line went idle. The interrupt adds at
+ * idle_head, the task takes from idle_tail */
+static volatile uint32_t idle_positions[UARTRX_IDLE_SLOTS];
+static volatile uint32_t idle_head;
+static volatile uint32_t idle_tail;
+/* Set by the error callback, the task starts the DMA again */
+static volatile uint32_t restart;
+/* Set by UARTRX_Wake, the waiting task returns without a frame */
+static volatile uint32_t wake;
+
+/* Frame being gathered, NUL terminated once complete */
+static char frame[UARTRX_MAX_FRAME + 1];
+static uint32_t frame_length;
+static uint32_t frame_dropped;
+
+static volatile UARTRX_StatsTypeDef stats;
+
+/**
+  * @brief Gets the DMA write position
+  * @retval Index of the next byte the DMA writes
+  */
+static uint32_t UARTRX_Head(void)
+{
+  return (UARTRX_RING_SIZE - __HAL_DMA_GET_COUNTER(huart1.hdmarx)) % UARTRX_RING_SIZE;
+}
+
+/**
+  * @brief Gets the DMA write position and the number of bytes written
+  * since the start
+  * @param head: Where the index of the next byte the DMA writes is stored
+  * @retval Bytes written, wraps around like read_count
+  */
+static uint32_t UARTRX_Written(uint32_t *head)
+{
+  uint32_t written;
+
+  taskENTER_CRITICAL();
+  *head = UARTRX_Head();
+  written = laps * UARTRX_RING_SIZE + *head;
+  /* Back at the ring start, but the lap is not counted by its interrupt
+   * yet */
+  if(__HAL_DMA_GET_FLAG(huart1.hdmarx, __HAL_DMA_GET_TC_FLAG_INDEX(huart1.hdmarx)) &&
+     *head < UARTRX_RING_SIZE / 2)
+    written += UARTRX_RING_SIZE;
+  taskEXIT_CRITICAL();
+
+  return written;
+}
+
+/**
+  * @brief Ends the frame being gathered
+  * @param idle: 1 if ended by a line pause
+  * @retval The frame, NULL if dropped
+  */
+static const char* UARTRX_EndFrame(uint32_t idle)
+{
+  uint32_t dropped = frame_dropped;
+
+  frame[frame_length] = '\0';
+  frame_length = 0;
+  frame_dropped = 0;
+
+  if(dropped)
+  {
+    if(dropped == UARTRX_DROPPED_TOO_LONG)
+      stats.too_long++;
+    return NULL;
+  }
+
+  stats.frames++;
+  if(idle)
+    stats.idle_frames++;
+
+  return frame;
+}
+
+/**
+  * @brief Starts the circular reception and the IDLE interrupt, from the
+  * ring start. A running reception is stopped first and anything not
+  * parsed yet is discarded. On failure it is tried again by the next
+  * UARTRX_GetFrame
+  */
+void UARTRX_Start(void)
+{
+  HAL_StatusTypeDef status;
+
+  frame_length = 0;
+  frame_dropped = 0;
+
+  /* The transmit completion shares the HAL lock. A circular reception
+   * never ends by itself: without the abort HAL_UART_Receive_DMA answers
+   * HAL_BUSY and the DMA goes on from its old position */
+  taskENTER_CRITICAL();
+  status = HAL_UART_AbortReceive(&huart1);
+  if(status == HAL_OK)
+  {
+    memset(ring, 0, sizeof(ring));
+    read_index = 0;
+    read_count = 0;
+    laps = 0;
+    idle_tail = idle_head;
+    status = HAL_UART_Receive_DMA(&huart1, ring, UARTRX_RING_SIZE);
+  }
+  taskEXIT_CRITICAL();
+
+  if(status != HAL_OK)
+  {
+    stats.errors++;
+    restart = 1;
+    return;
+  }
+
+  __HAL_UART_CLEAR_IDLEFLAG(&huart1);
+  __HAL_UART_ENABLE_IT(&huart1, UART_IT_IDLE);
+}
+
+/**
+  * @brief Waits for the next frame. Empty lines are skipped
+  * @param timeout: Milliseconds to wait for new input, osWaitForever
+  * @retval NUL terminated frame without its line terminator, valid until
+  * the next call. NULL on timeout, on UARTRX_Wake or if a frame was dropped
+  */
+const char* UARTRX_GetFrame(uint32_t timeout)
+{
+  osEvent event;
+  uint32_t head, written;
+  uint8_t c;
+
+  for(;;)
+  {
+    if(restart)
+    {
+      restart = 0;
+      UARTRX_Start();
+    }
+
+    written = UARTRX_Written(&head);
+
+    /* A full ring of unparsed bytes means the DMA went over the oldest
+     * ones: skip to the write position and drop the frame it cuts */
+    if(written - read_count >= UARTRX_RING_SIZE)
+    {
+      stats.overruns++;
+      read_index = head;
+      read_count = written;
+      idle_tail = idle_head;
+      frame_dropped = UARTRX_DROPPED_OVERRUN;
+    }
+
+    for(;;)
+    {
+      /* Bytes after a pause belong to the next frame */
+      if(idle_tail != idle_head &&
+         read_index == idle_positions[idle_tail % UARTRX_IDLE_SLOTS])
+      {
+        idle_tail++;
+        if(frame_length > 0 || frame_dropped)
+          return UARTRX_EndFrame(1);
+        continue;
+      }
+
+      if(read_index == head)
+        break;
+
+      c = ring[read_index];
+      read_index = (read_index + 1) % UARTRX_RING_SIZE;
+      read_count++;
+
+      if(c == '\r' || c == '\n')
+      {
+        if(frame_length > 0 || frame_dropped)
+          return UARTRX_EndFrame(0);
+        continue;
+      }
+
+      if(frame_length < UARTRX_MAX_FRAME)
+        frame[frame_length++] = c;
+      else if(!frame_dropped)
+        frame_dropped = UARTRX_DROPPED_TOO_LONG;
+    }
+
+    if(wake)
+    {
+      wake = 0;
+      return NULL;
+    }
+
+    /* Woken up by IDLE, half ring, full ring, an error or UARTRX_Wake */
+    event = osMessageGet(UARTQueueHandle, timeout);
+    if(event.status != osEventMessage)
+      return NULL;
+  }
+}
+
+/**
+  * @brief Makes the task waiting for a frame return without one, so it
+  * can do other work. Task context only
+  */
+void UARTRX_Wake(void)
+{
+  wake = 1;
+  osMessagePut(UARTQueueHandle, 0, 0);
+}
+
+/**
+  * @brief Gets a copy of the reception statistics
+  * @param copy: Where the statistics are copied
+  */
+void UARTRX_GetStats(UARTRX_StatsTypeDef *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  taskEXIT_CRITICAL();
+}
+
+/**
+  * @brief USART1 interrupt, before the HAL handler. Queues where the line
+  * went idle, the newest pause is dropped if the task is that far behind
+  */
+void UARTRX_IRQHandler(void)
+{
+  if(__HAL_UART_GET_FLAG(&huart1, UART_FLAG_IDLE) == RESET)
+    return;
+
+  __HAL_UART_CLEAR_IDLEFLAG(&huart1);
+
+  if(idle_head - idle_tail < UARTRX_IDLE_SLOTS)
+  {
+    idle_positions[idle_head % UARTRX_IDLE_SLOTS] = UARTRX_Head();
+    idle_head++;
+  }
+  osMessagePut(UARTQueueHandle, 0, 0);
+}
+
+/**
+  * @brief USART1 reception DMA reached the ring end and goes on from its
+  * start
+  * @param huart: UART handle
+  */
+void HAL_UART_RxCpltCallback(UART_HandleTypeDef *huart)
+{
+  if(huart == &huart1)
+    laps++;
+}
+
+/**
+  * @brief USART1 error: the HAL stops the reception DMA, the task starts
+  * it again. A transmit error is handed to the transmit queue
+  * @param huart: UART handle
+  */
+void HAL_UART_ErrorCallback(UART_HandleTypeDef *huart)
+{
+  if(huart != &huart1)
+    return;
+
+  UARTTX_ErrorCallback();
+
+  /* Only reception errors stop the reception DMA */
+  if(huart1.RxState != HAL_UART_STATE_READY)
+    return;
+
+  stats.errors++;
+  DLOG1(DLOG_UARTRX_ERROR, huart1.ErrorCode);
+  restart = 1;
+  osMessagePut(UARTQueueHandle, 0, 0);
+}
@@ -0,0 +1,202 @@
+/**
+  ******************************************************************************
+  * @file uart_tx.c
+  * @author fdominguez
+  * @brief This file provides the USART1 transmit queue. Writers copy their
+  * bytes into a ring and return, the ring is drained by USART1 TX DMA
+  * (DMA1 channel 4) one contiguous chunk at a time, and the next chunk is
+  * started from the transfer complete interrupt. A writer only waits when
+  * the ring is full.
+  * @date 10/19/2026
+  * @version 1.0.0
+  ******************************************************************************
+  */
+
+#include "uart_tx.h"
+#include "usart.h"
+#include "cmsis_os.h"
+#include "dlog.h"
+#include <string.h>
+
+static uint8_t ring[UARTTX_RING_SIZE];
+/* Next byte written */
+static volatile uint32_t head;
+/* Next byte sent */
+static volatile uint32_t tail;
+/* Bytes handed to the DMA, from the tail on */
+static volatile uint32_t in_flight;
+
+/* Room made for a waiting writer */
+static osMessageQId space_queue;
+static volatile uint32_t waiting;
+
+static volatile UARTTX_StatsTypeDef stats;
+
+/**
+  * @brief Bytes in the ring, sent or not
+  */
+static uint32_t UARTTX_Used(void)
+{
+  return (head + UARTTX_RING_SIZE - tail) % UARTTX_RING_SIZE;
+}
+
+/**
+  * @brief Starts the DMA on the next contiguous chunk, unless a transfer
+  * is running. Called with interrupts masked
+  */
+static void UARTTX_Kick(void)
+{
+  uint32_t length;
+
+  if(in_flight > 0 || head == tail)
+    return;
+
+  length = (head > tail) ? (head - tail) : (UARTTX_RING_SIZE - tail);
+
+  in_flight = length;
+  if(HAL_UART_Transmit_DMA(&huart1, &ring[tail], length) != HAL_OK)
+  {
+    /* Tried again by the next writer */
+    in_flight = 0;
+    stats.errors++;
+    DLOG1(DLOG_UARTTX_ERROR, length);
+    return;
+  }
+
+  stats.transfers++;
+}
+
+/**
+  * @brief Creates the queue writers wait on. Call once before the
+  * scheduler starts
+  */
+void UARTTX_Init(void)
+{
+  osMessageQDef(UARTTxSpaceQueue, 1, uint32_t);
+  space_queue = osMessageCreate(osMessageQ(UARTTxSpaceQueue), NULL);
+}
+
+/**
+  * @brief Queues bytes for transmission. Returns as soon as they are
+  * copied, waiting only while the ring is full
+  * @param data: Bytes to send
+  * @param size: Number of bytes
+  * @retval UARTTX Status, error if part of the data was dropped
+  */
+UARTTX_StatusTypeDef UARTTX_Write(const uint8_t *data, uint32_t size)
+{
+  uint32_t room, chunk, used;
+  osEvent event;
+
+  while(size > 0)
+  {
+    taskENTER_CRITICAL();
+
+    /* One slot is kept free so head == tail means empty */
+    room = UARTTX_RING_SIZE - 1 - UARTTX_Used();
+    chunk = (size < room) ? size : room;
+    if(chunk > UARTTX_RING_SIZE - head)
+      chunk = UARTTX_RING_SIZE - head;
+
+    if(chunk > 0)
+    {
+      memcpy(&ring[head], data, chunk);
+      head = (head + chunk) % UARTTX_RING_SIZE;
+      stats.bytes += chunk;
+      used = UARTTX_Used();
+      if(used > stats.peak)
+        stats.peak = used;
+      UARTTX_Kick();
+    }
+    else
+      waiting = 1;
+
+    taskEXIT_CRITICAL();
+
+    data += chunk;
+    size -= chunk;
+
+    if(chunk == 0)
+    {
+      stats.waits++;
+      event = osMessageGet(space_queue, UARTTX_TIMEOUT_MS);
+      if(event.status != osEventMessage)
+      {
+        stats.dropped += size;
+        return UARTTX_ERROR;
+      }
+    }
+  }
+
+  return UARTTX_OK;
+}
+
+/**
+  * @brief Queues a NUL terminated string for transmission
+  * @param str: String to send
+  * @retval UARTTX Status, error if part of the string was dropped
+  */
+UARTTX_StatusTypeDef UARTTX_Send(const char *str)
+{
+  return UARTTX_Write((const uint8_t*)str, strlen(str));
+}
+
+/**
+  * @brief Gets the number of bytes not sent yet
+  * @retval Bytes in the ring
+  */
+uint32_t UARTTX_Pending(void)
+{
+  uint32_t used;
+
+  taskENTER_CRITICAL();
+  used = UARTTX_Used();
+  taskEXIT_CRITICAL();
+
+  return used;
+}
+
+/**
+  * @brief Gets a copy of the transmission statistics
+  * @param copy: Where the statistics are copied
+  */
+void UARTTX_GetStats(UARTTX_StatsTypeDef *copy)
+{
+  taskENTER_CRITICAL();
+  *copy = stats;
+  taskEXIT_CRITICAL();
+}
+
+/**
+  * @brief USART1 error. A transmit DMA error ends the transfer without
+  * completion, the chunk is sent again
+  */
+void UARTTX_ErrorCallback(void)
+{
+  if(in_flight > 0 && huart1.gState == HAL_UART_STATE_READY)
+  {
+    in_flight = 0;
+    stats.errors++;
+    UARTTX_Kick();
+  }
+}
+
+/**
+  * @brief Last byte of a chunk sent: frees it and starts the next one
+  * @param huart: UART handle
+  */
+void HAL_UART_TxCpltCallback(UART_HandleTypeDef *huart)
+{
+  if(huart != &huart1)
+    return;
+
+  tail = (tail + in_flight) % UARTTX_RING_SIZE;
+  in_flight = 0;
+  UARTTX_Kick();
+
+  if(waiting)
+  {
+    waiting = 0;
+    osMessagePut(space_queue, 0, 0);
+  }
+}
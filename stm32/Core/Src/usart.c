@@ -22,6 +22,9 @@
 
 /* USER CODE BEGIN 0 */
 
+/* Not in the CubeMX project, set up in HAL_UART_MspInit user code */
+DMA_HandleTypeDef hdma_usart1_tx;
+
 /* USER CODE END 0 */
 
 UART_HandleTypeDef huart1;
@@ -96,6 +99,26 @@ void HAL_UART_MspInit(UART_HandleTypeDef* uartHandle)
     HAL_NVIC_EnableIRQ(USART1_IRQn);
   /* USER CODE BEGIN USART1_MspInit 1 */
 
+    /* USART1_TX Init, drains the transmit queue (uart_tx.c) */
+    hdma_usart1_tx.Instance = DMA1_Channel4;
+    hdma_usart1_tx.Init.Direction = DMA_MEMORY_TO_PERIPH;
+    hdma_usart1_tx.Init.PeriphInc = DMA_PINC_DISABLE;
+    hdma_usart1_tx.Init.MemInc = DMA_MINC_ENABLE;
+    hdma_usart1_tx.Init.PeriphDataAlignment = DMA_PDATAALIGN_BYTE;
+    hdma_usart1_tx.Init.MemDataAlignment = DMA_MDATAALIGN_BYTE;
+    hdma_usart1_tx.Init.Mode = DMA_NORMAL;
+    hdma_usart1_tx.Init.Priority = DMA_PRIORITY_LOW;
+    if (HAL_DMA_Init(&hdma_usart1_tx) != HAL_OK)
+    {
+      Error_Handler();
+    }
+
+    __HAL_LINKDMA(uartHandle,hdmatx,hdma_usart1_tx);
+
+    /* The completion ends up calling the RTOS API */
+    HAL_NVIC_SetPriority(DMA1_Channel4_IRQn, 5, 0);
+    HAL_NVIC_EnableIRQ(DMA1_Channel4_IRQn);
+
   /* USER CODE END USART1_MspInit 1 */
   }
 }
@@ -124,12 +147,43 @@ void HAL_UART_MspDeInit(UART_HandleTypeDef* uartHandle)
     HAL_NVIC_DisableIRQ(USART1_IRQn);
   /* USER CODE BEGIN USART1_MspDeInit 1 */
 
+    HAL_DMA_DeInit(uartHandle->hdmatx);
+    HAL_NVIC_DisableIRQ(DMA1_Channel4_IRQn);
+
   /* USER CODE END USART1_MspDeInit 1 */
   }
 }
 
 /* USER CODE BEGIN 1 */
 
+/**
+  * @brief Recomputes the USART1 baud rate divider from the current PCLK2
+  * frequency. Must be called after every system clock change.
+  */
+void USART1_UpdateBaudRate(void)
+{
+  uint32_t tickstart;
+
+  /* Nothing to do if the peripheral was not initialized yet */
+  if(huart1.gState == HAL_UART_STATE_RESET)
+    return;
+
+  /* Let the last character leave the shift register */
+  tickstart = HAL_GetTick();
+  while(__HAL_UART_GET_FLAG(&huart1, UART_FLAG_TC) == RESET)
+  {
+    if((HAL_GetTick() - tickstart) > 10U)
+      break;
+  }
+
+  /* A negotiated rate the new clock cannot make falls back to the
+   * default, the host has to negotiate again */
+  if(!UARTBAUD_IsReachable(huart1.Init.BaudRate))
+    huart1.Init.BaudRate = UARTBAUD_DEFAULT;
+
+  huart1.Instance->BRR = UART_BRR_SAMPLING16(HAL_RCC_GetPCLK2Freq(), huart1.Init.BaudRate);
+}
+
 /* USER CODE END 1 */
 
 /************************ (C) COPYRIGHT STMicroelectronics *****END OF FILE****/
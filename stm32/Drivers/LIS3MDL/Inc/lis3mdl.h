@@ -19,7 +19,10 @@
 #define LIS3MDL_CTRL_REG3		0x22
 #define LIS3MDL_CTRL_REG4		0x23
 #define LIS3MDL_CTRL_REG5		0x24
+/* CTRL_REG1..CTRL_REG5 are consecutive */
+#define LIS3MDL_CTRL_REG_COUNT	5
 
+#define LIS3MDL_STATUS_REG		0x27
 #define LIS3MDL_OUT_X_L			0x28
 #define LIS3MDL_OUT_X_H			0x29
 #define LIS3MDL_OUT_Y_L			0x2A
@@ -28,9 +31,39 @@
 #define LIS3MDL_OUT_Z_H			0x2D
 #define LIS3MDL_TEMP_OUT_L		0x2E
 #define LIS3MDL_TEMP_OUT_H		0x2F
+#define LIS3MDL_INT_CFG			0x30
+#define LIS3MDL_INT_SRC			0x31
+#define LIS3MDL_INT_THS_L		0x32
+#define LIS3MDL_INT_THS_H		0x33
+
+/* INT_THS is an unsigned 15 bit magnitude */
+#define LIS3MDL_INT_THS_MAX		0x7FFF
 
 #define LIS3MDL_INIT_RETRIALS	4
 
+/* STATUS_REG: new X, Y and Z data available / overwritten before read */
+#define LIS3MDL_STATUS_ZYXDA	0x08
+#define LIS3MDL_STATUS_ZYXOR	0x80
+
+/* Burst read of STATUS_REG..TEMP_OUT_H: address byte, status, 8 data bytes */
+#define LIS3MDL_BURST_SIZE		10
+/* Burst read with FAST_READ: the address pointer skips the low bytes, so
+ * it is the address byte, status, OUT_X_H, OUT_Y_H and OUT_Z_H */
+#define LIS3MDL_FAST_BURST_SIZE	5
+
+/* TEMP_OUT resolution, 0 is 25 degrees */
+#define LIS3MDL_TEMP_LSB_PER_DEGREE	8
+
+/* Register address modifiers (first byte of a transaction) */
+#define LIS3MDL_READ			0x80
+#define LIS3MDL_AUTO_INCREMENT	0x40
+
+/* Output data rates reached with FAST_ODR, by operating mode */
+#define LIS3MDL_FAST_ODR_LP_HZ	1000
+#define LIS3MDL_FAST_ODR_MP_HZ	560
+#define LIS3MDL_FAST_ODR_HP_HZ	300
+#define LIS3MDL_FAST_ODR_UHP_HZ	155
+
 typedef enum
 {
   LIS3MDL_ERROR = -1,
@@ -38,24 +71,114 @@ typedef enum
 } LIS3MDL_StatusTypeDef;
 
 
+/* Output data rate (CTRL_REG1 DO). With LIS3MDL_ODR_FAST the rate is set
+ * by the operating mode: 1000 Hz LP, 560 Hz MP, 300 Hz HP, 155 Hz UHP */
+typedef enum
+{
+  LIS3MDL_ODR_0_625HZ = 0,
+  LIS3MDL_ODR_1_25HZ,
+  LIS3MDL_ODR_2_5HZ,
+  LIS3MDL_ODR_5HZ,
+  LIS3MDL_ODR_10HZ,
+  LIS3MDL_ODR_20HZ,
+  LIS3MDL_ODR_40HZ,
+  LIS3MDL_ODR_80HZ,
+  LIS3MDL_ODR_FAST
+} LIS3MDL_OdrTypeDef;
+
+/* X/Y (CTRL_REG1 OM) and Z (CTRL_REG4 OMZ) operating mode */
+typedef enum
+{
+  LIS3MDL_MODE_LOW_POWER = 0,
+  LIS3MDL_MODE_MEDIUM,
+  LIS3MDL_MODE_HIGH,
+  LIS3MDL_MODE_ULTRA_HIGH
+} LIS3MDL_OperatingModeTypeDef;
+
+/* Full scale (CTRL_REG2 FS) */
+typedef enum
+{
+  LIS3MDL_FS_4GAUSS = 0,
+  LIS3MDL_FS_8GAUSS,
+  LIS3MDL_FS_12GAUSS,
+  LIS3MDL_FS_16GAUSS
+} LIS3MDL_FullScaleTypeDef;
+
+/* Conversion mode (CTRL_REG3 MD) */
+typedef enum
+{
+  LIS3MDL_CONVERSION_CONTINUOUS = 0,
+  LIS3MDL_CONVERSION_SINGLE = 1,
+  LIS3MDL_CONVERSION_POWER_DOWN = 3
+} LIS3MDL_ConversionModeTypeDef;
+
+typedef struct
+{
+  LIS3MDL_OdrTypeDef odr;
+  LIS3MDL_OperatingModeTypeDef mode;
+  LIS3MDL_FullScaleTypeDef full_scale;
+  LIS3MDL_ConversionModeTypeDef conversion;
+  uint8_t temp_enable;
+  uint8_t low_power;
+  /* Read only the high byte of each axis (CTRL_REG5 FAST_READ). The
+   * temperature is then read apart with LIS3MDL_ReadTemperature */
+  uint8_t fast_read;
+  /* Output registers are not updated until both bytes of the pair were
+   * read (CTRL_REG5 BDU). With FAST_READ the high byte completes the pair */
+  uint8_t block_data_update;
+} LIS3MDL_ConfigTypeDef;
+
 typedef struct
 {
 int16_t mag_x;
 int16_t mag_y;
 int16_t mag_z;
 int16_t temp;
+/* STATUS_REG read in the same burst */
+uint8_t status;
 } LIS3MDL_DataTypeDef;
 
+/* Fresh: ZYXDA set. Duplicate: ZYXDA clear, the values were already read.
+ * Overrun: fresh, but ZYXOR says at least one sample was overwritten */
+typedef struct
+{
+  uint32_t fresh;
+  uint32_t duplicate;
+  uint32_t overrun;
+} LIS3MDL_SampleStatsTypeDef;
+
+/* One per device. The chip select is filled in by the user, the rest is
+ * driver state */
+typedef struct
+{
+  /* Chip select pin, driven by LIS3MDL_ChipSelect (lis3mdl_conf.c) */
+  void *cs_port;
+  uint16_t cs_pin;
+  /* Shadow copies of CTRL_REG1..CTRL_REG5, as last written to the device */
+  uint8_t ctrl_shadow[LIS3MDL_CTRL_REG_COUNT];
+  /* Cleared until the shadow matches the device (after reset every
+   * register gets written) */
+  uint8_t ctrl_shadow_valid;
+  LIS3MDL_ConfigTypeDef config;
+  LIS3MDL_SampleStatsTypeDef sample_stats;
+  /* Last temperature read, reported along with FAST_READ samples */
+  int16_t last_temp;
+} LIS3MDL_HandleTypeDef;
+
+#define LIS3MDL_IS_FRESH(status)	(((status) & LIS3MDL_STATUS_ZYXDA) != 0)
+
+/* Bit fields are allocated from the LSB, so they are listed from
+ * register bit 0 up to bit 7 */
 typedef union
 {
   uint8_t chars;
   struct
   {
-	uint8_t TEMP_EN: 1;
-	uint8_t OM: 2;
-	uint8_t DO: 3;
-	uint8_t FAST_ODR: 1;
 	uint8_t ST: 1;
+	uint8_t FAST_ODR: 1;
+	uint8_t DO: 3;
+	uint8_t OM: 2;
+	uint8_t TEMP_EN: 1;
   };
 } LIS3MDL_CtrlReg1TypeDef;
 
@@ -65,12 +188,12 @@ typedef union
   uint8_t chars;
   struct
   {
-	uint8_t ZERO1: 1;
-	uint8_t FS: 2;
-	uint8_t ZERO2: 1;
-	uint8_t REBOOT: 1;
-	uint8_t SOFT_RST: 1;
 	uint8_t ZERO3: 2;
+	uint8_t SOFT_RST: 1;
+	uint8_t REBOOT: 1;
+	uint8_t ZERO2: 1;
+	uint8_t FS: 2;
+	uint8_t ZERO1: 1;
   };
 } LIS3MDL_CtrlReg2TypeDef;
 
@@ -80,11 +203,11 @@ typedef union
   uint8_t chars;
   struct
   {
-	uint8_t ZERO1: 2;
-	uint8_t LP: 1;
-	uint8_t ZERO2: 2;
-	uint8_t SIM: 1;
 	uint8_t MD: 2;
+	uint8_t SIM: 1;
+	uint8_t ZERO2: 2;
+	uint8_t LP: 1;
+	uint8_t ZERO1: 2;
   };
 } LIS3MDL_CtrlReg3TypeDef;
 
@@ -94,10 +217,10 @@ typedef union
   uint8_t chars;
   struct
   {
-	uint8_t ZERO1: 4;
-	uint8_t OMZ: 2;
-	uint8_t BLE: 1;
 	uint8_t ZERO2: 1;
+	uint8_t BLE: 1;
+	uint8_t OMZ: 2;
+	uint8_t ZERO1: 4;
   };
 } LIS3MDL_CtrlReg4TypeDef;
 
@@ -107,14 +230,65 @@ typedef union
   uint8_t chars;
   struct
   {
-	uint8_t FAST_READ: 1;
-	uint8_t BDU: 1;
 	uint8_t ZERO1: 6;
+	uint8_t BDU: 1;
+	uint8_t FAST_READ: 1;
   };
 } LIS3MDL_CtrlReg5TypeDef;
 
-LIS3MDL_StatusTypeDef LIS3MDL_Init(void);
+/* LIR = 0 latches the request until INT_SRC is read. ONE: must be set
+ * to 1, ZERO1: must be set to 0 */
+typedef union
+{
+  uint8_t chars;
+  struct
+  {
+	uint8_t IEN: 1;
+	uint8_t LIR: 1;
+	uint8_t IEA: 1;
+	uint8_t ONE: 1;
+	uint8_t ZERO1: 1;
+	uint8_t ZIEN: 1;
+	uint8_t YIEN: 1;
+	uint8_t XIEN: 1;
+  };
+} LIS3MDL_IntCfgTypeDef;
+
+/* Axes above (PTH) or below (NTH) the threshold, MROI: internal measurement
+ * range overflow, INT: interrupt active */
+typedef union
+{
+  uint8_t chars;
+  struct
+  {
+	uint8_t INT: 1;
+	uint8_t MROI: 1;
+	uint8_t NTH_Z: 1;
+	uint8_t NTH_Y: 1;
+	uint8_t NTH_X: 1;
+	uint8_t PTH_Z: 1;
+	uint8_t PTH_Y: 1;
+	uint8_t PTH_X: 1;
+  };
+} LIS3MDL_IntSrcTypeDef;
+
+LIS3MDL_StatusTypeDef LIS3MDL_Init(LIS3MDL_HandleTypeDef *hmag);
 
-LIS3MDL_StatusTypeDef LIS3MDL_ReadValues(LIS3MDL_DataTypeDef *data);
+LIS3MDL_StatusTypeDef LIS3MDL_ReadValues(LIS3MDL_HandleTypeDef *hmag, LIS3MDL_DataTypeDef *data);
+LIS3MDL_StatusTypeDef LIS3MDL_ReadTemperature(LIS3MDL_HandleTypeDef *hmag, int16_t *temp);
+uint32_t LIS3MDL_GetBurstSize(LIS3MDL_HandleTypeDef *hmag);
+void LIS3MDL_DecodeBurst(LIS3MDL_HandleTypeDef *hmag, const uint8_t *burst, LIS3MDL_DataTypeDef *data);
+void LIS3MDL_AccountSample(LIS3MDL_HandleTypeDef *hmag, uint8_t status);
+void LIS3MDL_GetSampleStats(LIS3MDL_HandleTypeDef *hmag, LIS3MDL_SampleStatsTypeDef *stats);
+void LIS3MDL_ResetSampleStats(LIS3MDL_HandleTypeDef *hmag);
+LIS3MDL_StatusTypeDef LIS3MDL_ReadRegister(LIS3MDL_HandleTypeDef *hmag, uint8_t reg, uint8_t *value);
+LIS3MDL_StatusTypeDef LIS3MDL_WriteRegister(LIS3MDL_HandleTypeDef *hmag, uint8_t reg, uint8_t value);
+LIS3MDL_StatusTypeDef LIS3MDL_SetDataRate(LIS3MDL_HandleTypeDef *hmag, uint32_t rate_hz);
+LIS3MDL_StatusTypeDef LIS3MDL_Configure(LIS3MDL_HandleTypeDef *hmag, const LIS3MDL_ConfigTypeDef *config);
+void LIS3MDL_GetConfig(LIS3MDL_HandleTypeDef *hmag, LIS3MDL_ConfigTypeDef *config);
+LIS3MDL_StatusTypeDef LIS3MDL_GetConversionCommand(LIS3MDL_HandleTypeDef *hmag, uint8_t *command);
+LIS3MDL_StatusTypeDef LIS3MDL_StartConversion(LIS3MDL_HandleTypeDef *hmag);
+LIS3MDL_StatusTypeDef LIS3MDL_ConfigureInterrupt(LIS3MDL_HandleTypeDef *hmag, uint32_t enable, uint16_t threshold);
+LIS3MDL_StatusTypeDef LIS3MDL_ReadInterruptSource(LIS3MDL_HandleTypeDef *hmag, LIS3MDL_IntSrcTypeDef *source);
 
 #endif /* LIS3MDL_H_ */
@@ -20,13 +20,16 @@
 #define LIS3MDL_CS_OFF									GPIO_PIN_SET
 
 /* Functions to be implemented by user */
-void LIS3MDL_ChipSelect(uint32_t on_off);
+void LIS3MDL_ChipSelect(LIS3MDL_HandleTypeDef *hmag, uint32_t on_off);
 void LIS3MDL_Delay(uint32_t ms);
 LIS3MDL_StatusTypeDef LIS3MDL_TxRx(uint8_t *pTxData, uint8_t *pRxData, uint16_t Size, uint32_t Timeout);
 LIS3MDL_StatusTypeDef LIS3MDL_Tx(uint8_t *pData, uint16_t Size, uint32_t Timeout);
 LIS3MDL_StatusTypeDef LIS3MDL_Rx(uint8_t *pData, uint16_t Size, uint32_t Timeout);
+LIS3MDL_StatusTypeDef LIS3MDL_TxRx_DMA(uint8_t *pTxData, uint8_t *pRxData, uint16_t Size);
 LIS3MDL_StatusTypeDef LIS3MDL_Tx_DMA(uint8_t *pData, uint16_t Size);
 LIS3MDL_StatusTypeDef LIS3MDL_Rx_DMA(uint8_t *pData, uint16_t Size);
 LIS3MDL_StatusTypeDef LIS3MDL_Tx_DMA_WaitToFinish(uint32_t timeout);
 LIS3MDL_StatusTypeDef LIS3MDL_Rx_DMA_WaitToFinish(uint32_t timeout);
+uint8_t* LIS3MDL_BufferAcquire(void);
+void LIS3MDL_BufferRelease(uint8_t *buffer);
 #endif /* LIS3MDL_CONF_H_ */
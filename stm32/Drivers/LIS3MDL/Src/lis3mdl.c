@@ -27,222 +27,563 @@
 
 #include "lis3mdl.h"
 #include "lis3mdl_conf.h"
+#include <string.h>
 
+/* Burst reads keep the transmit bytes at the start of a pool block and the
+ * received ones here, both halves fit LIS3MDL_BURST_SIZE */
+#define LIS3MDL_BUFFER_RX_OFFSET	16
+
+/* Output data rates selected by CTRL_REG1 DO (without FAST_ODR), in mHz */
+static const uint32_t lis3mdl_odr_mhz[] =
+{
+	625, 1250, 2500, 5000, 10000, 20000, 40000, 80000
+};
+
+/* Configuration applied by LIS3MDL_Init */
+static const LIS3MDL_ConfigTypeDef lis3mdl_default_config =
+{
+	.odr = LIS3MDL_ODR_10HZ,
+	.mode = LIS3MDL_MODE_ULTRA_HIGH,
+	.full_scale = LIS3MDL_FS_12GAUSS,
+	.conversion = LIS3MDL_CONVERSION_CONTINUOUS,
+	.temp_enable = 1,
+	.low_power = 0,
+	.fast_read = 0,
+	.block_data_update = 1
+};
 
 /**
-  * @brief Initializes the magnetometer
+  * @brief Reads a single register
+  * @param hmag: Device handle
+  * @param reg: Register address
+  * @param value: Value read
   * @retval LIS3MDL Status
   */
-LIS3MDL_StatusTypeDef LIS3MDL_Init(void)
+LIS3MDL_StatusTypeDef LIS3MDL_ReadRegister(LIS3MDL_HandleTypeDef *hmag, uint8_t reg, uint8_t *value)
 {
-	uint8_t tx_data[2], rx_data;
-	int retrials;
+	uint8_t tx_data[2], *rx_data;
+	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
+
+	rx_data = LIS3MDL_BufferAcquire();
+	if(rx_data == NULL)
+		return LIS3MDL_ERROR;
+
+	/* In order to read, R/W = 1. The register comes with the second byte */
+	tx_data[0] = (reg | LIS3MDL_READ);
+	tx_data[1] = 0x00;
+
+	LIS3MDL_ChipSelect(hmag, LIS3MDL_CS_ON);
+	retval = LIS3MDL_TxRx(tx_data, rx_data, 2, 100);
+	LIS3MDL_ChipSelect(hmag, LIS3MDL_CS_OFF);
+
+	*value = rx_data[1];
 
-	LIS3MDL_CtrlReg1TypeDef ctrl_reg1 = {0};
-	LIS3MDL_CtrlReg2TypeDef ctrl_reg2 = {0};
-	LIS3MDL_CtrlReg3TypeDef ctrl_reg3 = {0};
-	LIS3MDL_CtrlReg4TypeDef ctrl_reg4 = {0};
-	LIS3MDL_CtrlReg5TypeDef ctrl_reg5 = {0};
+	LIS3MDL_BufferRelease(rx_data);
 
+	return retval;
+}
+
+/**
+  * @brief Writes consecutive registers in a single auto increment burst
+  * @param hmag: Device handle
+  * @param reg: First register address
+  * @param values: Values to write
+  * @param count: Number of registers (up to LIS3MDL_CTRL_REG_COUNT)
+  * @retval LIS3MDL Status
+  */
+static LIS3MDL_StatusTypeDef LIS3MDL_WriteRegisters(LIS3MDL_HandleTypeDef *hmag, uint8_t reg, const uint8_t *values, uint32_t count)
+{
+	uint8_t *tx_data;
+	uint32_t index;
 	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
 
-	/* Enable CS pin and wait until stabilizes */
-	LIS3MDL_ChipSelect(LIS3MDL_CS_ON);
-	LIS3MDL_Delay(1);
+	if(count == 0 || count > LIS3MDL_CTRL_REG_COUNT)
+		return LIS3MDL_ERROR;
+
+	/* DMA source off the task stack */
+	tx_data = LIS3MDL_BufferAcquire();
+	if(tx_data == NULL)
+		return LIS3MDL_ERROR;
+
+	/* Write (R/W = 0) with M/S = 1 so the address increments */
+	tx_data[0] = reg | LIS3MDL_AUTO_INCREMENT;
+	for(index = 0; index < count; index++)
+		tx_data[index + 1] = values[index];
+
+	LIS3MDL_ChipSelect(hmag, LIS3MDL_CS_ON);
+
+#ifdef LIS3MDL_USE_DMA
+	if(LIS3MDL_Tx_DMA(tx_data, count + 1) == LIS3MDL_OK)
+	{
+		/* Wait up to one millisecond for the data to be transmitted */
+		retval = LIS3MDL_Tx_DMA_WaitToFinish(1);
+	}
+
+#else
+	retval = LIS3MDL_Tx(tx_data, count + 1, 100);
+
+#endif
+
+	LIS3MDL_ChipSelect(hmag, LIS3MDL_CS_OFF);
+
+	LIS3MDL_BufferRelease(tx_data);
+
+	return retval;
+}
+
+/**
+  * @brief Initializes the magnetometer
+  * @param hmag: Device handle
+  * @retval LIS3MDL Status
+  */
+LIS3MDL_StatusTypeDef LIS3MDL_Init(LIS3MDL_HandleTypeDef *hmag)
+{
+	uint8_t who_am_i;
+	int retrials;
 
 	/* Try to init up to LIS3MDL_INIT_RETRIALS times */
 	for(retrials = 1; retrials <= LIS3MDL_INIT_RETRIALS; retrials++)
 	{
-		/* In order to read, R/W = 1 */
-		tx_data[0] = (LIS3MDL_WHO_AM_I | 0x80);
-		if(LIS3MDL_TxRx(tx_data, &rx_data, 1, 100) != LIS3MDL_OK)
+		if(LIS3MDL_ReadRegister(hmag, LIS3MDL_WHO_AM_I, &who_am_i) != LIS3MDL_OK)
 			break;
 
 		/* If who am i read OK, continue, otherwise error */
-		if(rx_data == LIS3MDL_WHO_AM_I_RET)
+		if(who_am_i == LIS3MDL_WHO_AM_I_RET)
 		{
-			/* Enable temperature reading */
-			ctrl_reg1.TEMP_EN = 0b1;
+			/* The device state is unknown, write every register */
+			hmag->ctrl_shadow_valid = 0;
+			return LIS3MDL_Configure(hmag, &lis3mdl_default_config);
+		}
 
-			/* Set ultra high performance mode */
-			ctrl_reg1.OM = 0b11;
+		/* TODO: Do something when WHO_AM_I read error */
+		LIS3MDL_Delay(10);
+	}
 
-			/* Output data rate 10 Hz */
-			ctrl_reg1.DO = 0b100;
+	return LIS3MDL_ERROR;
+}
 
-			/* Disable fast ODR */
-			ctrl_reg1.FAST_ODR = 0b0;
+/**
+  * @brief Read magnetometer data values
+  * @param hmag: Device handle
+  * @param data: LIS3MDL Data
+  * @retval LIS3MDL Status
+  */
+LIS3MDL_StatusTypeDef LIS3MDL_ReadValues(LIS3MDL_HandleTypeDef *hmag, LIS3MDL_DataTypeDef *data)
+{
+	uint8_t *tx_data, *rx_data;
+	uint32_t burst_size = LIS3MDL_GetBurstSize(hmag);
+	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
+
+	/* DMA source and target share a pool block, off the task stack. A
+	 * transfer that times out is aborted before the block is given back */
+	tx_data = LIS3MDL_BufferAcquire();
+	if(tx_data == NULL)
+		return LIS3MDL_ERROR;
+	rx_data = tx_data + LIS3MDL_BUFFER_RX_OFFSET;
+	memset(tx_data, 0, burst_size);
 
-			/* Self test disabled */
-			ctrl_reg1.ST = 0;
+	/* Chip select setup time is a few nanoseconds, no delay needed. Reads
+	 * are triggered by DRDY, a millisecond here is a stale sample at high ODR */
+	LIS3MDL_ChipSelect(hmag, LIS3MDL_CS_ON);
 
-			tx_data[0] = LIS3MDL_CTRL_REG1;
-			tx_data[1] = ctrl_reg1.chars;
+	/* Burst read status and all values in one transaction (set R/W = 1
+	 * and M/S = 1). The first byte received is clocked during the address */
+	tx_data[0] = (LIS3MDL_STATUS_REG | LIS3MDL_READ | LIS3MDL_AUTO_INCREMENT);
 
 #ifdef LIS3MDL_USE_DMA
-			if(LIS3MDL_Tx_DMA(tx_data,2) != LIS3MDL_OK)
-				break;
+	if(LIS3MDL_TxRx_DMA(tx_data, rx_data, burst_size) == LIS3MDL_OK)
+	{
+		/* Wait up to one millisecond for the data to be received */
+		if(LIS3MDL_Rx_DMA_WaitToFinish(1) == LIS3MDL_OK)
+			retval = LIS3MDL_OK;
+	}
 
-			/* Wait up to one millisecond for the data to be transmitted */
-			if(LIS3MDL_Tx_DMA_WaitToFinish(1) != LIS3MDL_OK)
-				break;
 #else
-			if(LIS3MDL_Tx(tx_data, 2, 100) != LIS3MDL_OK)
-				break;
-#endif
-			/* Set +-12 gauss resolution */
-			ctrl_reg2.FS = 0b10;
+	retval = LIS3MDL_TxRx(tx_data, rx_data, burst_size, 100);
 
-			/* Do not reboot memory content */
-			ctrl_reg2.REBOOT = 0b0;
+#endif
 
-			/* Do not soft reset */
-			ctrl_reg2.SOFT_RST = 0b0;
+	LIS3MDL_ChipSelect(hmag, LIS3MDL_CS_OFF);
 
-			tx_data[0] = LIS3MDL_CTRL_REG2;
-			tx_data[1] = ctrl_reg2.chars;
+	if(retval == LIS3MDL_OK)
+	{
+		LIS3MDL_DecodeBurst(hmag, rx_data, data);
+		LIS3MDL_AccountSample(hmag, data->status);
+	}
 
-#ifdef LIS3MDL_USE_DMA
-			if(LIS3MDL_Tx_DMA(tx_data,2) != LIS3MDL_OK)
-				break;
+	LIS3MDL_BufferRelease(tx_data);
 
-			/* Wait up to one millisecond for the data to be transmitted */
-			if(LIS3MDL_Tx_DMA_WaitToFinish(1) != LIS3MDL_OK)
-				break;
+	return retval;
+}
 
-#else
-			if(LIS3MDL_Tx(tx_data, 2, 100) != LIS3MDL_OK)
-				break;
-#endif
+/**
+  * @brief Reads the temperature. With FAST_READ the sample bursts skip it,
+  * so it is read here at a slower cadence and reported with them
+  * @param hmag: Device handle
+  * @param temp: Temperature (LIS3MDL_TEMP_LSB_PER_DEGREE, 0 is 25 degrees),
+  * NULL to only refresh the value reported with the samples
+  * @retval LIS3MDL Status
+  */
+LIS3MDL_StatusTypeDef LIS3MDL_ReadTemperature(LIS3MDL_HandleTypeDef *hmag, int16_t *temp)
+{
+	uint8_t temp_low, temp_high;
 
-			/* Do not enable low power */
-			ctrl_reg3.LP = 0b0;
+	/* Low byte first, with BDU it releases the pair. One register per read,
+	 * FAST_READ changes how the address pointer increments */
+	if(LIS3MDL_ReadRegister(hmag, LIS3MDL_TEMP_OUT_L, &temp_low) != LIS3MDL_OK ||
+	   LIS3MDL_ReadRegister(hmag, LIS3MDL_TEMP_OUT_H, &temp_high) != LIS3MDL_OK)
+		return LIS3MDL_ERROR;
 
-			/* 4-wire SPI */
-			ctrl_reg3.SIM = 0b0;
+	hmag->last_temp = (int16_t) ((temp_high << 8) | temp_low);
+	if(temp != NULL)
+		*temp = hmag->last_temp;
 
-			/* Continuous conversion mode */
-			ctrl_reg3.MD = 0b00;
+	return LIS3MDL_OK;
+}
 
-			tx_data[0] = LIS3MDL_CTRL_REG3;
-			tx_data[1] = ctrl_reg3.chars;
+/**
+  * @brief Gets the length of the sample burst read from STATUS_REG for the
+  * current configuration
+  * @param hmag: Device handle
+  * @retval LIS3MDL_BURST_SIZE or LIS3MDL_FAST_BURST_SIZE
+  */
+uint32_t LIS3MDL_GetBurstSize(LIS3MDL_HandleTypeDef *hmag)
+{
+	return hmag->config.fast_read ? LIS3MDL_FAST_BURST_SIZE : LIS3MDL_BURST_SIZE;
+}
 
-#ifdef LIS3MDL_USE_DMA
-			if(LIS3MDL_Tx_DMA(tx_data,2) != LIS3MDL_OK)
-				break;
+/**
+  * @brief Decodes a sample burst read from STATUS_REG (first byte received
+  * during the address). With FAST_READ the low bytes are zero and the
+  * temperature is the last one read
+  * @param hmag: Device handle
+  * @param burst: Bytes received, LIS3MDL_GetBurstSize(hmag) of them
+  * @param data: LIS3MDL Data
+  */
+void LIS3MDL_DecodeBurst(LIS3MDL_HandleTypeDef *hmag, const uint8_t *burst, LIS3MDL_DataTypeDef *data)
+{
+	data->status = burst[1];
 
-			/* Wait up to one millisecond for the data to be transmitted */
-			if(LIS3MDL_Tx_DMA_WaitToFinish(1) != LIS3MDL_OK)
-				break;
-#else
-			if(LIS3MDL_Tx(tx_data, 2, 100) != LIS3MDL_OK)
-				break;
-#endif
+	if(hmag->config.fast_read)
+	{
+		data->mag_x = (int16_t) (burst[2] << 8);
+		data->mag_y = (int16_t) (burst[3] << 8);
+		data->mag_z = (int16_t) (burst[4] << 8);
+		data->temp = hmag->last_temp;
+	}
+	else
+	{
+		data->mag_x = (int16_t) ((burst[3] << 8) | burst[2]);
+		data->mag_y = (int16_t) ((burst[5] << 8) | burst[4]);
+		data->mag_z = (int16_t) ((burst[7] << 8) | burst[6]);
+		data->temp = (int16_t) ((burst[9] << 8) | burst[8]);
+		hmag->last_temp = data->temp;
+	}
+}
 
-			/* Set Z-axis to ultra high performance mode */
-			ctrl_reg4.OMZ = 0b11;
+/**
+  * @brief Counts a sample as fresh, duplicate and/or overrun from the
+  * STATUS_REG value read along with it
+  * @param hmag: Device handle
+  * @param status: STATUS_REG
+  */
+void LIS3MDL_AccountSample(LIS3MDL_HandleTypeDef *hmag, uint8_t status)
+{
+	if(!LIS3MDL_IS_FRESH(status))
+	{
+		hmag->sample_stats.duplicate++;
+		return;
+	}
 
-			/* Data LSB at lower address */
-			ctrl_reg4.BLE = 0b0;
+	hmag->sample_stats.fresh++;
+	if(status & LIS3MDL_STATUS_ZYXOR)
+		hmag->sample_stats.overrun++;
+}
 
-			tx_data[0] = LIS3MDL_CTRL_REG4;
-			tx_data[1] = ctrl_reg4.chars;
+/**
+  * @brief Gets a copy of the sample quality counters
+  * @param hmag: Device handle
+  * @param stats: Where the counters are copied
+  */
+void LIS3MDL_GetSampleStats(LIS3MDL_HandleTypeDef *hmag, LIS3MDL_SampleStatsTypeDef *stats)
+{
+	*stats = hmag->sample_stats;
+}
 
-#ifdef LIS3MDL_USE_DMA
-			if(LIS3MDL_Tx_DMA(tx_data,2) != LIS3MDL_OK)
-				break;
+/**
+  * @brief Clears the sample quality counters
+  * @param hmag: Device handle
+  */
+void LIS3MDL_ResetSampleStats(LIS3MDL_HandleTypeDef *hmag)
+{
+	hmag->sample_stats = (LIS3MDL_SampleStatsTypeDef){0};
+}
 
-			/* Wait up to one millisecond for the data to be transmitted */
-			if(LIS3MDL_Tx_DMA_WaitToFinish(1) != LIS3MDL_OK)
-				break;
-#else
-			if(LIS3MDL_Tx(tx_data, 2, 100) != LIS3MDL_OK)
-				break;
-#endif
+/**
+  * @brief Writes a single register
+  * @param hmag: Device handle
+  * @param reg: Register address
+  * @param value: Value to write
+  * @retval LIS3MDL Status
+  */
+LIS3MDL_StatusTypeDef LIS3MDL_WriteRegister(LIS3MDL_HandleTypeDef *hmag, uint8_t reg, uint8_t value)
+{
+	uint8_t *tx_data;
+	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
 
-			/* Disable fast read */
-			ctrl_reg5.FAST_READ = 0b0;
+	/* DMA source off the task stack */
+	tx_data = LIS3MDL_BufferAcquire();
+	if(tx_data == NULL)
+		return LIS3MDL_ERROR;
 
-			/* Update data periodically */
-			ctrl_reg5.BDU = 0b0;
+	/* One register per chip select, otherwise the following bytes would
+	 * be written into the same address */
+	LIS3MDL_ChipSelect(hmag, LIS3MDL_CS_ON);
 
-			tx_data[0] = LIS3MDL_CTRL_REG5;
-			tx_data[1] = ctrl_reg5.chars;
+	tx_data[0] = reg;
+	tx_data[1] = value;
 
 #ifdef LIS3MDL_USE_DMA
-			if(LIS3MDL_Tx_DMA(tx_data,2) != LIS3MDL_OK)
-				break;
+	if(LIS3MDL_Tx_DMA(tx_data, 2) == LIS3MDL_OK)
+	{
+		/* Wait up to one millisecond for the data to be transmitted */
+		retval = LIS3MDL_Tx_DMA_WaitToFinish(1);
+	}
 
-			/* Wait up to one millisecond for the data to be transmitted */
-			if(LIS3MDL_Tx_DMA_WaitToFinish(1) != LIS3MDL_OK)
-				break;
 #else
-			if(LIS3MDL_Tx(tx_data, 2, 100) != LIS3MDL_OK)
-				break;
+	retval = LIS3MDL_Tx(tx_data, 2, 100);
+
 #endif
 
-			retval = LIS3MDL_OK;
-			break;
-		}
-		else
-		{
-			/* TODO: Do something when WHO_AM_I read error */
-			LIS3MDL_Delay(10);
-		}
-	}
+	LIS3MDL_ChipSelect(hmag, LIS3MDL_CS_OFF);
 
-	/* Disable CS pin and wait until stabilizes */
-	LIS3MDL_ChipSelect(LIS3MDL_CS_OFF);
-	LIS3MDL_Delay(1);
+	LIS3MDL_BufferRelease(tx_data);
 
 	return retval;
 }
 
 /**
-  * @brief Read magnetometer data values
-  * @param data: LIS3MDL Data
-  * @retval LIS3MDL Status
+  * @brief Selects the slowest output data rate at or above rate_hz, with the
+  * highest operating mode (lowest noise) that can reach it
+  * @param hmag: Device handle
+  * @param rate_hz: Required output data rate (up to 1000 Hz)
+  * @retval LIS3MDL Status, error if the rate can not be reached
   */
-LIS3MDL_StatusTypeDef LIS3MDL_ReadValues(LIS3MDL_DataTypeDef *data)
+LIS3MDL_StatusTypeDef LIS3MDL_SetDataRate(LIS3MDL_HandleTypeDef *hmag, uint32_t rate_hz)
 {
-	uint8_t tx_data, rx_data[8];
-	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
+	LIS3MDL_ConfigTypeDef config = hmag->config;
+	uint32_t index;
 
-	/* Enable CS pin and wait until stabilizes */
-	LIS3MDL_ChipSelect(LIS3MDL_CS_ON);
-	LIS3MDL_Delay(1);
+	if(rate_hz == 0 || rate_hz > LIS3MDL_FAST_ODR_LP_HZ)
+		return LIS3MDL_ERROR;
 
-	/* Burst read all values (set R/W = 1 and M/S = 1) */
-	tx_data = (LIS3MDL_OUT_X_L | 0x80 | 0x40);
+	if(rate_hz * 1000 <= lis3mdl_odr_mhz[LIS3MDL_ODR_80HZ])
+	{
+		for(index = 0; lis3mdl_odr_mhz[index] < rate_hz * 1000; index++);
 
-#ifdef LIS3MDL_USE_DMA
-	if(LIS3MDL_Tx_DMA(&tx_data, 1) == LIS3MDL_OK)
+		config.odr = (LIS3MDL_OdrTypeDef)index;
+		config.mode = LIS3MDL_MODE_ULTRA_HIGH;
+	}
+	else
+	{
+		/* With FAST_ODR the rate is set by the operating mode */
+		config.odr = LIS3MDL_ODR_FAST;
+		if(rate_hz <= LIS3MDL_FAST_ODR_UHP_HZ)
+			config.mode = LIS3MDL_MODE_ULTRA_HIGH;
+		else if(rate_hz <= LIS3MDL_FAST_ODR_HP_HZ)
+			config.mode = LIS3MDL_MODE_HIGH;
+		else if(rate_hz <= LIS3MDL_FAST_ODR_MP_HZ)
+			config.mode = LIS3MDL_MODE_MEDIUM;
+		else
+			config.mode = LIS3MDL_MODE_LOW_POWER;
+	}
+
+	/* LP forces 0.625 Hz */
+	config.low_power = 0;
+
+	return LIS3MDL_Configure(hmag, &config);
+}
+
+/**
+  * @brief Applies a configuration. Only the control registers whose value
+  * changes are written, in a single burst from the first to the last one
+  * @param hmag: Device handle
+  * @param config: Configuration
+  * @retval LIS3MDL Status
+  */
+LIS3MDL_StatusTypeDef LIS3MDL_Configure(LIS3MDL_HandleTypeDef *hmag, const LIS3MDL_ConfigTypeDef *config)
+{
+	LIS3MDL_CtrlReg1TypeDef ctrl_reg1 = { .chars = hmag->ctrl_shadow[0] };
+	LIS3MDL_CtrlReg2TypeDef ctrl_reg2 = { .chars = hmag->ctrl_shadow[1] };
+	LIS3MDL_CtrlReg3TypeDef ctrl_reg3 = { .chars = hmag->ctrl_shadow[2] };
+	LIS3MDL_CtrlReg4TypeDef ctrl_reg4 = { .chars = hmag->ctrl_shadow[3] };
+	LIS3MDL_CtrlReg5TypeDef ctrl_reg5 = { .chars = hmag->ctrl_shadow[4] };
+	uint8_t regs[LIS3MDL_CTRL_REG_COUNT];
+	uint32_t index, first, last;
+
+	if(config->odr > LIS3MDL_ODR_FAST || config->mode > LIS3MDL_MODE_ULTRA_HIGH ||
+	   config->full_scale > LIS3MDL_FS_16GAUSS || config->conversion > LIS3MDL_CONVERSION_POWER_DOWN)
+		return LIS3MDL_ERROR;
+
+	ctrl_reg1.TEMP_EN = config->temp_enable ? 0b1 : 0b0;
+	ctrl_reg1.OM = config->mode;
+	ctrl_reg1.FAST_ODR = (config->odr == LIS3MDL_ODR_FAST) ? 0b1 : 0b0;
+	ctrl_reg1.DO = (config->odr == LIS3MDL_ODR_FAST) ? 0b000 : config->odr;
+	/* Self test disabled */
+	ctrl_reg1.ST = 0b0;
+
+	ctrl_reg2.FS = config->full_scale;
+	ctrl_reg2.REBOOT = 0b0;
+	ctrl_reg2.SOFT_RST = 0b0;
+
+	ctrl_reg3.LP = config->low_power ? 0b1 : 0b0;
+	/* 4-wire SPI */
+	ctrl_reg3.SIM = 0b0;
+	ctrl_reg3.MD = config->conversion;
+
+	/* Z axis operating mode follows X and Y, data LSB at lower address */
+	ctrl_reg4.OMZ = config->mode;
+	ctrl_reg4.BLE = 0b0;
+
+	ctrl_reg5.FAST_READ = config->fast_read ? 0b1 : 0b0;
+	ctrl_reg5.BDU = config->block_data_update ? 0b1 : 0b0;
+	ctrl_reg5.ZERO1 = 0b000000;
+
+	regs[0] = ctrl_reg1.chars;
+	regs[1] = ctrl_reg2.chars;
+	regs[2] = ctrl_reg3.chars;
+	regs[3] = ctrl_reg4.chars;
+	regs[4] = ctrl_reg5.chars;
+
+	/* Smallest range holding every change */
+	first = LIS3MDL_CTRL_REG_COUNT;
+	last = 0;
+	for(index = 0; index < LIS3MDL_CTRL_REG_COUNT; index++)
 	{
-		if(LIS3MDL_Rx_DMA(rx_data, 8) == LIS3MDL_OK)
+		if(!hmag->ctrl_shadow_valid || regs[index] != hmag->ctrl_shadow[index])
 		{
-			/* Wait up to one millisecond for the data to be received */
-			if(LIS3MDL_Rx_DMA_WaitToFinish(1) == LIS3MDL_OK)
-				retval = LIS3MDL_OK;
+			if(first == LIS3MDL_CTRL_REG_COUNT)
+				first = index;
+			last = index;
 		}
 	}
 
-#else
-	if(LIS3MDL_Tx(&tx_data, 1, 100) == LIS3MDL_OK)
+	if(first < LIS3MDL_CTRL_REG_COUNT)
 	{
-		if(LIS3MDL_Rx(rx_data, 8, 100) == LIS3MDL_OK)
-			retval = LIS3MDL_OK;
+		if(LIS3MDL_WriteRegisters(hmag, LIS3MDL_CTRL_REG1 + first, &regs[first], last - first + 1) != LIS3MDL_OK)
+		{
+			/* Part of the burst may have been written */
+			hmag->ctrl_shadow_valid = 0;
+			return LIS3MDL_ERROR;
+		}
+
+		for(index = first; index <= last; index++)
+			hmag->ctrl_shadow[index] = regs[index];
+		hmag->ctrl_shadow_valid = 1;
 	}
 
-#endif
+	hmag->config = *config;
+
+	return LIS3MDL_OK;
+}
+
+/**
+  * @brief Gets the configuration last applied
+  * @param hmag: Device handle
+  * @param config: Where the configuration is copied
+  */
+void LIS3MDL_GetConfig(LIS3MDL_HandleTypeDef *hmag, LIS3MDL_ConfigTypeDef *config)
+{
+	*config = hmag->config;
+}
+
+/**
+  * @brief Builds the write that starts a single conversion (CTRL_REG3
+  * MD = 01), for callers that send it themselves, e.g. to several devices
+  * back to back with interrupts masked
+  * @param hmag: Device handle
+  * @param command: Where the 2 bytes to send are stored
+  * @retval LIS3MDL Status, error if not configured in single conversion mode
+  */
+LIS3MDL_StatusTypeDef LIS3MDL_GetConversionCommand(LIS3MDL_HandleTypeDef *hmag, uint8_t *command)
+{
+	LIS3MDL_CtrlReg3TypeDef ctrl_reg3 = { .chars = hmag->ctrl_shadow[2] };
 
-	data->mag_x = (int16_t) ((rx_data[1] << 8) | rx_data[0]);
-	data->mag_y = (int16_t) ((rx_data[3] << 8) | rx_data[2]);
-	data->mag_z = (int16_t) ((rx_data[5] << 8) | rx_data[4]);
-	data->temp = (int16_t) ((rx_data[7] << 8) | rx_data[6]);
+	if(!hmag->ctrl_shadow_valid || hmag->config.conversion != LIS3MDL_CONVERSION_SINGLE)
+		return LIS3MDL_ERROR;
 
-	/* Disable CS pin and wait until stabilizes */
-	LIS3MDL_ChipSelect(LIS3MDL_CS_OFF);
-	LIS3MDL_Delay(1);
+	/* The shadow keeps MD = 01 while the part reads back power-down */
+	ctrl_reg3.MD = LIS3MDL_CONVERSION_SINGLE;
+
+	command[0] = LIS3MDL_CTRL_REG3;
+	command[1] = ctrl_reg3.chars;
+
+	return LIS3MDL_OK;
+}
+
+/**
+  * @brief Starts a single conversion (CTRL_REG3 MD = 01). DRDY rises when
+  * it is done and the part goes back to power-down by itself
+  * @param hmag: Device handle
+  * @retval LIS3MDL Status, error if not configured in single conversion mode
+  */
+LIS3MDL_StatusTypeDef LIS3MDL_StartConversion(LIS3MDL_HandleTypeDef *hmag)
+{
+	uint8_t tx_data[2];
+	LIS3MDL_StatusTypeDef retval;
+
+	if(LIS3MDL_GetConversionCommand(hmag, tx_data) != LIS3MDL_OK)
+		return LIS3MDL_ERROR;
+
+	LIS3MDL_ChipSelect(hmag, LIS3MDL_CS_ON);
+	retval = LIS3MDL_Tx(tx_data, 2, 1);
+	LIS3MDL_ChipSelect(hmag, LIS3MDL_CS_OFF);
 
 	return retval;
 }
+
+/**
+  * @brief Configures the threshold interrupt on the INT pin: active high,
+  * latched, on any axis whose magnitude exceeds the threshold. The latch
+  * is cleared as well
+  * @param hmag: Device handle
+  * @param enable: 0 disables the INT pin
+  * @param threshold: Magnitude, raw counts (up to LIS3MDL_INT_THS_MAX)
+  * @retval LIS3MDL Status
+  */
+LIS3MDL_StatusTypeDef LIS3MDL_ConfigureInterrupt(LIS3MDL_HandleTypeDef *hmag, uint32_t enable, uint16_t threshold)
+{
+	LIS3MDL_IntCfgTypeDef int_cfg = { .chars = 0 };
+	LIS3MDL_IntSrcTypeDef source;
+
+	if(threshold > LIS3MDL_INT_THS_MAX)
+		return LIS3MDL_ERROR;
+
+	int_cfg.XIEN = enable ? 0b1 : 0b0;
+	int_cfg.YIEN = enable ? 0b1 : 0b0;
+	int_cfg.ZIEN = enable ? 0b1 : 0b0;
+	int_cfg.ZERO1 = 0b0;
+	int_cfg.ONE = 0b1;
+	int_cfg.IEA = 0b1;
+	int_cfg.LIR = 0b0;
+	int_cfg.IEN = enable ? 0b1 : 0b0;
+
+	/* Threshold first, so the interrupt never sees a half written one */
+	if(LIS3MDL_WriteRegister(hmag, LIS3MDL_INT_THS_L, threshold & 0xFF) != LIS3MDL_OK ||
+	   LIS3MDL_WriteRegister(hmag, LIS3MDL_INT_THS_H, (threshold >> 8) & 0x7F) != LIS3MDL_OK ||
+	   LIS3MDL_WriteRegister(hmag, LIS3MDL_INT_CFG, int_cfg.chars) != LIS3MDL_OK)
+		return LIS3MDL_ERROR;
+
+	return LIS3MDL_ReadInterruptSource(hmag, &source);
+}
+
+/**
+  * @brief Reads INT_SRC, which also clears a latched interrupt
+  * @param hmag: Device handle
+  * @param source: Value read
+  * @retval LIS3MDL Status
+  */
+LIS3MDL_StatusTypeDef LIS3MDL_ReadInterruptSource(LIS3MDL_HandleTypeDef *hmag, LIS3MDL_IntSrcTypeDef *source)
+{
+	return LIS3MDL_ReadRegister(hmag, LIS3MDL_INT_SRC, &source->chars);
+}
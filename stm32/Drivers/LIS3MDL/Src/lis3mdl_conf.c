@@ -8,9 +8,13 @@
   ******************************************************************************
   */
 
-#include "w25q80dv_conf.h"
+#include "lis3mdl_conf.h"
 #include "cmsis_os.h"
 #include "stm32f1xx_hal.h"
+#include "spi.h"
+#include "dma_pool.h"
+#include "spi_trace.h"
+#include "dlog.h"
 
 extern SPI_HandleTypeDef hspi1;
 extern osMessageQId SPITxQueueHandle;
@@ -18,18 +22,36 @@ extern osMessageQId SPIRxQueueHandle;
 
 /**
   * @brief ON/OFF magnetometer chip select pin
+  * @param hmag: Device handle, cs_port is a GPIO port
   * @param on_off: pin state selected
   */
-void W25Q80DV_ChipSelect(uint32_t on_off)
+void LIS3MDL_ChipSelect(LIS3MDL_HandleTypeDef *hmag, uint32_t on_off)
 {
-	HAL_GPIO_WritePin(CS_MAG_GPIO_Port, CS_MAG_Pin, on_off);
+	if(on_off == LIS3MDL_CS_ON)
+	{
+		/* A timer paced acquisition burst may be in flight. Sleep a tick
+		 * rather than spin, a yield never lets lower priority tasks run */
+		while(SPI1_TryAcquireBus(SPI1_OWNER_TASK) == 0)
+			osDelay(1);
+
+		/* Set the magnetometer SPI clock before selecting it */
+		SPI1_SelectDevice(SPI1_DEVICE_MAG);
+		SPI_TRACE_BEGIN(SPI1_DEVICE_MAG);
+		HAL_GPIO_WritePin((GPIO_TypeDef*)hmag->cs_port, hmag->cs_pin, on_off);
+	}
+	else
+	{
+		SPI_TRACE_END();
+		HAL_GPIO_WritePin((GPIO_TypeDef*)hmag->cs_port, hmag->cs_pin, on_off);
+		SPI1_ReleaseBus(SPI1_OWNER_TASK);
+	}
 }
 
 /**
   * @brief Delay in milliseconds
   * @param ms: milliseconds to delay (should be a non-blocking function)
   */
-void W25Q80DV_Delay(uint32_t ms)
+void LIS3MDL_Delay(uint32_t ms)
 {
 	osDelay(ms);
 }
@@ -40,14 +62,19 @@ void W25Q80DV_Delay(uint32_t ms)
   * @param rx_data: Vector where the data read is stored
   * @param size: Number of bytes to transmit/receive
   * @param  Timeout Timeout duration
-  * @retval W25Q80DV status
+  * @retval LIS3MDL status
   */
-W25Q80DV_StatusTypeDef W25Q80DV_TxRx(uint8_t *tx_data, uint8_t *rx_data, uint16_t size, uint32_t timeout)
+LIS3MDL_StatusTypeDef LIS3MDL_TxRx(uint8_t *tx_data, uint8_t *rx_data, uint16_t size, uint32_t timeout)
 {
-	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
+	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
+
+	/* First byte after chip select is the opcode */
+	SPI_TRACE_OPCODE(tx_data[0]);
 
 	if(HAL_SPI_TransmitReceive(&hspi1, tx_data, rx_data, size, timeout) == HAL_OK)
-		retval = W25Q80DV_OK;
+		retval = LIS3MDL_OK;
+	else
+		DLOG1(DLOG_MAG_SPI_ERROR, hspi1.ErrorCode);
 
 	return retval;
 }
@@ -57,14 +84,17 @@ W25Q80DV_StatusTypeDef W25Q80DV_TxRx(uint8_t *tx_data, uint8_t *rx_data, uint16_
   * @param tx_data: Vector to transmit
   * @param size: Number of bytes to transmit
   * @param  Timeout Timeout duration
-  * @retval W25Q80DV status
+  * @retval LIS3MDL status
   */
-W25Q80DV_StatusTypeDef W25Q80DV_Tx(uint8_t *tx_data, uint16_t size, uint32_t timeout)
+LIS3MDL_StatusTypeDef LIS3MDL_Tx(uint8_t *tx_data, uint16_t size, uint32_t timeout)
 {
-	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
+	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
+
+	/* First byte after chip select is the opcode */
+	SPI_TRACE_OPCODE(tx_data[0]);
 
 	if(HAL_SPI_Transmit(&hspi1, tx_data, size, timeout) == HAL_OK)
-		retval = W25Q80DV_OK;
+		retval = LIS3MDL_OK;
 
 	return retval;
 }
@@ -74,30 +104,33 @@ W25Q80DV_StatusTypeDef W25Q80DV_Tx(uint8_t *tx_data, uint16_t size, uint32_t tim
   * @param rx_data: Vector where the data read is stored
   * @param size: Number of bytes to receive
   * @param  Timeout Timeout duration
-  * @retval W25Q80DV status
+  * @retval LIS3MDL status
   */
-W25Q80DV_StatusTypeDef W25Q80DV_Rx(uint8_t *rx_data, uint16_t size, uint32_t timeout)
+LIS3MDL_StatusTypeDef LIS3MDL_Rx(uint8_t *rx_data, uint16_t size, uint32_t timeout)
 {
-	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
+	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
 	if(HAL_SPI_Receive(&hspi1, rx_data, size, timeout) == HAL_OK)
-		retval = W25Q80DV_OK;
+		retval = LIS3MDL_OK;
 
 	return retval;
 }
 
 /**
-  * @brief Transmit and then receives a number of bytes using DMA
+  * @brief Transmits and receives a number of bytes using DMA
   * @param tx_data: Vector to transmit
   * @param rx_data: Vector where the data read is stored
   * @param size: Number of bytes to transmit/receive
-  * @retval W25Q80DV status
+  * @retval LIS3MDL status
   */
-W25Q80DV_StatusTypeDef W25Q80DV_TxRx_DMA(uint8_t *tx_data, uint8_t *rx_data, uint16_t size)
+LIS3MDL_StatusTypeDef LIS3MDL_TxRx_DMA(uint8_t *tx_data, uint8_t *rx_data, uint16_t size)
 {
-	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
+	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
+
+	/* First byte after chip select is the opcode */
+	SPI_TRACE_OPCODE(tx_data[0]);
 
 	if(HAL_SPI_TransmitReceive_DMA(&hspi1, tx_data, rx_data, size) == HAL_OK)
-		retval = W25Q80DV_OK;
+		retval = LIS3MDL_OK;
 
 	return retval;
 }
@@ -106,14 +139,17 @@ W25Q80DV_StatusTypeDef W25Q80DV_TxRx_DMA(uint8_t *tx_data, uint8_t *rx_data, uin
   * @brief Transmits a number of bytes using DMA
   * @param tx_data: Vector to transmit
   * @param size: Number of bytes to transmit
-  * @retval W25Q80DV status
+  * @retval LIS3MDL status
   */
-W25Q80DV_StatusTypeDef W25Q80DV_Tx_DMA(uint8_t *tx_data, uint16_t size)
+LIS3MDL_StatusTypeDef LIS3MDL_Tx_DMA(uint8_t *tx_data, uint16_t size)
 {
-	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
+	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
+
+	/* First byte after chip select is the opcode */
+	SPI_TRACE_OPCODE(tx_data[0]);
 
 	if(HAL_SPI_Transmit_DMA(&hspi1, tx_data, size) == HAL_OK)
-		retval = W25Q80DV_OK;
+		retval = LIS3MDL_OK;
 
 	return retval;
 }
@@ -122,31 +158,44 @@ W25Q80DV_StatusTypeDef W25Q80DV_Tx_DMA(uint8_t *tx_data, uint16_t size)
   * @brief Receives a number of bytes using DMA
   * @param rx_data: Vector where the data read is stored
   * @param size: Number of bytes to receive
-  * @retval W25Q80DV status
+  * @retval LIS3MDL status
   */
-W25Q80DV_StatusTypeDef W25Q80DV_Rx_DMA(uint8_t *rx_data, uint16_t size)
+LIS3MDL_StatusTypeDef LIS3MDL_Rx_DMA(uint8_t *rx_data, uint16_t size)
 {
-	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
+	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
 
 	if(HAL_SPI_Receive_DMA(&hspi1, rx_data, size) == HAL_OK)
-		retval = W25Q80DV_OK;
+		retval = LIS3MDL_OK;
 
 	return retval;
 }
 
+/**
+  * @brief Stops a DMA transfer that timed out, so that it can not write
+  * into its buffer once it is given back, and drops a late completion
+  */
+static void LIS3MDL_AbortTransfer(void)
+{
+	HAL_SPI_Abort(&hspi1);
+	osMessageGet(SPITxQueueHandle, 0);
+	osMessageGet(SPIRxQueueHandle, 0);
+}
+
 /**
   * @brief Waits for last SPI transmit operation to be completed
   * @param  Timeout Timeout duration
-  * @retval W25Q80DV status
+  * @retval LIS3MDL status
   */
-W25Q80DV_StatusTypeDef W25Q80DV_Tx_DMA_WaitToFinish(uint32_t timeout)
+LIS3MDL_StatusTypeDef LIS3MDL_Tx_DMA_WaitToFinish(uint32_t timeout)
 {
 	osEvent event;
-	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
+	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
 
 	event = osMessageGet(SPITxQueueHandle, timeout);
 	if(event.status == osEventMessage)
-		retval = W25Q80DV_OK;
+		retval = LIS3MDL_OK;
+	else
+		LIS3MDL_AbortTransfer();
 
 	return retval;
 }
@@ -154,16 +203,42 @@ W25Q80DV_StatusTypeDef W25Q80DV_Tx_DMA_WaitToFinish(uint32_t timeout)
 /**
   * @brief Waits for last SPI receive operation to be completed
   * @param  Timeout Timeout duration
-  * @retval W25Q80DV status
+  * @retval LIS3MDL status
   */
-W25Q80DV_StatusTypeDef W25Q80DV_Rx_DMA_WaitToFinish(uint32_t timeout)
+LIS3MDL_StatusTypeDef LIS3MDL_Rx_DMA_WaitToFinish(uint32_t timeout)
 {
 	osEvent event;
-	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
+	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
 
 	event = osMessageGet(SPIRxQueueHandle, timeout);
 	if(event.status == osEventMessage)
-		retval = W25Q80DV_OK;
+	{
+		/* Reception runs full duplex, so the transmit channel completed
+		 * first and signaled too. Drop it or the next transmit wait would
+		 * return before its data is out */
+		osMessageGet(SPITxQueueHandle, 0);
+		retval = LIS3MDL_OK;
+	}
+	else
+		LIS3MDL_AbortTransfer();
 
 	return retval;
 }
+
+/**
+  * @brief Borrows a DMA capable buffer (at least 32 bytes)
+  * @retval Buffer, NULL if none available
+  */
+uint8_t* LIS3MDL_BufferAcquire(void)
+{
+	return DMAPOOL_Acquire(DMAPOOL_SMALL);
+}
+
+/**
+  * @brief Gives back a buffer borrowed with LIS3MDL_BufferAcquire
+  * @param buffer: Buffer to give back
+  */
+void LIS3MDL_BufferRelease(uint8_t *buffer)
+{
+	DMAPOOL_Release(buffer);
+}
@@ -26,12 +26,31 @@
 #define W25Q80DV_STATUS_REG_1	0x05
 #define W25Q80DV_STATUS_REG_2	0x35
 
+/* Bytes in the memory (8 Mbit) */
+#define W25Q80DV_CAPACITY		1048576
 /* Bytes per sector */
 #define W25Q80DV_SECTOR_SIZE	4096
-/* Based on sector size */
-#define W25Q80DV_BLOCK_SIZE		16
-/* Based on block size */
-#define W25Q80DV_PAGE_SIZE		16
+/* Bytes per block (16 sectors) */
+#define W25Q80DV_BLOCK_SIZE		65536
+/* Bytes per page, the most a single page program can write */
+#define W25Q80DV_PAGE_SIZE		256
+
+/* Status register 1 BUSY bit */
+#define W25Q80DV_SR1_BUSY		0x01
+
+/* Datasheet typical times, initial value of the online estimates */
+#define W25Q80DV_PAGE_PROGRAM_TYP_US	700
+#define W25Q80DV_ERASE_SECTOR_TYP_US	45000
+/* Datasheet maximum times, a wait is aborted after them */
+#define W25Q80DV_PAGE_PROGRAM_MAX_US	3000
+#define W25Q80DV_ERASE_SECTOR_MAX_US	400000
+
+/* Wake up this long before the predicted completion */
+#define W25Q80DV_WAIT_GUARD_US			1000
+/* Status polling backoff: first interval, doubled up to the maximum.
+ * The task sleeps between polls, one tick at least */
+#define W25Q80DV_WAIT_MIN_BACKOFF_MS	1
+#define W25Q80DV_WAIT_MAX_BACKOFF_MS	4
 
 
 typedef enum
@@ -40,6 +59,27 @@ typedef enum
   W25Q80DV_OK    = 0
 } W25Q80DV_StatusTypeDef;
 
+/* Operations completed in the background by the memory */
+typedef enum
+{
+  W25Q80DV_OP_PAGE_PROGRAM = 0,
+  W25Q80DV_OP_ERASE_SECTOR,
+  W25Q80DV_OP_COUNT
+} W25Q80DV_OperationTypeDef;
+
+typedef struct
+{
+  /* Online estimate of the operation time */
+  uint32_t estimate_us;
+  uint32_t last_us;
+  uint32_t count;
+  /* Status register reads */
+  uint32_t polls;
+  /* Times the task slept and was woken up */
+  uint32_t wakeups;
+  uint32_t timeouts;
+} W25Q80DV_WaitStatsTypeDef;
+
 typedef struct
 {
    uint8_t BUSY: 1;
@@ -68,7 +108,11 @@ W25Q80DV_StatusTypeDef W25Q80DV_WriteDisable(void);
 W25Q80DV_StatusTypeDef W25Q80DV_ReadBytes(uint32_t init_pos, uint8_t* data, uint32_t count);
 W25Q80DV_StatusTypeDef W25Q80DV_ReadSector(uint32_t init_pos, uint8_t* received_data);
 W25Q80DV_StatusTypeDef W25Q80DV_ReadStatusRegister(uint8_t* data);
+W25Q80DV_StatusTypeDef W25Q80DV_ReadStatusRegister1(uint8_t* data);
+W25Q80DV_StatusTypeDef W25Q80DV_WaitForReady(W25Q80DV_OperationTypeDef operation);
+void W25Q80DV_GetWaitStats(W25Q80DV_OperationTypeDef operation, W25Q80DV_WaitStatsTypeDef *stats);
 W25Q80DV_StatusTypeDef W25Q80DV_EraseSector(uint32_t init_pos);
 W25Q80DV_StatusTypeDef W25Q80DV_WriteSector(uint32_t init_pos, uint8_t* data);
+W25Q80DV_StatusTypeDef W25Q80DV_WriteBytes(uint32_t init_pos, uint8_t* data, uint32_t count);
 
 #endif /* W25Q80DV_H_ */
@@ -19,9 +19,16 @@
 #define W25Q80DV_CS_ON									GPIO_PIN_RESET
 #define W25Q80DV_CS_OFF									GPIO_PIN_SET
 
+/* Slack added to the wire time of a DMA transfer: one tick for the
+ * timeout phase and one for the interrupt and the task switch */
+#define W25Q80DV_TRANSFER_MARGIN_MS						2
+
 /* Functions to be implemented by user */
 void W25Q80DV_ChipSelect(uint32_t on_off);
 void W25Q80DV_Delay(uint32_t ms);
+uint32_t W25Q80DV_GetTimestamp(void);
+uint32_t W25Q80DV_TimestampToUs(uint32_t timestamp_delta);
+uint32_t W25Q80DV_TransferTimeout(uint32_t size);
 W25Q80DV_StatusTypeDef W25Q80DV_TxRx(uint8_t *pTxData, uint8_t *pRxData, uint16_t Size, uint32_t Timeout);
 W25Q80DV_StatusTypeDef W25Q80DV_Tx(uint8_t *pData, uint16_t Size, uint32_t Timeout);
 W25Q80DV_StatusTypeDef W25Q80DV_Rx(uint8_t *pData, uint16_t Size, uint32_t Timeout);
@@ -30,4 +37,6 @@ W25Q80DV_StatusTypeDef W25Q80DV_Tx_DMA(uint8_t *pData, uint16_t Size);
 W25Q80DV_StatusTypeDef W25Q80DV_Rx_DMA(uint8_t *pData, uint16_t Size);
 W25Q80DV_StatusTypeDef W25Q80DV_Tx_DMA_WaitToFinish(uint32_t timeout);
 W25Q80DV_StatusTypeDef W25Q80DV_Rx_DMA_WaitToFinish(uint32_t timeout);
+uint8_t* W25Q80DV_BufferAcquire(void);
+void W25Q80DV_BufferRelease(uint8_t *buffer);
 #endif /* W25Q80DV_CONF_H_ */
@@ -27,6 +27,23 @@
 
 #include "w25q80dv_conf.h"
 
+/* Weight of a new sample in the operation time estimate, as a shift (1/8) */
+#define W25Q80DV_ESTIMATE_SHIFT		3
+
+/* Commands go at the start of a pool block, received bytes here */
+#define W25Q80DV_BUFFER_RX_OFFSET	16
+
+static W25Q80DV_WaitStatsTypeDef wait_stats[W25Q80DV_OP_COUNT] =
+{
+	[W25Q80DV_OP_PAGE_PROGRAM] = { .estimate_us = W25Q80DV_PAGE_PROGRAM_TYP_US },
+	[W25Q80DV_OP_ERASE_SECTOR] = { .estimate_us = W25Q80DV_ERASE_SECTOR_TYP_US },
+};
+
+static const uint32_t wait_max_us[W25Q80DV_OP_COUNT] =
+{
+	[W25Q80DV_OP_PAGE_PROGRAM] = W25Q80DV_PAGE_PROGRAM_MAX_US,
+	[W25Q80DV_OP_ERASE_SECTOR] = W25Q80DV_ERASE_SECTOR_MAX_US,
+};
 
 /**
   * @brief Initializes the FLASH memory
@@ -34,10 +51,17 @@
   */
 W25Q80DV_StatusTypeDef W25Q80DV_Init(void)
 {
-	uint8_t tx_data, rx_data[3];
+	uint8_t *tx_data, *rx_data;
 	uint32_t value, retrials;
 	W25Q80DV_StatusTypeDef prevop_status = W25Q80DV_ERROR;
 
+	/* DMA source and target share a pool block, off the task stack. A
+	 * transfer that times out is aborted before the block is given back */
+	tx_data = W25Q80DV_BufferAcquire();
+	if(tx_data == NULL)
+		return W25Q80DV_ERROR;
+	rx_data = tx_data + W25Q80DV_BUFFER_RX_OFFSET;
+
 	/* Retry initialization W25Q80DV_RETRIAL times in case of failure */
 	for(retrials = 0; retrials <= W25Q80DV_RETIRALS; retrials++)
 	{
@@ -46,11 +70,11 @@ W25Q80DV_StatusTypeDef W25Q80DV_Init(void)
 		W25Q80DV_Delay(10);
 
 		/* Send ID */
-		tx_data = W25Q80DV_ID;
+		tx_data[0] = W25Q80DV_ID;
 
 #ifdef W25Q80DV_USE_DMA
 
-		if(W25Q80DV_Tx_DMA(&tx_data, 1) == W25Q80DV_OK)
+		if(W25Q80DV_Tx_DMA(tx_data, 1) == W25Q80DV_OK)
 		{
 			/* read values */
 			if(W25Q80DV_Rx_DMA(rx_data, 3) == W25Q80DV_OK)
@@ -61,7 +85,7 @@ W25Q80DV_StatusTypeDef W25Q80DV_Init(void)
 		}
 
 #else
-		if(W25Q80DV_Tx(&tx_data, 1, 100) == W25Q80DV_OK)
+		if(W25Q80DV_Tx(tx_data, 1, 100) == W25Q80DV_OK)
 		{
 			/* read values */
 			prevop_status = W25Q80DV_Rx(rx_data, 3, 100);
@@ -86,6 +110,9 @@ W25Q80DV_StatusTypeDef W25Q80DV_Init(void)
 		else
 			break;
 	}
+
+	W25Q80DV_BufferRelease(tx_data);
+
 	return prevop_status;
 }
 
@@ -95,30 +122,37 @@ W25Q80DV_StatusTypeDef W25Q80DV_Init(void)
   */
 W25Q80DV_StatusTypeDef W25Q80DV_WriteEnable(void)
 {
-	uint8_t tx_data;
+	uint8_t *tx_data;
 	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
 
+	/* DMA source off the task stack */
+	tx_data = W25Q80DV_BufferAcquire();
+	if(tx_data == NULL)
+		return W25Q80DV_ERROR;
+
 	/* Enable CS pin and wait until stabilizes */
 	W25Q80DV_ChipSelect(W25Q80DV_CS_ON);
 	W25Q80DV_Delay(10);
 
 	/* Enable write */
-	tx_data = W25Q80DV_WRITE_ENABLE;
+	tx_data[0] = W25Q80DV_WRITE_ENABLE;
 
 #ifdef W25Q80DV_USE_DMA
-	if(W25Q80DV_Tx_DMA(&tx_data, 1) == W25Q80DV_OK)
+	if(W25Q80DV_Tx_DMA(tx_data, 1) == W25Q80DV_OK)
 	{
 		/* Wait up to one millisecond for the data to be transmitted */
 		retval = W25Q80DV_Tx_DMA_WaitToFinish(1);
 	}
 
 #else
-	retval = W25Q80DV_Tx(&tx_data, 1, 100);
+	retval = W25Q80DV_Tx(tx_data, 1, 100);
 #endif
 	/* Disable CS pin and wait until stabilizes */
 	W25Q80DV_ChipSelect(W25Q80DV_CS_OFF);
 	W25Q80DV_Delay(10);
 
+	W25Q80DV_BufferRelease(tx_data);
+
 	return retval;
 }
 
@@ -128,31 +162,38 @@ W25Q80DV_StatusTypeDef W25Q80DV_WriteEnable(void)
   */
 W25Q80DV_StatusTypeDef W25Q80DV_WriteDisable(void)
 {
-	uint8_t tx_data;
+	uint8_t *tx_data;
 	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
 
+	/* DMA source off the task stack */
+	tx_data = W25Q80DV_BufferAcquire();
+	if(tx_data == NULL)
+		return W25Q80DV_ERROR;
+
 	/* Enable CS pin and wait until stabilizes */
 	W25Q80DV_ChipSelect(W25Q80DV_CS_ON);
 	W25Q80DV_Delay(10);
 
 	/* Disable write */
-	tx_data = W25Q80DV_WRITE_DISABLE;
+	tx_data[0] = W25Q80DV_WRITE_DISABLE;
 
 #ifdef W25Q80DV_USE_DMA
-	if(W25Q80DV_Tx_DMA(&tx_data, 1) == W25Q80DV_OK)
+	if(W25Q80DV_Tx_DMA(tx_data, 1) == W25Q80DV_OK)
 	{
 		/* Wait up to one millisecond for the data to be transmitted */
 		retval = W25Q80DV_Tx_DMA_WaitToFinish(1);
 	}
 
 #else
-	retval = W25Q80DV_Tx(&tx_data, 1, 100);
+	retval = W25Q80DV_Tx(tx_data, 1, 100);
 #endif
 
 	/* Disable CS pin and wait until stabilizes */
 	W25Q80DV_ChipSelect(W25Q80DV_CS_OFF);
 	W25Q80DV_Delay(10);
 
+	W25Q80DV_BufferRelease(tx_data);
+
 	return retval;
 }
 
@@ -163,8 +204,14 @@ W25Q80DV_StatusTypeDef W25Q80DV_WriteDisable(void)
 W25Q80DV_StatusTypeDef W25Q80DV_Reset(void)
 {
 	W25Q80DV_StatusTypeDef prevop_status = W25Q80DV_ERROR;
-	uint8_t tx_data;
+	uint8_t *tx_data;
 	W25Q80DV_StatusRegTypeDef status;
+
+	/* DMA source off the task stack */
+	tx_data = W25Q80DV_BufferAcquire();
+	if(tx_data == NULL)
+		return W25Q80DV_ERROR;
+
 	/* Enable CS pin and wait until stabilizes */
 	W25Q80DV_ChipSelect(W25Q80DV_CS_ON);
 	W25Q80DV_Delay(10);
@@ -178,10 +225,10 @@ W25Q80DV_StatusTypeDef W25Q80DV_Reset(void)
 	if(prevop_status == W25Q80DV_OK && status.SUS == 0 && status.BUSY == 0)
 	{
 		/* Enable reset */
-		tx_data = W25Q80DV_ENABLE_RESET;
+		tx_data[0] = W25Q80DV_ENABLE_RESET;
 
 #ifdef W25Q80DV_USE_DMA
-		if(W25Q80DV_Tx_DMA(&tx_data, 1) == W25Q80DV_OK)
+		if(W25Q80DV_Tx_DMA(tx_data, 1) == W25Q80DV_OK)
 		{
 			/* Wait up to one millisecond for the data to be transmitted */
 			prevop_status = W25Q80DV_Tx_DMA_WaitToFinish(1);
@@ -190,7 +237,7 @@ W25Q80DV_StatusTypeDef W25Q80DV_Reset(void)
 			prevop_status = W25Q80DV_ERROR;
 
 #else
-		prevop_status = W25Q80DV_Tx(&tx_data, 1, 100);
+		prevop_status = W25Q80DV_Tx(tx_data, 1, 100);
 #endif
 
 		/* Disable CS pin and wait until stabilizes */
@@ -205,10 +252,10 @@ W25Q80DV_StatusTypeDef W25Q80DV_Reset(void)
 
 
 			/* reset memory */
-			tx_data = W25Q80DV_RESET;
+			tx_data[0] = W25Q80DV_RESET;
 
 #ifdef W25Q80DV_USE_DMA
-			if(W25Q80DV_Tx_DMA(&tx_data, 1) == W25Q80DV_OK)
+			if(W25Q80DV_Tx_DMA(tx_data, 1) == W25Q80DV_OK)
 			{
 				/* Wait up to one millisecond for the data to be transmitted */
 				prevop_status = W25Q80DV_Tx_DMA_WaitToFinish(1);
@@ -217,7 +264,7 @@ W25Q80DV_StatusTypeDef W25Q80DV_Reset(void)
 				prevop_status = W25Q80DV_ERROR;
 
 #else
-			prevop_status = W25Q80DV_Tx(&tx_data, 1, 100);
+			prevop_status = W25Q80DV_Tx(tx_data, 1, 100);
 #endif
 
 			/* Disable CS pin and wait until stabilizes */
@@ -226,23 +273,31 @@ W25Q80DV_StatusTypeDef W25Q80DV_Reset(void)
 		}
 	}
 
+	W25Q80DV_BufferRelease(tx_data);
+
 	return prevop_status;
 }
 
 /**
   * @brief Read some bytes based on initial position
   * @param init_pos: Position where the read action begins
+  * @param data: Data read
   * @param count: Number of bytes to read
   * @retval W25Q80DV Status
   */
 W25Q80DV_StatusTypeDef W25Q80DV_ReadBytes(uint32_t init_pos, uint8_t* data, uint32_t count)
 {
-	uint8_t aux_data[4];
+	uint8_t *aux_data;
 	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
 
-	/* Enable CS pin and wait until stabilizes */
+	/* DMA source off the task stack */
+	aux_data = W25Q80DV_BufferAcquire();
+	if(aux_data == NULL)
+		return W25Q80DV_ERROR;
+
+	/* Chip select setup time is a few nanoseconds, small reads are issued
+	 * back to back by the log, no delays here */
 	W25Q80DV_ChipSelect(W25Q80DV_CS_ON);
-	W25Q80DV_Delay(10);
 
 	/* Send read command with sector initial position */
 	aux_data[0] = W25Q80DV_READ;
@@ -251,12 +306,13 @@ W25Q80DV_StatusTypeDef W25Q80DV_ReadBytes(uint32_t init_pos, uint8_t* data, uint
 	aux_data[3] = (init_pos) & 0xFF;
 
 #ifdef W25Q80DV_USE_DMA
-	if(W25Q80DV_Tx_DMA(aux_data, 4) == W25Q80DV_OK)
+	/* The reception can not start until the command is out */
+	if(W25Q80DV_Tx_DMA(aux_data, 4) == W25Q80DV_OK && W25Q80DV_Tx_DMA_WaitToFinish(1) == W25Q80DV_OK)
 	{
 		if(W25Q80DV_Rx_DMA(data, count) == W25Q80DV_OK)
 		{
-			/* Wait up to 2 milliseconds for the data to be received */
-			retval = W25Q80DV_Rx_DMA_WaitToFinish(2);
+			/* Wait for the data to be received, ranges go up to a sector */
+			retval = W25Q80DV_Rx_DMA_WaitToFinish(W25Q80DV_TransferTimeout(count));
 		}
 	}
 
@@ -265,11 +321,9 @@ W25Q80DV_StatusTypeDef W25Q80DV_ReadBytes(uint32_t init_pos, uint8_t* data, uint
 		retval = W25Q80DV_Rx(data, count, 100);
 #endif
 
-	/* Disable CS pin and wait until stabilizes */
 	W25Q80DV_ChipSelect(W25Q80DV_CS_OFF);
-	W25Q80DV_Delay(10);
 
-	W25Q80DV_WriteDisable();
+	W25Q80DV_BufferRelease(aux_data);
 
 	return retval;
 }
@@ -282,9 +336,14 @@ W25Q80DV_StatusTypeDef W25Q80DV_ReadBytes(uint32_t init_pos, uint8_t* data, uint
   */
 W25Q80DV_StatusTypeDef W25Q80DV_ReadSector(uint32_t init_pos, uint8_t* received_data)
 {
-	uint8_t tx_data[4];
+	uint8_t *tx_data;
 	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
 
+	/* DMA source off the task stack */
+	tx_data = W25Q80DV_BufferAcquire();
+	if(tx_data == NULL)
+		return W25Q80DV_ERROR;
+
 	/* Enable CS pin and wait until stabilizes */
 	W25Q80DV_ChipSelect(W25Q80DV_CS_ON);
 	W25Q80DV_Delay(10);
@@ -297,13 +356,14 @@ W25Q80DV_StatusTypeDef W25Q80DV_ReadSector(uint32_t init_pos, uint8_t* received_
 	tx_data[3] = (init_pos) & 0xFF;
 
 #ifdef W25Q80DV_USE_DMA
-	if(W25Q80DV_Tx_DMA(tx_data, 4) == W25Q80DV_OK)
+	/* The reception can not start until the command is out */
+	if(W25Q80DV_Tx_DMA(tx_data, 4) == W25Q80DV_OK && W25Q80DV_Tx_DMA_WaitToFinish(1) == W25Q80DV_OK)
 	{
 		/* Read the sector secuentially */
 		if(W25Q80DV_Rx_DMA(received_data, W25Q80DV_SECTOR_SIZE) == W25Q80DV_OK)
 		{
-			/* Wait up to 5 milliseconds for the data to be received */
-			retval = W25Q80DV_Rx_DMA_WaitToFinish(5);
+			/* Wait for the data to be received, a sector is 8.2 ms at 4 MHz */
+			retval = W25Q80DV_Rx_DMA_WaitToFinish(W25Q80DV_TransferTimeout(W25Q80DV_SECTOR_SIZE));
 		}
 	}
 
@@ -319,6 +379,8 @@ W25Q80DV_StatusTypeDef W25Q80DV_ReadSector(uint32_t init_pos, uint8_t* received_
 	W25Q80DV_ChipSelect(W25Q80DV_CS_OFF);
 	W25Q80DV_Delay(10);
 
+	W25Q80DV_BufferRelease(tx_data);
+
 	return retval;
 }
 
@@ -331,41 +393,48 @@ W25Q80DV_StatusTypeDef W25Q80DV_ReadSector(uint32_t init_pos, uint8_t* received_
   */
 W25Q80DV_StatusTypeDef W25Q80DV_ReadStatusRegister(uint8_t* data)
 {
-	uint8_t tx_data;
+	uint8_t *tx_data, *rx_data;
 	W25Q80DV_StatusTypeDef prevop_status = W25Q80DV_ERROR;
 
+	/* DMA source and target off the task stack, the caller's data may
+	 * live there too */
+	tx_data = W25Q80DV_BufferAcquire();
+	if(tx_data == NULL)
+		return W25Q80DV_ERROR;
+	rx_data = tx_data + W25Q80DV_BUFFER_RX_OFFSET;
+
 	/* Enable CS pin and wait until stabilizes */
 	W25Q80DV_ChipSelect(W25Q80DV_CS_ON);
 	W25Q80DV_Delay(10);
 
 	/* Send Status register 1 and read it */
-	tx_data = W25Q80DV_STATUS_REG_1;
+	tx_data[0] = W25Q80DV_STATUS_REG_1;
 
 #ifdef W25Q80DV_USE_DMA
-	if(W25Q80DV_TxRx_DMA(&tx_data, &data[0], 1) == W25Q80DV_OK)
+	if(W25Q80DV_TxRx_DMA(tx_data, &rx_data[0], 1) == W25Q80DV_OK)
 	{
 		/* Wait up to one millisecond for the data to be received */
 		prevop_status = W25Q80DV_Rx_DMA_WaitToFinish(1);
 	}
 
 #else
-	prevop_status = W25Q80DV_TxRx(&tx_data, &data[0], 1, 100);
+	prevop_status = W25Q80DV_TxRx(tx_data, &rx_data[0], 1, 100);
 
 #endif
 
 	if(prevop_status == W25Q80DV_OK)
 	{
 		/* Send Status register 2 and read it */
-		tx_data = W25Q80DV_STATUS_REG_2;
+		tx_data[0] = W25Q80DV_STATUS_REG_2;
 
 #ifdef W25Q80DV_USE_DMA
-		if(W25Q80DV_TxRx_DMA(&tx_data, &data[1], 1) == W25Q80DV_OK)
+		if(W25Q80DV_TxRx_DMA(tx_data, &rx_data[1], 1) == W25Q80DV_OK)
 		{
 			/* Wait up to one millisecond for the data to be received */
 			prevop_status = W25Q80DV_Rx_DMA_WaitToFinish(1);
 		}
 #else
-		prevop_status = W25Q80DV_TxRx(&tx_data, &data[1], 1, 100);
+		prevop_status = W25Q80DV_TxRx(tx_data, &rx_data[1], 1, 100);
 
 #endif
     }
@@ -374,24 +443,168 @@ W25Q80DV_StatusTypeDef W25Q80DV_ReadStatusRegister(uint8_t* data)
 	W25Q80DV_ChipSelect(W25Q80DV_CS_OFF);
 	W25Q80DV_Delay(10);
 
+	if(prevop_status == W25Q80DV_OK)
+	{
+		data[0] = rx_data[0];
+		data[1] = rx_data[1];
+	}
+
+	W25Q80DV_BufferRelease(tx_data);
+
 	return prevop_status;
 }
 
+/**
+  * @brief Reads only status register 1 in a single short transaction,
+  * used to poll the BUSY bit
+  * @param data: Data read (1 byte)
+  * @retval W25Q80DV Status
+  */
+W25Q80DV_StatusTypeDef W25Q80DV_ReadStatusRegister1(uint8_t* data)
+{
+	uint8_t *tx_data, *rx_data;
+	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
+
+	tx_data = W25Q80DV_BufferAcquire();
+	if(tx_data == NULL)
+		return W25Q80DV_ERROR;
+	rx_data = tx_data + W25Q80DV_BUFFER_RX_OFFSET;
+
+	/* The register is shifted out while the dummy byte is sent. No CS
+	 * settling delay here, this runs once per poll */
+	tx_data[0] = W25Q80DV_STATUS_REG_1;
+	tx_data[1] = 0xFF;
+
+	W25Q80DV_ChipSelect(W25Q80DV_CS_ON);
+
+#ifdef W25Q80DV_USE_DMA
+	if(W25Q80DV_TxRx_DMA(tx_data, rx_data, 2) == W25Q80DV_OK)
+	{
+		/* Wait for the data to be received */
+		retval = W25Q80DV_Rx_DMA_WaitToFinish(W25Q80DV_TransferTimeout(2));
+	}
+
+#else
+	retval = W25Q80DV_TxRx(tx_data, rx_data, 2, 100);
+
+#endif
+
+	W25Q80DV_ChipSelect(W25Q80DV_CS_OFF);
+
+	if(retval == W25Q80DV_OK)
+		*data = rx_data[1];
+
+	W25Q80DV_BufferRelease(tx_data);
+
+	return retval;
+}
+
+/**
+  * @brief Waits until the memory finishes a program or erase operation.
+  * The task sleeps until shortly before the predicted completion, then
+  * polls status register 1 with an exponential backoff, sleeping between
+  * polls. The measured time updates the prediction.
+  * @param operation: Operation in progress
+  * @retval W25Q80DV Status
+  */
+W25Q80DV_StatusTypeDef W25Q80DV_WaitForReady(W25Q80DV_OperationTypeDef operation)
+{
+	W25Q80DV_WaitStatsTypeDef *stats;
+	uint32_t start, elapsed_us, sample_us, backoff_ms, polls = 0;
+	uint8_t status_reg;
+
+	if(operation >= W25Q80DV_OP_COUNT)
+		return W25Q80DV_ERROR;
+
+	stats = &wait_stats[operation];
+	start = W25Q80DV_GetTimestamp();
+
+	/* Sleep through most of the expected time without touching the bus */
+	if(stats->estimate_us > W25Q80DV_WAIT_GUARD_US + 1000)
+	{
+		W25Q80DV_Delay((stats->estimate_us - W25Q80DV_WAIT_GUARD_US) / 1000);
+		stats->wakeups++;
+	}
+
+	backoff_ms = W25Q80DV_WAIT_MIN_BACKOFF_MS;
+	for(;;)
+	{
+		stats->polls++;
+		polls++;
+		if(W25Q80DV_ReadStatusRegister1(&status_reg) != W25Q80DV_OK)
+			return W25Q80DV_ERROR;
+
+		elapsed_us = W25Q80DV_TimestampToUs(W25Q80DV_GetTimestamp() - start);
+
+		if((status_reg & W25Q80DV_SR1_BUSY) == 0)
+			break;
+
+		if(elapsed_us >= wait_max_us[operation])
+		{
+			stats->timeouts++;
+			return W25Q80DV_ERROR;
+		}
+
+		W25Q80DV_Delay(backoff_ms);
+		stats->wakeups++;
+
+		if(backoff_ms < W25Q80DV_WAIT_MAX_BACKOFF_MS)
+			backoff_ms <<= 1;
+	}
+
+	/* Ready at the first poll: it finished somewhere before it, so the
+	 * elapsed time overstates the duration. Take the guard off to move the
+	 * estimate down until a poll finds the memory busy again */
+	sample_us = elapsed_us;
+	if(polls == 1)
+		sample_us = (elapsed_us > W25Q80DV_WAIT_GUARD_US) ? elapsed_us - W25Q80DV_WAIT_GUARD_US : 0;
+
+	/* Exponentially weighted moving average of the real duration */
+	stats->last_us = elapsed_us;
+	stats->count++;
+	stats->estimate_us = stats->estimate_us
+			- (stats->estimate_us >> W25Q80DV_ESTIMATE_SHIFT)
+			+ (sample_us >> W25Q80DV_ESTIMATE_SHIFT);
+
+	return W25Q80DV_OK;
+}
+
+/**
+  * @brief Gets a copy of the wait statistics of an operation
+  * @param operation: Operation
+  * @param stats: Where the statistics are copied
+  */
+void W25Q80DV_GetWaitStats(W25Q80DV_OperationTypeDef operation, W25Q80DV_WaitStatsTypeDef *stats)
+{
+	if(operation < W25Q80DV_OP_COUNT && stats != NULL)
+		*stats = wait_stats[operation];
+}
+
 /**
   * @brief Erases a complete sector starting in init_pos (24 bits)
+  * and waits for the erase to finish
   * @param init_pos: Position where the sector begins
   * @retval W25Q80DV Status
   */
 W25Q80DV_StatusTypeDef W25Q80DV_EraseSector(uint32_t init_pos)
 {
-	uint8_t tx_data[4];
+	uint8_t *tx_data;
 	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
 
+	/* Erase is rejected by the memory unless write is enabled */
+	if(W25Q80DV_WriteEnable() != W25Q80DV_OK)
+		return W25Q80DV_ERROR;
+
+	/* DMA source off the task stack */
+	tx_data = W25Q80DV_BufferAcquire();
+	if(tx_data == NULL)
+		return W25Q80DV_ERROR;
+
 	/* Enable CS pin and wait until stabilizes */
 	W25Q80DV_ChipSelect(W25Q80DV_CS_ON);
 	W25Q80DV_Delay(10);
 
-	/* Send read command with sector position */
+	/* Send erase command with sector position */
 	tx_data[0] = W25Q80DV_ERASE_SECTOR;
 	tx_data[1] = (init_pos >> 16) & 0xFF;
 	tx_data[2] = (init_pos >> 8) & 0xFF;
@@ -400,8 +613,8 @@ W25Q80DV_StatusTypeDef W25Q80DV_EraseSector(uint32_t init_pos)
 #ifdef W25Q80DV_USE_DMA
 	if(W25Q80DV_Tx_DMA(tx_data, 4) == W25Q80DV_OK)
 	{
-		/* Wait up to one millisecond for the data to be received */
-		retval = W25Q80DV_Rx_DMA_WaitToFinish(1);
+		/* Wait up to one millisecond for the data to be transmitted */
+		retval = W25Q80DV_Tx_DMA_WaitToFinish(1);
 	}
 
 #else
@@ -409,63 +622,102 @@ W25Q80DV_StatusTypeDef W25Q80DV_EraseSector(uint32_t init_pos)
 
 #endif
 
-	/* Disable CS pin and wait until stabilizes */
+	/* Disable CS pin, the erase starts here */
 	W25Q80DV_ChipSelect(W25Q80DV_CS_OFF);
-	W25Q80DV_Delay(10);
+	W25Q80DV_BufferRelease(tx_data);
+
+	if(retval == W25Q80DV_OK)
+		retval = W25Q80DV_WaitForReady(W25Q80DV_OP_ERASE_SECTOR);
 
 	return retval;
 }
 
 /**
-  * @brief Writes a complete sector starting in init_pos (24 bits)
+  * @brief Writes a complete sector starting in init_pos (24 bits),
+  * one page program at a time
   * @param init_pos: Position where the sector begins
   * @param data: Data to be written
   * @retval W25Q80DV Status
   */
 W25Q80DV_StatusTypeDef W25Q80DV_WriteSector(uint32_t init_pos, uint8_t* data)
 {
-	uint8_t aux_data[4];
-	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
+	return W25Q80DV_WriteBytes(init_pos, data, W25Q80DV_SECTOR_SIZE);
+}
 
-	W25Q80DV_WriteEnable();
+/**
+  * @brief Writes some bytes starting in init_pos (24 bits). The bytes must
+  * be erased, they are split in page programs at the page boundaries
+  * @param init_pos: Position where the write begins
+  * @param data: Data to be written
+  * @param count: Number of bytes to write
+  * @retval W25Q80DV Status
+  */
+W25Q80DV_StatusTypeDef W25Q80DV_WriteBytes(uint32_t init_pos, uint8_t* data, uint32_t count)
+{
+	uint8_t *aux_data;
+	uint32_t offset, length;
+	W25Q80DV_StatusTypeDef retval = W25Q80DV_OK;
+
+	/* DMA source off the task stack */
+	aux_data = W25Q80DV_BufferAcquire();
+	if(aux_data == NULL)
+		return W25Q80DV_ERROR;
+
+	/* A page program wraps inside its page, so no program crosses
+	 * a page boundary */
+	for(offset = 0; offset < count && retval == W25Q80DV_OK; offset += length)
+	{
+		length = W25Q80DV_PAGE_SIZE - ((init_pos + offset) & (W25Q80DV_PAGE_SIZE - 1));
+		if(length > count - offset)
+			length = count - offset;
 
-	/* Enable CS pin and wait until stabilizes */
-	W25Q80DV_ChipSelect(W25Q80DV_CS_ON);
-	W25Q80DV_Delay(10);
+		if(W25Q80DV_WriteEnable() != W25Q80DV_OK)
+		{
+			retval = W25Q80DV_ERROR;
+			break;
+		}
 
-	/* Send read command with sector initial position */
-	aux_data[0] = W25Q80DV_PAGE_PROGRAM;
-	aux_data[1] = (init_pos >> 16) & 0xFF;
-	aux_data[2] = (init_pos >> 8) & 0xFF;
-	aux_data[3] = (init_pos) & 0xFF;
+		retval = W25Q80DV_ERROR;
+
+		W25Q80DV_ChipSelect(W25Q80DV_CS_ON);
+
+		/* Send page program command with initial position */
+		aux_data[0] = W25Q80DV_PAGE_PROGRAM;
+		aux_data[1] = ((init_pos + offset) >> 16) & 0xFF;
+		aux_data[2] = ((init_pos + offset) >> 8) & 0xFF;
+		aux_data[3] = (init_pos + offset) & 0xFF;
 
 #ifdef W25Q80DV_USE_DMA
 
-	if(W25Q80DV_Tx_DMA(aux_data, 4) == W25Q80DV_OK)
-	{
-		/* Wait up to one millisecond for the data to be transmitted */
-		if(W25Q80DV_Tx_DMA_WaitToFinish(1) == W25Q80DV_OK)
+		if(W25Q80DV_Tx_DMA(aux_data, 4) == W25Q80DV_OK)
 		{
-			/* Then, send data */
-			if(W25Q80DV_Tx_DMA(data, W25Q80DV_SECTOR_SIZE) == W25Q80DV_OK)
+			/* Wait up to one millisecond for the data to be transmitted */
+			if(W25Q80DV_Tx_DMA_WaitToFinish(1) == W25Q80DV_OK)
 			{
-				/* Wait up to 5 milliseconds for the data to be transmitted */
-				retval = W25Q80DV_Tx_DMA_WaitToFinish(5);
+				/* Then, send data */
+				if(W25Q80DV_Tx_DMA(&data[offset], length) == W25Q80DV_OK)
+				{
+					/* Wait for the data to be transmitted */
+					retval = W25Q80DV_Tx_DMA_WaitToFinish(W25Q80DV_TransferTimeout(length));
+				}
 			}
 		}
-	}
 
 #else
-	if(W25Q80DV_Tx(aux_data, 4, 100) == W25Q80DV_OK)
-		retval = W25Q80DV_Tx(data, W25Q80DV_SECTOR_SIZE, 1000);
+		if(W25Q80DV_Tx(aux_data, 4, 100) == W25Q80DV_OK)
+			retval = W25Q80DV_Tx(&data[offset], length, 100);
 
 #endif
 
-	/* Disable CS pin and wait until stabilizes */
-	W25Q80DV_ChipSelect(W25Q80DV_CS_OFF);
-	W25Q80DV_Delay(10);
+		/* Disable CS pin, the program starts here */
+		W25Q80DV_ChipSelect(W25Q80DV_CS_OFF);
+
+		if(retval == W25Q80DV_OK)
+			retval = W25Q80DV_WaitForReady(W25Q80DV_OP_PAGE_PROGRAM);
+	}
 
 	W25Q80DV_WriteDisable();
+	W25Q80DV_BufferRelease(aux_data);
 
 	return retval;
 }
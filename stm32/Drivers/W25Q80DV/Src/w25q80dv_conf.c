@@ -8,46 +8,104 @@
   ******************************************************************************
   */
 
-#include "lis3mdl_conf.h"
+#include "w25q80dv_conf.h"
 #include "cmsis_os.h"
 #include "stm32f1xx_hal.h"
+#include "spi.h"
+#include "dma_pool.h"
+#include "spi_trace.h"
+#include "cycle_counter.h"
+#include "dlog.h"
 
 extern SPI_HandleTypeDef hspi1;
 extern osMessageQId SPITxQueueHandle;
 extern osMessageQId SPIRxQueueHandle;
 
 /**
-  * @brief ON/OFF magnetometer chip select pin
+  * @brief ON/OFF memory chip select pin
   * @param on_off: pin state selected
   */
-void LIS3MDL_ChipSelect(uint32_t on_off)
+void W25Q80DV_ChipSelect(uint32_t on_off)
 {
-	HAL_GPIO_WritePin(CS_MAG_GPIO_Port, CS_MAG_Pin, on_off);
+	if(on_off == W25Q80DV_CS_ON)
+	{
+		/* A timer paced acquisition burst may be in flight. Sleep a tick
+		 * rather than spin, the caller holds the SPI semaphore */
+		while(SPI1_TryAcquireBus(SPI1_OWNER_TASK) == 0)
+			osDelay(1);
+
+		/* Set the memory SPI clock before selecting it */
+		SPI1_SelectDevice(SPI1_DEVICE_FLASH);
+		SPI_TRACE_BEGIN(SPI1_DEVICE_FLASH);
+		HAL_GPIO_WritePin(CS_FLASH_GPIO_Port, CS_FLASH_Pin, on_off);
+	}
+	else
+	{
+		SPI_TRACE_END();
+		HAL_GPIO_WritePin(CS_FLASH_GPIO_Port, CS_FLASH_Pin, on_off);
+		SPI1_ReleaseBus(SPI1_OWNER_TASK);
+	}
 }
 
 /**
   * @brief Delay in milliseconds
   * @param ms: milliseconds to delay (should be a non-blocking function)
   */
-void LIS3MDL_Delay(uint32_t ms)
+void W25Q80DV_Delay(uint32_t ms)
 {
 	osDelay(ms);
 }
 
+/**
+  * @brief Gets a free running time stamp
+  * @retval Time stamp (DWT cycles)
+  */
+uint32_t W25Q80DV_GetTimestamp(void)
+{
+	return CYCCNT_Get();
+}
+
+/**
+  * @brief Converts a difference of time stamps to microseconds
+  * @param timestamp_delta: Difference of two W25Q80DV_GetTimestamp values
+  * @retval Microseconds
+  */
+uint32_t W25Q80DV_TimestampToUs(uint32_t timestamp_delta)
+{
+	return CYCCNT_ToUs(timestamp_delta);
+}
+
+/**
+  * @brief Time allowed to a DMA transfer at the current memory SPI clock,
+  * which goes down to a few MHz with the low power clock profile
+  * @param size: Number of bytes transferred
+  * @retval Timeout in milliseconds
+  */
+uint32_t W25Q80DV_TransferTimeout(uint32_t size)
+{
+	uint32_t sck = SPI1_GetDeviceSck(SPI1_DEVICE_FLASH);
+
+	/* 8 clocks per byte, rounded up to the next millisecond */
+	return (size * 8 * 1000 + sck - 1) / sck + W25Q80DV_TRANSFER_MARGIN_MS;
+}
+
 /**
   * @brief Transmit and then receives a number of bytes
   * @param tx_data: Vector to transmit
   * @param rx_data: Vector where the data read is stored
   * @param size: Number of bytes to transmit/receive
   * @param  Timeout Timeout duration
-  * @retval LIS3MDL status
+  * @retval W25Q80DV status
   */
-LIS3MDL_StatusTypeDef LIS3MDL_TxRx(uint8_t *tx_data, uint8_t *rx_data, uint16_t size, uint32_t timeout)
+W25Q80DV_StatusTypeDef W25Q80DV_TxRx(uint8_t *tx_data, uint8_t *rx_data, uint16_t size, uint32_t timeout)
 {
-	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
+	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
+
+	/* First byte after chip select is the opcode */
+	SPI_TRACE_OPCODE(tx_data[0]);
 
 	if(HAL_SPI_TransmitReceive(&hspi1, tx_data, rx_data, size, timeout) == HAL_OK)
-		retval = LIS3MDL_OK;
+		retval = W25Q80DV_OK;
 
 	return retval;
 }
@@ -57,14 +115,17 @@ LIS3MDL_StatusTypeDef LIS3MDL_TxRx(uint8_t *tx_data, uint8_t *rx_data, uint16_t
   * @param tx_data: Vector to transmit
   * @param size: Number of bytes to transmit
   * @param  Timeout Timeout duration
-  * @retval LIS3MDL status
+  * @retval W25Q80DV status
   */
-LIS3MDL_StatusTypeDef LIS3MDL_Tx(uint8_t *tx_data, uint16_t size, uint32_t timeout)
+W25Q80DV_StatusTypeDef W25Q80DV_Tx(uint8_t *tx_data, uint16_t size, uint32_t timeout)
 {
-	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
+	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
+
+	/* First byte after chip select is the opcode */
+	SPI_TRACE_OPCODE(tx_data[0]);
 
 	if(HAL_SPI_Transmit(&hspi1, tx_data, size, timeout) == HAL_OK)
-		retval = LIS3MDL_OK;
+		retval = W25Q80DV_OK;
 
 	return retval;
 }
@@ -74,13 +135,33 @@ LIS3MDL_StatusTypeDef LIS3MDL_Tx(uint8_t *tx_data, uint16_t size, uint32_t timeo
   * @param rx_data: Vector where the data read is stored
   * @param size: Number of bytes to receive
   * @param  Timeout Timeout duration
-  * @retval LIS3MDL status
+  * @retval W25Q80DV status
   */
-LIS3MDL_StatusTypeDef LIS3MDL_Rx(uint8_t *rx_data, uint16_t size, uint32_t timeout)
+W25Q80DV_StatusTypeDef W25Q80DV_Rx(uint8_t *rx_data, uint16_t size, uint32_t timeout)
 {
-	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
+	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
 	if(HAL_SPI_Receive(&hspi1, rx_data, size, timeout) == HAL_OK)
-		retval = LIS3MDL_OK;
+		retval = W25Q80DV_OK;
+
+	return retval;
+}
+
+/**
+  * @brief Transmit and then receives a number of bytes using DMA
+  * @param tx_data: Vector to transmit
+  * @param rx_data: Vector where the data read is stored
+  * @param size: Number of bytes to transmit/receive
+  * @retval W25Q80DV status
+  */
+W25Q80DV_StatusTypeDef W25Q80DV_TxRx_DMA(uint8_t *tx_data, uint8_t *rx_data, uint16_t size)
+{
+	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
+
+	/* First byte after chip select is the opcode */
+	SPI_TRACE_OPCODE(tx_data[0]);
+
+	if(HAL_SPI_TransmitReceive_DMA(&hspi1, tx_data, rx_data, size) == HAL_OK)
+		retval = W25Q80DV_OK;
 
 	return retval;
 }
@@ -89,14 +170,17 @@ LIS3MDL_StatusTypeDef LIS3MDL_Rx(uint8_t *rx_data, uint16_t size, uint32_t timeo
   * @brief Transmits a number of bytes using DMA
   * @param tx_data: Vector to transmit
   * @param size: Number of bytes to transmit
-  * @retval LIS3MDL status
+  * @retval W25Q80DV status
   */
-LIS3MDL_StatusTypeDef LIS3MDL_Tx_DMA(uint8_t *tx_data, uint16_t size)
+W25Q80DV_StatusTypeDef W25Q80DV_Tx_DMA(uint8_t *tx_data, uint16_t size)
 {
-	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
+	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
+
+	/* First byte after chip select is the opcode */
+	SPI_TRACE_OPCODE(tx_data[0]);
 
 	if(HAL_SPI_Transmit_DMA(&hspi1, tx_data, size) == HAL_OK)
-		retval = LIS3MDL_OK;
+		retval = W25Q80DV_OK;
 
 	return retval;
 }
@@ -105,31 +189,47 @@ LIS3MDL_StatusTypeDef LIS3MDL_Tx_DMA(uint8_t *tx_data, uint16_t size)
   * @brief Receives a number of bytes using DMA
   * @param rx_data: Vector where the data read is stored
   * @param size: Number of bytes to receive
-  * @retval LIS3MDL status
+  * @retval W25Q80DV status
   */
-LIS3MDL_StatusTypeDef LIS3MDL_Rx_DMA(uint8_t *rx_data, uint16_t size)
+W25Q80DV_StatusTypeDef W25Q80DV_Rx_DMA(uint8_t *rx_data, uint16_t size)
 {
-	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
+	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
 
 	if(HAL_SPI_Receive_DMA(&hspi1, rx_data, size) == HAL_OK)
-		retval = LIS3MDL_OK;
+		retval = W25Q80DV_OK;
 
 	return retval;
 }
 
+/**
+  * @brief Stops a DMA transfer that timed out, so that it can not write
+  * into its buffer once it is given back, and drops a late completion
+  */
+static void W25Q80DV_AbortTransfer(void)
+{
+	HAL_SPI_Abort(&hspi1);
+	osMessageGet(SPITxQueueHandle, 0);
+	osMessageGet(SPIRxQueueHandle, 0);
+}
+
 /**
   * @brief Waits for last SPI transmit operation to be completed
   * @param  Timeout Timeout duration
-  * @retval LIS3MDL status
+  * @retval W25Q80DV status
   */
-LIS3MDL_StatusTypeDef LIS3MDL_Tx_DMA_WaitToFinish(uint32_t timeout)
+W25Q80DV_StatusTypeDef W25Q80DV_Tx_DMA_WaitToFinish(uint32_t timeout)
 {
 	osEvent event;
-	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
+	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
 
 	event = osMessageGet(SPITxQueueHandle, timeout);
 	if(event.status == osEventMessage)
-		retval = LIS3MDL_OK;
+		retval = W25Q80DV_OK;
+	else
+	{
+		DLOG2(DLOG_FLASH_DMA_TIMEOUT, timeout, 0);
+		W25Q80DV_AbortTransfer();
+	}
 
 	return retval;
 }
@@ -137,16 +237,45 @@ LIS3MDL_StatusTypeDef LIS3MDL_Tx_DMA_WaitToFinish(uint32_t timeout)
 /**
   * @brief Waits for last SPI receive operation to be completed
   * @param  Timeout Timeout duration
-  * @retval LIS3MDL status
+  * @retval W25Q80DV status
   */
-LIS3MDL_StatusTypeDef LIS3MDL_Rx_DMA_WaitToFinish(uint32_t timeout)
+W25Q80DV_StatusTypeDef W25Q80DV_Rx_DMA_WaitToFinish(uint32_t timeout)
 {
 	osEvent event;
-	LIS3MDL_StatusTypeDef retval = LIS3MDL_ERROR;
+	W25Q80DV_StatusTypeDef retval = W25Q80DV_ERROR;
 
 	event = osMessageGet(SPIRxQueueHandle, timeout);
 	if(event.status == osEventMessage)
-		retval = LIS3MDL_OK;
+	{
+		/* Reception runs full duplex, so the transmit channel completed
+		 * first and signaled too. Drop it or the next transmit wait would
+		 * return before its data is out */
+		osMessageGet(SPITxQueueHandle, 0);
+		retval = W25Q80DV_OK;
+	}
+	else
+	{
+		DLOG2(DLOG_FLASH_DMA_TIMEOUT, timeout, 1);
+		W25Q80DV_AbortTransfer();
+	}
 
 	return retval;
 }
+
+/**
+  * @brief Borrows a DMA capable buffer (at least 32 bytes)
+  * @retval Buffer, NULL if none available
+  */
+uint8_t* W25Q80DV_BufferAcquire(void)
+{
+	return DMAPOOL_Acquire(DMAPOOL_SMALL);
+}
+
+/**
+  * @brief Gives back a buffer borrowed with W25Q80DV_BufferAcquire
+  * @param buffer: Buffer to give back
+  */
+void W25Q80DV_BufferRelease(uint8_t *buffer)
+{
+	DMAPOOL_Release(buffer);
+}
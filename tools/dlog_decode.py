@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+"""Decodes the deferred log of the magnetometer firmware.
+
+The firmware sends, in binary mode ("B1"), PROTO_MSG_LOG messages holding
+message IDs and raw argument words only. The text of each message is taken
+from stm32/Core/Inc/dlog_table.h, where the ID is the position in the table,
+so use the table of the build that is running.
+
+Usage:
+    dlog_decode.py capture.bin            decode a raw capture
+    dlog_decode.py /dev/ttyUSB0 [baud]    decode live (needs pyserial)
+    dlog_decode.py - < capture.bin        decode stdin
+"""
+
+import os
+import re
+import struct
+import sys
+
+TABLE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "stm32",
+                     "Core", "Inc", "dlog_table.h")
+
+PROTO_MSG_TEXT = 0x01
+PROTO_MSG_ERROR = 0x03
+PROTO_MSG_LOG = 0x08
+
+
+def load_table(path):
+    """Returns the (name, text) of every message, in ID order."""
+    with open(path) as table:
+        source = table.read()
+    return re.findall(r'DLOG_MESSAGE\(\s*(\w+)\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)', source)
+
+
+def crc16(data):
+    """CRC-16/CCITT-FALSE, as PROTO_Crc16."""
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else (crc << 1)
+            crc &= 0xFFFF
+    return crc
+
+
+def cobs_decode(frame):
+    """Returns the message of a frame without its delimiter, None if broken."""
+    message = bytearray()
+    index = 0
+    while index < len(frame):
+        code = frame[index]
+        if code == 0 or index + code > len(frame):
+            return None
+        message += frame[index + 1:index + code]
+        index += code
+        if code < 0xFF and index < len(frame):
+            message.append(0)
+    return bytes(message)
+
+
+def format_message(table, msg_id, args):
+    """Fills the text of a message the way FMT_Format would."""
+    if msg_id >= len(table):
+        return "unknown message %u %s" % (msg_id, " ".join("%X" % a for a in args))
+    name, text = table[msg_id]
+    fields = re.findall(r"%0?\d*l?([duXx])", text)
+    if len(fields) != len(args):
+        return "%s: %d arguments for %d fields %s" % (name, len(args), len(fields), args)
+    values = []
+    for field, arg in zip(fields, args):
+        # The words are sent unsigned, %d ones are 32 bit signed
+        values.append(arg - (1 << 32) if field == "d" and arg & 0x80000000 else arg)
+    text = re.sub(r"%(0?\d*)l?([duXx])", lambda m: "%" + m.group(1) + m.group(2).replace("x", "X"), text)
+    return "%s: %s" % (name, text % tuple(values))
+
+
+def decode_log(table, payload):
+    """Yields a line per entry of a PROTO_MSG_LOG payload."""
+    index = 0
+    while index + 7 <= len(payload):
+        msg_id, count, tick = struct.unpack_from("<HBI", payload, index)
+        index += 7
+        args = list(struct.unpack_from("<%dI" % count, payload, index))
+        index += 4 * count
+        yield "%10u.%03u %s" % (tick // 1000, tick % 1000, format_message(table, msg_id, args))
+
+
+def decode_frame(table, frame):
+    message = cobs_decode(frame)
+    if message is None or len(message) < 4:
+        print("broken frame", file=sys.stderr)
+        return
+    body, crc = message[:-2], struct.unpack("<H", message[-2:])[0]
+    if crc16(body) != crc:
+        print("CRC error, sequence %u" % body[1], file=sys.stderr)
+        return
+    msg_type, payload = body[0], body[2:]
+    if msg_type == PROTO_MSG_LOG:
+        for line in decode_log(table, payload):
+            print(line)
+    elif msg_type == PROTO_MSG_TEXT:
+        print(payload.decode("ascii", "replace").rstrip())
+    elif msg_type == PROTO_MSG_ERROR:
+        print("error code %u" % payload[0])
+
+
+def read_chunks(source, baud):
+    if source == "-":
+        stream = sys.stdin.buffer
+    elif os.path.isfile(source):
+        stream = open(source, "rb")
+    else:
+        import serial
+        stream = serial.Serial(source, baud, timeout=0.1)
+    while True:
+        chunk = stream.read(256)
+        if chunk:
+            yield chunk
+        elif not hasattr(stream, "in_waiting"):
+            return
+
+
+def main(argv):
+    if len(argv) < 2:
+        print(__doc__, file=sys.stderr)
+        return 1
+    table = load_table(TABLE)
+    baud = int(argv[2]) if len(argv) > 2 else 115200
+    pending = bytearray()
+    try:
+        for chunk in read_chunks(argv[1], baud):
+            pending += chunk
+            while b"\x00" in pending:
+                frame, _, rest = pending.partition(b"\x00")
+                pending = bytearray(rest)
+                if frame:
+                    decode_frame(table, bytes(frame))
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))